@@ -0,0 +1,520 @@
+/**
+ \file
+ \brief Заголовочный файл с определением протоколов прикладного уровня
+
+ Данный файл содержит определение протокола прикладного уровня по портам с разбором начала "полезной нагрузки"
+ (имя запроса DNS, заголовок Host HTTP, имя сервера TLS SNI), счетчики пакетов и байт по протоколам и сводку наиболее
+ частых имен. Имена хранятся в пуле строк без выделения памяти на каждый пакет
+*/
+
+#ifndef APP_CLASSIFIER_H
+#define APP_CLASSIFIER_H
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "FlatCounters.h"
+#include "SpaceSaving.h"
+#include "PacketDecoder.h"
+
+//! Протокол прикладного уровня
+enum AppProtocol {
+    //! Не определен
+    AppOther,
+    //! DNS (порт 53, UDP и TCP)
+    AppDns,
+    //! HTTP (порты 80, 8000, 8080)
+    AppHttp,
+    //! TLS (порты 443, 8443, 993, 995, 465, 853)
+    AppTls,
+    //! Число протоколов
+    numOfAppProtocols
+};
+
+//! Название протокола прикладного уровня
+inline const char* appProtocolName(int protocol) {
+    static const char* names[numOfAppProtocols] = {"other", "DNS", "HTTP", "TLS"};
+    return names[protocol];
+}
+
+/**
+ * \brief Разбор списка протоколов
+ * @param list Названия через запятую: dns, http, tls, all
+ * @param mask Маска протоколов (бит 1 << AppProtocol)
+ * @return false, если название неизвестно
+ */
+inline bool parseAppProtocols(const std::string& list, unsigned& mask) {
+    mask = 0;
+    size_t begin = 0;
+    while (begin <= list.size()) {
+        size_t end = std::min(list.find(',', begin), list.size());
+        std::string name = list.substr(begin, end - begin);
+        if (name == "dns")
+            mask |= 1u << AppDns;
+        else if (name == "http")
+            mask |= 1u << AppHttp;
+        else if (name == "tls")
+            mask |= 1u << AppTls;
+        else if (name == "all")
+            mask |= (1u << AppDns) | (1u << AppHttp) | (1u << AppTls);
+        else
+            return false;
+        begin = end + 1;
+    }
+    return true;
+}
+
+/**
+ * \brief Протокол прикладного уровня по порту
+ * @param l4Protocol Протокол транспортного уровня
+ * @param port Порт
+ */
+inline AppProtocol appProtocolByPort(uint8_t l4Protocol, uint16_t port) {
+    switch (port) {
+        case 53:
+            return AppDns;
+        case 80:
+        case 8000:
+        case 8080:
+            return l4Protocol == ipProtocolTcp ? AppHttp : AppOther;
+        case 443:
+        case 465:
+        case 853:
+        case 993:
+        case 995:
+        case 8443:
+            return l4Protocol == ipProtocolTcp ? AppTls : AppOther;
+        default:
+            return AppOther;
+    }
+}
+
+//! Наибольшая длина имени (DNS)
+const size_t maxAppNameLen = 255;
+
+/**
+ * \brief Символ имени для сводки
+ * @param c Байт из пакета
+ * @return Буква в нижнем регистре, непечатные байты и запятая (разделитель CSV) - '?'
+ */
+inline char nameChar(char c) {
+    if (c >= 'A' && c <= 'Z')
+        return static_cast<char>(c - 'A' + 'a');
+    return c > ' ' && c < 127 && c != ',' ? c : '?';
+}
+
+/**
+ * \brief Имя запроса DNS
+ * @param payload Начало сообщения DNS (для TCP - после поля длины)
+ * @param len Число байт сообщения
+ * @param name Буфер не меньше maxAppNameLen байт для имени в нижнем регистре через точки
+ * @return Длина имени, 0 - сообщение не запрос или имя не разобрано
+ *
+ * Учитываются только запросы (QR = 0) с хотя бы одним вопросом, ответы не удваивают счет имен. Сжатие имен в
+ * вопросе не используется, поэтому указатели сжатия считаются ошибкой
+ */
+inline size_t dnsQueryName(const uint8_t* payload, size_t len, char* name) {
+    if (len < 12 || (payload[2] & 0x80) != 0 || readNet16(payload + 4) == 0)
+        return 0;
+    size_t offset = 12;
+    size_t nameLen = 0;
+    while (offset < len) {
+        size_t labelLen = payload[offset++];
+        if (labelLen == 0)
+            return nameLen;
+        if (labelLen > 63 || offset + labelLen > len || nameLen + labelLen + 1 > maxAppNameLen)
+            return 0;
+        if (nameLen > 0)
+            name[nameLen++] = '.';
+        for (size_t i = 0; i < labelLen; ++i) {
+            char c = static_cast<char>(payload[offset + i]);
+            name[nameLen++] = nameChar(c);
+        }
+        offset += labelLen;
+    }
+    return 0;
+}
+
+/**
+ * \brief Значение заголовка Host запроса HTTP
+ * @param payload Начало "полезной нагрузки" TCP
+ * @param len Число байт
+ * @param name Буфер не меньше maxAppNameLen байт для имени в нижнем регистре (без порта)
+ * @return Длина имени, 0 - сегмент не начинается с запроса или заголовка Host в нем нет
+ */
+inline size_t httpHost(const uint8_t* payload, size_t len, char* name) {
+    static const char* methods[] = {"GET ", "POST ", "HEAD ", "PUT ", "DELETE ", "OPTIONS ", "PATCH ", "CONNECT "};
+    bool request = false;
+    for (const char* method : methods) {
+        size_t methodLen = std::strlen(method);
+        if (len >= methodLen && std::memcmp(payload, method, methodLen) == 0) {
+            request = true;
+            break;
+        }
+    }
+    if (!request)
+        return 0;
+    const char* text = reinterpret_cast<const char*>(payload);
+    for (size_t i = 0; i + 7 < len; ++i) {
+        if (text[i] != '\n' || (text[i + 1] | 0x20) != 'h' || (text[i + 2] | 0x20) != 'o' ||
+            (text[i + 3] | 0x20) != 's' || (text[i + 4] | 0x20) != 't' || text[i + 5] != ':')
+            continue;
+        size_t begin = i + 6;
+        while (begin < len && (text[begin] == ' ' || text[begin] == '\t'))
+            ++begin;
+        size_t nameLen = 0;
+        for (size_t j = begin; j < len && text[j] != '\r' && text[j] != '\n' && text[j] != ':'; ++j) {
+            if (nameLen == maxAppNameLen)
+                return 0;
+            char c = text[j];
+            name[nameLen++] = nameChar(c);
+        }
+        return nameLen;
+    }
+    return 0;
+}
+
+/**
+ * \brief Имя сервера (SNI) из ClientHello TLS
+ * @param payload Начало "полезной нагрузки" TCP
+ * @param len Число байт
+ * @param name Буфер не меньше maxAppNameLen байт для имени в нижнем регистре
+ * @return Длина имени, 0 - сегмент не начинается с ClientHello или расширения server_name в нем нет
+ *
+ * Разбирается только ClientHello, целиком лежащий в первом сегменте (так почти всегда, кроме постквантовых
+ * ключей в несколько килобайт)
+ */
+inline size_t tlsServerName(const uint8_t* payload, size_t len, char* name) {
+    // Запись handshake, версия 3.x, сообщение ClientHello
+    if (len < 5 + 4 + 2 + 32 + 1 || payload[0] != 0x16 || payload[1] != 0x03 || payload[5] != 0x01)
+        return 0;
+    size_t end = std::min(len, static_cast<size_t>(5 + readNet16(payload + 3)));
+    size_t offset = 5 + 4 + 2 + 32;
+    offset += 1 + payload[offset];
+    if (offset + 2 > end)
+        return 0;
+    offset += 2 + readNet16(payload + offset);
+    if (offset + 1 > end)
+        return 0;
+    offset += 1 + payload[offset];
+    if (offset + 2 > end)
+        return 0;
+    size_t extensionsEnd = std::min(end, offset + 2 + readNet16(payload + offset));
+    offset += 2;
+    while (offset + 4 <= extensionsEnd) {
+        uint16_t type = readNet16(payload + offset);
+        size_t extensionLen = readNet16(payload + offset + 2);
+        offset += 4;
+        if (offset + extensionLen > extensionsEnd)
+            return 0;
+        // server_name: длина списка, тип имени (0 - host_name), длина имени, имя
+        if (type == 0 && extensionLen >= 5 && payload[offset + 2] == 0) {
+            size_t nameLen = readNet16(payload + offset + 3);
+            if (nameLen == 0 || nameLen > maxAppNameLen || 5 + nameLen > extensionLen)
+                return 0;
+            for (size_t i = 0; i < nameLen; ++i) {
+                char c = static_cast<char>(payload[offset + 5 + i]);
+                name[i] = nameChar(c);
+            }
+            return nameLen;
+        }
+        offset += extensionLen;
+    }
+    return 0;
+}
+
+//! Пул строк
+/**
+ * \brief Хранение различных строк подряд в одном буфере с поиском по хешу
+ * \author Jodode
+ * \version 0.1
+ *
+ * Строка добавляется один раз и далее обозначается номером. Повторная строка находится по хешу без выделения памяти,
+ * память выделяется только при росте буфера и таблицы
+ */
+class StringPool {
+public:
+    /**
+     * \brief Номер строки с добавлением новой строки
+     * @param data Байты строки
+     * @param len Длина строки
+     * @return Номер строки (с 1)
+     */
+    uint32_t intern(const char* data, size_t len) {
+        uint64_t hash = hashOf(data, len);
+        uint64_t key = hash | 1;
+        for (uint32_t* id = ids.find(key); id != nullptr; id = ids.find(key += 2)) {
+            const Entry& entry = entries[*id - 1];
+            if (entry.hash == hash && entry.length == len && std::memcmp(&arena[entry.offset], data, len) == 0)
+                return *id;
+        }
+        entries.push_back(Entry{static_cast<uint32_t>(arena.size()), static_cast<uint32_t>(len), hash});
+        arena.insert(arena.end(), data, data + len);
+        uint32_t id = static_cast<uint32_t>(entries.size());
+        ids[key] = id;
+        return id;
+    }
+
+    //! Строка по номеру
+    std::string str(uint32_t id) const {
+        const Entry& entry = entries[id - 1];
+        return std::string(arena.data() + entry.offset, entry.length);
+    }
+
+    //! Число строк
+    size_t size() const { return entries.size(); }
+
+    //! Функция очищения
+    void clear() {
+        arena.clear();
+        entries.clear();
+        ids.clear();
+    }
+
+private:
+    //! Строка пула
+    struct Entry {
+        //! Смещение в буфере
+        uint32_t offset;
+        //! Длина
+        uint32_t length;
+        //! Хеш
+        uint64_t hash;
+    };
+
+    //! Хеш FNV-1a с перемешиванием
+    static uint64_t hashOf(const char* data, size_t len) {
+        uint64_t hash = 1469598103934665603ULL;
+        for (size_t i = 0; i < len; ++i)
+            hash = (hash ^ static_cast<uint8_t>(data[i])) * 1099511628211ULL;
+        return mixHash(hash);
+    }
+
+    //! Байты строк подряд
+    std::vector<char> arena;
+    //! Строки по номерам
+    std::vector<Entry> entries;
+    //! Номера строк по хешу (коллизии - в ключах +2, +4..., младший бит ключа всегда 1, поэтому ключ не нулевой)
+    FlatHashMap<uint64_t, uint32_t> ids;
+};
+
+//! Сводка наиболее частых имен
+/**
+ * \brief Space-Saving по номерам строк пула
+ * \author Jodode
+ * \version 0.1
+ *
+ * Каждое новое имя попадает в пул, поэтому при большом числе различных имен (например, случайные поддомены) пул
+ * периодически сжимается до имен, оставшихся в сводке
+ */
+class NameTopK {
+public:
+    //! Имя со счетчиком
+    struct Entry {
+        //! Имя
+        std::string name;
+        //! Оценка сверху числа появлений
+        uint64_t count;
+        //! Максимальная переоценка
+        uint64_t error;
+    };
+
+    //! Конструктор
+    /**
+     * @param capacity Число счетчиков (0 - сводка отключена)
+     */
+    explicit NameTopK(size_t capacity = 0) : counters(capacity) {}
+
+    //! Признак включенной сводки
+    bool enabled() const { return counters.enabled(); }
+    //! Число счетчиков
+    size_t capacity() const { return counters.capacity(); }
+    //! Число учтенных имен
+    uint64_t total() const { return counters.total(); }
+    //! Максимальная переоценка любого имени
+    uint64_t maxError() const { return counters.maxError(); }
+
+    /**
+     * \brief Учет имени
+     * @param name Байты имени
+     * @param len Длина имени
+     * @param weight Число появлений
+     */
+    void add(const char* name, size_t len, uint64_t weight = 1) {
+        counters.add(pool.intern(name, len), weight);
+        if (pool.size() > counters.capacity() * 8 + 1024)
+            compact();
+    }
+
+    //! Имена по убыванию оценки
+    std::vector<Entry> top() const {
+        std::vector<Entry> result;
+        for (auto& counter : counters.top())
+            result.push_back(Entry{pool.str(counter.key), counter.count, counter.error});
+        return result;
+    }
+
+    /**
+     * \brief Объединение со сводкой другой части трафика
+     * @param other Сводка, собранная другим потоком (номера строк другого пула переводятся в номера этого)
+     */
+    void merge(const NameTopK& other) {
+        SpaceSaving<uint32_t> remapped(counters.capacity());
+        remapped.assign(other.total(), translate(other.top()));
+        counters.merge(remapped);
+        if (pool.size() > counters.capacity() * 8 + 1024)
+            compact();
+    }
+
+    /**
+     * \brief Замена содержимого сводки
+     * @param itemsTotal Число учтенных имен
+     * @param entries Имена со счетчиками
+     */
+    void assign(uint64_t itemsTotal, const std::vector<Entry>& entries) {
+        pool.clear();
+        counters.assign(itemsTotal, translate(entries));
+    }
+
+    //! Функция очищения
+    void clear() {
+        counters.clear();
+        pool.clear();
+    }
+
+private:
+    //! Перевод имен в счетчики по номерам строк пула
+    std::vector<SpaceSaving<uint32_t>::Counter> translate(const std::vector<Entry>& entries) {
+        std::vector<SpaceSaving<uint32_t>::Counter> result;
+        result.reserve(entries.size());
+        for (auto& entry : entries)
+            result.push_back(SpaceSaving<uint32_t>::Counter{pool.intern(entry.name.data(), entry.name.size()),
+                                                            entry.count, entry.error});
+        return result;
+    }
+
+    //! Сжатие пула до имен сводки
+    void compact() {
+        std::vector<Entry> entries = top();
+        assign(counters.total(), entries);
+    }
+
+    //! Строки имен
+    StringPool pool;
+    //! Счетчики по номерам строк
+    SpaceSaving<uint32_t> counters;
+};
+
+//! Статистика прикладного уровня
+/**
+ * \brief Счетчики пакетов и байт по протоколам и сводки имен DNS и HTTP/TLS
+ * \author Jodode
+ * \version 0.1
+ *
+ * Протокол определяется по порту назначения, затем по порту источника (ответы), только для включенных протоколов:
+ * без включенных протоколов classify не вызывается. Начало "полезной нагрузки" разбирается только у пакетов
+ * включенного протокола с разобранными заголовками (payload != nullptr)
+ */
+struct AppStats {
+    //! Конструктор
+    /**
+     * @param mask Маска включенных протоколов (бит 1 << AppProtocol)
+     * @param topNames Число счетчиков сводок имен
+     */
+    explicit AppStats(unsigned mask = 0, size_t topNames = 0)
+        : mask(mask), dnsNames(mask & (1u << AppDns) ? topNames : 0),
+          hostNames(mask & ((1u << AppHttp) | (1u << AppTls)) ? topNames : 0) {}
+
+    //! Маска включенных протоколов
+    unsigned mask;
+    //! Число пакетов по протоколам
+    std::array<uint64_t, numOfAppProtocols> packets{};
+    //! Число байт "полезной нагрузки" по протоколам
+    std::array<uint64_t, numOfAppProtocols> bytes{};
+    //! Наиболее частые имена запросов DNS
+    NameTopK dnsNames;
+    //! Наиболее частые имена HTTP Host и TLS SNI
+    NameTopK hostNames;
+
+    //! Признак включенного определения протоколов
+    bool enabled() const { return mask != 0; }
+
+    /**
+     * \brief Определение протокола пакета и учет имени
+     * @param headers Заголовки пакета (заполняется headers.appProtocol)
+     * @param countNames Учитывать имена в сводках
+     */
+    void classify(PacketHeaders& headers, bool countNames) {
+        if (headers.l4Protocol == 0)
+            return;
+        AppProtocol protocol = appProtocolByPort(headers.l4Protocol, headers.dstPort);
+        if (protocol == AppOther)
+            protocol = appProtocolByPort(headers.l4Protocol, headers.srcPort);
+        if (protocol == AppOther || !(mask & (1u << protocol)))
+            return;
+        headers.appProtocol = static_cast<uint8_t>(protocol);
+        if (!countNames || headers.payload == nullptr || headers.payloadLen == 0)
+            return;
+
+        const uint8_t* payload = headers.payload;
+        size_t len = headers.payloadLen;
+        size_t nameLen = 0;
+        if (protocol == AppDns) {
+            // DNS по TCP начинается с длины сообщения
+            if (headers.l4Protocol == ipProtocolTcp) {
+                if (len < 2)
+                    return;
+                payload += 2;
+                len -= 2;
+            }
+            if ((nameLen = dnsQueryName(payload, len, name)) != 0)
+                dnsNames.add(name, nameLen);
+        } else if (protocol == AppHttp) {
+            if ((nameLen = httpHost(payload, len, name)) != 0)
+                hostNames.add(name, nameLen);
+        } else if ((nameLen = tlsServerName(payload, len, name)) != 0) {
+            hostNames.add(name, nameLen);
+        }
+    }
+
+    /**
+     * \brief Учет пакета в счетчиках протоколов
+     * @param headers Заголовки пакета после classify
+     */
+    void count(const PacketHeaders& headers) {
+        ++packets[headers.appProtocol];
+        bytes[headers.appProtocol] += headers.payloadLen;
+    }
+
+    /**
+     * \brief Функция объединения
+     * @param other Статистика, собранная по другой части трафика
+     */
+    void merge(const AppStats& other) {
+        for (size_t i = 0; i < numOfAppProtocols; ++i) {
+            packets[i] += other.packets[i];
+            bytes[i] += other.bytes[i];
+        }
+        if (dnsNames.enabled())
+            dnsNames.merge(other.dnsNames);
+        if (hostNames.enabled())
+            hostNames.merge(other.hostNames);
+    }
+
+    //! Функция очищения
+    void clear() {
+        packets.fill(0);
+        bytes.fill(0);
+        dnsNames.clear();
+        hostNames.clear();
+    }
+
+private:
+    //! Буфер имени текущего пакета
+    char name[maxAppNameLen];
+};
+
+#endif // APP_CLASSIFIER_H
@@ -0,0 +1,305 @@
+/**
+ \file
+ \brief Заголовочный файл с пачечной обработкой заголовков пакетов
+
+ Данный файл содержит пачку заголовков пакетов со столбцами горячих полей (структура массивов) и векторные ядра над
+ столбцами: номера интервалов гистограммы размеров "полезной нагрузки" и число пакетов UDP и TCP. Ядра есть в
+ вариантах AVX2, SSE2 и скалярном, вариант выбирается один раз при запуске по возможностям процессора
+*/
+
+#ifndef BATCH_KERNELS_H
+#define BATCH_KERNELS_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include "FlatCounters.h"
+#include "PacketDecoder.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SFT_X86_KERNELS
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
+
+//! Число пакетов в пачке заголовков
+const size_t headerBatchSize = 256;
+//! На сколько пакетов вперед предвыбираются счетчики
+const size_t prefetchDistance = 8;
+
+/**
+ * \brief Предвыборка строки кэша для записи
+ * @param address Адрес счетчика, который будет обновлен
+ */
+inline void prefetchWrite(const void* address) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(address, 1, 3);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_prefetch(static_cast<const char*>(address), _MM_HINT_T0);
+#else
+    (void) address;
+#endif
+}
+
+//! Вариант векторных ядер
+enum KernelLevel {
+    //! Скалярные ядра
+    KernelScalar,
+    //! SSE2 (16 байт)
+    KernelSse2,
+    //! AVX2 (32 байта)
+    KernelAvx2
+};
+
+//! Название варианта ядер
+inline const char* kernelLevelName(KernelLevel level) {
+    return level == KernelAvx2 ? "AVX2" : level == KernelSse2 ? "SSE2" : "scalar";
+}
+
+//! Лучший вариант ядер, поддерживаемый процессором (определяется при первом вызове)
+inline KernelLevel kernelLevel() {
+#if defined(SFT_X86_KERNELS)
+    static const KernelLevel level = __builtin_cpu_supports("avx2") ? KernelAvx2 :
+                                     __builtin_cpu_supports("sse2") ? KernelSse2 : KernelScalar;
+    return level;
+#else
+    return KernelScalar;
+#endif
+}
+
+/**
+ * \brief Номера интервалов гистограммы размеров, скалярный вариант
+ * @param payloadLen Размеры "полезной нагрузки"
+ * @param buckets Номера интервалов (PayloadHistogram::bucketOf)
+ * @param count Число пакетов
+ */
+inline void payloadBucketsScalar(const uint32_t* payloadLen, uint8_t* buckets, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t length = payloadLen[i];
+        buckets[i] = static_cast<uint8_t>(length == 0 ? 0 : length < 20 ? 1 : highestBit(length / 10) + 1);
+    }
+}
+
+/**
+ * \brief Число пакетов UDP и TCP, скалярный вариант
+ * @param protocols Протоколы транспортного уровня
+ * @param count Число пакетов
+ * @param numOfUdp Число пакетов UDP
+ * @param numOfTcp Число пакетов TCP
+ */
+inline void countProtocolsScalar(const uint8_t* protocols, size_t count, size_t& numOfUdp, size_t& numOfTcp) {
+    numOfUdp = 0;
+    numOfTcp = 0;
+    for (size_t i = 0; i < count; ++i) {
+        numOfUdp += protocols[i] == ipProtocolUdp;
+        numOfTcp += protocols[i] == ipProtocolTcp;
+    }
+}
+
+#if defined(SFT_X86_KERNELS)
+
+/*
+ * Векторные ядра считают интервал без деления: при length >= 20 и e = floor(log2(length)) номер интервала равен
+ * e - 2, если 4 * length >= 5 * 2^e, иначе e - 3. Показатель e и 2^e берутся из представления length во float,
+ * которое точно для length < 2^24, поэтому группы с большими размерами считаются скалярно
+ */
+
+//! Номера интервалов гистограммы размеров, SSE2
+__attribute__((target("sse2")))
+inline void payloadBucketsSse2(const uint32_t* payloadLen, uint8_t* buckets, size_t count) {
+    const __m128i exponentMask = _mm_set1_epi32(0x7F800000);
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i twenty = _mm_set1_epi32(20);
+    const __m128 four = _mm_set1_ps(4.0f);
+    const __m128 five = _mm_set1_ps(5.0f);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i length = _mm_loadu_si128(reinterpret_cast<const __m128i*>(payloadLen + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_srli_epi32(length, 24), _mm_setzero_si128())) != 0xFFFF) {
+            payloadBucketsScalar(payloadLen + i, buckets + i, 4);
+            continue;
+        }
+        __m128 value = _mm_cvtepi32_ps(length);
+        __m128i bits = _mm_and_si128(_mm_castps_si128(value), exponentMask);
+        __m128i exponent = _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127 + 2));
+        __m128i below = _mm_castps_si128(_mm_cmplt_ps(_mm_mul_ps(value, four),
+                                                      _mm_mul_ps(_mm_castsi128_ps(bits), five)));
+        __m128i bucket = _mm_add_epi32(exponent, below);
+        __m128i small = _mm_cmpgt_epi32(twenty, length);
+        __m128i smallBucket = _mm_andnot_si128(_mm_cmpeq_epi32(length, _mm_setzero_si128()), one);
+        bucket = _mm_or_si128(_mm_and_si128(small, smallBucket), _mm_andnot_si128(small, bucket));
+        alignas(16) uint32_t lanes[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes), bucket);
+        for (size_t j = 0; j < 4; ++j)
+            buckets[i + j] = static_cast<uint8_t>(lanes[j]);
+    }
+    payloadBucketsScalar(payloadLen + i, buckets + i, count - i);
+}
+
+//! Номера интервалов гистограммы размеров, AVX2
+__attribute__((target("avx2")))
+inline void payloadBucketsAvx2(const uint32_t* payloadLen, uint8_t* buckets, size_t count) {
+    const __m256i exponentMask = _mm256_set1_epi32(0x7F800000);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i twenty = _mm256_set1_epi32(20);
+    const __m256 four = _mm256_set1_ps(4.0f);
+    const __m256 five = _mm256_set1_ps(5.0f);
+    // Младшие байты 8 номеров в первые 8 байт: сначала внутри 128-битных половин, затем между ними
+    const __m256i packBytes = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                               0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i packHalves = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i length = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(payloadLen + i));
+        __m256i exact = _mm256_cmpeq_epi32(_mm256_srli_epi32(length, 24), _mm256_setzero_si256());
+        if (static_cast<uint32_t>(_mm256_movemask_epi8(exact)) != 0xFFFFFFFFu) {
+            payloadBucketsScalar(payloadLen + i, buckets + i, 8);
+            continue;
+        }
+        __m256 value = _mm256_cvtepi32_ps(length);
+        __m256i bits = _mm256_and_si256(_mm256_castps_si256(value), exponentMask);
+        __m256i exponent = _mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127 + 2));
+        __m256 scaledPower = _mm256_mul_ps(_mm256_castsi256_ps(bits), five);
+        __m256i below = _mm256_castps_si256(_mm256_cmp_ps(_mm256_mul_ps(value, four), scaledPower, _CMP_LT_OQ));
+        __m256i bucket = _mm256_add_epi32(exponent, below);
+        __m256i small = _mm256_cmpgt_epi32(twenty, length);
+        __m256i smallBucket = _mm256_andnot_si256(_mm256_cmpeq_epi32(length, _mm256_setzero_si256()), one);
+        bucket = _mm256_blendv_epi8(bucket, smallBucket, small);
+        __m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(bucket, packBytes), packHalves);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(buckets + i), _mm256_castsi256_si128(packed));
+    }
+    payloadBucketsScalar(payloadLen + i, buckets + i, count - i);
+}
+
+//! Число пакетов UDP и TCP, SSE2
+__attribute__((target("sse2")))
+inline void countProtocolsSse2(const uint8_t* protocols, size_t count, size_t& numOfUdp, size_t& numOfTcp) {
+    const __m128i udp = _mm_set1_epi8(static_cast<char>(ipProtocolUdp));
+    const __m128i tcp = _mm_set1_epi8(static_cast<char>(ipProtocolTcp));
+    size_t udpCount = 0;
+    size_t tcpCount = 0;
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(protocols + i));
+        udpCount += static_cast<size_t>(__builtin_popcount(
+                static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(value, udp)))));
+        tcpCount += static_cast<size_t>(__builtin_popcount(
+                static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(value, tcp)))));
+    }
+    countProtocolsScalar(protocols + i, count - i, numOfUdp, numOfTcp);
+    numOfUdp += udpCount;
+    numOfTcp += tcpCount;
+}
+
+//! Число пакетов UDP и TCP, AVX2
+__attribute__((target("avx2,popcnt")))
+inline void countProtocolsAvx2(const uint8_t* protocols, size_t count, size_t& numOfUdp, size_t& numOfTcp) {
+    const __m256i udp = _mm256_set1_epi8(static_cast<char>(ipProtocolUdp));
+    const __m256i tcp = _mm256_set1_epi8(static_cast<char>(ipProtocolTcp));
+    size_t udpCount = 0;
+    size_t tcpCount = 0;
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(protocols + i));
+        udpCount += static_cast<size_t>(__builtin_popcount(
+                static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(value, udp)))));
+        tcpCount += static_cast<size_t>(__builtin_popcount(
+                static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(value, tcp)))));
+    }
+    countProtocolsScalar(protocols + i, count - i, numOfUdp, numOfTcp);
+    numOfUdp += udpCount;
+    numOfTcp += tcpCount;
+}
+
+#endif
+
+/**
+ * \brief Номера интервалов гистограммы размеров
+ * @param payloadLen Размеры "полезной нагрузки"
+ * @param buckets Номера интервалов (PayloadHistogram::bucketOf)
+ * @param count Число пакетов
+ */
+inline void payloadBuckets(const uint32_t* payloadLen, uint8_t* buckets, size_t count) {
+#if defined(SFT_X86_KERNELS)
+    switch (kernelLevel()) {
+        case KernelAvx2:
+            return payloadBucketsAvx2(payloadLen, buckets, count);
+        case KernelSse2:
+            return payloadBucketsSse2(payloadLen, buckets, count);
+        default:
+            break;
+    }
+#endif
+    payloadBucketsScalar(payloadLen, buckets, count);
+}
+
+/**
+ * \brief Число пакетов UDP и TCP
+ * @param protocols Протоколы транспортного уровня
+ * @param count Число пакетов
+ * @param numOfUdp Число пакетов UDP
+ * @param numOfTcp Число пакетов TCP
+ */
+inline void countProtocols(const uint8_t* protocols, size_t count, size_t& numOfUdp, size_t& numOfTcp) {
+#if defined(SFT_X86_KERNELS)
+    switch (kernelLevel()) {
+        case KernelAvx2:
+            return countProtocolsAvx2(protocols, count, numOfUdp, numOfTcp);
+        case KernelSse2:
+            return countProtocolsSse2(protocols, count, numOfUdp, numOfTcp);
+        default:
+            break;
+    }
+#endif
+    countProtocolsScalar(protocols, count, numOfUdp, numOfTcp);
+}
+
+//! Пачка заголовков
+/**
+ * \brief Заголовки пачки пакетов и столбцы их горячих полей
+ * \author Jodode
+ * \version 0.1
+ *
+ * Заголовки заполняются разбором пакетов, после чего finish() переписывает протокол, адрес и порт назначения и размер
+ * "полезной нагрузки" в отдельные выровненные столбцы и считает по ним ядрами номера интервалов гистограммы и число
+ * пакетов UDP и TCP. Модули хранилища с пачечным обработчиком (updateBatch) читают столбцы, остальные - заголовки
+ */
+struct HeaderBatch {
+    //! Заголовки пакетов
+    std::array<PacketHeaders, headerBatchSize> headers;
+    //! Протокол транспортного уровня
+    alignas(32) uint8_t protocol[headerBatchSize];
+    //! Признак IPv4 заголовка
+    alignas(32) uint8_t hasIPv4[headerBatchSize];
+    //! Номер интервала гистограммы размеров "полезной нагрузки"
+    alignas(32) uint8_t payloadBucket[headerBatchSize];
+    //! Порт назначения UDP или TCP (0 - пакет другого протокола)
+    alignas(32) uint16_t dstPort[headerBatchSize];
+    //! IPv4 адрес назначения в сетевом порядке байт
+    alignas(32) uint32_t dstIPv4[headerBatchSize];
+    //! Размер "полезной нагрузки"
+    alignas(32) uint32_t payloadLen[headerBatchSize];
+    //! Число пакетов в пачке
+    size_t count = 0;
+    //! Число пакетов UDP
+    size_t numOfUdp = 0;
+    //! Число пакетов TCP
+    size_t numOfTcp = 0;
+
+    //! Заполнение столбцов и расчет ядер по заголовкам headers[0..count)
+    void finish() {
+        for (size_t i = 0; i < count; ++i) {
+            const PacketHeaders& packet = headers[i];
+            protocol[i] = packet.l4Protocol;
+            hasIPv4[i] = packet.hasIPv4;
+            dstPort[i] = transportDstPort(packet);
+            dstIPv4[i] = packet.dstIPv4;
+            payloadLen[i] = static_cast<uint32_t>(packet.payloadLen);
+        }
+        payloadBuckets(payloadLen, payloadBucket, count);
+        countProtocols(protocol, count, numOfUdp, numOfTcp);
+    }
+};
+
+#endif // BATCH_KERNELS_H
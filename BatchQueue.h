@@ -0,0 +1,85 @@
+/**
+ \file
+ \brief Заголовочный файл с очередью пакетов между потоками
+
+ Данный файл содержит ограниченную блокирующую очередь, через которую поток чтения передает пачки пакетов
+ потокам-обработчикам
+*/
+
+#ifndef BATCH_QUEUE_H
+#define BATCH_QUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+//! Очередь пачек
+/**
+ * \brief Ограниченная блокирующая очередь
+ * \author Jodode
+ * \version 0.1
+ *
+ * Блокировка берется один раз на пачку, а не на пакет, поэтому на горячем пути обработки пакетов блокировок нет.
+ * После вызова close() очередь отдает оставшиеся элементы, а затем pop() возвращает false
+ */
+template <typename T>
+class BatchQueue {
+public:
+    //! Конструктор
+    /**
+     * @param capacity Максимальное число элементов в очереди
+     */
+    explicit BatchQueue(size_t capacity) : capacity(capacity) {}
+
+    /**
+     * \brief Добавление элемента, блокируется пока очередь заполнена
+     * @param item Элемент
+     * @return false, если очередь закрыта
+     */
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return items.size() < capacity || closed; });
+        if (closed)
+            return false;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    /**
+     * \brief Извлечение элемента, блокируется пока очередь пуста
+     * @param item Извлеченный элемент
+     * @return false, если очередь закрыта и пуста
+     */
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+        if (items.empty())
+            return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    //! Закрытие очереди, будит все ожидающие потоки
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+
+private:
+    //! Максимальное число элементов
+    size_t capacity;
+    //! Признак закрытия очереди
+    bool closed = false;
+    //! Элементы очереди
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+};
+
+#endif // BATCH_QUEUE_H
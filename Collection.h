@@ -0,0 +1,561 @@
+/**
+ \file
+ \brief Заголовочный файл со сбором статистики из файлов трафика
+
+ Данный файл содержит чтение файлов трафика (однопоточное и многопоточное), чтение из stdin и обработку
+ нескольких файлов сразу. Функции используются программой и набором бенчмарков
+*/
+
+#ifndef COLLECTION_H
+#define COLLECTION_H
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include "PcapFileDevice.h"
+#include "StatsCollector.h"
+#include "BatchQueue.h"
+#include "MmapPcapReader.h"
+#include "PcapIndex.h"
+#include "StreamPcapReader.h"
+#include "InputFiles.h"
+#include "Profiler.h"
+
+//! Режим работы программы false - тихий, true - подробный (определяется в программе)
+extern bool verboseMode;
+//! Блокировка вывода сообщений из нескольких потоков (определяется в программе)
+extern std::mutex logMutex;
+
+//! Число пакетов в одной пачке, передаваемой потоку-обработчику
+const size_t packetBatchSize = 1024;
+//! Наибольшее число потоков-обработчиков (номера обработчиков пакетов хранятся в uint16_t)
+const size_t maxNumOfThreads = 1024;
+static_assert(maxNumOfThreads <= 65536, "worker ids of packets are stored in uint16_t");
+
+static const char pathSeparator =
+#if defined _WIN32 || defined __CYGWIN__ || defined WIN32
+        '\\';
+#else
+        '/';
+#endif
+
+/**
+ * \brief Вывод сообщения, безопасный при обработке нескольких файлов одновременно
+ * @param stream Поток вывода
+ * @param message Сообщение без перевода строки
+ */
+inline void logMessage(std::ostream& stream, const std::string& message) {
+    std::lock_guard<std::mutex> lock(logMutex);
+    stream << message << std::endl;
+}
+
+//! Тип пакета читателя
+/**
+ * \brief Тип "сырого" пакета, который заполняет читатель
+ *
+ * Читатели PcapPlusPlus выделяют память под каждый пакет и передают владение пакету, собственные читатели
+ * выдают пакеты без владения данными. stablePackets - данные пакета остаются действительными после чтения следующих
+ * пакетов (пакеты можно учитывать пачками), для потокового читателя это не так: его буфер переиспользуется
+ */
+template <typename Reader>
+struct ReaderTraits {
+    typedef pcpp::RawPacket PacketType;
+    static constexpr bool stablePackets = true;
+};
+
+template <>
+struct ReaderTraits<MmapPcapReader> {
+    typedef MmapPcapReader::PacketType PacketType;
+    static constexpr bool stablePackets = true;
+};
+
+template <>
+struct ReaderTraits<StreamPcapReader> {
+    typedef StreamPcapReader::PacketType PacketType;
+    static constexpr bool stablePackets = false;
+};
+
+/**
+ * \brief Чтение следующего пакета с замером этапа чтения
+ * @param readerDevice Читатель
+ * @param rawPacket Пакет для заполнения
+ * @return false, если пакеты закончились
+ */
+template <typename Reader, typename Packet>
+bool readPacket(Reader* readerDevice, Packet& rawPacket) {
+    ProfileScope scope(ProfileRead);
+    if (!readerDevice->getNextPacket(rawPacket))
+        return false;
+    profilePacket(static_cast<size_t>(rawPacket.getRawDataLen()));
+    return true;
+}
+
+//! Освобождение прочитанного ведет вызывающий: пакеты используются после чтения следующих (MmapPcapReader)
+template <typename Reader>
+void holdReadWindows(Reader*) {}
+
+inline void holdReadWindows(MmapPcapReader* readerDevice) { readerDevice->setManualRelease(true); }
+
+//! Смещение последнего выданного пакета в файле (MmapPcapReader, иначе 0)
+template <typename Reader>
+size_t readPosition(Reader*) { return 0; }
+
+inline size_t readPosition(MmapPcapReader* readerDevice) { return readerDevice->packetPosition(); }
+
+//! Освобождение прочитанного до смещения upTo (MmapPcapReader)
+template <typename Reader>
+void releaseReadWindows(Reader*, size_t) {}
+
+inline void releaseReadWindows(MmapPcapReader* readerDevice, size_t upTo) { readerDevice->release(upTo); }
+
+/**
+ * \brief Чтение всех пакетов в хранилище статистики
+ * @param readerDevice Читатель
+ * @param stats Хранилище статистики
+ *
+ * С stats.options.batchMode пакеты читаются по headerBatchSize и учитываются пачкой (если читатель это допускает),
+ * иначе по одному
+ */
+template <typename Reader, typename Collector>
+void readPackets(Reader* readerDevice, Collector& stats) {
+    typedef typename ReaderTraits<Reader>::PacketType PacketType;
+    if (!stats.options.batchMode || !ReaderTraits<Reader>::stablePackets) {
+        PacketType rawPacket;
+        while (readPacket(readerDevice, rawPacket))
+            stats.collectRawPacket(rawPacket);
+        return;
+    }
+    std::vector<PacketType> packets(headerBatchSize);
+    size_t count = headerBatchSize;
+    while (count == headerBatchSize) {
+        count = 0;
+        while (count < headerBatchSize && readPacket(readerDevice, packets[count]))
+            ++count;
+        stats.collectRawBatch(packets.data(), count);
+    }
+}
+
+/**
+ * \brief Метод для сборки пакетов в хранилище статистики
+ * \author Jodode
+ * \version 0.1
+ * @param readerDevice читающий агрегат
+ * @param stats Хранилище статистики
+ *
+ * Метод итерируется по всем пакетам трафика и отправляет их на дальнейшую обработку в хранилище
+ */
+template <typename Reader, typename Collector>
+void collectPcap(Reader* readerDevice, Collector& stats) {
+    readPackets(readerDevice, stats);
+    if (verboseMode)
+        logMessage(std::cout, "[+] All packets collected");
+
+}
+
+//! Пачка "сырых" пакетов
+/**
+ * \brief Пачка пакетов, передаваемая от потока чтения потокам-обработчикам
+ *
+ * Пакеты внутри пачки переиспользуются: поток чтения заполняет их повторно после того, как пачка вернулась
+ */
+template <typename Packet>
+struct PacketBatch {
+    //! Конструктор
+    explicit PacketBatch(size_t capacity) : packets(capacity), owners(capacity) {}
+
+    //! Пакеты пачки
+    std::vector<Packet> packets;
+    //! Номера обработчиков пакетов при распределении по потокам трафика
+    std::vector<uint16_t> owners;
+    //! Число заполненных пакетов
+    size_t count = 0;
+    //! Смещение первого пакета в файле, SIZE_MAX - пачка свободна (меняется только потоком чтения)
+    size_t position = SIZE_MAX;
+    //! Число обработчиков, еще не учевших пачку
+    std::atomic<size_t> pending{0};
+};
+
+/**
+ * \brief Номер обработчика пакета при распределении по потокам трафика
+ * @param rawPacket "Сырой" пакет
+ * @param numOfOwners Число обработчиков
+ * @return Остаток от деления хеша потока трафика пакета, 0 для пакетов без разобранного заголовка IPv4
+ */
+inline uint16_t flowOwner(pcpp::RawPacket& rawPacket, size_t numOfOwners) {
+    PacketHeaders headers;
+    if (decodeHeaders(rawPacket.getRawData(), static_cast<size_t>(rawPacket.getRawDataLen()),
+                      rawPacket.getLinkLayerType(), headers) != DecodeOk || !headers.hasIPv4)
+        return 0;
+    FlowKey key{headers.srcIPv4, headers.dstIPv4, headers.srcPort, headers.dstPort, headers.l4Protocol};
+    return static_cast<uint16_t>(key.hash() % numOfOwners);
+}
+
+/**
+ * \brief Метод для многопоточной сборки пакетов в хранилище статистики
+ * \author Jodode
+ * \version 0.1
+ * @param readerDevice читающий агрегат
+ * @param stats Хранилище статистики
+ * @param numOfThreads Число потоков-обработчиков
+ *
+ * Текущий поток читает пакеты пачками и передает их через очередь потокам-обработчикам. Каждый обработчик разбирает
+ * пакеты и собирает статистику в собственное хранилище, поэтому на горячем пути блокировок нет. Пустые пачки
+ * возвращаются потоку чтения через вторую очередь. После окончания чтения хранилища обработчиков объединяются в stats
+ *
+ * При учете потоков трафика (options.trackFlows) пачка передается всем обработчикам, и каждый учитывает только
+ * пакеты своих потоков трафика (flowOwner). Иначе поток трафика делился бы между хранилищами и завершался в каждом
+ * из них. Пачка возвращается, когда ее учли все обработчики. Хранилища обработчиков сначала объединяются между
+ * собой: по отдельности каждое содержит только часть потоков трафика своего интервала времени.
+ *
+ * Окна отображения файла освобождаются потоком чтения только до первого пакета пачек, которые еще не вернулись
+ */
+template <typename Reader, typename Collector>
+void collectPcapParallel(Reader* readerDevice, Collector& stats, size_t numOfThreads) {
+    typedef PacketBatch<typename ReaderTraits<Reader>::PacketType> Batch;
+    numOfThreads = std::min(numOfThreads, maxNumOfThreads);
+    bool byFlow = stats.options.trackFlows;
+    std::vector<std::unique_ptr<Batch>> batches;
+    BatchQueue<Batch*> freeBatches(numOfThreads * 4);
+    for (size_t i = 0; i < numOfThreads * 4; ++i) {
+        batches.emplace_back(new Batch(packetBatchSize));
+        freeBatches.push(batches.back().get());
+    }
+    std::vector<std::unique_ptr<BatchQueue<Batch*>>> filledBatches;
+    for (size_t i = 0; i < (byFlow ? numOfThreads : 1); ++i)
+        filledBatches.emplace_back(new BatchQueue<Batch*>(numOfThreads * 2));
+
+    holdReadWindows(readerDevice);
+
+    std::vector<std::unique_ptr<Collector>> shards;
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < numOfThreads; ++i) {
+        shards.emplace_back(new Collector(stats.options));
+        Collector* shard = shards.back().get();
+        BatchQueue<Batch*>* queue = filledBatches[byFlow ? i : 0].get();
+        uint16_t owner = static_cast<uint16_t>(i);
+        workers.emplace_back([shard, queue, owner, byFlow, &freeBatches]() {
+            Batch* batch;
+            while (queue->pop(batch)) {
+                shard->collectRawBatch(batch->packets.data(), batch->count,
+                                       byFlow ? batch->owners.data() : nullptr, owner);
+                if (byFlow && --batch->pending != 0)
+                    continue;
+                batch->count = 0;
+                freeBatches.push(batch);
+            }
+        });
+    }
+
+    bool hasPackets = true;
+    Batch* batch;
+    while (hasPackets && freeBatches.pop(batch)) {
+        batch->position = SIZE_MAX;
+        size_t inUse = SIZE_MAX;
+        for (auto& other : batches)
+            inUse = std::min(inUse, other->position);
+        releaseReadWindows(readerDevice, inUse);
+        while (batch->count < batch->packets.size()) {
+            hasPackets = readPacket(readerDevice, batch->packets[batch->count]);
+            if (!hasPackets)
+                break;
+            if (batch->count == 0)
+                batch->position = readPosition(readerDevice);
+            ++batch->count;
+        }
+        if (batch->count == 0)
+            continue;
+        if (!byFlow) {
+            filledBatches.front()->push(batch);
+            continue;
+        }
+        for (size_t i = 0; i < batch->count; ++i)
+            batch->owners[i] = flowOwner(batch->packets[i], numOfThreads);
+        batch->pending = numOfThreads;
+        for (auto& queue : filledBatches)
+            queue->push(batch);
+    }
+    for (auto& queue : filledBatches)
+        queue->close();
+    for (auto& worker : workers)
+        worker.join();
+
+    {
+        ProfileScope scope(ProfileMerge);
+        for (size_t i = 1; i < shards.size(); ++i)
+            shards.front()->merge(*shards[i]);
+        stats.merge(*shards.front());
+    }
+    if (verboseMode)
+        logMessage(std::cout, fmt::format("[+] All packets collected by {} threads", numOfThreads));
+}
+
+
+/**
+ * \brief Метод для сборки одного файла трафика по индексу
+ * \author Jodode
+ * \version 0.1
+ * @param inPath Путь до файла трафика
+ * @param index Индекс файла
+ * @param stats Хранилище статистики
+ * @param numOfThreads Число потоков
+ * @return false, если индекс не соответствует файлу (в stats ничего не учтено)
+ *
+ * Двоичным поиском по индексу выбираются блоки, которые могут содержать пакеты интервала stats.options.timeRange,
+ * и делятся на диапазоны байт примерно равного размера. Каждый поток отображает файл, разбирает его заголовки и
+ * читает свой диапазон в собственное хранилище, хранилища объединяются в stats по порядку файла. С одним потоком
+ * диапазон читается сразу в stats
+ */
+template <typename Collector>
+bool collectIndexed(const std::string& inPath, const PcapIndex& index, Collector& stats, size_t numOfThreads) {
+    size_t first = 0;
+    size_t last = 0;
+    index.select(stats.options.timeRange, first, last);
+    std::vector<PcapIndex::ByteRange> ranges = index.split(first, last, numOfThreads);
+    if (verboseMode)
+        logMessage(std::cout, fmt::format("[+] Reading {} of {} index blocks in {} ranges", last - first,
+                                          index.data().size(), ranges.size()));
+
+    std::atomic<bool> mismatch(false);
+    auto collectRange = [&inPath, &index, &mismatch](const PcapIndex::ByteRange& range, Collector& shard) {
+        MmapPcapReader reader(inPath);
+        if (!reader.open() || !reader.seek(static_cast<size_t>(index.headerEnd()), static_cast<size_t>(range.begin),
+                                           static_cast<size_t>(range.end))) {
+            mismatch = true;
+            return;
+        }
+        reader.setTimeRange(shard.options.timeRange);
+        readPackets(&reader, shard);
+    };
+    if (ranges.size() == 1) {
+        collectRange(ranges[0], stats);
+        return !mismatch;
+    }
+
+    std::vector<std::unique_ptr<Collector>> shards;
+    std::vector<std::thread> workers;
+    for (auto& range : ranges) {
+        shards.emplace_back(new Collector(stats.options));
+        Collector* shard = shards.back().get();
+        workers.emplace_back([&collectRange, &range, shard]() { collectRange(range, *shard); });
+    }
+    for (auto& worker : workers)
+        worker.join();
+    if (mismatch)
+        return false;
+    ProfileScope scope(ProfileMerge);
+    for (auto& shard : shards)
+        stats.merge(*shard);
+    return true;
+}
+
+/**
+ * \brief Метод для сборки одного файла трафика
+ * \author Jodode
+ * \version 0.1
+ * @param inPath Путь до файла трафика
+ * @param stats Хранилище статистики
+ * @param numOfThreads Число потоков-обработчиков
+ * @param useMmap Читать файл через отображение в память
+ * @return false, если файл не удалось открыть
+ *
+ * Открывает подходящего читателя и собирает пакеты в хранилище. Если рядом с файлом есть актуальный индекс и нужно
+ * несколько потоков или интервал времени, файл читается по индексу. Интервал времени без индекса проверяется при
+ * чтении всего файла через отображение. Если отображение в память недоступно, файл читается через PcapPlusPlus.
+ *
+ * Сжатый файл (gzip, zstd) распаковывается в отдельном потоке читателем потока, разбор идет в текущем потоке:
+ * пакеты читателя действительны только до следующего пакета, поэтому пачками между потоками они не передаются
+ */
+template <typename Collector>
+bool collectFile(const std::string& inPath, Collector& stats, size_t numOfThreads, bool useMmap) {
+    std::string inFilename = inPath.substr(inPath.rfind(pathSeparator) + 1);
+    const TimeRange& timeRange = stats.options.timeRange;
+
+    Compression compression = fileCompression(inPath);
+    if (compression != CompressionNone) {
+        StreamPcapReader streamReader(inPath);
+        if (!streamReader.open()) {
+            if (streamReader.unsupported())
+                logMessage(std::cerr, "[-] ERROR: " + inFilename + " is " + compressionName(compression) +
+                                      " compressed, built without " + compressionName(compression) + " support");
+            else
+                logMessage(std::cerr, "[-] ERROR: Cannot read " + inFilename + " as a compressed pcap/pcapng file");
+            return false;
+        }
+        streamReader.setTimeRange(timeRange);
+        logMessage(std::cout, "[+] File " + inFilename + " successfully opened (" + compressionName(compression) + ")");
+        if (verboseMode)
+            logMessage(std::cout, "[+] Starting analyze");
+        collectPcap(&streamReader, stats);
+        if (streamReader.corrupted())
+            logMessage(std::cerr, "[-] WARNING: " + inFilename + " is corrupted or truncated, stopped after " +
+                                  std::to_string(stats.totalPackets) + " packets");
+        return true;
+    }
+
+    if (numOfThreads > 1 || timeRange.bounded()) {
+        PcapIndex index;
+        std::string error;
+        if (index.load(inPath, error)) {
+            logMessage(std::cout, "[+] File " + inFilename + " successfully opened by index");
+            if (collectIndexed(inPath, index, stats, numOfThreads))
+                return true;
+            logMessage(std::cerr, "[-] WARNING: Index of " + inFilename + " does not match the file, reading it whole");
+        } else if (verboseMode) {
+            logMessage(std::cout, "[!] " + error);
+        }
+    }
+
+    if (useMmap || timeRange.bounded()) {
+        MmapPcapReader mmapReader(inPath);
+        if (mmapReader.open()) {
+            mmapReader.setTimeRange(timeRange);
+            logMessage(std::cout, "[+] File " + inFilename + " successfully mapped");
+            if (verboseMode)
+                logMessage(std::cout, "[+] Starting analyze");
+            if (numOfThreads > 1)
+                collectPcapParallel(&mmapReader, stats, numOfThreads);
+            else
+                collectPcap(&mmapReader, stats);
+            return true;
+        }
+        if (timeRange.bounded()) {
+            logMessage(std::cerr, "[-] ERROR: Cannot map " + inFilename + ", --from/--to need a pcap/pcapng file");
+            return false;
+        }
+        if (verboseMode)
+            logMessage(std::cout, "[!] Cannot map " + inFilename + ", falling back to buffered reading");
+    }
+
+    std::unique_ptr<pcpp::IFileReaderDevice> reader(pcpp::IFileReaderDevice::getReader(inPath));
+
+    if (reader == nullptr)
+    {
+        logMessage(std::cerr, "[-] ERROR: Cannot determine reader for file type of " + inFilename);
+        return false;
+    }
+    if (!reader->open())
+    {
+        logMessage(std::cerr, "[-] ERROR: Cannot open " + inFilename + " for reading");
+        return false;
+    }
+
+    logMessage(std::cout, "[+] File " + inFilename + " successfully opened");
+    if (verboseMode)
+        logMessage(std::cout, "[+] Starting analyze");
+
+    if (numOfThreads > 1)
+        collectPcapParallel(reader.get(), stats, numOfThreads);
+    else
+        collectPcap(reader.get(), stats);
+    reader->close();
+    return true;
+}
+
+/**
+ * \brief Метод для сборки трафика из stdin
+ * \author Jodode
+ * \version 0.1
+ * @param stats Хранилище статистики
+ * @param reportEvery Число пакетов между промежуточными отчетами (0 - без промежуточных отчетов)
+ * @param report Запись отчета по уже собранной статистике
+ * @return false, если поток не является pcap/pcapng
+ *
+ * Пакеты собираются в одном потоке по мере поступления, чтение stdin идет в отдельном потоке и не
+ * останавливается на время записи промежуточного отчета
+ */
+template <typename Collector>
+bool collectStream(Collector& stats, uint64_t reportEvery, const std::function<void()>& report) {
+    StreamPcapReader reader(0);
+    if (!reader.open()) {
+        if (reader.unsupported())
+            logMessage(std::cerr, std::string("[-] ERROR: stdin is ") + compressionName(reader.compression()) +
+                                  " compressed, built without its support");
+        else
+            logMessage(std::cerr, "[-] ERROR: stdin is not a pcap/pcapng stream");
+        return false;
+    }
+    reader.setTimeRange(stats.options.timeRange);
+    logMessage(std::cout, reader.compression() == CompressionNone ? std::string("[+] Reading stream from stdin") :
+                          std::string("[+] Reading ") + compressionName(reader.compression()) + " stream from stdin");
+    if (verboseMode)
+        logMessage(std::cout, "[+] Starting analyze");
+
+    StreamPcapReader::PacketType rawPacket;
+    uint64_t sinceReport = 0;
+    while (readPacket(&reader, rawPacket)) {
+        stats.collectRawPacket(rawPacket);
+        if (reportEvery != 0 && ++sinceReport == reportEvery) {
+            sinceReport = 0;
+            report();
+        }
+    }
+    if (reader.corrupted())
+        logMessage(std::cerr, "[-] WARNING: stream is corrupted, stopped after " +
+                              std::to_string(stats.totalPackets) + " packets");
+    if (verboseMode)
+        logMessage(std::cout, "[+] Analyze finished");
+    return true;
+}
+
+/**
+ * \brief Метод для сборки нескольких файлов трафика
+ * \author Jodode
+ * \version 0.1
+ * @param files Файлы трафика с размерами
+ * @param stats Хранилище статистики
+ * @param numOfThreads Число потоков
+ * @param useMmap Читать файлы через отображение в память
+ * @return Файлы, которые не удалось открыть
+ *
+ * Планирование учитывает размеры файлов. Файлы больше средней доли одного потока обрабатываются по очереди всеми
+ * потоками сразу (чтение + обработчики), чтобы один большой файл не оставлял остальные ядра без работы. Остальные
+ * файлы раздаются пулу потоков от больших к меньшим (LPT), каждый поток собирает статистику в собственное хранилище,
+ * которые объединяются в stats после обработки
+ */
+template <typename Collector>
+std::vector<InputFile> collectFiles(std::vector<InputFile> files, Collector& stats, size_t numOfThreads,
+                                    bool useMmap) {
+    std::sort(files.begin(), files.end(), [](const InputFile& a, const InputFile& b) { return a.size > b.size; });
+    uint64_t totalSize = 0;
+    for (auto& file : files)
+        totalSize += file.size;
+
+    std::vector<InputFile> failed;
+    std::mutex failedMutex;
+    size_t next = 0;
+    while (numOfThreads > 1 && next + 1 < files.size() && files[next].size > totalSize / numOfThreads) {
+        if (!collectFile(files[next].path, stats, numOfThreads, useMmap))
+            failed.push_back(files[next]);
+        totalSize -= files[next].size;
+        ++next;
+    }
+
+    std::atomic<size_t> nextFile(next);
+    size_t numOfWorkers = std::min(numOfThreads, files.size() - next);
+    std::vector<std::unique_ptr<Collector>> shards;
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < numOfWorkers; ++i) {
+        shards.emplace_back(new Collector(stats.options));
+        Collector* shard = shards.back().get();
+        workers.emplace_back([shard, &files, &nextFile, &failed, &failedMutex, useMmap]() {
+            for (size_t index = nextFile++; index < files.size(); index = nextFile++)
+                if (!collectFile(files[index].path, *shard, 1, useMmap)) {
+                    std::lock_guard<std::mutex> lock(failedMutex);
+                    failed.push_back(files[index]);
+                }
+        });
+    }
+    for (auto& worker : workers)
+        worker.join();
+    ProfileScope scope(ProfileMerge);
+    for (auto& shard : shards)
+        stats.merge(*shard);
+    return failed;
+}
+
+#endif // COLLECTION_H
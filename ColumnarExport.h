@@ -0,0 +1,497 @@
+/**
+ \file
+ \brief Заголовочный файл с колоночной выгрузкой заголовков пакетов
+
+ Данный файл содержит запись заголовков каждого учтенного пакета (время, адреса, порты, протокол, размеры) в
+ колоночный файл .col и его чтение. Повторный анализ по такому файлу не требует разбора пакетов, а файл в разы
+ меньше исходного дампа
+
+ Формат (все числа little-endian):
+ - заголовок: сигнатура "SFTCOL\0\0", версия u32, число колонок u32, имена колонок (u32 длина + байты);
+ - блоки: тег "CHNK" u32, число записей u32, наименьшее и наибольшее время i64, затем для каждой колонки по
+   порядку заголовка длина u32 и значения: разность с предыдущим значением колонки (первое - с нулем),
+   zigzag и varint (7 бит на байт, старший бит - продолжение);
+ - адреса src_ip и dst_ip - числа в порядке байт адреса: a.b.c.d записывается как (a << 24) | (b << 16) | (c << 8) | d,
+   поэтому соседние адреса дают разность 1 (в версии 1 - байты адреса, прочитанные как число записавшей машины);
+ - оглавление: тег "CIDX" u32, число блоков u64, для блока смещение u64, число записей u32, наименьшее и наибольшее
+   время i64;
+ - конец файла: смещение оглавления u64 и сигнатура "SFTCOL\0\0"
+*/
+
+#ifndef COLUMNAR_EXPORT_H
+#define COLUMNAR_EXPORT_H
+
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include "BatchQueue.h"
+#include "MappedFile.h"
+#include "PacketDecoder.h"
+#include "SubnetTable.h"
+
+//! Версия колоночного формата
+const uint32_t columnarVersion = 2;
+
+//! Сигнатура колоночного файла
+const char columnarMagic[8] = {'S', 'F', 'T', 'C', 'O', 'L', '\0', '\0'};
+
+//! Проверка, похоже ли имя файла на колоночную выгрузку (.col)
+inline bool isColumnarName(const std::string& name) {
+    return name.size() > 4 && name.compare(name.size() - 4, 4, ".col") == 0;
+}
+
+//! Блок записей
+/**
+ * \brief Заголовки пакетов, разложенные по колонкам
+ * \author Jodode
+ * \version 0.1
+ */
+struct ColumnChunk {
+    //! Число колонок
+    static constexpr size_t numOfColumns = 8;
+    //! Наибольшее число записей в блоке
+    static constexpr size_t maxRecords = 64 * 1024;
+
+    //! Имена колонок в порядке записи
+    static const char* columnName(size_t column) {
+        static const char* names[numOfColumns] = {"timestamp_ns", "src_ip", "dst_ip", "src_port", "dst_port",
+                                                  "protocol", "payload_len", "frame_len"};
+        return names[column];
+    }
+
+    //! Время захвата, нс
+    std::vector<int64_t> timestampNs;
+    //! IPv4 адрес источника, a.b.c.d - (a << 24) | ... | d (0 для пакетов без IPv4)
+    std::vector<uint32_t> srcIPv4;
+    //! IPv4 адрес назначения, a.b.c.d - (a << 24) | ... | d (0 для пакетов без IPv4)
+    std::vector<uint32_t> dstIPv4;
+    //! Порт источника
+    std::vector<uint16_t> srcPort;
+    //! Порт назначения
+    std::vector<uint16_t> dstPort;
+    //! Протокол транспортного уровня
+    std::vector<uint8_t> protocol;
+    //! Размер "полезной нагрузки"
+    std::vector<uint32_t> payloadLen;
+    //! Длина пакета в сети
+    std::vector<uint32_t> frameLen;
+
+    //! Добавление заголовков пакета
+    void add(const PacketHeaders& headers) {
+        timestampNs.push_back(headers.timestampNs);
+        srcIPv4.push_back(headers.hasIPv4 ? ipv4ToHost(headers.srcIPv4) : 0);
+        dstIPv4.push_back(headers.hasIPv4 ? ipv4ToHost(headers.dstIPv4) : 0);
+        srcPort.push_back(headers.srcPort);
+        dstPort.push_back(headers.dstPort);
+        protocol.push_back(headers.l4Protocol);
+        payloadLen.push_back(static_cast<uint32_t>(headers.payloadLen));
+        frameLen.push_back(static_cast<uint32_t>(headers.frameLen));
+    }
+
+    //! Число записей
+    size_t size() const { return timestampNs.size(); }
+
+    //! Функция очищения
+    void clear() {
+        timestampNs.clear();
+        srcIPv4.clear();
+        dstIPv4.clear();
+        srcPort.clear();
+        dstPort.clear();
+        protocol.clear();
+        payloadLen.clear();
+        frameLen.clear();
+    }
+};
+
+namespace columnar {
+
+inline void put(std::string& buffer, uint64_t value, size_t size) {
+    for (size_t i = 0; i < size; ++i)
+        buffer.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+}
+
+inline uint64_t get(const uint8_t* data, size_t size) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; ++i)
+        value |= static_cast<uint64_t>(data[i]) << (8 * i);
+    return value;
+}
+
+/**
+ * \brief Запись колонки разностями в zigzag varint
+ * @param values Значения колонки
+ * @param buffer Буфер, в который дописывается длина и значения
+ */
+template <typename T>
+void encodeColumn(const std::vector<T>& values, std::string& buffer) {
+    size_t lengthOffset = buffer.size();
+    put(buffer, 0, 4);
+    uint64_t previous = 0;
+    for (T value : values) {
+        auto current = static_cast<uint64_t>(static_cast<int64_t>(value));
+        auto delta = static_cast<int64_t>(current - previous);
+        uint64_t zigzag = (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63);
+        while (zigzag >= 0x80) {
+            buffer.push_back(static_cast<char>((zigzag & 0x7F) | 0x80));
+            zigzag >>= 7;
+        }
+        buffer.push_back(static_cast<char>(zigzag));
+        previous = current;
+    }
+    auto length = static_cast<uint32_t>(buffer.size() - lengthOffset - 4);
+    for (size_t i = 0; i < 4; ++i)
+        buffer[lengthOffset + i] = static_cast<char>((length >> (8 * i)) & 0xFF);
+}
+
+/**
+ * \brief Чтение колонки
+ * @param data Начало колонки (после длины)
+ * @param size Длина колонки
+ * @param count Число значений
+ * @param values Значения колонки
+ * @return false, если колонка повреждена
+ */
+template <typename T>
+bool decodeColumn(const uint8_t* data, size_t size, size_t count, std::vector<T>& values) {
+    values.resize(count);
+    const uint8_t* end = data + size;
+    uint64_t previous = 0;
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t zigzag = 0;
+        for (unsigned shift = 0;; shift += 7) {
+            if (data == end || shift > 63)
+                return false;
+            uint8_t byte = *data++;
+            zigzag |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+                break;
+        }
+        auto delta = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+        previous += static_cast<uint64_t>(delta);
+        values[i] = static_cast<T>(static_cast<int64_t>(previous));
+    }
+    return data == end;
+}
+
+const uint32_t tagChunk = 0x4B4E4843;
+const uint32_t tagIndex = 0x58444943;
+
+} // namespace columnar
+
+//! Оглавление колоночного файла
+struct ColumnChunkInfo {
+    //! Смещение блока
+    uint64_t offset;
+    //! Число записей
+    uint32_t numOfRecords;
+    //! Наименьшее время в блоке, нс
+    int64_t minTimestampNs;
+    //! Наибольшее время в блоке, нс
+    int64_t maxTimestampNs;
+};
+
+//! Запись колоночного файла
+/**
+ * \brief Кодирование и запись блоков в отдельном потоке
+ * \author Jodode
+ * \version 0.1
+ *
+ * Блоки передаются через очередь, поэтому кодирование и запись на диск не останавливают сбор статистики, пока очередь
+ * не заполнена. Блоки от разных потоков сбора записываются в порядке поступления, внутри блока записи идут в порядке
+ * учета пакетов
+ */
+class ColumnarWriter {
+public:
+    //! Число блоков в очереди на запись
+    static constexpr size_t queueSize = 8;
+
+    //! Конструктор
+    /**
+     * @param path Путь до колоночного файла
+     */
+    explicit ColumnarWriter(const std::string& path) : path(path), chunks(queueSize) {}
+
+    //! Деструктор
+    ~ColumnarWriter() {
+        std::string error;
+        close(error);
+    }
+
+    ColumnarWriter(const ColumnarWriter&) = delete;
+    ColumnarWriter& operator=(const ColumnarWriter&) = delete;
+
+    /**
+     * \brief Создание файла и запуск потока записи
+     * @param error Описание ошибки
+     * @return false, если файл не удалось создать
+     */
+    bool open(std::string& error) {
+        file.open(path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            error = "Cannot create " + path;
+            return false;
+        }
+        std::string header(columnarMagic, sizeof(columnarMagic));
+        columnar::put(header, columnarVersion, 4);
+        columnar::put(header, ColumnChunk::numOfColumns, 4);
+        for (size_t i = 0; i < ColumnChunk::numOfColumns; ++i) {
+            std::string name(ColumnChunk::columnName(i));
+            columnar::put(header, name.size(), 4);
+            header += name;
+        }
+        write(header);
+        worker = std::thread(&ColumnarWriter::run, this);
+        return true;
+    }
+
+    /**
+     * \brief Передача заполненного блока на запись
+     * @param chunk Блок записей
+     */
+    void submit(std::unique_ptr<ColumnChunk> chunk) { chunks.push(std::move(chunk)); }
+
+    /**
+     * \brief Запись оставшихся блоков и оглавления
+     * @param error Описание ошибки
+     * @return false, если запись не удалась
+     */
+    bool close(std::string& error) {
+        if (!worker.joinable())
+            return !failed;
+        chunks.close();
+        worker.join();
+        std::string footer;
+        columnar::put(footer, columnar::tagIndex, 4);
+        columnar::put(footer, index.size(), 8);
+        for (auto& info : index) {
+            columnar::put(footer, info.offset, 8);
+            columnar::put(footer, info.numOfRecords, 4);
+            columnar::put(footer, static_cast<uint64_t>(info.minTimestampNs), 8);
+            columnar::put(footer, static_cast<uint64_t>(info.maxTimestampNs), 8);
+        }
+        columnar::put(footer, offset, 8);
+        footer.append(columnarMagic, sizeof(columnarMagic));
+        write(footer);
+        file.close();
+        if (failed)
+            error = "Cannot write " + path;
+        return !failed;
+    }
+
+    //! Число записанных записей
+    uint64_t numOfRecords() const { return records; }
+
+private:
+    //! Поток записи: кодирование блоков
+    void run() {
+        std::unique_ptr<ColumnChunk> chunk;
+        std::string buffer;
+        while (chunks.pop(chunk)) {
+            ColumnChunkInfo info{offset, static_cast<uint32_t>(chunk->size()),
+                                 std::numeric_limits<int64_t>::max(), std::numeric_limits<int64_t>::min()};
+            for (int64_t timestampNs : chunk->timestampNs) {
+                info.minTimestampNs = timestampNs < info.minTimestampNs ? timestampNs : info.minTimestampNs;
+                info.maxTimestampNs = timestampNs > info.maxTimestampNs ? timestampNs : info.maxTimestampNs;
+            }
+            buffer.clear();
+            columnar::put(buffer, columnar::tagChunk, 4);
+            columnar::put(buffer, info.numOfRecords, 4);
+            columnar::put(buffer, static_cast<uint64_t>(info.minTimestampNs), 8);
+            columnar::put(buffer, static_cast<uint64_t>(info.maxTimestampNs), 8);
+            columnar::encodeColumn(chunk->timestampNs, buffer);
+            columnar::encodeColumn(chunk->srcIPv4, buffer);
+            columnar::encodeColumn(chunk->dstIPv4, buffer);
+            columnar::encodeColumn(chunk->srcPort, buffer);
+            columnar::encodeColumn(chunk->dstPort, buffer);
+            columnar::encodeColumn(chunk->protocol, buffer);
+            columnar::encodeColumn(chunk->payloadLen, buffer);
+            columnar::encodeColumn(chunk->frameLen, buffer);
+            index.push_back(info);
+            records += info.numOfRecords;
+            write(buffer);
+        }
+    }
+
+    void write(const std::string& data) {
+        file.write(data.data(), static_cast<std::streamsize>(data.size()));
+        offset += data.size();
+        failed = failed || !file.good();
+    }
+
+    //! Путь до файла
+    std::string path;
+    //! Файл
+    std::ofstream file;
+    //! Блоки, ожидающие записи
+    BatchQueue<std::unique_ptr<ColumnChunk>> chunks;
+    //! Поток записи
+    std::thread worker;
+    //! Оглавление
+    std::vector<ColumnChunkInfo> index;
+    //! Смещение конца записанных данных
+    uint64_t offset = 0;
+    //! Число записанных записей
+    uint64_t records = 0;
+    //! Признак ошибки записи
+    bool failed = false;
+};
+
+//! Буфер записей
+/**
+ * \brief Накопление записей одного хранилища статистики в блок
+ *
+ * Каждое хранилище (и каждый поток сбора) заполняет собственный блок без блокировок, заполненный блок передается
+ * на запись. Оставшиеся записи передаются при flush() и в деструкторе
+ */
+class ColumnarBuffer {
+public:
+    //! Конструктор
+    /**
+     * @param writer Запись колоночного файла
+     */
+    explicit ColumnarBuffer(ColumnarWriter* writer) : writer(writer), chunk(new ColumnChunk()) {}
+
+    //! Деструктор
+    ~ColumnarBuffer() { flush(); }
+
+    ColumnarBuffer(const ColumnarBuffer&) = delete;
+    ColumnarBuffer& operator=(const ColumnarBuffer&) = delete;
+
+    //! Добавление заголовков пакета
+    void add(const PacketHeaders& headers) {
+        chunk->add(headers);
+        if (chunk->size() == ColumnChunk::maxRecords)
+            flush();
+    }
+
+    //! Передача накопленных записей на запись
+    void flush() {
+        if (chunk->size() == 0)
+            return;
+        writer->submit(std::move(chunk));
+        chunk.reset(new ColumnChunk());
+    }
+
+private:
+    //! Запись колоночного файла
+    ColumnarWriter* writer;
+    //! Заполняемый блок
+    std::unique_ptr<ColumnChunk> chunk;
+};
+
+//! Чтение колоночного файла
+/**
+ * \brief Чтение блоков колоночного файла по оглавлению
+ * \author Jodode
+ * \version 0.1
+ */
+class ColumnarReader {
+public:
+    /**
+     * \brief Открытие файла и чтение оглавления
+     * @param path Путь до колоночного файла
+     * @param error Описание ошибки
+     * @return false, если файл не является колоночным или поврежден
+     */
+    bool open(const std::string& path, std::string& error) {
+        const size_t tailSize = 8 + sizeof(columnarMagic);
+        if (!file.open(path) || file.size() < sizeof(columnarMagic) + 8 + tailSize ||
+            std::memcmp(file.data(), columnarMagic, sizeof(columnarMagic)) != 0 ||
+            std::memcmp(file.data() + file.size() - sizeof(columnarMagic), columnarMagic,
+                        sizeof(columnarMagic)) != 0) {
+            error = path + " is not a columnar file or is not finished";
+            return false;
+        }
+        version = static_cast<uint32_t>(columnar::get(file.data() + sizeof(columnarMagic), 4));
+        if (version < 1 || version > columnarVersion) {
+            error = "Unsupported columnar version " + std::to_string(version) + " in " + path;
+            return false;
+        }
+        uint64_t indexOffset = columnar::get(file.data() + file.size() - tailSize, 8);
+        if (indexOffset > file.size() - tailSize || file.size() - tailSize - indexOffset < 12 ||
+            columnar::get(file.data() + indexOffset, 4) != columnar::tagIndex) {
+            error = path + " has a corrupted index";
+            return false;
+        }
+        uint64_t numOfChunks = columnar::get(file.data() + indexOffset + 4, 8);
+        const uint8_t* entry = file.data() + indexOffset + 12;
+        if (numOfChunks > (file.size() - tailSize - indexOffset - 12) / 28) {
+            error = path + " has a corrupted index";
+            return false;
+        }
+        chunkInfo.resize(static_cast<size_t>(numOfChunks));
+        for (auto& info : chunkInfo) {
+            info.offset = columnar::get(entry, 8);
+            info.numOfRecords = static_cast<uint32_t>(columnar::get(entry + 8, 4));
+            info.minTimestampNs = static_cast<int64_t>(columnar::get(entry + 12, 8));
+            info.maxTimestampNs = static_cast<int64_t>(columnar::get(entry + 20, 8));
+            entry += 28;
+            if (info.offset >= indexOffset) {
+                error = path + " has a corrupted index";
+                return false;
+            }
+        }
+        dataEnd = indexOffset;
+        return true;
+    }
+
+    //! Оглавление
+    const std::vector<ColumnChunkInfo>& chunks() const { return chunkInfo; }
+
+    /**
+     * \brief Чтение блока
+     * @param number Номер блока в оглавлении
+     * @param chunk Записи блока
+     * @return false, если блок поврежден
+     */
+    bool read(size_t number, ColumnChunk& chunk) const {
+        const ColumnChunkInfo& info = chunkInfo[number];
+        const uint8_t* cur = file.data() + info.offset;
+        const uint8_t* end = file.data() + dataEnd;
+        if (end - cur < 24 || columnar::get(cur, 4) != columnar::tagChunk ||
+            columnar::get(cur + 4, 4) != info.numOfRecords)
+            return false;
+        cur += 24;
+        size_t count = info.numOfRecords;
+        auto column = [&cur, end, count](auto& values) {
+            if (end - cur < 4)
+                return false;
+            auto length = static_cast<size_t>(columnar::get(cur, 4));
+            cur += 4;
+            if (static_cast<size_t>(end - cur) < length)
+                return false;
+            bool ok = columnar::decodeColumn(cur, length, count, values);
+            cur += length;
+            return ok;
+        };
+        if (!(column(chunk.timestampNs) && column(chunk.srcIPv4) && column(chunk.dstIPv4) &&
+              column(chunk.srcPort) && column(chunk.dstPort) && column(chunk.protocol) &&
+              column(chunk.payloadLen) && column(chunk.frameLen)))
+            return false;
+        if (version == 1) {
+            for (size_t i = 0; i < count; ++i) {
+                chunk.srcIPv4[i] = ipv4ToHost(chunk.srcIPv4[i]);
+                chunk.dstIPv4[i] = ipv4ToHost(chunk.dstIPv4[i]);
+            }
+        }
+        return true;
+    }
+
+private:
+    //! Отображение файла
+    MappedFile file;
+    //! Оглавление
+    std::vector<ColumnChunkInfo> chunkInfo;
+    //! Версия формата файла
+    uint32_t version = columnarVersion;
+    //! Конец блоков (начало оглавления)
+    uint64_t dataEnd = 0;
+};
+
+#endif // COLUMNAR_EXPORT_H
@@ -0,0 +1,269 @@
+/**
+ \file
+ \brief Заголовочный файл с оценкой квантилей
+
+ Данный файл содержит скетч DDSketch, который оценивает квантили размеров с заданной относительной ошибкой в
+ памяти, не зависящей от числа значений, и объединяется между потоками и файлами сложением корзин
+*/
+
+#ifndef DD_SKETCH_H
+#define DD_SKETCH_H
+
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+//! Скетч DDSketch
+/**
+ * \brief Оценка квантилей с относительной ошибкой (Masson et al., DDSketch)
+ * \author Jodode
+ * \version 0.1
+ *
+ * Значение x > 0 попадает в корзину ceil(log_gamma(x)), где gamma = (1 + accuracy) / (1 - accuracy), поэтому
+ * любой квантиль оценивается с относительной ошибкой не больше accuracy. Нули считаются отдельно. Корзины хранятся
+ * плотным массивом от наименьшего занятого номера: при accuracy 1% размеры до 64 КБ занимают около 560 корзин
+ * (4.5 КБ). Если корзин становится больше maxNumOfBins, младшие корзины сливаются, и гарантия ошибки сохраняется
+ * для верхних квантилей. Скетчи одинаковой точности объединяются без потерь.
+ *
+ * Номера корзин значений меньше smallValues (размеры пакетов) берутся из таблицы, которая вычисляется один раз
+ * на точность и общая для всех скетчей этой точности, поэтому учет размера не вызывает log
+ */
+class DDSketch {
+public:
+    //! Наибольшее число корзин
+    static constexpr size_t maxNumOfBins = 2048;
+    //! Наименьшая относительная ошибка
+    static constexpr double minAccuracy = 1e-4;
+    //! Наибольшая относительная ошибка
+    static constexpr double maxAccuracy = 0.5;
+    //! Наибольший номер корзины (значения до 2^64 при наименьшей ошибке)
+    static constexpr int maxIndex = 1 << 20;
+    //! Граница значений с номером корзины из таблицы (номер не больше 55452 при наименьшей ошибке)
+    static constexpr uint64_t smallValues = 65536;
+
+    //! Конструктор
+    /**
+     * @param accuracy Относительная ошибка квантилей (1e-4 - 0.5)
+     */
+    explicit DDSketch(double accuracy = 0.01)
+        : alpha(accuracy < minAccuracy ? minAccuracy : accuracy > maxAccuracy ? maxAccuracy : accuracy),
+          gamma((1.0 + alpha) / (1.0 - alpha)), logGamma(std::log(gamma)),
+          smallIndexes(smallIndexTable(alpha, logGamma)) {}
+
+    /**
+     * \brief Учет значения
+     * @param value Значение
+     * @param count Число повторений значения
+     */
+    void add(uint64_t value, uint64_t count = 1) {
+        if (count == 0)
+            return;
+        if (value == 0)
+            zeroCount += count;
+        else if (value < smallValues)
+            bins[binOf((*smallIndexes)[value])] += count;
+        else
+            bins[binOf(indexOf(static_cast<double>(value)))] += count;
+        if (total == 0 || value < minValue)
+            minValue = value;
+        if (total == 0 || value > maxValue)
+            maxValue = value;
+        total += count;
+    }
+
+    /**
+     * \brief Оценка квантиля
+     * @param q Уровень квантиля (0-1)
+     * @return Значение, не больше которого q значений (0 для пустого скетча)
+     */
+    double quantile(double q) const {
+        if (total == 0)
+            return 0.0;
+        if (q <= 0.0)
+            return static_cast<double>(minValue);
+        if (q >= 1.0)
+            return static_cast<double>(maxValue);
+        auto rank = static_cast<uint64_t>(q * static_cast<double>(total - 1));
+        uint64_t seen = zeroCount;
+        if (seen > rank)
+            return static_cast<double>(minValue);
+        for (size_t i = 0; i < bins.size(); ++i) {
+            seen += bins[i];
+            if (seen > rank)
+                return clamp(valueOf(offset + static_cast<int>(i)));
+        }
+        return static_cast<double>(maxValue);
+    }
+
+    /**
+     * \brief Объединение со скетчем той же точности
+     * @param other Скетч, собранный по другой части трафика
+     * @return false, если точность скетчей различается
+     */
+    bool merge(const DDSketch& other) {
+        if (other.alpha != alpha)
+            return false;
+        if (other.total == 0)
+            return true;
+        if (!other.bins.empty()) {
+            int otherLast = other.offset + static_cast<int>(other.bins.size()) - 1;
+            reshape(bins.empty() ? other.offset : std::min(offset, other.offset),
+                    bins.empty() ? otherLast : std::max(offset + static_cast<int>(bins.size()) - 1, otherLast));
+            for (size_t i = 0; i < other.bins.size(); ++i) {
+                int index = other.offset + static_cast<int>(i);
+                bins[index < offset ? 0 : static_cast<size_t>(index - offset)] += other.bins[i];
+            }
+        }
+        zeroCount += other.zeroCount;
+        if (total == 0 || other.minValue < minValue)
+            minValue = other.minValue;
+        if (total == 0 || other.maxValue > maxValue)
+            maxValue = other.maxValue;
+        total += other.total;
+        return true;
+    }
+
+    /**
+     * \brief Восстановление сохраненного скетча
+     * @param firstIndex Номер первой корзины
+     * @param savedBins Корзины
+     * @param savedZeroCount Число нулей
+     * @param savedMin Наименьшее значение
+     * @param savedMax Наибольшее значение
+     * @return false, если корзин больше maxNumOfBins или номера корзин вне [0, maxIndex]
+     */
+    bool restore(int firstIndex, const std::vector<uint64_t>& savedBins, uint64_t savedZeroCount, uint64_t savedMin,
+                 uint64_t savedMax) {
+        if (savedBins.size() > maxNumOfBins || firstIndex < 0 ||
+            firstIndex > maxIndex - static_cast<int>(savedBins.size()))
+            return false;
+        clear();
+        offset = firstIndex;
+        bins = savedBins;
+        zeroCount = savedZeroCount;
+        total = zeroCount;
+        for (uint64_t count : bins)
+            total += count;
+        minValue = savedMin;
+        maxValue = savedMax;
+        return true;
+    }
+
+    //! Функция очищения (точность сохраняется)
+    void clear() {
+        bins.clear();
+        offset = 0;
+        zeroCount = 0;
+        total = 0;
+        minValue = 0;
+        maxValue = 0;
+    }
+
+    //! Относительная ошибка
+    double accuracy() const { return alpha; }
+    //! Число учтенных значений
+    uint64_t count() const { return total; }
+    //! Номер первой корзины
+    int firstIndex() const { return offset; }
+    //! Корзины
+    const std::vector<uint64_t>& data() const { return bins; }
+    //! Число нулей
+    uint64_t zeros() const { return zeroCount; }
+    //! Наименьшее значение
+    uint64_t min() const { return minValue; }
+    //! Наибольшее значение
+    uint64_t max() const { return maxValue; }
+
+private:
+    int indexOf(double value) const { return indexOf(value, logGamma); }
+
+    static int indexOf(double value, double logGamma) {
+        return static_cast<int>(std::ceil(std::log(value) / logGamma));
+    }
+
+    //! Таблица номеров корзин значений [0, smallValues) для точности alpha, одна на точность
+    static std::shared_ptr<const std::vector<uint16_t>> smallIndexTable(double alpha, double logGamma) {
+        static std::mutex mutex;
+        static std::map<double, std::shared_ptr<const std::vector<uint16_t>>> tables;
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<const std::vector<uint16_t>>& table = tables[alpha];
+        if (!table) {
+            std::vector<uint16_t> indexes(smallValues, 0);
+            for (uint64_t value = 1; value < smallValues; ++value)
+                indexes[value] = static_cast<uint16_t>(indexOf(static_cast<double>(value), logGamma));
+            table = std::make_shared<const std::vector<uint16_t>>(std::move(indexes));
+        }
+        return table;
+    }
+
+    //! Середина корзины в смысле относительной ошибки
+    double valueOf(int index) const { return 2.0 * std::pow(gamma, index) / (gamma + 1.0); }
+
+    double clamp(double value) const {
+        if (value < static_cast<double>(minValue))
+            return static_cast<double>(minValue);
+        if (value > static_cast<double>(maxValue))
+            return static_cast<double>(maxValue);
+        return value;
+    }
+
+    //! Позиция корзины в массиве с расширением массива
+    size_t binOf(int index) {
+        if (bins.empty()) {
+            offset = index;
+            bins.assign(1, 0);
+            return 0;
+        }
+        int last = offset + static_cast<int>(bins.size()) - 1;
+        if (index < offset && bins.size() == maxNumOfBins)
+            return 0;
+        if (index < offset || index > last)
+            reshape(std::min(offset, index), std::max(last, index));
+        return index < offset ? 0 : static_cast<size_t>(index - offset);
+    }
+
+    /**
+     * \brief Расширение массива до корзин [first, last]
+     *
+     * Если корзин больше maxNumOfBins, массив начинается с last - maxNumOfBins + 1, а младшие корзины сливаются
+     * в первую
+     */
+    void reshape(int first, int last) {
+        if (last - first + 1 > static_cast<int>(maxNumOfBins))
+            first = last - static_cast<int>(maxNumOfBins) + 1;
+        std::vector<uint64_t> reshaped(static_cast<size_t>(last - first + 1), 0);
+        for (size_t i = 0; i < bins.size(); ++i) {
+            int index = offset + static_cast<int>(i);
+            reshaped[index < first ? 0 : static_cast<size_t>(index - first)] += bins[i];
+        }
+        bins.swap(reshaped);
+        offset = first;
+    }
+
+    //! Относительная ошибка
+    double alpha;
+    //! Основание логарифма корзин
+    double gamma;
+    //! Натуральный логарифм gamma
+    double logGamma;
+    //! Номера корзин значений меньше smallValues
+    std::shared_ptr<const std::vector<uint16_t>> smallIndexes;
+    //! Корзины, начиная с номера offset
+    std::vector<uint64_t> bins;
+    //! Номер первой корзины
+    int offset = 0;
+    //! Число нулей
+    uint64_t zeroCount = 0;
+    //! Число учтенных значений
+    uint64_t total = 0;
+    //! Наименьшее значение
+    uint64_t minValue = 0;
+    //! Наибольшее значение
+    uint64_t maxValue = 0;
+};
+
+#endif // DD_SKETCH_H
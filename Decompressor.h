@@ -0,0 +1,208 @@
+/**
+ \file
+ \brief Заголовочный файл с распаковкой сжатых файлов трафика
+
+ Данный файл содержит определение сжатия по сигнатуре (gzip, zstd) и потоковую распаковку, которой читатель потока
+ заполняет блоки для разбора. gzip доступен со сборкой с zlib (SFT_WITH_ZLIB), zstd - с libzstd (SFT_WITH_ZSTD)
+*/
+
+#ifndef DECOMPRESSOR_H
+#define DECOMPRESSOR_H
+
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <string>
+
+#if defined(SFT_WITH_ZLIB)
+#include <zlib.h>
+#endif
+#if defined(SFT_WITH_ZSTD)
+#include <zstd.h>
+#endif
+
+//! Сжатие данных
+enum Compression {
+    //! Без сжатия
+    CompressionNone,
+    //! gzip (в том числе несколько склеенных частей, как у pigz и bgzip)
+    CompressionGzip,
+    //! Zstandard (в том числе несколько кадров)
+    CompressionZstd
+};
+
+//! Число байт, по которым определяется сжатие
+const size_t compressionMagicLen = 4;
+
+/**
+ * \brief Определение сжатия по первым байтам
+ * @param data Первые байты данных
+ * @param size Число байт (не меньше compressionMagicLen, иначе данные считаются несжатыми)
+ */
+inline Compression detectCompression(const uint8_t* data, size_t size) {
+    if (size >= 2 && data[0] == 0x1f && data[1] == 0x8b)
+        return CompressionGzip;
+    if (size >= 4 && data[0] == 0x28 && data[1] == 0xb5 && data[2] == 0x2f && data[3] == 0xfd)
+        return CompressionZstd;
+    return CompressionNone;
+}
+
+/**
+ * \brief Определение сжатия файла по сигнатуре
+ * @param path Путь до файла
+ * @return CompressionNone, если файл не сжат или не открывается
+ */
+inline Compression fileCompression(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    uint8_t magic[compressionMagicLen] = {};
+    file.read(reinterpret_cast<char*>(magic), sizeof(magic));
+    return detectCompression(magic, static_cast<size_t>(file.gcount()));
+}
+
+//! Название сжатия для сообщений
+inline const char* compressionName(Compression compression) {
+    return compression == CompressionGzip ? "gzip" : compression == CompressionZstd ? "zstd" : "none";
+}
+
+//! Потоковая распаковка
+/**
+ * \brief Распаковка gzip или zstd частями произвольного размера
+ * \author Jodode
+ * \version 0.1
+ *
+ * Сжатые данные подаются кусками по мере чтения, распакованные пишутся прямо в переданный буфер, поэтому между
+ * распаковкой и разбором нет промежуточных копий. Склеенные части gzip и кадры zstd распаковываются подряд
+ */
+class Decompressor {
+public:
+    //! Результат распаковки
+    enum Status {
+        //! Данные распакованы, часть входа или выхода могла остаться неиспользованной
+        Ok,
+        //! Данные повреждены
+        Error
+    };
+
+    //! Конструктор
+    /**
+     * @param compression Сжатие данных
+     */
+    explicit Decompressor(Compression compression) : compression(compression) {
+#if defined(SFT_WITH_ZLIB)
+        if (compression == CompressionGzip) {
+            inflater = z_stream{};
+            ready = inflateInit2(&inflater, 15 + 16) == Z_OK;
+        }
+#endif
+#if defined(SFT_WITH_ZSTD)
+        if (compression == CompressionZstd) {
+            zstdContext = ZSTD_createDStream();
+            ready = zstdContext != nullptr && !ZSTD_isError(ZSTD_initDStream(zstdContext));
+        }
+#endif
+    }
+
+    //! Деструктор
+    ~Decompressor() {
+#if defined(SFT_WITH_ZLIB)
+        if (compression == CompressionGzip && ready)
+            inflateEnd(&inflater);
+#endif
+#if defined(SFT_WITH_ZSTD)
+        if (zstdContext != nullptr)
+            ZSTD_freeDStream(zstdContext);
+#endif
+    }
+
+    Decompressor(const Decompressor&) = delete;
+    Decompressor& operator=(const Decompressor&) = delete;
+
+    //! Признак того, что сжатие поддерживается сборкой
+    bool supported() const { return ready; }
+
+    /**
+     * \brief Распаковка очередной части
+     * @param input Сжатые данные
+     * @param inputSize Число сжатых байт
+     * @param consumed Число использованных сжатых байт
+     * @param output Буфер для распакованных данных
+     * @param outputSize Размер буфера
+     * @param produced Число распакованных байт
+     * @return Error, если данные повреждены
+     */
+    Status run(const uint8_t* input, size_t inputSize, size_t& consumed, uint8_t* output, size_t outputSize,
+               size_t& produced) {
+        consumed = 0;
+        produced = 0;
+#if defined(SFT_WITH_ZLIB)
+        if (compression == CompressionGzip) {
+            if (memberEnded && inputSize > 0 && input[0] != 0x1f) {
+                // Как и gzip, нули и мусор после последней части пропускаются
+                consumed = inputSize;
+                return Ok;
+            }
+            memberEnded = false;
+            inflater.next_in = const_cast<Bytef*>(input);
+            inflater.avail_in = static_cast<uInt>(inputSize);
+            inflater.next_out = output;
+            inflater.avail_out = static_cast<uInt>(outputSize);
+            int result = inflate(&inflater, Z_NO_FLUSH);
+            consumed = inputSize - inflater.avail_in;
+            produced = outputSize - inflater.avail_out;
+            if (result == Z_STREAM_END) {
+                // Следующая часть gzip начинается сразу за концом текущей
+                inflateReset(&inflater);
+                midStream = false;
+                memberEnded = true;
+                return Ok;
+            }
+            if (result != Z_OK && result != Z_BUF_ERROR)
+                return Error;
+            midStream = midStream || consumed > 0 || produced > 0;
+            return Ok;
+        }
+#endif
+#if defined(SFT_WITH_ZSTD)
+        if (compression == CompressionZstd) {
+            ZSTD_inBuffer in{input, inputSize, 0};
+            ZSTD_outBuffer out{output, outputSize, 0};
+            size_t result = ZSTD_decompressStream(zstdContext, &out, &in);
+            consumed = in.pos;
+            produced = out.pos;
+            if (ZSTD_isError(result))
+                return Error;
+            // 0 - кадр распакован и выдан полностью
+            midStream = result != 0;
+            return Ok;
+        }
+#endif
+        (void) input;
+        (void) inputSize;
+        (void) output;
+        (void) outputSize;
+        return Error;
+    }
+
+    //! Признак незавершенной части gzip или кадра zstd (в конце входа означает обрезанный файл)
+    bool unfinished() const { return midStream; }
+
+private:
+    //! Сжатие данных
+    Compression compression;
+    //! Признак успешной инициализации
+    bool ready = false;
+    //! Признак незавершенной части
+    bool midStream = false;
+    //! Признак окончания части gzip
+    bool memberEnded = false;
+#if defined(SFT_WITH_ZLIB)
+    //! Состояние zlib
+    z_stream inflater;
+#endif
+#if defined(SFT_WITH_ZSTD)
+    //! Состояние zstd
+    ZSTD_DStream* zstdContext = nullptr;
+#endif
+};
+
+#endif // DECOMPRESSOR_H
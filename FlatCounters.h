@@ -0,0 +1,303 @@
+/**
+ \file
+ \brief Заголовочный файл с плоскими счетчиками
+
+ Данный файл содержит контейнеры для счетчиков, обновляемых на каждый пакет: плотный массив счетчиков портов
+ и хеш-таблицу с открытой адресацией для IP адресов. Ни один из них не выделяет память на каждый новый ключ
+*/
+
+#ifndef FLAT_COUNTERS_H
+#define FLAT_COUNTERS_H
+
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/**
+ * \brief Номер старшего единичного бита
+ * \author Jodode
+ * @param value Ненулевое значение
+ * @return floor(log2(value))
+ */
+inline size_t highestBit(uint64_t value) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return static_cast<size_t>(index);
+#else
+    return static_cast<size_t>(63 - __builtin_clzll(value));
+#endif
+}
+
+/**
+ * \brief Перемешивание битов ключа
+ * @param key Ключ
+ * @return 64-битный хеш
+ *
+ * Финализатор splitmix64: соседние адреса и порты попадают в далекие ячейки
+ */
+inline uint64_t mixHash(uint64_t key) {
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return key;
+}
+
+//! Счетчик портов
+/**
+ * \brief Плотный массив счетчиков для всех 65536 портов
+ * \author Jodode
+ * \version 0.1
+ *
+ * Обновление - одно обращение к массиву по индексу. Порядок обхода совпадает с порядком портов
+ */
+class PortCounter {
+public:
+    //! Число портов
+    static constexpr size_t numOfPorts = 65536;
+
+    //! Конструктор
+    PortCounter() : counts(numOfPorts, 0) {}
+
+    /**
+     * \brief Увеличение счетчика порта
+     * @param port Порт
+     * @param count Величина увеличения
+     */
+    void add(uint16_t port, uint64_t count = 1) {
+        if (counts[port] == 0)
+            ++used;
+        counts[port] += count;
+    }
+
+    /**
+     * \brief Значение счетчика
+     * @param port Порт
+     */
+    uint64_t count(uint16_t port) const { return counts[port]; }
+
+    //! Адрес счетчика порта, для предвыборки в кэш до обновления
+    const void* slotAddress(uint16_t port) const { return &counts[port]; }
+
+    //! Число портов с ненулевым счетчиком
+    size_t size() const { return used; }
+
+    //! Признак отсутствия счетчиков
+    bool empty() const { return used == 0; }
+
+    /**
+     * \brief Объединение с другим счетчиком
+     * @param other Счетчик, собранный по другой части трафика
+     */
+    void merge(const PortCounter& other) {
+        for (size_t port = 0; port < numOfPorts; ++port)
+            if (other.counts[port] != 0)
+                add(static_cast<uint16_t>(port), other.counts[port]);
+    }
+
+    //! Функция очищения
+    void clear() {
+        std::fill(counts.begin(), counts.end(), 0);
+        used = 0;
+    }
+
+    /**
+     * \brief Обход ненулевых счетчиков по возрастанию порта
+     * @param func Функция, принимающая (порт, счетчик)
+     */
+    template <typename Func>
+    void forEach(Func func) const {
+        for (size_t port = 0; port < numOfPorts; ++port)
+            if (counts[port] != 0)
+                func(static_cast<uint32_t>(port), counts[port]);
+    }
+
+private:
+    //! Счетчики, индекс - номер порта
+    std::vector<uint64_t> counts;
+    //! Число ненулевых счетчиков
+    size_t used = 0;
+};
+
+//! Плоская хеш-таблица
+/**
+ * \brief Хеш-таблица с открытой адресацией и линейным пробированием
+ * \author Jodode
+ * \version 0.1
+ *
+ * Ключи и значения хранятся в одном непрерывном массиве, память выделяется только при росте таблицы (заполнение
+ * не выше 1/2). Нулевой ключ помечает пустую ячейку, поэтому значение для него хранится отдельно. Удаление сдвигает
+ * следующие элементы цепочки назад, без "надгробий"
+ */
+template <typename Key, typename Value>
+class FlatHashMap {
+public:
+    //! Конструктор
+    /**
+     * @param capacity Начальное число ячеек (округляется до степени двойки)
+     */
+    explicit FlatHashMap(size_t capacity = 1024) { rehash(capacity); }
+
+    /**
+     * \brief Поиск значения
+     * @param key Ключ
+     * @return Указатель на значение или nullptr
+     */
+    Value* find(Key key) {
+        if (key == Key()) return hasZero ? &zeroValue : nullptr;
+        for (size_t i = index(key);; i = (i + 1) & mask) {
+            if (slots[i].first == key) return &slots[i].second;
+            if (slots[i].first == Key()) return nullptr;
+        }
+    }
+
+    //! Поиск значения
+    const Value* find(Key key) const { return const_cast<FlatHashMap*>(this)->find(key); }
+
+    /**
+     * \brief Доступ к значению с вставкой значения по умолчанию
+     * @param key Ключ
+     */
+    Value& operator[](Key key) {
+        if (key == Key()) {
+            if (!hasZero) {
+                hasZero = true;
+                ++count;
+            }
+            return zeroValue;
+        }
+        size_t i = index(key);
+        for (; slots[i].first != Key(); i = (i + 1) & mask)
+            if (slots[i].first == key) return slots[i].second;
+        if ((count + 1) * 2 > slots.size()) {
+            rehash(slots.size() * 2);
+            return (*this)[key];
+        }
+        ++count;
+        slots[i].first = key;
+        slots[i].second = Value();
+        return slots[i].second;
+    }
+
+    /**
+     * \brief Удаление ключа
+     * @param key Ключ
+     * @return false, если ключа не было
+     */
+    bool erase(Key key) {
+        if (key == Key()) {
+            if (!hasZero) return false;
+            hasZero = false;
+            zeroValue = Value();
+            --count;
+            return true;
+        }
+        size_t i = index(key);
+        for (; slots[i].first != key; i = (i + 1) & mask)
+            if (slots[i].first == Key()) return false;
+        // Сдвиг назад элементов, которые могли пропустить освободившуюся ячейку
+        for (size_t j = (i + 1) & mask; slots[j].first != Key(); j = (j + 1) & mask) {
+            size_t home = index(slots[j].first);
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                slots[i] = slots[j];
+                i = j;
+            }
+        }
+        slots[i].first = Key();
+        slots[i].second = Value();
+        --count;
+        return true;
+    }
+
+    //! Число ключей
+    size_t size() const { return count; }
+
+    //! Признак отсутствия ключей
+    bool empty() const { return count == 0; }
+
+    //! Функция очищения, память таблицы сохраняется
+    void clear() {
+        std::fill(slots.begin(), slots.end(), Slot(Key(), Value()));
+        hasZero = false;
+        zeroValue = Value();
+        count = 0;
+    }
+
+    /**
+     * \brief Обход всех элементов в порядке ячеек
+     * @param func Функция, принимающая (ключ, значение)
+     */
+    template <typename Func>
+    void forEach(Func func) const {
+        if (hasZero) func(Key(), zeroValue);
+        for (auto& slot : slots)
+            if (slot.first != Key()) func(slot.first, slot.second);
+    }
+
+    /**
+     * \brief Элементы, отсортированные по ключу
+     * @return Вектор пар (ключ, значение)
+     */
+    std::vector<std::pair<Key, Value>> sorted() const {
+        std::vector<std::pair<Key, Value>> result;
+        result.reserve(count);
+        forEach([&result](Key key, const Value& value) { result.emplace_back(key, value); });
+        std::sort(result.begin(), result.end(),
+                  [](const std::pair<Key, Value>& a, const std::pair<Key, Value>& b) { return a.first < b.first; });
+        return result;
+    }
+
+    /**
+     * \brief Сложение значений другой таблицы
+     * @param other Таблица, собранная по другой части трафика
+     */
+    void merge(const FlatHashMap& other) {
+        other.forEach([this](Key key, const Value& value) { (*this)[key] += value; });
+    }
+
+    //! Адрес ячейки ключа, для предвыборки в кэш до обновления
+    const void* slotAddress(Key key) const { return &slots[index(key)]; }
+
+private:
+    typedef std::pair<Key, Value> Slot;
+
+    size_t index(Key key) const { return static_cast<size_t>(mixHash(static_cast<uint64_t>(key))) & mask; }
+
+    void rehash(size_t capacity) {
+        size_t size = 16;
+        while (size < capacity) size *= 2;
+        std::vector<Slot> old(size, Slot(Key(), Value()));
+        old.swap(slots);
+        mask = size - 1;
+        count = hasZero ? 1 : 0;
+        for (auto& slot : old) {
+            if (slot.first == Key()) continue;
+            size_t i = index(slot.first);
+            while (slots[i].first != Key()) i = (i + 1) & mask;
+            slots[i] = slot;
+            ++count;
+        }
+    }
+
+    //! Ячейки таблицы
+    std::vector<Slot> slots;
+    //! Маска индекса (число ячеек - 1)
+    size_t mask = 0;
+    //! Число ключей
+    size_t count = 0;
+    //! Признак наличия нулевого ключа
+    bool hasZero = false;
+    //! Значение для нулевого ключа
+    Value zeroValue = Value();
+};
+
+//! Счетчик обращений на IPv4 адреса
+typedef FlatHashMap<uint32_t, uint64_t> IPv4Counter;
+
+#endif // FLAT_COUNTERS_H
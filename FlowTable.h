@@ -0,0 +1,558 @@
+/**
+ \file
+ \brief Заголовочный файл с таблицей потоков
+
+ Данный файл содержит учет потоков по 5-кортежу (адреса, порты, протокол): число пакетов и байт, время первого
+ и последнего пакета, флаги TCP. Записи потоков берутся из пула, а не выделяются по одной
+*/
+
+#ifndef FLOW_TABLE_H
+#define FLOW_TABLE_H
+
+#include <array>
+#include <memory>
+#include <tuple>
+#include <vector>
+#include <algorithm>
+#include "FlatCounters.h"
+#include "PacketDecoder.h"
+
+//! Ключ потока
+/**
+ * \brief 5-кортеж потока, адреса в сетевом порядке байт
+ */
+struct FlowKey {
+    uint32_t srcIPv4;
+    uint32_t dstIPv4;
+    uint16_t srcPort;
+    uint16_t dstPort;
+    uint8_t protocol;
+
+    bool operator==(const FlowKey& other) const {
+        return srcIPv4 == other.srcIPv4 && dstIPv4 == other.dstIPv4 && srcPort == other.srcPort &&
+               dstPort == other.dstPort && protocol == other.protocol;
+    }
+
+    //! Хеш ключа
+    uint64_t hash() const {
+        uint64_t addresses = (static_cast<uint64_t>(srcIPv4) << 32) | dstIPv4;
+        uint64_t ports = (static_cast<uint64_t>(srcPort) << 24) | (static_cast<uint64_t>(dstPort) << 8) | protocol;
+        return mixHash(addresses ^ mixHash(ports));
+    }
+};
+
+//! Статистика потока
+/**
+ * \brief Запись таблицы потоков
+ */
+struct FlowEntry {
+    //! Ключ потока
+    FlowKey key;
+    //! Число пакетов
+    uint64_t packets;
+    //! Число байт (длина пакетов в сети)
+    uint64_t bytes;
+    //! Время первого пакета, нс
+    int64_t firstNs;
+    //! Время последнего пакета, нс
+    int64_t lastNs;
+    //! Объединение флагов TCP всех пакетов потока
+    uint8_t tcpFlags;
+
+    //! Длительность потока, нс
+    int64_t duration() const { return lastNs - firstNs; }
+
+    /**
+     * \brief Добавление статистики той же пары направлений, собранной в другом месте
+     * @param other Запись того же потока
+     */
+    void merge(const FlowEntry& other) {
+        packets += other.packets;
+        bytes += other.bytes;
+        firstNs = std::min(firstNs, other.firstNs);
+        lastNs = std::max(lastNs, other.lastNs);
+        tcpFlags |= other.tcpFlags;
+    }
+};
+
+//! Пул записей потоков
+/**
+ * \brief Пул записей фиксированного размера
+ * \author Jodode
+ * \version 0.1
+ *
+ * Записи выделяются блоками по chunkSize штук и адресуются 32-битным индексом, освобожденные записи
+ * переиспользуются через список свободных. Адреса записей не меняются при росте пула
+ */
+class FlowArena {
+public:
+    //! Число записей в блоке
+    static constexpr uint32_t chunkSize = 4096;
+
+    //! Выделение записи
+    uint32_t allocate() {
+        if (!freeList.empty()) {
+            uint32_t index = freeList.back();
+            freeList.pop_back();
+            return index;
+        }
+        if (next == chunks.size() * chunkSize)
+            chunks.emplace_back(new FlowEntry[chunkSize]);
+        return next++;
+    }
+
+    //! Возврат записи в пул
+    void release(uint32_t index) { freeList.push_back(index); }
+
+    //! Доступ к записи
+    FlowEntry& operator[](uint32_t index) { return chunks[index / chunkSize][index % chunkSize]; }
+    //! Доступ к записи
+    const FlowEntry& operator[](uint32_t index) const { return chunks[index / chunkSize][index % chunkSize]; }
+
+    //! Функция очищения, блоки остаются выделенными
+    void clear() {
+        freeList.clear();
+        next = 0;
+    }
+
+private:
+    //! Блоки записей
+    std::vector<std::unique_ptr<FlowEntry[]>> chunks;
+    //! Освобожденные записи
+    std::vector<uint32_t> freeList;
+    //! Число записей, выданных из блоков
+    uint32_t next = 0;
+};
+
+//! Таблица потоков
+/**
+ * \brief Таблица активных потоков с вытеснением по времени бездействия
+ * \author Jodode
+ * \version 0.1
+ *
+ * Индекс - открытая адресация с линейным пробированием: ячейка хранит номер записи в пуле и старшие биты хеша,
+ * поэтому при поиске запись читается только при совпадении хеша. Поток - пакеты одного 5-кортежа, между соседними
+ * из которых меньше idleTimeout: пакет после большего перерыва начинает новый поток. Время берется из меток пакетов:
+ * не чаще одного раза за idleTimeout по времени трафика таблица просматривается, и потоки без пакетов дольше
+ * idleTimeout завершаются. Завершенные потоки сворачиваются в распределение длительностей и в top-N по байтам,
+ * поэтому память ограничена числом одновременно активных потоков. Выделение памяти происходит только при росте пула
+ * и индекса.
+ *
+ * Пакеты учитываются отрезками времени (span): отрезок заканчивается, когда время пакета уходит назад или вперед
+ * больше чем на idleTimeout (следующий файл, другой диапазон). Потоки, которые могут продолжать поток соседнего
+ * отрезка (начавшиеся в первые idleTimeout отрезка и активные в его конце), не сворачиваются, а хранятся записями
+ * на границах. При объединении таблиц (разные файлы или диапазоны байт) записи границ склеиваются по ключу и
+ * перерыву, и потоки, оказавшиеся внутри общего отрезка, сворачиваются. Поэтому поток, разделенный между частями
+ * трафика, учитывается один раз. Таблицы, собранные по части потоков одного отрезка (потоки-обработчики с
+ * распределением пакетов по хешу), объединяются между собой раньше, чем с таблицами соседних отрезков
+ */
+class FlowTable {
+public:
+    //! Число интервалов распределения длительностей
+    static constexpr size_t numOfDurationBuckets = 40;
+
+    //! Отрезок времени, покрытый учтенными пакетами
+    struct Span {
+        //! Время первого пакета, нс
+        int64_t firstNs;
+        //! Время последнего пакета, нс
+        int64_t lastNs;
+    };
+
+    //! Конструктор
+    /**
+     * @param idleTimeoutNs Время бездействия, после которого поток завершается, нс
+     * @param topN Число потоков в отчете
+     */
+    explicit FlowTable(int64_t idleTimeoutNs = 60LL * 1000000000LL, size_t topN = 10)
+        : idleTimeoutNs(idleTimeoutNs), topN(topN) {}
+
+    /**
+     * \brief Учет пакета
+     * @param headers Заголовки пакета, учитываются только пакеты с IPv4
+     */
+    void update(const PacketHeaders& headers) {
+        if (!headers.hasIPv4)
+            return;
+        if (slots.empty())
+            resize(1024);
+        int64_t timestampNs = headers.timestampNs;
+        if (running && (timestampNs < run.lastNs - idleTimeoutNs || timestampNs - run.lastNs >= idleTimeoutNs))
+            closeRun();
+        if (!running) {
+            run = Span{timestampNs, timestampNs};
+            lastSweepNs = timestampNs;
+            running = true;
+        }
+        if (timestampNs > run.lastNs) run.lastNs = timestampNs;
+        if (timestampNs - lastSweepNs >= idleTimeoutNs) {
+            expire(timestampNs);
+            lastSweepNs = timestampNs;
+        }
+
+        FlowKey key{headers.srcIPv4, headers.dstIPv4, headers.srcPort, headers.dstPort, headers.l4Protocol};
+        FlowEntry& entry = findOrInsert(key, timestampNs);
+        if (entry.packets != 0 && timestampNs - entry.lastNs >= idleTimeoutNs) {
+            finish(entry);
+            entry = FlowEntry{key, 0, 0, timestampNs, timestampNs, 0};
+        }
+        ++entry.packets;
+        entry.bytes += headers.frameLen;
+        entry.tcpFlags |= headers.tcpFlags;
+        if (timestampNs > entry.lastNs) entry.lastNs = timestampNs;
+        if (timestampNs < entry.firstNs) entry.firstNs = timestampNs;
+    }
+
+    /**
+     * \brief Объединение с другой таблицей
+     * @param other Таблица, собранная по другой части трафика
+     *
+     * Текущий отрезок таблицы закрывается. Активные потоки и записи границ обеих таблиц склеиваются по ключу, если
+     * перерыв между ними меньше idleTimeout, завершенные потоки объединяются в сводках
+     */
+    void merge(const FlowTable& other) {
+        closeRun();
+        other.forEachActive([this](const FlowEntry& entry) { boundary.push_back(entry); });
+        boundary.insert(boundary.end(), other.boundary.begin(), other.boundary.end());
+        spans.insert(spans.end(), other.spans.begin(), other.spans.end());
+        if (other.running)
+            spans.push_back(other.run);
+        finishedFlows += other.finishedFlows;
+        for (size_t i = 0; i < numOfDurationBuckets; ++i)
+            durations[i] += other.durations[i];
+        for (auto& flow : other.topFinished)
+            pushTop(topFinished, flow);
+        settle();
+    }
+
+    /**
+     * \brief Добавление сохраненного состояния таблицы
+     * @param finished Число завершенных потоков
+     * @param finishedDurations Распределение длительностей завершенных потоков
+     * @param top Наибольшие завершенные потоки
+     * @param pendingFlows Активные потоки и записи границ
+     * @param coverage Отрезки времени сохраненной таблицы (пустые для снимков без отрезков)
+     */
+    void restore(uint64_t finished, const std::array<uint64_t, numOfDurationBuckets>& finishedDurations,
+                 const std::vector<FlowEntry>& top, const std::vector<FlowEntry>& pendingFlows,
+                 const std::vector<Span>& coverage) {
+        closeRun();
+        boundary.insert(boundary.end(), pendingFlows.begin(), pendingFlows.end());
+        spans.insert(spans.end(), coverage.begin(), coverage.end());
+        finishedFlows += finished;
+        for (size_t i = 0; i < numOfDurationBuckets; ++i)
+            durations[i] += finishedDurations[i];
+        for (auto& flow : top)
+            pushTop(topFinished, flow);
+        settle();
+    }
+
+    //! Число завершенных потоков (свернутых в сводки)
+    uint64_t finishedCount() const { return finishedFlows; }
+
+    //! Распределение длительностей завершенных потоков
+    const std::array<uint64_t, numOfDurationBuckets>& finishedDurations() const { return durations; }
+
+    //! Наибольшие завершенные потоки
+    const std::vector<FlowEntry>& finishedTop() const { return topFinished; }
+
+    //! Записи потоков на границах отрезков
+    const std::vector<FlowEntry>& boundaryFlows() const { return boundary; }
+
+    //! Отрезки времени учтенных пакетов, включая текущий
+    std::vector<Span> coverage() const {
+        std::vector<Span> result(spans);
+        if (running)
+            result.push_back(run);
+        return result;
+    }
+
+    /**
+     * \brief Обход активных потоков
+     * @param func Функция, принимающая const FlowEntry&
+     */
+    template <typename Func>
+    void forEachActive(Func func) const {
+        for (auto& slot : slots)
+            if (slot.entry != 0)
+                func(arena[slot.entry - 1]);
+    }
+
+    //! Число потоков (завершенных, на границах и активных)
+    uint64_t numOfFlows() const { return finishedFlows + pending().size(); }
+
+    //! Число активных потоков
+    size_t activeFlows() const { return active; }
+
+    //! Признак пустой таблицы
+    bool empty() const { return finishedFlows == 0 && active == 0 && boundary.empty(); }
+
+    /**
+     * \brief Наибольшие по числу байт потоки
+     * @return До topN потоков по убыванию числа байт
+     */
+    std::vector<FlowEntry> topFlows() const {
+        std::vector<FlowEntry> heap(topFinished);
+        for (auto& entry : pending())
+            pushTop(heap, entry);
+        std::sort(heap.begin(), heap.end(), heavier);
+        return heap;
+    }
+
+    /**
+     * \brief Распределение длительностей потоков
+     * @return Число потоков в интервалах: 0 - менее 1 мс, k - [2^(k-1), 2^k) мс
+     */
+    std::array<uint64_t, numOfDurationBuckets> durationHistogram() const {
+        auto result = durations;
+        for (auto& entry : pending())
+            ++result[durationBucket(entry.duration())];
+        return result;
+    }
+
+    //! Функция очищения
+    void clear() {
+        std::fill(slots.begin(), slots.end(), Slot());
+        arena.clear();
+        active = 0;
+        finishedFlows = 0;
+        durations.fill(0);
+        topFinished.clear();
+        boundary.clear();
+        spans.clear();
+        running = false;
+        lastSweepNs = 0;
+    }
+
+    /**
+     * \brief Номер интервала длительности
+     * @param durationNs Длительность потока, нс
+     */
+    static size_t durationBucket(int64_t durationNs) {
+        uint64_t ms = durationNs > 0 ? static_cast<uint64_t>(durationNs) / 1000000ULL : 0;
+        if (ms == 0)
+            return 0;
+        return std::min(highestBit(ms) + 1, numOfDurationBuckets - 1);
+    }
+
+private:
+    //! Ячейка индекса
+    struct Slot {
+        //! Номер записи в пуле + 1 (0 - пустая ячейка)
+        uint32_t entry = 0;
+        //! Старшие биты хеша ключа
+        uint32_t tag = 0;
+    };
+
+    FlowEntry& findOrInsert(const FlowKey& key, int64_t timestampNs) {
+        uint64_t hash = key.hash();
+        uint32_t tag = static_cast<uint32_t>(hash >> 32);
+        size_t i = static_cast<size_t>(hash) & mask;
+        for (; slots[i].entry != 0; i = (i + 1) & mask)
+            if (slots[i].tag == tag && arena[slots[i].entry - 1].key == key)
+                return arena[slots[i].entry - 1];
+
+        if ((active + 1) * 2 > slots.size()) {
+            resize(slots.size() * 2);
+            return findOrInsert(key, timestampNs);
+        }
+        uint32_t index = arena.allocate();
+        FlowEntry& entry = arena[index];
+        entry = FlowEntry{key, 0, 0, timestampNs, timestampNs, 0};
+        slots[i].entry = index + 1;
+        slots[i].tag = tag;
+        ++active;
+        return entry;
+    }
+
+    size_t home(const Slot& slot) const {
+        return static_cast<size_t>(arena[slot.entry - 1].key.hash()) & mask;
+    }
+
+    void resize(size_t capacity) {
+        std::vector<Slot> old(capacity);
+        old.swap(slots);
+        mask = capacity - 1;
+        for (auto& slot : old) {
+            if (slot.entry == 0)
+                continue;
+            size_t i = home(slot);
+            while (slots[i].entry != 0) i = (i + 1) & mask;
+            slots[i] = slot;
+        }
+    }
+
+    //! Завершение потоков, бездействующих дольше idleTimeoutNs
+    void expire(int64_t nowNs) {
+        size_t i = 0;
+        while (i < slots.size()) {
+            if (slots[i].entry == 0 || nowNs - arena[slots[i].entry - 1].lastNs < idleTimeoutNs) {
+                ++i;
+                continue;
+            }
+            finish(arena[slots[i].entry - 1]);
+            arena.release(slots[i].entry - 1);
+            // Удаление со сдвигом назад: в ячейку i может переместиться следующий элемент, поэтому i не растет
+            size_t hole = i;
+            for (size_t j = (hole + 1) & mask; slots[j].entry != 0; j = (j + 1) & mask) {
+                size_t h = home(slots[j]);
+                if (((j - h) & mask) >= ((j - hole) & mask)) {
+                    slots[hole] = slots[j];
+                    hole = j;
+                }
+            }
+            slots[hole] = Slot();
+            --active;
+        }
+    }
+
+    //! Завершение потока текущего отрезка: поток из первых idleTimeout отрезка остается записью границы
+    void finish(const FlowEntry& entry) {
+        if (entry.firstNs - run.firstNs < idleTimeoutNs)
+            boundary.push_back(entry);
+        else
+            fold(entry);
+    }
+
+    //! Учет завершенного потока в сводках
+    void fold(const FlowEntry& entry) {
+        ++finishedFlows;
+        ++durations[durationBucket(entry.duration())];
+        pushTop(topFinished, entry);
+    }
+
+    //! Закрытие текущего отрезка: активные потоки становятся записями границ (или завершаются)
+    void closeRun() {
+        if (!running)
+            return;
+        for (auto& slot : slots) {
+            if (slot.entry == 0)
+                continue;
+            const FlowEntry& entry = arena[slot.entry - 1];
+            if (run.lastNs - entry.lastNs >= idleTimeoutNs)
+                finish(entry);
+            else
+                boundary.push_back(entry);
+            slot = Slot();
+        }
+        arena.clear();
+        active = 0;
+        spans.push_back(run);
+        running = false;
+    }
+
+    //! Порядок ключей потоков
+    static bool keyLess(const FlowKey& a, const FlowKey& b) {
+        return std::tie(a.srcIPv4, a.dstIPv4, a.srcPort, a.dstPort, a.protocol) <
+               std::tie(b.srcIPv4, b.dstIPv4, b.srcPort, b.dstPort, b.protocol);
+    }
+
+    //! Порядок top-N: больше байт, при равенстве - раньше начало, затем меньше ключ (не зависит от порядка учета)
+    static bool heavier(const FlowEntry& a, const FlowEntry& b) {
+        if (a.bytes != b.bytes)
+            return a.bytes > b.bytes;
+        if (a.firstNs != b.firstNs)
+            return a.firstNs < b.firstNs;
+        return keyLess(a.key, b.key);
+    }
+
+    //! Склейка потоков одного ключа с перерывом меньше idleTimeout (flows сортируется по ключу и времени)
+    void coalesce(std::vector<FlowEntry>& flows) const {
+        std::sort(flows.begin(), flows.end(), [](const FlowEntry& a, const FlowEntry& b) {
+            return keyLess(a.key, b.key) || (a.key == b.key && a.firstNs < b.firstNs);
+        });
+        size_t last = 0;
+        for (size_t i = 1; i < flows.size(); ++i) {
+            if (flows[i].key == flows[last].key && flows[i].firstNs - flows[last].lastNs < idleTimeoutNs)
+                flows[last].merge(flows[i]);
+            else
+                flows[++last] = flows[i];
+        }
+        if (!flows.empty())
+            flows.resize(last + 1);
+    }
+
+    /**
+     * \brief Склейка записей границ после объединения
+     *
+     * Отрезки, между которыми меньше idleTimeout, склеиваются. Запись, отстоящая от краев своего отрезка не меньше
+     * чем на idleTimeout, не может продолжаться в других частях трафика и сворачивается в сводки
+     */
+    void settle() {
+        std::sort(spans.begin(), spans.end(), [](const Span& a, const Span& b) { return a.firstNs < b.firstNs; });
+        size_t last = 0;
+        for (size_t i = 1; i < spans.size(); ++i) {
+            if (spans[i].firstNs - spans[last].lastNs < idleTimeoutNs)
+                spans[last].lastNs = std::max(spans[last].lastNs, spans[i].lastNs);
+            else
+                spans[++last] = spans[i];
+        }
+        if (!spans.empty())
+            spans.resize(last + 1);
+
+        coalesce(boundary);
+        size_t kept = 0;
+        for (auto& entry : boundary) {
+            auto span = std::upper_bound(spans.begin(), spans.end(), entry.firstNs,
+                                         [](int64_t time, const Span& other) { return time < other.firstNs; });
+            bool inner = span != spans.begin() && entry.firstNs - (span - 1)->firstNs >= idleTimeoutNs &&
+                         (span - 1)->lastNs - entry.lastNs >= idleTimeoutNs;
+            if (inner)
+                fold(entry);
+            else
+                boundary[kept++] = entry;
+        }
+        boundary.resize(kept);
+    }
+
+    //! Активные потоки и записи границ, склеенные по ключу
+    std::vector<FlowEntry> pending() const {
+        std::vector<FlowEntry> flows(boundary);
+        forEachActive([&flows](const FlowEntry& entry) { flows.push_back(entry); });
+        coalesce(flows);
+        return flows;
+    }
+
+    //! Добавление потока в минимальную кучу наибольших потоков
+    void pushTop(std::vector<FlowEntry>& heap, const FlowEntry& entry) const {
+        if (heap.size() < topN) {
+            heap.push_back(entry);
+            std::push_heap(heap.begin(), heap.end(), heavier);
+        } else if (topN > 0 && heavier(entry, heap.front())) {
+            std::pop_heap(heap.begin(), heap.end(), heavier);
+            heap.back() = entry;
+            std::push_heap(heap.begin(), heap.end(), heavier);
+        }
+    }
+
+    //! Время бездействия, после которого поток завершается, нс
+    int64_t idleTimeoutNs;
+    //! Число потоков в отчете
+    size_t topN;
+    //! Индекс таблицы
+    std::vector<Slot> slots;
+    //! Маска индекса
+    size_t mask = 0;
+    //! Пул записей
+    FlowArena arena;
+    //! Число активных потоков
+    size_t active = 0;
+    //! Число завершенных потоков
+    uint64_t finishedFlows = 0;
+    //! Распределение длительностей завершенных потоков
+    std::array<uint64_t, numOfDurationBuckets> durations{};
+    //! Наибольшие завершенные потоки (минимальная куча по байтам)
+    std::vector<FlowEntry> topFinished;
+    //! Потоки на границах отрезков, которые могут продолжаться в других частях трафика
+    std::vector<FlowEntry> boundary;
+    //! Закрытые отрезки времени
+    std::vector<Span> spans;
+    //! Текущий отрезок
+    Span run{0, 0};
+    //! Признак текущего отрезка
+    bool running = false;
+    //! Время последнего просмотра таблицы, нс
+    int64_t lastSweepNs = 0;
+};
+
+#endif // FLOW_TABLE_H
@@ -0,0 +1,120 @@
+/**
+ \file
+ \brief Заголовочный файл с оценкой числа уникальных ключей
+
+ Данный файл содержит скетч HyperLogLog, который оценивает число уникальных ключей в памяти 2^precision байт
+ и объединяется между потоками и файлами взятием максимума регистров
+*/
+
+#ifndef HYPER_LOG_LOG_H
+#define HYPER_LOG_LOG_H
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include "FlatCounters.h"
+
+//! Скетч HyperLogLog
+/**
+ * \brief Оценка числа уникальных ключей (Flajolet et al., поправка линейного счета для малых значений)
+ * \author Jodode
+ * \version 0.1
+ *
+ * Старшие precision бит 64-битного хеша выбирают регистр, в регистре хранится наибольшая позиция первой единицы
+ * среди остальных бит. Стандартная относительная ошибка 1.04 / sqrt(2^precision): 1.6% при precision 12 (4 КБ),
+ * 0.8% при precision 14 (16 КБ), независимо от числа ключей. Скетчи одинаковой точности объединяются без потерь
+ */
+class HyperLogLog {
+public:
+    //! Минимальная точность
+    static constexpr unsigned minPrecision = 4;
+    //! Максимальная точность
+    static constexpr unsigned maxPrecision = 18;
+
+    //! Конструктор
+    /**
+     * @param precision Число бит индекса регистра (4-18)
+     */
+    explicit HyperLogLog(unsigned precision = 12)
+        : bits(precision < minPrecision ? minPrecision : precision > maxPrecision ? maxPrecision : precision),
+          registers(size_t(1) << bits, 0) {}
+
+    /**
+     * \brief Учет уже хешированного ключа
+     * @param hash 64-битный хеш ключа
+     */
+    void addHash(uint64_t hash) {
+        size_t index = static_cast<size_t>(hash >> (64 - bits));
+        uint64_t rest = (hash << bits) | (uint64_t(1) << (bits - 1));
+        auto rank = static_cast<uint8_t>(64 - highestBit(rest));
+        if (rank > registers[index])
+            registers[index] = rank;
+    }
+
+    /**
+     * \brief Учет ключа
+     * @param key Ключ
+     */
+    void add(uint64_t key) { addHash(mixHash(key)); }
+
+    /**
+     * \brief Объединение со скетчем той же точности
+     * @param other Скетч, собранный по другой части трафика
+     * @return false, если точность скетчей различается
+     */
+    bool merge(const HyperLogLog& other) { return mergeRegisters(other.bits, other.registers.data()); }
+
+    /**
+     * \brief Объединение с сохраненными регистрами
+     * @param otherPrecision Точность сохраненного скетча
+     * @param otherRegisters 2^otherPrecision регистров
+     * @return false, если точность скетчей различается
+     */
+    bool mergeRegisters(unsigned otherPrecision, const uint8_t* otherRegisters) {
+        if (otherPrecision != bits)
+            return false;
+        for (size_t i = 0; i < registers.size(); ++i)
+            registers[i] = std::max(registers[i], otherRegisters[i]);
+        return true;
+    }
+
+    //! Оценка числа уникальных ключей
+    double estimate() const {
+        const double m = static_cast<double>(registers.size());
+        double sum = 0;
+        size_t zeros = 0;
+        for (uint8_t value : registers) {
+            sum += std::ldexp(1.0, -static_cast<int>(value));
+            if (value == 0)
+                ++zeros;
+        }
+        double alpha = registers.size() == 16 ? 0.673 :
+                       registers.size() == 32 ? 0.697 :
+                       registers.size() == 64 ? 0.709 : 0.7213 / (1.0 + 1.079 / m);
+        double estimate = alpha * m * m / sum;
+        if (estimate <= 2.5 * m && zeros != 0)
+            estimate = m * std::log(m / static_cast<double>(zeros));
+        return estimate;
+    }
+
+    //! Стандартная относительная ошибка оценки
+    double relativeError() const { return 1.04 / std::sqrt(static_cast<double>(registers.size())); }
+
+    //! Точность скетча
+    unsigned precision() const { return bits; }
+
+    //! Регистры скетча
+    const std::vector<uint8_t>& data() const { return registers; }
+
+    //! Функция очищения
+    void clear() { std::fill(registers.begin(), registers.end(), 0); }
+
+private:
+    //! Число бит индекса регистра
+    unsigned bits;
+    //! Регистры
+    std::vector<uint8_t> registers;
+};
+
+#endif // HYPER_LOG_LOG_H
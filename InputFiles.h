@@ -0,0 +1,129 @@
+/**
+ \file
+ \brief Заголовочный файл с разбором списка входных файлов
+
+ Данный файл содержит раскрытие аргументов -f (файлы, каталоги, шаблоны имен) в список файлов трафика с размерами,
+ по которым планируется параллельная обработка
+*/
+
+#ifndef INPUT_FILES_H
+#define INPUT_FILES_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#if !defined(_WIN32)
+#include <glob.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+//! Входной файл
+struct InputFile {
+    //! Путь до файла
+    std::string path;
+    //! Размер файла в байтах
+    uint64_t size;
+    //! Время последнего изменения файла, с
+    int64_t mtime;
+
+    //! Признак того же файла (путь, размер и время изменения совпадают)
+    bool sameAs(const InputFile& other) const {
+        return path == other.path && size == other.size && mtime == other.mtime;
+    }
+};
+
+/**
+ * \brief Проверка расширения файла трафика
+ * @param name Имя файла
+ */
+inline bool isCaptureName(const std::string& name) {
+    static const char* extensions[] = {".pcap", ".pcapng", ".cap", ".pcap.gz", ".pcap.zst", ".pcapng.gz",
+                                       ".pcapng.zst"};
+    for (const char* extension : extensions) {
+        std::string suffix(extension);
+        if (name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * \brief Файл по пути без раскрытия шаблонов
+ * @param path Путь до файла (символы *?[ - часть имени)
+ * @return Файл с размером и временем изменения, нулевыми для несуществующего пути
+ */
+inline InputFile inputFileOf(const std::string& path) {
+#if !defined(_WIN32)
+    struct stat st{};
+    if (stat(path.c_str(), &st) == 0)
+        return InputFile{path, static_cast<uint64_t>(st.st_size), static_cast<int64_t>(st.st_mtime)};
+#endif
+    return InputFile{path, 0, 0};
+}
+
+/**
+ * \brief Раскрытие аргументов в список файлов
+ * \author Jodode
+ * \version 0.1
+ * @param specs Пути до файлов, каталогов или шаблоны имен (*.pcap)
+ * @param accept Отбор файлов каталога по имени
+ * @return Файлы с размерами, без повторов, в порядке аргументов
+ *
+ * Каталог раскрывается в файлы первого уровня, прошедшие отбор (по умолчанию файлы трафика: .pcap, .pcapng, .cap
+ * и их сжатые варианты), шаблон - через
+ * glob(3). Несуществующий путь остается в списке с нулевым размером, чтобы ошибка открытия была выведена при обработке
+ */
+inline std::vector<InputFile> expandInputs(const std::vector<std::string>& specs,
+                                           bool (*accept)(const std::string&) = isCaptureName) {
+    std::vector<InputFile> files;
+    auto addFile = [&files](const std::string& path, uint64_t size, int64_t mtime) {
+        for (auto& file : files)
+            if (file.path == path)
+                return;
+        files.push_back(InputFile{path, size, mtime});
+    };
+
+    for (auto& spec : specs) {
+#if defined(_WIN32)
+        addFile(spec, 0, 0);
+#else
+        struct stat st{};
+        if (stat(spec.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            std::vector<std::string> names;
+            if (DIR* dir = opendir(spec.c_str())) {
+                while (dirent* entry = readdir(dir))
+                    if (accept(entry->d_name))
+                        names.emplace_back(entry->d_name);
+                closedir(dir);
+            }
+            std::sort(names.begin(), names.end());
+            for (auto& name : names) {
+                std::string path = spec + (spec.back() == '/' ? "" : "/") + name;
+                struct stat fileStat{};
+                if (stat(path.c_str(), &fileStat) == 0 && S_ISREG(fileStat.st_mode))
+                    addFile(path, static_cast<uint64_t>(fileStat.st_size), static_cast<int64_t>(fileStat.st_mtime));
+            }
+        } else if (spec.find_first_of("*?[") != std::string::npos) {
+            glob_t matches{};
+            if (glob(spec.c_str(), 0, nullptr, &matches) == 0) {
+                for (size_t i = 0; i < matches.gl_pathc; ++i) {
+                    struct stat fileStat{};
+                    if (stat(matches.gl_pathv[i], &fileStat) == 0 && S_ISREG(fileStat.st_mode))
+                        addFile(matches.gl_pathv[i], static_cast<uint64_t>(fileStat.st_size),
+                                static_cast<int64_t>(fileStat.st_mtime));
+                }
+            }
+            globfree(&matches);
+        } else {
+            InputFile file = inputFileOf(spec);
+            addFile(file.path, file.size, file.mtime);
+        }
+#endif
+    }
+    return files;
+}
+
+#endif // INPUT_FILES_H
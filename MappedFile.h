@@ -0,0 +1,148 @@
+/**
+ \file
+ \brief Заголовочный файл с отображением файла в память
+
+ Данный файл содержит обертку над mmap, которой пользуются читатель трафика и загрузка снимков статистики.
+ На платформах без mmap файл читается в память целиком
+*/
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+//! Файл, отображенный в память
+/**
+ * \brief Файл, доступный только для чтения как непрерывный массив байт
+ * \author Jodode
+ * \version 0.1
+ *
+ * Данные действительны до закрытия файла или разрушения объекта
+ */
+class MappedFile {
+public:
+    //! Режим доступа, сообщаемый ядру
+    enum Access {
+        //! Произвольный доступ
+        RandomAccess,
+        //! Последовательное чтение от начала к концу
+        SequentialAccess
+    };
+
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+     * \brief Открытие и отображение файла
+     * @param path Путь до файла
+     * @param access Ожидаемый режим доступа
+     * @return false, если файл не удалось открыть или он пуст
+     */
+    bool open(const std::string& path, Access access = RandomAccess) {
+        close();
+#if defined(_WIN32)
+        std::ifstream file(path, std::ios::binary);
+        if (!file.good())
+            return false;
+        buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        bytes = reinterpret_cast<const uint8_t*>(buffer.data());
+        length = buffer.size();
+        (void)access;
+        return length > 0;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            ::close(fd);
+            return false;
+        }
+        length = static_cast<size_t>(st.st_size);
+        void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            length = 0;
+            return false;
+        }
+        bytes = static_cast<const uint8_t*>(mapping);
+        madvise(mapping, length, access == SequentialAccess ? MADV_SEQUENTIAL : MADV_WILLNEED);
+        return true;
+#endif
+    }
+
+    //! Закрытие файла
+    void close() {
+#if defined(_WIN32)
+        buffer.clear();
+#else
+        if (bytes != nullptr)
+            munmap(const_cast<uint8_t*>(bytes), length);
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+
+    /**
+     * \brief Запрос у ядра участка файла заранее
+     * @param offset Начало участка (кратно размеру страницы)
+     * @param size Размер участка
+     */
+    void willNeed(size_t offset, size_t size) const { advise(offset, size, true); }
+
+    /**
+     * \brief Освобождение прочитанного участка файла
+     * @param offset Начало участка (кратно размеру страницы)
+     * @param size Размер участка
+     */
+    void dontNeed(size_t offset, size_t size) const { advise(offset, size, false); }
+
+    //! Данные файла
+    const uint8_t* data() const { return bytes; }
+
+    //! Размер файла
+    size_t size() const { return length; }
+
+    //! Признак открытого файла
+    bool isOpen() const { return bytes != nullptr; }
+
+private:
+    void advise(size_t offset, size_t size, bool need) const {
+#if !defined(_WIN32)
+        if (offset >= length)
+            return;
+        if (size > length - offset)
+            size = length - offset;
+        madvise(const_cast<uint8_t*>(bytes) + offset, size, need ? MADV_WILLNEED : MADV_DONTNEED);
+#else
+        (void)offset;
+        (void)size;
+        (void)need;
+#endif
+    }
+
+    //! Начало данных
+    const uint8_t* bytes = nullptr;
+    //! Размер данных
+    size_t length = 0;
+#if defined(_WIN32)
+    //! Содержимое файла, если отображение недоступно
+    std::vector<char> buffer;
+#endif
+};
+
+#endif // MAPPED_FILE_H
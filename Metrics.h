@@ -0,0 +1,334 @@
+/**
+ \file
+ \brief Заголовочный файл с выдачей счетчиков в формате Prometheus
+
+ Данный файл содержит запись накопленной статистики в текстовом формате Prometheus (text/plain; version=0.0.4) и
+ небольшой HTTP сервер, который отдает ее на локальном адресе (host:port) или Unix сокете (unix:PATH)
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <fmt/format.h>
+#include "StatsCollector.h"
+
+#if !defined(_WIN32)
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+//! Число наиболее частых портов назначения в счетчиках
+const size_t metricsTopPorts = 20;
+
+//! Счетчики режима наблюдения за каталогом
+struct WatchMetrics {
+    //! Число учтенных файлов
+    uint64_t filesCollected = 0;
+    //! Число файлов, которые не удалось прочитать
+    uint64_t filesFailed = 0;
+    //! Задержка от закрытия последнего файла до учета его статистики, с
+    double lastLatency = 0.0;
+    //! Сумма задержек по всем учтенным файлам, с
+    double latencySum = 0.0;
+    //! Время учета последнего файла, с от начала эпохи
+    double lastCollectedAt = 0.0;
+};
+
+/**
+ * \brief Метод для записи счетчиков в формате Prometheus
+ * \author Jodode
+ * \version 0.1
+ * @param stats Хранилище статистики
+ * @param watch Счетчики наблюдения за каталогом
+ * @param output Поток для записи результатов
+ *
+ * Счетчики пакетов не масштабируются выборкой, доля выборки выводится отдельно. Размеры "полезной нагрузки"
+ * выводятся как summary с квантилями DDSketch, порты назначения - только metricsTopPorts наиболее частых, чтобы
+ * число рядов не росло с трафиком
+ */
+inline void writePrometheus(const StatsCollector& stats, const WatchMetrics& watch, std::ostream& output) {
+    auto header = [&output](const char* name, const char* type, const char* help) {
+        output << fmt::format("# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+    };
+
+    header("sft_packets_total", "counter", "Packets read from capture files.");
+    output << fmt::format("sft_packets_total {}\n", stats.totalPackets);
+    header("sft_dropped_packets_total", "counter", "Packets without a UDP or TCP layer.");
+    output << fmt::format("sft_dropped_packets_total {}\n", stats.droppedPackets);
+    header("sft_filtered_packets_total", "counter", "Packets rejected by --filter.");
+    output << fmt::format("sft_filtered_packets_total {}\n", stats.filteredPackets);
+    header("sft_sample_fraction", "gauge", "Fraction of packets counted by sampling, 1 without sampling.");
+    output << fmt::format("sft_sample_fraction {}\n", stats.sampleFraction());
+
+    header("sft_payload_bytes", "summary", "Transport payload length.");
+    const std::pair<const char*, const GeneralStats*> protocols[] = {{"udp", &stats.udpStats},
+                                                                      {"tcp", &stats.tcpStats}};
+    for (auto& protocol : protocols) {
+        const DDSketch& quantiles = protocol.second->payloadQuantiles;
+        if (quantiles.count() > 0)
+            for (double level : {0.5, 0.9, 0.99, 0.999})
+                output << fmt::format("sft_payload_bytes{{protocol=\"{}\",quantile=\"{}\"}} {:.0f}\n",
+                                      protocol.first, level, quantiles.quantile(level));
+        output << fmt::format("sft_payload_bytes_sum{{protocol=\"{}\"}} {}\n", protocol.first,
+                              protocol.second->amountOfPackets);
+        output << fmt::format("sft_payload_bytes_count{{protocol=\"{}\"}} {}\n", protocol.first,
+                              protocol.second->numOfPackets);
+    }
+
+    std::vector<std::pair<uint32_t, uint64_t>> ports;
+    stats.dstPorts.forEach([&ports](uint32_t port, uint64_t count) { ports.emplace_back(port, count); });
+    size_t numOfPorts = std::min(ports.size(), metricsTopPorts);
+    std::partial_sort(ports.begin(), ports.begin() + static_cast<std::ptrdiff_t>(numOfPorts), ports.end(),
+                      [](const std::pair<uint32_t, uint64_t>& a, const std::pair<uint32_t, uint64_t>& b) {
+                          return a.second > b.second || (a.second == b.second && a.first < b.first);
+                      });
+    header("sft_dst_port_packets_total", "counter", "Packets to the most frequent destination ports.");
+    for (size_t i = 0; i < numOfPorts; ++i)
+        output << fmt::format("sft_dst_port_packets_total{{port=\"{}\"}} {}\n", ports[i].first, ports[i].second);
+
+    if (stats.trackCardinality) {
+        header("sft_distinct", "gauge", "Estimated number of distinct keys (HyperLogLog, --cardinality).");
+        const std::pair<const char*, const HyperLogLog*> sketches[] = {
+                {"src_ipv4", &stats.uniqueSrcIPv4},
+                {"dst_ipv4", &stats.uniqueDstIPv4},
+                {"dst_endpoint", &stats.uniqueDstEndpoints},
+                {"flow", &stats.uniqueFlows}};
+        for (auto& sketch : sketches)
+            output << fmt::format("sft_distinct{{key=\"{}\"}} {:.0f}\n", sketch.first, sketch.second->estimate());
+    }
+
+    if (stats.apps.enabled()) {
+        header("sft_app_packets_total", "counter", "UDP and TCP packets by application protocol (--apps).");
+        for (int protocol = 0; protocol < numOfAppProtocols; ++protocol)
+            output << fmt::format("sft_app_packets_total{{app=\"{}\"}} {}\n", appProtocolName(protocol),
+                                  stats.apps.packets[protocol]);
+        header("sft_app_payload_bytes_total", "counter", "Transport payload bytes by application protocol.");
+        for (int protocol = 0; protocol < numOfAppProtocols; ++protocol)
+            output << fmt::format("sft_app_payload_bytes_total{{app=\"{}\"}} {}\n", appProtocolName(protocol),
+                                  stats.apps.bytes[protocol]);
+    }
+    header("sft_watch_files_total", "counter", "Capture files picked up from the watched directory.");
+    output << fmt::format("sft_watch_files_total{{result=\"collected\"}} {}\n", watch.filesCollected);
+    output << fmt::format("sft_watch_files_total{{result=\"failed\"}} {}\n", watch.filesFailed);
+    header("sft_watch_file_latency_seconds", "summary", "Time from closing a capture file to its counters.");
+    output << fmt::format("sft_watch_file_latency_seconds_sum {:.6f}\n", watch.latencySum);
+    output << fmt::format("sft_watch_file_latency_seconds_count {}\n", watch.filesCollected);
+    header("sft_watch_last_file_latency_seconds", "gauge", "Latency of the last collected file.");
+    output << fmt::format("sft_watch_last_file_latency_seconds {:.6f}\n", watch.lastLatency);
+    header("sft_watch_last_file_timestamp_seconds", "gauge", "Unix time when the last file was collected.");
+    output << fmt::format("sft_watch_last_file_timestamp_seconds {:.3f}\n", watch.lastCollectedAt);
+}
+
+#if !defined(_WIN32)
+
+//! Сервер счетчиков
+/**
+ * \brief HTTP/1.0 сервер, отдающий счетчики в формате Prometheus
+ * \author Jodode
+ * \version 0.1
+ *
+ * Запросы обслуживаются по одному в отдельном потоке: ответ формируется функцией render (она сама берет нужные
+ * блокировки), поэтому медленный клиент не задерживает сбор статистики. GET /metrics и GET / отдают счетчики,
+ * остальные пути - 404. Unix сокет удобен, когда открывать порт нельзя: curl --unix-socket PATH http://sft/metrics
+ */
+class MetricsServer {
+public:
+    //! Наибольший размер запроса
+    static constexpr size_t maxRequestSize = 8192;
+    //! Время ожидания запроса от клиента, мс
+    static constexpr int requestTimeoutMs = 2000;
+
+    //! Конструктор
+    /**
+     * @param render Функция, возвращающая тело ответа
+     */
+    explicit MetricsServer(std::function<std::string()> render) : render(std::move(render)) {}
+
+    //! Деструктор
+    ~MetricsServer() { stop(); }
+
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    /**
+     * \brief Открытие сокета и запуск потока обслуживания
+     * @param address host:port (":port" - 127.0.0.1) или unix:PATH
+     * @param error Описание ошибки
+     * @return false, если сокет не удалось открыть
+     */
+    bool start(const std::string& address, std::string& error) {
+        if (address.compare(0, 5, "unix:") == 0) {
+            if (!listenUnix(address.substr(5), error))
+                return false;
+        } else if (!listenTcp(address, error)) {
+            return false;
+        }
+        worker = std::thread(&MetricsServer::run, this);
+        return true;
+    }
+
+    //! Остановка потока обслуживания и закрытие сокета
+    void stop() {
+        stopping = true;
+        if (worker.joinable())
+            worker.join();
+        if (listenFd >= 0)
+            ::close(listenFd);
+        listenFd = -1;
+        if (!unixPath.empty())
+            ::unlink(unixPath.c_str());
+        unixPath.clear();
+    }
+
+private:
+    //! Открытие TCP сокета
+    bool listenTcp(const std::string& address, std::string& error) {
+        size_t colon = address.rfind(':');
+        if (colon == std::string::npos) {
+            error = "Wrong metrics address " + address + ", expected host:port or unix:PATH";
+            return false;
+        }
+        std::string host = address.substr(0, colon);
+        std::string port = address.substr(colon + 1);
+        if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+            host = host.substr(1, host.size() - 2);
+        if (host.empty())
+            host = "127.0.0.1";
+
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+        addrinfo* addresses = nullptr;
+        int result = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses);
+        if (result != 0) {
+            error = "Cannot resolve metrics address " + address + ": " + gai_strerror(result);
+            return false;
+        }
+        for (addrinfo* candidate = addresses; candidate != nullptr && listenFd < 0; candidate = candidate->ai_next) {
+            int fd = ::socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+            if (fd < 0)
+                continue;
+            int reuse = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            if (::bind(fd, candidate->ai_addr, candidate->ai_addrlen) == 0 && ::listen(fd, 16) == 0)
+                listenFd = fd;
+            else
+                ::close(fd);
+        }
+        freeaddrinfo(addresses);
+        if (listenFd < 0) {
+            error = "Cannot listen on " + address + ": " + std::strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    //! Открытие Unix сокета (оставшийся от прошлого запуска сокет удаляется)
+    bool listenUnix(const std::string& path, std::string& error) {
+        sockaddr_un local{};
+        if (path.empty() || path.size() >= sizeof(local.sun_path)) {
+            error = "Wrong metrics socket path " + path;
+            return false;
+        }
+        struct stat st{};
+        if (::lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+            ::unlink(path.c_str());
+        local.sun_family = AF_UNIX;
+        std::memcpy(local.sun_path, path.c_str(), path.size());
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0 || ::listen(fd, 16) != 0) {
+            error = "Cannot listen on " + path + ": " + std::strerror(errno);
+            if (fd >= 0)
+                ::close(fd);
+            return false;
+        }
+        listenFd = fd;
+        unixPath = path;
+        return true;
+    }
+
+    //! Поток обслуживания: ожидание соединений с проверкой остановки
+    void run() {
+        while (!stopping) {
+            pollfd listening{listenFd, POLLIN, 0};
+            if (::poll(&listening, 1, 200) <= 0)
+                continue;
+            int client = ::accept(listenFd, nullptr, nullptr);
+            if (client < 0)
+                continue;
+            serve(client);
+            ::close(client);
+        }
+    }
+
+    //! Чтение запроса и отправка ответа
+    void serve(int client) {
+        std::string request;
+        char buffer[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.find("\n\n") == std::string::npos &&
+               request.size() < maxRequestSize) {
+            pollfd readable{client, POLLIN, 0};
+            if (::poll(&readable, 1, requestTimeoutMs) <= 0)
+                return;
+            ssize_t received = ::recv(client, buffer, sizeof(buffer), 0);
+            if (received <= 0)
+                break;
+            request.append(buffer, static_cast<size_t>(received));
+        }
+
+        std::string target = request.substr(0, request.find_first_of("\r\n"));
+        std::string response;
+        if (target.compare(0, 4, "GET ") != 0) {
+            response = "HTTP/1.0 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\n\r\n";
+        } else {
+            std::string path = target.substr(4, target.find(' ', 4) - 4);
+            path = path.substr(0, path.find('?'));
+            if (path == "/metrics" || path == "/") {
+                std::string body = render();
+                response = fmt::format("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                                       "Content-Length: {}\r\n\r\n", body.size()) + body;
+            } else {
+                response = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+            }
+        }
+        for (size_t sent = 0; sent < response.size();) {
+#if defined(MSG_NOSIGNAL)
+            ssize_t written = ::send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+#else
+            ssize_t written = ::send(client, response.data() + sent, response.size() - sent, 0);
+#endif
+            if (written <= 0)
+                return;
+            sent += static_cast<size_t>(written);
+        }
+    }
+
+    //! Функция, возвращающая тело ответа
+    std::function<std::string()> render;
+    //! Слушающий сокет
+    int listenFd = -1;
+    //! Путь до Unix сокета (пустой для TCP)
+    std::string unixPath;
+    //! Поток обслуживания
+    std::thread worker;
+    //! Признак остановки
+    std::atomic<bool> stopping{false};
+};
+
+#endif
+
+#endif // METRICS_H
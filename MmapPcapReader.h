@@ -0,0 +1,202 @@
+/**
+ \file
+ \brief Заголовочный файл с читателем pcap/pcapng через отображение в память
+
+ Данный файл содержит читателя, который отображает файл трафика в память и выдает пакеты, указывающие прямо
+ в отображение, без системных вызовов и копирования на каждый пакет
+*/
+
+#ifndef MMAP_PCAP_READER_H
+#define MMAP_PCAP_READER_H
+
+#include <string>
+#include "PcapFormat.h"
+#include "PacketDecoder.h"
+#include "MappedFile.h"
+
+//! Читатель через отображение в память
+/**
+ * \brief Читатель pcap/pcapng без копирования пакетов
+ * \author Jodode
+ * \version 0.1
+ *
+ * Файл отображается в память целиком, заголовки записей разбираются на месте, а пакеты выдаются как
+ * BorrowedRawPacket, указывающие в отображение. Данные пакетов действительны, пока читатель открыт.
+ * Ядру сообщается о последовательном доступе, следующее окно файла запрашивается заранее, а прочитанное
+ * освобождается. Если пакеты используются долго после чтения (пачки потоков-обработчиков), освобождение ведет
+ * вызывающий через setManualRelease и release. На платформах без mmap файл читается в память целиком.
+ *
+ * Чтение можно ограничить диапазоном байт (seek) и интервалом времени (setTimeRange): так несколько читателей
+ * одного файла обрабатывают его части по индексу (PcapIndex.h)
+ */
+class MmapPcapReader {
+public:
+    //! Тип пакета, который заполняет читатель
+    typedef BorrowedRawPacket PacketType;
+
+    //! Размер окна упреждающего чтения
+    static constexpr size_t readaheadWindow = 64 * 1024 * 1024;
+
+    //! Конструктор
+    /**
+     * @param path Путь до файла трафика
+     */
+    explicit MmapPcapReader(const std::string& path) : path(path) {}
+
+    //! Деструктор
+    ~MmapPcapReader() { close(); }
+
+    MmapPcapReader(const MmapPcapReader&) = delete;
+    MmapPcapReader& operator=(const MmapPcapReader&) = delete;
+
+    /**
+     * \brief Открытие и отображение файла
+     * @return false, если файл не удалось отобразить или он не является pcap/pcapng
+     */
+    bool open() {
+        if (!file.open(path, MappedFile::SequentialAccess))
+            return false;
+        data = file.data();
+        size = file.size();
+        limit = size;
+        releasedUpTo = 0;
+        prefetch(0);
+
+        PcapRecord record;
+        size_t consumed = 0;
+        if (parser.next(data, size, consumed, record) != PcapRecordParser::Skip) {
+            close();
+            return false;
+        }
+        offset = consumed;
+        return true;
+    }
+
+    //! Закрытие файла, пакеты, выданные читателем, становятся недействительными
+    void close() {
+        file.close();
+        data = nullptr;
+        size = 0;
+        limit = 0;
+        offset = 0;
+        packetOffset = 0;
+    }
+
+    /**
+     * \brief Ограничение чтения диапазоном байт
+     * @param headerEnd Конец заголовков файла (смещение первого пакета), заголовки разбираются перед переходом
+     * @param begin Смещение первого блока диапазона (начало блока pcap/pcapng)
+     * @param end Конец диапазона, блок, начинающийся до end, читается целиком
+     * @return false, если до headerEnd встретился пакет или файл поврежден
+     */
+    bool seek(size_t headerEnd, size_t begin, size_t end) {
+        PcapRecord record;
+        while (offset < headerEnd && offset < size) {
+            size_t consumed = 0;
+            if (parser.next(data + offset, size - offset, consumed, record) != PcapRecordParser::Skip)
+                return false;
+            offset += consumed;
+        }
+        if (offset != headerEnd || begin < headerEnd || begin > size)
+            return false;
+        offset = begin;
+        limit = end < size ? end : size;
+        releasedUpTo = begin / readaheadWindow * readaheadWindow;
+        prefetch(begin);
+        return true;
+    }
+
+    /**
+     * \brief Ограничение чтения интервалом времени, пакеты вне интервала пропускаются без учета
+     * @param range Интервал времени захвата
+     */
+    void setTimeRange(const TimeRange& range) { timeRange = range; }
+
+    //! Смещение следующего непрочитанного блока
+    size_t position() const { return offset; }
+
+    //! Смещение блока последнего выданного пакета
+    size_t packetPosition() const { return packetOffset; }
+
+    /**
+     * \brief Освобождение прочитанных окон только вызовами release
+     * @param manual true - выданные пакеты используются и после следующих вызовов getNextPacket
+     */
+    void setManualRelease(bool manual) { manualRelease = manual; }
+
+    /**
+     * \brief Освобождение окон файла, целиком лежащих до upTo и до позиции чтения
+     * @param upTo Смещение, до которого выданные пакеты больше не используются
+     */
+    void release(size_t upTo) {
+        if (upTo > offset)
+            upTo = offset;
+        for (; releasedUpTo + readaheadWindow <= upTo; releasedUpTo += readaheadWindow)
+            file.dontNeed(releasedUpTo, readaheadWindow);
+    }
+
+    //! Число разобранных заголовков и описаний интерфейсов
+    uint32_t numOfDefinitions() const { return parser.numOfDefinitions(); }
+
+    /**
+     * \brief Получение следующего пакета
+     * @param rawPacket Пакет, который будет указывать в отображение файла
+     * @return false, если пакеты закончились или файл поврежден
+     */
+    bool getNextPacket(BorrowedRawPacket& rawPacket) {
+        PcapRecord record;
+        while (offset < limit) {
+            size_t consumed = 0;
+            PcapRecordParser::Status status = parser.next(data + offset, size - offset, consumed, record);
+            if (status == PcapRecordParser::NeedMore || status == PcapRecordParser::Error)
+                return false;
+            packetOffset = offset;
+            offset += consumed;
+            if (offset >= nextWindow)
+                prefetch(nextWindow);
+            if (status == PcapRecordParser::Packet &&
+                (!timeRange.bounded() || timeRange.contains(toNanoseconds(record.timestamp)))) {
+                rawPacket.setRawData(record.data, static_cast<int>(record.capLen), record.timestamp,
+                                     record.linkType, static_cast<int>(record.frameLen));
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    //! Запрос следующего окна у ядра и освобождение окон перед текущим
+    void prefetch(size_t from) {
+        file.willNeed(from, readaheadWindow);
+        if (!manualRelease && from >= readaheadWindow)
+            release(from - readaheadWindow);
+        nextWindow = from + readaheadWindow;
+    }
+
+    //! Путь до файла
+    std::string path;
+    //! Отображение файла
+    MappedFile file;
+    //! Начало отображения
+    const uint8_t* data = nullptr;
+    //! Размер файла
+    size_t size = 0;
+    //! Конец читаемого диапазона
+    size_t limit = 0;
+    //! Смещение первого непрочитанного блока
+    size_t offset = 0;
+    //! Смещение блока последнего выданного пакета
+    size_t packetOffset = 0;
+    //! Интервал времени читаемых пакетов
+    TimeRange timeRange;
+    //! Смещение, после которого запрашивается следующее окно
+    size_t nextWindow = 0;
+    //! Окна до этого смещения освобождены (кратно readaheadWindow)
+    size_t releasedUpTo = 0;
+    //! Окна освобождаются только вызовами release
+    bool manualRelease = false;
+    //! Разбор записей
+    PcapRecordParser parser;
+};
+
+#endif // MMAP_PCAP_READER_H
@@ -0,0 +1,260 @@
+/**
+ \file
+ \brief Заголовочный файл с быстрым разбором заголовков L2-L4
+
+ Данный файл содержит разбор Ethernet, VLAN/QinQ, IPv4 и TCP/UDP прямо по "сырым" байтам пакета, без создания
+ объектов слоев PcapPlusPlus. Пакеты, которые быстрый разбор не поддерживает, разбираются PcapPlusPlus
+*/
+
+#ifndef PACKET_DECODER_H
+#define PACKET_DECODER_H
+
+#include <cstdint>
+#include <cstring>
+#include "Packet.h"
+#include "IPv4Layer.h"
+#include "TcpLayer.h"
+#include "UdpLayer.h"
+
+//! Номер протокола TCP в заголовке IPv4
+const uint8_t ipProtocolTcp = 6;
+//! Номер протокола UDP в заголовке IPv4
+const uint8_t ipProtocolUdp = 17;
+
+//! Заголовки пакета
+/**
+ * \brief Поля заголовков, необходимые для сбора статистики
+ * \author Jodode
+ * \version 0.1
+ *
+ * Заполняется быстрым разбором или, для неподдерживаемых пакетов, по слоям PcapPlusPlus
+ */
+struct PacketHeaders {
+    //! Тип протокола сетевого уровня из заголовка Ethernet (0, если неизвестен)
+    uint16_t etherType = 0;
+    //! Признак наличия IPv4 заголовка
+    bool hasIPv4 = false;
+    //! IPv4 адрес источника в сетевом порядке байт (как pcpp::IPv4Address::toInt())
+    uint32_t srcIPv4 = 0;
+    //! IPv4 адрес назначения в сетевом порядке байт (как pcpp::IPv4Address::toInt())
+    uint32_t dstIPv4 = 0;
+    //! Протокол транспортного уровня (ipProtocolTcp, ipProtocolUdp или 0 для прочих пакетов)
+    uint8_t l4Protocol = 0;
+    //! Порт источника
+    uint16_t srcPort = 0;
+    //! Порт назначения
+    uint16_t dstPort = 0;
+    //! Флаги TCP (байт 13 заголовка: CWR ECE URG ACK PSH RST SYN FIN)
+    uint8_t tcpFlags = 0;
+    //! Размер "полезной нагрузки" транспортного уровня
+    size_t payloadLen = 0;
+    //! Начало "полезной нагрузки" транспортного уровня (действительно, пока доступны данные пакета)
+    const uint8_t* payload = nullptr;
+    //! Протокол прикладного уровня (AppProtocol, заполняется при определении протоколов)
+    uint8_t appProtocol = 0;
+    //! Длина пакета в сети
+    size_t frameLen = 0;
+    //! Время захвата пакета в наносекундах от начала эпохи
+    int64_t timestampNs = 0;
+};
+
+/**
+ * \brief Порт назначения пакета
+ * @param headers Заголовки пакета
+ * @return Порт назначения UDP или TCP, 0 - пакет другого протокола
+ */
+inline uint16_t transportDstPort(const PacketHeaders& headers) {
+    return headers.l4Protocol == ipProtocolTcp || headers.l4Protocol == ipProtocolUdp ? headers.dstPort : 0;
+}
+
+/**
+ * \brief Перевод времени захвата в наносекунды
+ * @param timestamp Время захвата пакета
+ */
+inline int64_t toNanoseconds(const timespec& timestamp) {
+    return static_cast<int64_t>(timestamp.tv_sec) * 1000000000LL + static_cast<int64_t>(timestamp.tv_nsec);
+}
+
+//! Результат быстрого разбора
+enum DecodeStatus {
+    //! Заголовки разобраны
+    DecodeOk,
+    //! Пакет нужно разобрать с помощью PcapPlusPlus
+    DecodeUnsupported
+};
+
+/**
+ * \brief Чтение 16-битного числа в сетевом порядке байт
+ * @param data Указатель на число
+ */
+inline uint16_t readNet16(const uint8_t* data) {
+    return static_cast<uint16_t>((data[0] << 8) | data[1]);
+}
+
+/**
+ * \brief Быстрый разбор заголовков IPv4 и транспортного уровня
+ * \author Jodode
+ * \version 0.1
+ * @param data Начало IPv4 заголовка
+ * @param len Число байт от начала заголовка до конца пакета
+ * @param headers Результат разбора
+ * @return DecodeUnsupported для поврежденных заголовков и туннелей, которые PcapPlusPlus разбирает глубже
+ *
+ * Размер "полезной нагрузки" вычисляется так же, как в PcapPlusPlus: по полю total length, если оно меньше
+ * размера пакета (остаток - выравнивание Ethernet). Фрагменты не разбираются дальше IPv4
+ */
+inline DecodeStatus decodeIPv4(const uint8_t* data, size_t len, PacketHeaders& headers) {
+    if (len < 20 || (data[0] >> 4) != 4)
+        return DecodeUnsupported;
+    size_t ipHeaderLen = static_cast<size_t>(data[0] & 0x0f) * 4;
+    if (ipHeaderLen < 20 || ipHeaderLen > len)
+        return DecodeUnsupported;
+    size_t totalLen = readNet16(data + 2);
+    if (totalLen != 0 && totalLen < len)
+        len = totalLen;
+    if (ipHeaderLen > len)
+        return DecodeUnsupported;
+
+    headers.hasIPv4 = true;
+    std::memcpy(&headers.srcIPv4, data + 12, sizeof(headers.srcIPv4));
+    std::memcpy(&headers.dstIPv4, data + 16, sizeof(headers.dstIPv4));
+
+    uint16_t fragment = readNet16(data + 6);
+    if ((fragment & 0x3fff) != 0)
+        return DecodeOk;
+
+    const uint8_t* l4 = data + ipHeaderLen;
+    size_t l4Len = len - ipHeaderLen;
+    switch (data[9]) {
+        case ipProtocolTcp: {
+            if (l4Len < 20)
+                return DecodeUnsupported;
+            size_t tcpHeaderLen = static_cast<size_t>(l4[12] >> 4) * 4;
+            if (tcpHeaderLen < 20 || tcpHeaderLen > l4Len)
+                return DecodeUnsupported;
+            headers.l4Protocol = ipProtocolTcp;
+            headers.srcPort = readNet16(l4);
+            headers.dstPort = readNet16(l4 + 2);
+            headers.tcpFlags = l4[13];
+            headers.payloadLen = l4Len - tcpHeaderLen;
+            headers.payload = l4 + tcpHeaderLen;
+            return DecodeOk;
+        }
+        case ipProtocolUdp: {
+            if (l4Len < 8)
+                return DecodeUnsupported;
+            uint16_t srcPort = readNet16(l4);
+            uint16_t dstPort = readNet16(l4 + 2);
+            // VXLAN и GTP-U: PcapPlusPlus разбирает вложенный пакет
+            if (srcPort == 4789 || dstPort == 4789 || srcPort == 2152 || dstPort == 2152)
+                return DecodeUnsupported;
+            headers.l4Protocol = ipProtocolUdp;
+            headers.srcPort = srcPort;
+            headers.dstPort = dstPort;
+            headers.payloadLen = l4Len - 8;
+            headers.payload = l4 + 8;
+            return DecodeOk;
+        }
+        case 4:   // IP-in-IP
+        case 41:  // IPv6-in-IPv4
+        case 47:  // GRE
+            return DecodeUnsupported;
+        default:
+            return DecodeOk;
+    }
+}
+
+/**
+ * \brief Быстрый разбор заголовков пакета
+ * \author Jodode
+ * \version 0.1
+ * @param data "Сырые" данные пакета
+ * @param len Размер данных
+ * @param linkType Тип канального уровня
+ * @param headers Результат разбора
+ * @return DecodeUnsupported, если пакет нужно разобрать с помощью PcapPlusPlus
+ *
+ * Поддерживает Ethernet II с любым числом меток VLAN (802.1Q, 802.1ad), "сырой" IPv4 и ARP. Все остальное
+ * (IPv6, MPLS, PPPoE, 802.3, туннели, обрезанные заголовки) отдается PcapPlusPlus
+ */
+inline DecodeStatus decodeHeaders(const uint8_t* data, size_t len, pcpp::LinkLayerType linkType,
+                                  PacketHeaders& headers) {
+    headers = PacketHeaders();
+    switch (linkType) {
+        case pcpp::LINKTYPE_ETHERNET:
+            break;
+        case pcpp::LINKTYPE_RAW:
+        case pcpp::LINKTYPE_DLT_RAW1:
+        case pcpp::LINKTYPE_DLT_RAW2:
+        case pcpp::LINKTYPE_IPV4:
+            headers.etherType = 0x0800;
+            return decodeIPv4(data, len, headers);
+        default:
+            return DecodeUnsupported;
+    }
+
+    if (len < 14)
+        return DecodeUnsupported;
+    size_t offset = 12;
+    uint16_t etherType = readNet16(data + offset);
+    offset += 2;
+    while (etherType == 0x8100 || etherType == 0x88a8) {
+        if (len < offset + 4)
+            return DecodeUnsupported;
+        etherType = readNet16(data + offset + 2);
+        offset += 4;
+    }
+    headers.etherType = etherType;
+
+    switch (etherType) {
+        case 0x0800:
+            return decodeIPv4(data + offset, len - offset, headers);
+        case 0x0806:
+            return DecodeOk;
+        default:
+            return DecodeUnsupported;
+    }
+}
+
+/**
+ * \brief Заполнение заголовков по разобранному пакету PcapPlusPlus
+ * \author Jodode
+ * \version 0.1
+ * @param packet Пакет, прошедший парсинг
+ * @param headers Результат
+ *
+ * Используется для пакетов, которые не поддерживает быстрый разбор. Пакеты без IPv4 заголовка учитываются без адреса
+ */
+inline void headersFromPacket(pcpp::Packet& packet, PacketHeaders& headers) {
+    headers = PacketHeaders();
+    pcpp::RawPacket* rawPacket = packet.getRawPacket();
+    if (rawPacket != nullptr) {
+        headers.frameLen = static_cast<size_t>(rawPacket->getFrameLength());
+        headers.timestampNs = toNanoseconds(rawPacket->getPacketTimeStamp());
+    }
+    auto* ipv4 = packet.getLayerOfType<pcpp::IPv4Layer>();
+    if (ipv4 != nullptr) {
+        headers.etherType = 0x0800;
+        headers.hasIPv4 = true;
+        headers.srcIPv4 = ipv4->getSrcIPv4Address().toInt();
+        headers.dstIPv4 = ipv4->getDstIPv4Address().toInt();
+    }
+    if (packet.isPacketOfType(pcpp::TCP)) {
+        auto* tcp = packet.getLayerOfType<pcpp::TcpLayer>();
+        headers.l4Protocol = ipProtocolTcp;
+        headers.srcPort = tcp->getSrcPort();
+        headers.dstPort = tcp->getDstPort();
+        headers.tcpFlags = tcp->getData()[13];
+        headers.payloadLen = tcp->getLayerPayloadSize();
+        headers.payload = tcp->getLayerPayload();
+    } else if (packet.isPacketOfType(pcpp::UDP)) {
+        auto* udp = packet.getLayerOfType<pcpp::UdpLayer>();
+        headers.l4Protocol = ipProtocolUdp;
+        headers.srcPort = udp->getSrcPort();
+        headers.dstPort = udp->getDstPort();
+        headers.payloadLen = udp->getLayerPayloadSize();
+        headers.payload = udp->getLayerPayload();
+    }
+}
+
+#endif // PACKET_DECODER_H
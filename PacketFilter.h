@@ -0,0 +1,173 @@
+/**
+ \file
+ \brief Заголовочный файл с фильтром пакетов BPF
+
+ Данный файл содержит фильтр, который проверяет "сырые" байты пакета выражением BPF (синтаксис tcpdump) до
+ разбора пакета, поэтому отброшенные пакеты почти ничего не стоят
+*/
+
+#ifndef PACKET_FILTER_H
+#define PACKET_FILTER_H
+
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include <pcap.h>
+
+/**
+ * \brief Перевод типа канального уровня файла трафика (LINKTYPE_*) в тип libpcap (DLT_*)
+ * @param linkType Тип канального уровня из заголовка файла
+ * @return Тип для pcap_open_dead
+ *
+ * Большинство значений совпадают, отличаются те, у которых DLT_* зависит от платформы. Значения 12 и 14 - это DLT_RAW
+ * разных систем, которые встречаются в файлах вместо LINKTYPE_RAW
+ */
+inline int linkTypeToDlt(int linkType) {
+    switch (linkType) {
+        case 100:
+            return DLT_ATM_RFC1483;
+        case 101:
+        case 12:
+        case 14:
+            return DLT_RAW;
+        case 102:
+            return DLT_SLIP_BSDOS;
+        case 103:
+            return DLT_PPP_BSDOS;
+        case 104:
+            return DLT_C_HDLC;
+        case 108:
+            return DLT_LOOP;
+        default:
+            return linkType;
+    }
+}
+
+//! Фильтр BPF
+/**
+ * \brief Выражение BPF, скомпилированное libpcap и выполняемое на байтах пакета
+ * \author Jodode
+ * \version 0.1
+ *
+ * Программа BPF зависит от типа канального уровня, поэтому выражение компилируется при первом пакете каждого
+ * типа и хранится в кэше. Каждое хранилище статистики владеет своим фильтром, поэтому проверка пакета не требует
+ * блокировок, а компиляция (не потокобезопасная в старых libpcap) выполняется под общей блокировкой. Если выражение
+ * не компилируется для типа канального уровня, об этом один раз выводится предупреждение, а пакеты этого типа
+ * проходят фильтр
+ */
+class PacketFilter {
+public:
+    //! Конструктор
+    /**
+     * @param expression Выражение BPF, например "tcp port 443 and net 10.0.0.0/8"
+     */
+    explicit PacketFilter(const std::string& expression) : expression(expression) {}
+
+    //! Деструктор
+    ~PacketFilter() {
+        for (auto& program : programs)
+            if (program.valid)
+                pcap_freecode(&program.code);
+    }
+
+    PacketFilter(const PacketFilter&) = delete;
+    PacketFilter& operator=(const PacketFilter&) = delete;
+
+    /**
+     * \brief Проверка выражения
+     * @param expression Выражение BPF
+     * @param error Описание ошибки компиляции
+     * @return false, если выражение не компилируется для Ethernet
+     */
+    static bool validate(const std::string& expression, std::string& error) {
+        bpf_program code;
+        if (!compile(expression, 1, code, &error))
+            return false;
+        pcap_freecode(&code);
+        return true;
+    }
+
+    /**
+     * \brief Проверка пакета
+     * @param data Байты пакета с канального уровня
+     * @param capLen Число сохраненных байт
+     * @param frameLen Длина пакета в сети
+     * @param linkType Тип канального уровня
+     * @return true, если пакет проходит фильтр. Пакеты типа, для которого выражение не компилируется, проходят
+     */
+    bool matches(const uint8_t* data, uint32_t capLen, uint32_t frameLen, int linkType) {
+        if (last >= programs.size() || programs[last].linkType != linkType)
+            last = programFor(linkType);
+        const Program& program = programs[last];
+        if (!program.valid)
+            return true;
+        pcap_pkthdr header{};
+        header.caplen = capLen;
+        header.len = frameLen;
+        return pcap_offline_filter(&program.code, &header, data) != 0;
+    }
+
+    //! Выражение фильтра
+    const std::string& text() const { return expression; }
+
+private:
+    //! Программа для одного типа канального уровня
+    struct Program {
+        //! Тип канального уровня
+        int linkType;
+        //! Признак успешной компиляции
+        bool valid;
+        //! Программа BPF
+        bpf_program code;
+    };
+
+    static bool compile(const std::string& expression, int linkType, bpf_program& code, std::string* error) {
+        static std::mutex compileMutex;
+        std::lock_guard<std::mutex> lock(compileMutex);
+        pcap_t* handle = pcap_open_dead(linkTypeToDlt(linkType), 262144);
+        if (handle == nullptr) {
+            if (error != nullptr)
+                *error = "cannot open libpcap handle";
+            return false;
+        }
+        bool compiled = pcap_compile(handle, &code, expression.c_str(), 1, PCAP_NETMASK_UNKNOWN) == 0;
+        if (!compiled && error != nullptr)
+            *error = pcap_geterr(handle);
+        pcap_close(handle);
+        return compiled;
+    }
+
+    size_t programFor(int linkType) {
+        for (size_t i = 0; i < programs.size(); ++i)
+            if (programs[i].linkType == linkType)
+                return i;
+        Program program{linkType, false, bpf_program{}};
+        std::string error;
+        program.valid = compile(expression, linkType, program.code, &error);
+        if (!program.valid)
+            warnOnce(linkType, error);
+        programs.push_back(program);
+        return programs.size() - 1;
+    }
+
+    //! Предупреждение о типе канального уровня без программы (одно на тип для всех фильтров программы)
+    static void warnOnce(int linkType, const std::string& error) {
+        static std::mutex warnedMutex;
+        static std::set<int> warned;
+        std::lock_guard<std::mutex> lock(warnedMutex);
+        if (warned.insert(linkType).second)
+            std::cerr << "[-] WARNING: --filter cannot be applied to link type " << linkType << " (" << error
+                      << "), its packets are not filtered" << std::endl;
+    }
+
+    //! Выражение фильтра
+    std::string expression;
+    //! Программы по типам канального уровня
+    std::vector<Program> programs;
+    //! Номер программы последнего пакета
+    size_t last = 0;
+};
+
+#endif // PACKET_FILTER_H
@@ -0,0 +1,181 @@
+/**
+ \file
+ \brief Заголовочный файл с выборкой пакетов
+
+ Данный файл содержит выборку пакетов для приближенной статистики по очень большим файлам трафика: каждый N-й
+ пакет, пакеты с хешем, кратным N, или выборку фиксированного размера. Решение принимается до разбора пакета
+*/
+
+#ifndef PACKET_SAMPLER_H
+#define PACKET_SAMPLER_H
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include "FlatCounters.h"
+#include "PacketDecoder.h"
+
+//! Режим выборки
+enum SampleMode {
+    //! Без выборки
+    SampleNone,
+    //! Пакеты, хеш которых кратен N (детерминированно, одинаково при любом числе потоков)
+    SampleHash,
+    //! Каждый N-й пакет
+    SampleSystematic,
+    //! Равномерная выборка не больше заданного числа пакетов
+    SampleBudget
+};
+
+/**
+ * \brief Хеш пакета для выборки
+ * @param data Байты пакета
+ * @param length Число байт пакета
+ * @param timestampNs Время захвата пакета
+ * @return 64-битный хеш первых 64 байт, длины и времени пакета
+ *
+ * Время захвата различает одинаковые по содержимому пакеты, поэтому повторы (например, запросы DNS) выбираются
+ * независимо. Хеш зависит только от пакета, поэтому выборка не зависит от числа потоков и порядка файлов
+ */
+inline uint64_t samplingHash(const uint8_t* data, size_t length, int64_t timestampNs) {
+    uint64_t hash = mixHash(static_cast<uint64_t>(timestampNs) ^ (static_cast<uint64_t>(length) << 48));
+    size_t prefix = std::min<size_t>(length, 64);
+    size_t i = 0;
+    for (; i + 8 <= prefix; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = mixHash(hash ^ word);
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, data + i, prefix - i);
+    return mixHash(hash ^ tail);
+}
+
+//! Выборка пакетов
+/**
+ * \brief Решение о выборке пакета до его разбора
+ * \author Jodode
+ * \version 0.1
+ *
+ * В режиме SampleBudget хранятся заголовки budget пакетов с наименьшими хешами (bottom-k): это равномерная выборка
+ * без возвращения, и выборки потоков объединяются выбором наименьших хешей из объединения. Пакет с хешем не меньше
+ * наибольшего из хранимых отбрасывается без разбора. Заголовки выборки учитываются в хранилище после окончания
+ * сбора (drain)
+ */
+class PacketSampler {
+public:
+    //! Конструктор
+    /**
+     * @param mode Режим выборки
+     * @param rate N для SampleHash и SampleSystematic (выбирается 1 пакет из N)
+     * @param budget Размер выборки для SampleBudget
+     */
+    explicit PacketSampler(SampleMode mode = SampleNone, uint64_t rate = 1, size_t budget = 0)
+        : sampleMode(rate > 1 || mode == SampleBudget ? mode : SampleNone), sampleRate(rate > 1 ? rate : 1),
+          sampleBudget(budget) {
+        if (sampleMode == SampleBudget && sampleBudget == 0)
+            sampleMode = SampleNone;
+    }
+
+    //! Признак включенной выборки
+    bool enabled() const { return sampleMode != SampleNone; }
+    //! Режим выборки
+    SampleMode mode() const { return sampleMode; }
+    //! N для SampleHash и SampleSystematic
+    uint64_t rate() const { return sampleRate; }
+    //! Размер выборки для SampleBudget
+    size_t budget() const { return sampleBudget; }
+    //! Число заголовков, ожидающих учета (SampleBudget)
+    size_t pending() const { return reservoir.size(); }
+
+    /**
+     * \brief Решение о выборке пакета
+     * @param data Байты пакета
+     * @param length Число байт пакета
+     * @param timestampNs Время захвата пакета
+     * @param key Хеш пакета (заполняется для SampleBudget и передается в offer)
+     * @return false, если пакет не попадает в выборку
+     */
+    bool select(const uint8_t* data, size_t length, int64_t timestampNs, uint64_t& key) {
+        if (sampleMode == SampleSystematic)
+            return counter++ % sampleRate == 0;
+        key = samplingHash(data, length, timestampNs);
+        if (sampleMode == SampleHash)
+            return key % sampleRate == 0;
+        return reservoir.size() < sampleBudget || key < reservoir.front().key;
+    }
+
+    /**
+     * \brief Добавление разобранного пакета в выборку (SampleBudget)
+     * @param key Хеш пакета из select
+     * @param headers Заголовки пакета
+     * @return Число пакетов, вытесненных из выборки (0 или 1)
+     */
+    size_t offer(uint64_t key, const PacketHeaders& headers) {
+        reservoir.push_back(Sample{key, headers});
+        std::push_heap(reservoir.begin(), reservoir.end(), byKey);
+        if (reservoir.size() <= sampleBudget)
+            return 0;
+        std::pop_heap(reservoir.begin(), reservoir.end(), byKey);
+        reservoir.pop_back();
+        return 1;
+    }
+
+    /**
+     * \brief Объединение с выборкой другой части трафика
+     * @param other Выборка, собранная другим потоком
+     * @return Число пакетов, вытесненных из объединенной выборки
+     */
+    size_t merge(const PacketSampler& other) {
+        size_t evicted = 0;
+        for (auto& sample : other.reservoir)
+            evicted += offer(sample.key, sample.headers);
+        return evicted;
+    }
+
+    /**
+     * \brief Выдача заголовков выборки в порядке времени с очисткой выборки
+     * @param func Функция, принимающая заголовки пакета
+     */
+    template <typename Func>
+    void drain(Func func) {
+        std::sort(reservoir.begin(), reservoir.end(), [](const Sample& a, const Sample& b) {
+            return a.headers.timestampNs < b.headers.timestampNs;
+        });
+        for (auto& sample : reservoir)
+            func(sample.headers);
+        reservoir.clear();
+    }
+
+    //! Функция очищения (режим сохраняется)
+    void clear() {
+        reservoir.clear();
+        counter = 0;
+    }
+
+private:
+    //! Пакет выборки
+    struct Sample {
+        //! Хеш пакета
+        uint64_t key;
+        //! Заголовки пакета
+        PacketHeaders headers;
+    };
+
+    //! Порядок кучи: наибольший хеш в вершине
+    static bool byKey(const Sample& a, const Sample& b) { return a.key < b.key; }
+
+    //! Режим выборки
+    SampleMode sampleMode;
+    //! N для SampleHash и SampleSystematic
+    uint64_t sampleRate;
+    //! Размер выборки для SampleBudget
+    size_t sampleBudget;
+    //! Счетчик пакетов для SampleSystematic
+    uint64_t counter = 0;
+    //! Выборка SampleBudget (куча по хешу)
+    std::vector<Sample> reservoir;
+};
+
+#endif // PACKET_SAMPLER_H
@@ -0,0 +1,346 @@
+/**
+ \file
+ \brief Заголовочный файл с разбором форматов pcap/pcapng
+
+ Данный файл содержит разбор заголовков записей классического pcap и pcapng прямо в буфере, без копирования
+ данных пакетов. Используется читателями, которые сами управляют памятью (отображение файла, потоковый буфер)
+*/
+
+#ifndef PCAP_FORMAT_H
+#define PCAP_FORMAT_H
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+#include "RawPacket.h"
+
+//! Пакет без владения данными
+/**
+ * \brief "Сырой" пакет, данные которого принадлежат читателю
+ * \author Jodode
+ * \version 0.1
+ *
+ * В отличие от pcpp::RawPacket не освобождает данные в деструкторе и при установке новых данных, поэтому может
+ * указывать прямо в отображенный файл или буфер читателя
+ */
+class BorrowedRawPacket : public pcpp::RawPacket {
+public:
+    //! Конструктор
+    BorrowedRawPacket() : pcpp::RawPacket() { m_DeleteRawDataAtDestructor = false; }
+    //! Копирование создает собственную копию данных, как и у pcpp::RawPacket
+    BorrowedRawPacket(const BorrowedRawPacket& other) = default;
+};
+
+//! Запись с пакетом
+/**
+ * \brief Описание пакета, найденного в буфере
+ */
+struct PcapRecord {
+    //! Начало данных пакета внутри буфера
+    const uint8_t* data = nullptr;
+    //! Число сохраненных байт пакета
+    uint32_t capLen = 0;
+    //! Исходная длина пакета в сети
+    uint32_t frameLen = 0;
+    //! Время захвата пакета
+    timespec timestamp{};
+    //! Тип канального уровня
+    pcpp::LinkLayerType linkType = pcpp::LINKTYPE_ETHERNET;
+};
+
+//! Интервал времени
+/**
+ * \brief Интервал времени захвата [from, to], по умолчанию не ограничен
+ */
+struct TimeRange {
+    //! Начало интервала, нс от начала эпохи
+    int64_t fromNs = std::numeric_limits<int64_t>::min();
+    //! Конец интервала включительно, нс от начала эпохи
+    int64_t toNs = std::numeric_limits<int64_t>::max();
+
+    //! Признак ограниченного интервала
+    bool bounded() const {
+        return fromNs != std::numeric_limits<int64_t>::min() || toNs != std::numeric_limits<int64_t>::max();
+    }
+
+    //! Попадание времени в интервал
+    bool contains(int64_t timestampNs) const { return timestampNs >= fromNs && timestampNs <= toNs; }
+};
+
+//! Разбор pcap/pcapng
+/**
+ * \brief Разбор последовательности блоков pcap или pcapng
+ * \author Jodode
+ * \version 0.1
+ *
+ * Формат определяется по первым байтам. Разбор не хранит указателей на буфер между вызовами, поэтому один и тот же
+ * объект работает как с отображенным в память файлом целиком, так и с потоком, читаемым по частям
+ */
+class PcapRecordParser {
+public:
+    //! Результат разбора
+    enum Status {
+        //! Найден пакет
+        Packet,
+        //! Служебный блок пропущен
+        Skip,
+        //! В буфере недостаточно данных, required содержит нужное число байт
+        NeedMore,
+        //! Данные не являются pcap/pcapng или повреждены
+        Error
+    };
+
+    //! Максимальный размер блока, больший размер считается повреждением
+    static constexpr uint32_t maxBlockLen = 16 * 1024 * 1024;
+
+    /**
+     * \brief Разбор очередного блока
+     * @param data Начало непрочитанных данных
+     * @param avail Число доступных байт
+     * @param consumed Число байт, занимаемых блоком (при NeedMore - требуемое число байт)
+     * @param record Описание пакета (только при статусе Packet)
+     * @return Результат разбора
+     */
+    Status next(const uint8_t* data, size_t avail, size_t& consumed, PcapRecord& record) {
+        switch (format) {
+            case Unknown:
+                return parseFileHeader(data, avail, consumed);
+            case Pcap:
+                return parsePcapRecord(data, avail, consumed, record);
+            default:
+                return parsePcapNgBlock(data, avail, consumed, record);
+        }
+    }
+
+    //! Признак того, что заголовок файла уже разобран
+    bool headerParsed() const { return format != Unknown; }
+
+    //! Число разобранных заголовков файла, секций и описаний интерфейсов (от них зависит разбор пакетов)
+    uint32_t numOfDefinitions() const { return definitions; }
+
+private:
+    enum Format { Unknown, Pcap, PcapNg };
+
+    //! Интерфейс захвата pcapng
+    struct Interface {
+        pcpp::LinkLayerType linkType;
+        //! Число единиц времени в секунде
+        uint64_t unitsPerSecond;
+    };
+
+    uint32_t read32(const uint8_t* p) const {
+        uint32_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return swapped ? swap32(value) : value;
+    }
+
+    uint16_t read16(const uint8_t* p) const {
+        uint16_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return swapped ? static_cast<uint16_t>((value >> 8) | (value << 8)) : value;
+    }
+
+    static uint32_t swap32(uint32_t value) {
+        return (value >> 24) | ((value >> 8) & 0xff00) | ((value << 8) & 0xff0000) | (value << 24);
+    }
+
+    static timespec toTimespec(uint64_t units, uint64_t unitsPerSecond) {
+        timespec ts{};
+        ts.tv_sec = static_cast<time_t>(units / unitsPerSecond);
+        uint64_t rest = units % unitsPerSecond;
+        if (unitsPerSecond == 1000000000ULL)
+            ts.tv_nsec = static_cast<long>(rest);
+        else
+            ts.tv_nsec = static_cast<long>(static_cast<double>(rest) * 1e9 / static_cast<double>(unitsPerSecond));
+        return ts;
+    }
+
+    Status parseFileHeader(const uint8_t* data, size_t avail, size_t& consumed) {
+        if (avail < 4) {
+            consumed = 4;
+            return NeedMore;
+        }
+        uint32_t magic;
+        std::memcpy(&magic, data, sizeof(magic));
+        if (magic == 0x0A0D0D0A) {
+            format = PcapNg;
+            return parsePcapNgBlock(data, avail, consumed, dummyRecord);
+        }
+
+        if (magic == 0xa1b2c3d4 || magic == 0xa1b23c4d) {
+            swapped = false;
+        } else if (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1) {
+            swapped = true;
+        } else {
+            return Error;
+        }
+        if (avail < 24) {
+            consumed = 24;
+            return NeedMore;
+        }
+        nanoseconds = (magic == 0xa1b23c4d || magic == 0x4d3cb2a1);
+        pcapLinkType = static_cast<pcpp::LinkLayerType>(read32(data + 20) & 0x0fffffff);
+        format = Pcap;
+        ++definitions;
+        consumed = 24;
+        return Skip;
+    }
+
+    Status parsePcapRecord(const uint8_t* data, size_t avail, size_t& consumed, PcapRecord& record) {
+        if (avail < 16) {
+            consumed = 16;
+            return NeedMore;
+        }
+        uint32_t capLen = read32(data + 8);
+        if (capLen > maxBlockLen)
+            return Error;
+        if (avail < 16 + static_cast<size_t>(capLen)) {
+            consumed = 16 + static_cast<size_t>(capLen);
+            return NeedMore;
+        }
+        record.data = data + 16;
+        record.capLen = capLen;
+        record.frameLen = read32(data + 12);
+        record.timestamp.tv_sec = static_cast<time_t>(read32(data));
+        record.timestamp.tv_nsec = static_cast<long>(nanoseconds ? read32(data + 4) : read32(data + 4) * 1000);
+        record.linkType = pcapLinkType;
+        consumed = 16 + static_cast<size_t>(capLen);
+        return Packet;
+    }
+
+    Status parsePcapNgBlock(const uint8_t* data, size_t avail, size_t& consumed, PcapRecord& record) {
+        if (avail < 12) {
+            consumed = 12;
+            return NeedMore;
+        }
+        uint32_t rawType;
+        std::memcpy(&rawType, data, sizeof(rawType));
+        if (rawType == 0x0A0D0D0A) {
+            uint32_t byteOrder;
+            std::memcpy(&byteOrder, data + 8, sizeof(byteOrder));
+            if (byteOrder == 0x1A2B3C4D)
+                swapped = false;
+            else if (byteOrder == 0x4D3C2B1A)
+                swapped = true;
+            else
+                return Error;
+        }
+
+        uint32_t blockType = read32(data);
+        uint32_t blockLen = read32(data + 4);
+        if (blockLen < 12 || blockLen % 4 != 0 || blockLen > maxBlockLen)
+            return Error;
+        if (avail < blockLen) {
+            consumed = blockLen;
+            return NeedMore;
+        }
+        consumed = blockLen;
+
+        switch (blockType) {
+            case 0x0A0D0D0A:
+                // Новая секция начинает собственную нумерацию интерфейсов
+                interfaces.clear();
+                ++definitions;
+                return Skip;
+            case 1:
+                return parseInterface(data, blockLen);
+            case 6: {
+                if (blockLen < 32)
+                    return Error;
+                uint32_t interfaceId = read32(data + 8);
+                if (interfaceId >= interfaces.size())
+                    return Error;
+                uint32_t capLen = read32(data + 20);
+                if (capLen > blockLen - 32)
+                    return Error;
+                const Interface& iface = interfaces[interfaceId];
+                uint64_t units = (static_cast<uint64_t>(read32(data + 12)) << 32) | read32(data + 16);
+                record.data = data + 28;
+                record.capLen = capLen;
+                record.frameLen = read32(data + 24);
+                record.timestamp = toTimespec(units, iface.unitsPerSecond);
+                record.linkType = iface.linkType;
+                return Packet;
+            }
+            case 3: {
+                if (blockLen < 16 || interfaces.empty())
+                    return Error;
+                uint32_t frameLen = read32(data + 8);
+                record.data = data + 12;
+                record.frameLen = frameLen;
+                record.capLen = frameLen < blockLen - 16 ? frameLen : blockLen - 16;
+                record.timestamp = timespec{};
+                record.linkType = interfaces[0].linkType;
+                return Packet;
+            }
+            case 2: {
+                if (blockLen < 32)
+                    return Error;
+                uint16_t interfaceId = read16(data + 8);
+                if (interfaceId >= interfaces.size())
+                    return Error;
+                uint32_t capLen = read32(data + 20);
+                if (capLen > blockLen - 32)
+                    return Error;
+                const Interface& iface = interfaces[interfaceId];
+                uint64_t units = (static_cast<uint64_t>(read32(data + 12)) << 32) | read32(data + 16);
+                record.data = data + 28;
+                record.capLen = capLen;
+                record.frameLen = read32(data + 24);
+                record.timestamp = toTimespec(units, iface.unitsPerSecond);
+                record.linkType = iface.linkType;
+                return Packet;
+            }
+            default:
+                return Skip;
+        }
+    }
+
+    Status parseInterface(const uint8_t* data, uint32_t blockLen) {
+        if (blockLen < 20)
+            return Error;
+        Interface iface{static_cast<pcpp::LinkLayerType>(read16(data + 8)), 1000000};
+        // Опции интерфейса: ищем if_tsresol (код 9)
+        size_t offset = 16;
+        while (offset + 4 <= blockLen - 4) {
+            uint16_t code = read16(data + offset);
+            uint16_t length = read16(data + offset + 2);
+            if (code == 0)
+                break;
+            if (code == 9 && length >= 1 && offset + 5 <= blockLen - 4) {
+                uint8_t resolution = data[offset + 4];
+                uint8_t power = resolution & 0x7f;
+                if (resolution & 0x80) {
+                    iface.unitsPerSecond = power < 64 ? (1ULL << power) : 1000000;
+                } else {
+                    uint64_t units = 1;
+                    for (uint8_t i = 0; i < power && i < 19; ++i)
+                        units *= 10;
+                    iface.unitsPerSecond = units;
+                }
+            }
+            offset += 4 + ((static_cast<size_t>(length) + 3) & ~static_cast<size_t>(3));
+        }
+        interfaces.push_back(iface);
+        ++definitions;
+        return Skip;
+    }
+
+    //! Формат потока
+    Format format = Unknown;
+    //! Порядок байт отличается от порядка байт машины
+    bool swapped = false;
+    //! Временные метки pcap в наносекундах
+    bool nanoseconds = false;
+    //! Тип канального уровня классического pcap
+    pcpp::LinkLayerType pcapLinkType = pcpp::LINKTYPE_ETHERNET;
+    //! Интерфейсы текущей секции pcapng
+    std::vector<Interface> interfaces;
+    //! Число разобранных заголовков и описаний интерфейсов
+    uint32_t definitions = 0;
+    //! Запись для разбора заголовка секции, в котором пакетов нет
+    PcapRecord dummyRecord;
+};
+
+#endif // PCAP_FORMAT_H
@@ -0,0 +1,318 @@
+/**
+ \file
+ \brief Заголовочный файл с индексом файла трафика
+
+ Данный файл содержит индекс, который хранится рядом с файлом трафика (capture.pcap.sftidx) и для каждого K-го
+ пакета запоминает смещение и время захвата. По индексу один файл делится на диапазоны байт для нескольких потоков,
+ а интервал времени находится двоичным поиском без чтения файла с начала
+*/
+
+#ifndef PCAP_INDEX_H
+#define PCAP_INDEX_H
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <sys/stat.h>
+#include "MmapPcapReader.h"
+#include "MappedFile.h"
+
+//! Версия формата индекса
+const uint32_t pcapIndexVersion = 1;
+
+//! Сигнатура файла индекса
+const char pcapIndexMagic[8] = {'S', 'F', 'T', 'I', 'D', 'X', '\0', '\0'};
+
+//! Индекс файла трафика
+/**
+ * \brief Смещения и время захвата пакетов через каждые K пакетов
+ * \author Jodode
+ * \version 0.1
+ *
+ * Файл делится на блоки по K пакетов, для блока хранятся смещение первого пакета и наименьшее и наибольшее время
+ * захвата в блоке (24 байта на блок). Границы по времени не требуют упорядоченности пакетов: начало интервала ищется
+ * по нарастающему максимуму блоков, конец - по убывающему с конца минимуму, поэтому пропускаются только блоки, все
+ * пакеты которых вне интервала. Индекс устаревает при изменении размера или времени изменения файла.
+ *
+ * Блоки читаются независимо, если разбор пакетов зависит только от заголовков в начале файла: для pcap это всегда
+ * так, файл pcapng с новыми секциями или интерфейсами после первого пакета не индексируется
+ */
+class PcapIndex {
+public:
+    //! Блок индекса
+    struct Block {
+        //! Смещение первого пакета блока
+        uint64_t offset;
+        //! Наименьшее время захвата в блоке, нс
+        int64_t minTimestampNs;
+        //! Наибольшее время захвата в блоке, нс
+        int64_t maxTimestampNs;
+    };
+
+    //! Диапазон байт файла [begin, end)
+    struct ByteRange {
+        //! Смещение первого блока
+        uint64_t begin;
+        //! Конец диапазона
+        uint64_t end;
+    };
+
+    //! Путь до индекса файла трафика
+    static std::string pathFor(const std::string& capturePath) { return capturePath + ".sftidx"; }
+
+    /**
+     * \brief Построение индекса чтением файла
+     * @param capturePath Путь до файла трафика
+     * @param every Число пакетов в блоке
+     * @param error Описание ошибки
+     * @return false, если файл не удалось прочитать или он не индексируется
+     */
+    bool build(const std::string& capturePath, uint32_t every, std::string& error) {
+        *this = PcapIndex();
+        packetsPerBlock = every > 0 ? every : 1;
+        if (!captureStamp(capturePath, fileSize, fileMtime)) {
+            error = "Cannot stat " + capturePath;
+            return false;
+        }
+        MmapPcapReader reader(capturePath);
+        if (!reader.open()) {
+            error = "Cannot map " + capturePath + " or it is not a pcap/pcapng file";
+            return false;
+        }
+
+        BorrowedRawPacket rawPacket;
+        uint32_t definitions = 0;
+        while (reader.getNextPacket(rawPacket)) {
+            int64_t timestampNs = toNanoseconds(rawPacket.getPacketTimeStamp());
+            if (packets == 0) {
+                headerLen = reader.packetPosition();
+                definitions = reader.numOfDefinitions();
+            } else if (reader.numOfDefinitions() != definitions) {
+                error = capturePath + " defines interfaces after the first packet and cannot be indexed";
+                return false;
+            }
+            if (packets % packetsPerBlock == 0) {
+                blocks.push_back(Block{reader.packetPosition(), timestampNs, timestampNs});
+            } else {
+                Block& block = blocks.back();
+                block.minTimestampNs = std::min(block.minTimestampNs, timestampNs);
+                block.maxTimestampNs = std::max(block.maxTimestampNs, timestampNs);
+            }
+            ++packets;
+        }
+        dataEnd = reader.position();
+        updateBounds();
+        return true;
+    }
+
+    /**
+     * \brief Запись индекса во временный файл с переименованием
+     * @param path Путь до файла индекса
+     * @param error Описание ошибки
+     * @return false, если файл не удалось записать
+     */
+    bool save(const std::string& path, std::string& error) const {
+        std::string buffer(pcapIndexMagic, sizeof(pcapIndexMagic));
+        put(buffer, pcapIndexVersion, 4);
+        put(buffer, packetsPerBlock, 4);
+        put(buffer, fileSize, 8);
+        put(buffer, static_cast<uint64_t>(fileMtime), 8);
+        put(buffer, headerLen, 8);
+        put(buffer, dataEnd, 8);
+        put(buffer, packets, 8);
+        put(buffer, blocks.size(), 8);
+        for (auto& block : blocks) {
+            put(buffer, block.offset, 8);
+            put(buffer, static_cast<uint64_t>(block.minTimestampNs), 8);
+            put(buffer, static_cast<uint64_t>(block.maxTimestampNs), 8);
+        }
+
+        std::string tempPath = path + ".tmp";
+        {
+            std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+            file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            file.close();
+            if (!file.good()) {
+                std::remove(tempPath.c_str());
+                error = "Cannot write index " + tempPath;
+                return false;
+            }
+        }
+        if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+            std::remove(tempPath.c_str());
+            error = "Cannot rename index to " + path;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * \brief Чтение индекса файла трафика
+     * @param capturePath Путь до файла трафика (индекс читается из pathFor(capturePath))
+     * @param error Описание ошибки
+     * @return false, если индекса нет, он поврежден или устарел
+     */
+    bool load(const std::string& capturePath, std::string& error) {
+        *this = PcapIndex();
+        std::string path = pathFor(capturePath);
+        MappedFile file;
+        if (!file.open(path)) {
+            error = "No index " + path;
+            return false;
+        }
+        const uint8_t* cur = file.data();
+        const uint8_t* end = file.data() + file.size();
+        const size_t headerSize = sizeof(pcapIndexMagic) + 8 + 6 * 8;
+        if (file.size() < headerSize || std::memcmp(cur, pcapIndexMagic, sizeof(pcapIndexMagic)) != 0) {
+            error = path + " is not an index";
+            return false;
+        }
+        cur += sizeof(pcapIndexMagic);
+        uint32_t version = static_cast<uint32_t>(get(cur, 4));
+        packetsPerBlock = static_cast<uint32_t>(get(cur, 4));
+        fileSize = get(cur, 8);
+        fileMtime = static_cast<int64_t>(get(cur, 8));
+        headerLen = get(cur, 8);
+        dataEnd = get(cur, 8);
+        packets = get(cur, 8);
+        uint64_t numOfBlocks = get(cur, 8);
+        if (version != pcapIndexVersion) {
+            error = "Unsupported index version " + std::to_string(version) + " in " + path;
+            return false;
+        }
+        if (numOfBlocks > static_cast<uint64_t>(end - cur) / 24 || headerLen > dataEnd || dataEnd > fileSize) {
+            error = path + " is corrupted";
+            return false;
+        }
+        blocks.resize(static_cast<size_t>(numOfBlocks));
+        for (auto& block : blocks) {
+            block.offset = get(cur, 8);
+            block.minTimestampNs = static_cast<int64_t>(get(cur, 8));
+            block.maxTimestampNs = static_cast<int64_t>(get(cur, 8));
+        }
+        for (size_t i = 0; i < blocks.size(); ++i)
+            if (blocks[i].offset < (i == 0 ? headerLen : blocks[i - 1].offset + 1) || blocks[i].offset >= dataEnd) {
+                error = path + " is corrupted";
+                return false;
+            }
+
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        if (!captureStamp(capturePath, size, mtime) || size != fileSize || mtime != fileMtime) {
+            error = path + " is outdated, rebuild it with --build-index";
+            return false;
+        }
+        updateBounds();
+        return true;
+    }
+
+    /**
+     * \brief Поиск блоков, которые могут содержать пакеты интервала времени
+     * @param range Интервал времени
+     * @param first Первый блок
+     * @param last Блок после последнего (first == last, если пакетов интервала нет)
+     */
+    void select(const TimeRange& range, size_t& first, size_t& last) const {
+        first = static_cast<size_t>(std::lower_bound(runningMax.begin(), runningMax.end(), range.fromNs) -
+                                    runningMax.begin());
+        last = static_cast<size_t>(std::upper_bound(suffixMin.begin(), suffixMin.end(), range.toNs) -
+                                   suffixMin.begin());
+        if (last < first)
+            last = first;
+    }
+
+    /**
+     * \brief Деление блоков на диапазоны байт примерно равного размера
+     * @param first Первый блок
+     * @param last Блок после последнего
+     * @param parts Наибольшее число диапазонов
+     * @return Диапазоны по порядку файла, каждый из целых блоков
+     */
+    std::vector<ByteRange> split(size_t first, size_t last, size_t parts) const {
+        std::vector<ByteRange> ranges;
+        if (first >= last || parts == 0)
+            return ranges;
+        uint64_t begin = blocks[first].offset;
+        uint64_t total = blockEnd(last - 1) - begin;
+        size_t start = first;
+        for (size_t i = first; i < last; ++i) {
+            uint64_t target = begin + total * (ranges.size() + 1) / parts;
+            if (blockEnd(i) >= target || i + 1 == last) {
+                ranges.push_back(ByteRange{blocks[start].offset, blockEnd(i)});
+                start = i + 1;
+            }
+        }
+        return ranges;
+    }
+
+    //! Смещение первого пакета (заголовки файла разбираются до него)
+    uint64_t headerEnd() const { return headerLen; }
+    //! Число пакетов в блоке
+    uint32_t every() const { return packetsPerBlock; }
+    //! Число пакетов в файле
+    uint64_t numOfPackets() const { return packets; }
+    //! Блоки индекса
+    const std::vector<Block>& data() const { return blocks; }
+
+private:
+    //! Размер и время изменения файла
+    static bool captureStamp(const std::string& path, uint64_t& size, int64_t& mtime) {
+        struct stat st{};
+        if (stat(path.c_str(), &st) != 0)
+            return false;
+        size = static_cast<uint64_t>(st.st_size);
+        mtime = static_cast<int64_t>(st.st_mtime);
+        return true;
+    }
+
+    static void put(std::string& buffer, uint64_t value, size_t size) {
+        for (size_t i = 0; i < size; ++i)
+            buffer.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+
+    static uint64_t get(const uint8_t*& cur, size_t size) {
+        uint64_t value = 0;
+        for (size_t i = 0; i < size; ++i)
+            value |= static_cast<uint64_t>(cur[i]) << (8 * i);
+        cur += size;
+        return value;
+    }
+
+    //! Конец блока (начало следующего или конец данных)
+    uint64_t blockEnd(size_t block) const { return block + 1 < blocks.size() ? blocks[block + 1].offset : dataEnd; }
+
+    //! Пересчет границ для поиска по времени
+    void updateBounds() {
+        runningMax.resize(blocks.size());
+        suffixMin.resize(blocks.size());
+        for (size_t i = 0; i < blocks.size(); ++i)
+            runningMax[i] = i == 0 ? blocks[i].maxTimestampNs : std::max(runningMax[i - 1], blocks[i].maxTimestampNs);
+        for (size_t i = blocks.size(); i-- > 0;)
+            suffixMin[i] = i + 1 == blocks.size() ? blocks[i].minTimestampNs :
+                           std::min(suffixMin[i + 1], blocks[i].minTimestampNs);
+    }
+
+    //! Число пакетов в блоке
+    uint32_t packetsPerBlock = 1;
+    //! Размер файла трафика
+    uint64_t fileSize = 0;
+    //! Время изменения файла трафика, с
+    int64_t fileMtime = 0;
+    //! Смещение первого пакета
+    uint64_t headerLen = 0;
+    //! Конец последнего пакета
+    uint64_t dataEnd = 0;
+    //! Число пакетов
+    uint64_t packets = 0;
+    //! Блоки
+    std::vector<Block> blocks;
+    //! Наибольшее время захвата в блоках до i-го включительно
+    std::vector<int64_t> runningMax;
+    //! Наименьшее время захвата в блоках от i-го до последнего
+    std::vector<int64_t> suffixMin;
+};
+
+#endif // PCAP_INDEX_H
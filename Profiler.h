@@ -0,0 +1,339 @@
+/**
+ \file
+ \brief Заголовочный файл с замерами времени по этапам обработки
+
+ Данный файл содержит счетчики тактов по этапам (чтение, фильтр, разбор, сбор, объединение, отчет), счетчики
+ выделений памяти и пиковую память процесса. Без макроса SFT_PROFILING замеры не компилируются
+*/
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include <fmt/format.h>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#endif
+
+//! Режим замеров false - выключен, true - включен (определяется в программе)
+extern bool profileMode;
+
+//! Этап обработки
+enum ProfileStage {
+    //! Чтение пакета из файла или потока
+    ProfileRead,
+    //! Проверка фильтром BPF
+    ProfileFilter,
+    //! Разбор заголовков по байтам пакета
+    ProfileDecode,
+    //! Разбор пакета PcapPlusPlus (pcpp::Packet)
+    ProfileParse,
+    //! Определение протокола прикладного уровня
+    ProfileClassify,
+    //! Учет заголовков в хранилище
+    ProfileCollect,
+    //! Объединение хранилищ потоков
+    ProfileMerge,
+    //! Чтение и запись снимков
+    ProfileState,
+    //! Запись отчета
+    ProfileReport,
+    //! Число этапов
+    numOfProfileStages
+};
+
+//! Название этапа
+inline const char* profileStageName(int stage) {
+    static const char* names[numOfProfileStages] = {"read", "filter", "decode", "parse", "classify",
+                                                    "collect", "merge", "state", "report"};
+    return names[stage];
+}
+
+//! Текущее значение счетчика тактов (или наносекунд, если счетчик тактов недоступен)
+inline uint64_t profileTicks() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+//! Счетчики одного потока
+struct ProfileCounters {
+    //! Такты по этапам
+    uint64_t ticks[numOfProfileStages] = {};
+    //! Число замеров по этапам
+    uint64_t calls[numOfProfileStages] = {};
+    //! Число прочитанных пакетов
+    uint64_t packets = 0;
+    //! Число прочитанных байт пакетов
+    uint64_t bytes = 0;
+};
+
+//! Счетчики выделений памяти (заполняются замененным operator new)
+struct AllocationCounters {
+    //! Число выделений
+    std::atomic<uint64_t> count{0};
+    //! Число выделенных байт
+    std::atomic<uint64_t> bytes{0};
+};
+
+//! Счетчики выделений памяти процесса
+inline AllocationCounters& allocationCounters() {
+    static AllocationCounters counters;
+    return counters;
+}
+
+//! Замеры
+/**
+ * \brief Сбор и вывод замеров по этапам обработки
+ * \author Jodode
+ * \version 0.1
+ *
+ * Каждый поток пишет в собственные счетчики без блокировок, счетчики потоков регистрируются при первом замере и
+ * суммируются при выводе (после завершения потоков). Такты переводятся в секунды по отношению к steady_clock за
+ * время работы. Время этапов, выполнявшихся в нескольких потоках, суммируется по потокам
+ */
+class Profiler {
+public:
+    //! Общий объект замеров
+    static Profiler& instance() {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    //! Начало замеров
+    void start() {
+        startTicks = profileTicks();
+        startTime = std::chrono::steady_clock::now();
+        allocationCounters().count = 0;
+        allocationCounters().bytes = 0;
+    }
+
+    //! Счетчики текущего потока
+    ProfileCounters& threadCounters() {
+        thread_local ProfileCounters* counters = registerThread();
+        return *counters;
+    }
+
+    //! Сумма счетчиков всех потоков
+    ProfileCounters total() {
+        std::lock_guard<std::mutex> lock(countersMutex);
+        ProfileCounters sum;
+        for (auto& counters : allCounters) {
+            for (int i = 0; i < numOfProfileStages; ++i) {
+                sum.ticks[i] += counters->ticks[i];
+                sum.calls[i] += counters->calls[i];
+            }
+            sum.packets += counters->packets;
+            sum.bytes += counters->bytes;
+        }
+        return sum;
+    }
+
+    //! Пиковая резидентная память процесса, байт (0, если недоступна)
+    static uint64_t peakRss() {
+#if defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS memory;
+        if (K32GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory)))
+            return static_cast<uint64_t>(memory.PeakWorkingSetSize);
+        return 0;
+#else
+        rusage usage{};
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+            return 0;
+#if defined(__APPLE__)
+        return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+        return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+    }
+
+    /**
+     * \brief Вывод замеров таблицей
+     * @param output Поток вывода
+     */
+    void writeText(std::ostream& output) {
+        Summary summary = summarize();
+        output << fmt::format("|{:=^80}|\n|{:^16}{:^16}{:^16}{:^16}{:^16}|\n", "Profile", "stage", "calls",
+                              "time s", "ns per call", "perc");
+        for (int i = 0; i < numOfProfileStages; ++i) {
+            if (summary.counters.calls[i] == 0)
+                continue;
+            double seconds = summary.stageSeconds(i);
+            output << fmt::format("|{:<16}{:<16}{:<16.4f}{:<16.1f}{:<16.3}|\n", profileStageName(i),
+                                  summary.counters.calls[i], seconds,
+                                  seconds * 1e9 / static_cast<double>(summary.counters.calls[i]),
+                                  summary.stagesSeconds > 0 ? seconds * 100.0 / summary.stagesSeconds : 0.0);
+        }
+        output << fmt::format("|{:=^80}|\n", "Totals");
+        output << fmt::format("|{:<32}{:<48.4f}|\n", "wall time s", summary.wallSeconds);
+        output << fmt::format("|{:<32}{:<48}|\n", "packets", summary.counters.packets);
+        output << fmt::format("|{:<32}{:<48.0f}|\n", "packets per s", summary.packetsPerSecond());
+        output << fmt::format("|{:<32}{:<48.1f}|\n", "MB per s", summary.megabytesPerSecond());
+        output << fmt::format("|{:<32}{:<48.1f}|\n", "peak RSS MB", static_cast<double>(summary.peakRss) / 1e6);
+        output << fmt::format("|{:<32}{:<48}|\n", "allocations", summary.allocations);
+        output << fmt::format("|{:<32}{:<48.1f}|\n", "allocated MB", static_cast<double>(summary.allocated) / 1e6);
+    }
+
+    /**
+     * \brief Вывод замеров в JSON
+     * @param output Поток вывода
+     */
+    void writeJson(std::ostream& output) {
+        Summary summary = summarize();
+        output << "{\n  \"stages\": {";
+        bool first = true;
+        for (int i = 0; i < numOfProfileStages; ++i) {
+            if (summary.counters.calls[i] == 0)
+                continue;
+            output << fmt::format("{}\n    \"{}\": {{\"calls\": {}, \"seconds\": {:.6f}}}", first ? "" : ",",
+                                  profileStageName(i), summary.counters.calls[i], summary.stageSeconds(i));
+            first = false;
+        }
+        output << fmt::format("\n  }},\n  \"wall_seconds\": {:.6f},\n  \"packets\": {},\n  \"bytes\": {},\n"
+                              "  \"packets_per_second\": {:.0f},\n  \"mb_per_second\": {:.3f},\n"
+                              "  \"peak_rss_bytes\": {},\n  \"allocations\": {},\n  \"allocated_bytes\": {}\n}}\n",
+                              summary.wallSeconds, summary.counters.packets, summary.counters.bytes,
+                              summary.packetsPerSecond(), summary.megabytesPerSecond(), summary.peakRss,
+                              summary.allocations, summary.allocated);
+    }
+
+private:
+    //! Итог замеров
+    struct Summary {
+        //! Сумма счетчиков потоков
+        ProfileCounters counters;
+        //! Время работы, с
+        double wallSeconds = 0;
+        //! Тактов в секунду
+        double ticksPerSecond = 1e9;
+        //! Сумма времени всех этапов, с
+        double stagesSeconds = 0;
+        //! Пиковая память, байт
+        uint64_t peakRss = 0;
+        //! Число выделений памяти
+        uint64_t allocations = 0;
+        //! Число выделенных байт
+        uint64_t allocated = 0;
+
+        double stageSeconds(int stage) const { return static_cast<double>(counters.ticks[stage]) / ticksPerSecond; }
+        double packetsPerSecond() const {
+            return wallSeconds > 0 ? static_cast<double>(counters.packets) / wallSeconds : 0.0;
+        }
+        double megabytesPerSecond() const {
+            return wallSeconds > 0 ? static_cast<double>(counters.bytes) / 1e6 / wallSeconds : 0.0;
+        }
+    };
+
+    Profiler() { start(); }
+
+    ProfileCounters* registerThread() {
+        std::lock_guard<std::mutex> lock(countersMutex);
+        allCounters.emplace_back(new ProfileCounters());
+        return allCounters.back().get();
+    }
+
+    Summary summarize() {
+        Summary summary;
+        summary.counters = total();
+        uint64_t ticks = profileTicks() - startTicks;
+        summary.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        if (summary.wallSeconds > 0 && ticks > 0)
+            summary.ticksPerSecond = static_cast<double>(ticks) / summary.wallSeconds;
+        for (int i = 0; i < numOfProfileStages; ++i)
+            summary.stagesSeconds += summary.stageSeconds(i);
+        summary.peakRss = peakRss();
+        summary.allocations = allocationCounters().count;
+        summary.allocated = allocationCounters().bytes;
+        return summary;
+    }
+
+    //! Такты в начале замеров
+    uint64_t startTicks = 0;
+    //! Время начала замеров
+    std::chrono::steady_clock::time_point startTime;
+    //! Блокировка списка счетчиков
+    std::mutex countersMutex;
+    //! Счетчики всех потоков (живут до конца программы, потоки могут завершиться раньше вывода)
+    std::vector<std::unique_ptr<ProfileCounters>> allCounters;
+};
+
+//! Замер этапа
+/**
+ * \brief Время от создания до уничтожения объекта добавляется к этапу
+ *
+ * Без SFT_PROFILING объект пуст и исчезает при компиляции, с SFT_PROFILING при выключенном режиме замеров
+ * стоимость - одна проверка флага
+ */
+class ProfileScope {
+public:
+#if defined(SFT_PROFILING)
+    //! Конструктор
+    /**
+     * @param stage Этап обработки
+     */
+    explicit ProfileScope(ProfileStage stage) : stage(stage), begin(profileMode ? profileTicks() : 0) {}
+
+    //! Деструктор
+    ~ProfileScope() {
+        if (profileMode) {
+            ProfileCounters& counters = Profiler::instance().threadCounters();
+            counters.ticks[stage] += profileTicks() - begin;
+            ++counters.calls[stage];
+        }
+    }
+#else
+    explicit ProfileScope(ProfileStage) {}
+#endif
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+#if defined(SFT_PROFILING)
+    //! Этап обработки
+    ProfileStage stage;
+    //! Такты в начале замера
+    uint64_t begin;
+#endif
+};
+
+/**
+ * \brief Учет прочитанного пакета
+ * @param bytes Число байт пакета
+ */
+inline void profilePacket(size_t bytes) {
+#if defined(SFT_PROFILING)
+    if (profileMode) {
+        ProfileCounters& counters = Profiler::instance().threadCounters();
+        ++counters.packets;
+        counters.bytes += bytes;
+    }
+#else
+    (void) bytes;
+#endif
+}
+
+#endif // PROFILER_H
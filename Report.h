@@ -0,0 +1,631 @@
+/**
+ \file
+ \brief Заголовочный файл с записью отчета
+
+ Данный файл содержит запись собранной статистики в поток в форматах txt и csv. Функции используются программой и
+ набором бенчмарков
+*/
+
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <cmath>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fmt/format.h>
+#include "StatsCollector.h"
+
+//! Минимальный процент содержания порта в трафике для отображения в статистике (определяется в программе)
+extern double minimalPercPort;
+//! Минимальный процент содержания IP адреса в трафике для отображения в статистике (определяется в программе)
+extern double minimalPercIP;
+//! Формат файла с результатом (определяется в программе)
+extern std::string fileFormat;
+//! Длина префикса, до которой укрупняются адреса назначения в отчете (0 - без укрупнения, определяется в программе)
+extern unsigned subnetRollup;
+
+/**
+ * \brief Функция для получения процентной статистики
+ * @param totalValues количество определенных элементов в выборке
+ * @param allValues количество всех элементов в выборке
+ * @return Процент от общего количества
+ */
+inline double getPerc(const size_t& totalValues, const size_t& allValues) {
+    return (static_cast<double>(totalValues) / static_cast<double>(allValues)) * 100.0;
+}
+
+inline double getPerc(const uint32_t & totalValues, const size_t& allValues) {
+    return getPerc(static_cast<size_t>(totalValues), allValues);
+}
+
+//! Выборка отчета
+/**
+ * \brief Доля пакетов, по которой собрана статистика отчета
+ *
+ * Устанавливается writeResults на время записи отчета по выборке, 1 - статистика собрана по всем пакетам
+ */
+inline double& reportSampleFraction() {
+    static double fraction = 1.0;
+    return fraction;
+}
+
+//! Заголовок столбца процентов (с доверительным интервалом, если отчет собран по выборке)
+inline std::string percHeader() {
+    if (reportSampleFraction() >= 1.0)
+        return "perc";
+    return fileFormat == "csv" ? "perc,ci95" : "perc +-ci95";
+}
+
+/**
+ * \brief Значение процента для отчета
+ * @param perc Процент
+ * @param allValues Оценка числа всех элементов, от которого считается процент
+ * @return Процент, а для отчета по выборке - процент и половина 95% доверительного интервала
+ *
+ * Интервал нормального приближения для доли выборки без возвращения: 1.96 * sqrt(p (1 - p) / n * (1 - n / N)),
+ * где n - число элементов выборки, N - число всех элементов
+ */
+inline std::string percCell(double perc, size_t allValues) {
+    double fraction = reportSampleFraction();
+    if (fraction >= 1.0)
+        return fmt::format("{:.3}", perc);
+    double sampled = static_cast<double>(allValues) * fraction;
+    double share = perc / 100.0;
+    double halfWidth = sampled > 0 ? 196.0 * std::sqrt(share * (1.0 - share) / sampled * (1.0 - fraction)) : 100.0;
+    return fmt::format((fileFormat == "csv" ? "{:.3},{:.2}" : "{:.3}+-{:.2}"), perc, halfWidth);
+}
+
+/**
+ * \brief Метод для записи статистики "полезной нагрузки"
+ * \author Jodode
+ * \version 0.1
+ * @param histogram Распределение размеров "полезной нагрузки" пакетов протокола X (UDP/TCP)
+ * @param protocol Протокол X (UDP/TCP)
+ * @param output Поток для записи результатов
+ *
+ * Внутри метода распределение пакетов по байт-интервалам приводится к виду с последним интервалом, ограниченным
+ * максимумом, а затем результат записывается в указанный пользователем поток, существует автоматическое определение
+ * формата вывода (csv,txt)
+ */
+inline void writePayloadLen(const PayloadHistogram& histogram, const std::string& protocol, std::ostream& output) {
+    const size_t max = histogram.max;
+    const auto& intervals = histogram.buckets;
+    auto depth = max > 0 ? static_cast<size_t>(std::log2(static_cast<double>(max))) : 0;
+    size_t countOfMaxes = histogram.countOfMax;
+
+    size_t totalPackets = 0;
+    for (auto& count : intervals)
+        totalPackets += count;
+
+    output << fmt::format((fileFormat == "csv" ? "{}\n{},{},{}\n" : "|{:=^48}|\n|{:^16}{:^16}{:^16}|\n"),
+                          protocol + " payload length", "interval", "count", percHeader());
+    output << fmt::format((fileFormat == "csv" ? "{},{},{}\n" : "|{:<16}{:<16}{:<16}|\n"), 0, intervals[0],
+                          percCell(getPerc(intervals[0], totalPackets), totalPackets));
+    for (size_t lower_bound = 1, upper_bound = 20, i = 1; i < depth; lower_bound = upper_bound, upper_bound *= 2, ++i) {
+
+        std::string perc = percCell(getPerc(intervals[i], totalPackets), totalPackets);
+        std::string percMax = percCell(getPerc(countOfMaxes, totalPackets), totalPackets);
+        if (upper_bound > max) {
+            upper_bound = max + 1;
+
+            output << fmt::format((fileFormat == "csv" ? "{},{},{}\n" : "|{:<16}{:<16}{:<16}|\n"),
+                                  fmt::format("{}-{}", lower_bound, upper_bound-1), intervals[i], perc);
+            output << fmt::format((fileFormat == "csv" ? "{},{},{}\n" : "|{:<16}{:<16}{:<16}|\n"),
+                                  fmt::format("{}-max", max), countOfMaxes, percMax);
+            break;
+        } else {
+            output << fmt::format((fileFormat == "csv" ? "{},{},{}\n" : "|{:<16}{:<16}{:<16}|\n"),
+                                  fmt::format("{}-{}", lower_bound, upper_bound-1), intervals[i], perc);
+        }
+    }
+}
+
+/**
+ * \brief Метод для записи квантилей размеров "полезной нагрузки"
+ * \author Jodode
+ * \version 0.1
+ * @param udpQuantiles Квантили размеров UDP пакетов
+ * @param tcpQuantiles Квантили размеров TCP пакетов
+ * @param output Поток для записи результатов
+ *
+ * Записывает медиану, p90, p99 и p99.9 по обоим протоколам, оценка отличается от точного значения не больше чем на
+ * относительную ошибку скетча. Для протокола без пакетов выводится "-", существует автоматическое определение
+ * формата вывода (csv,txt)
+ */
+inline void writePayloadQuantiles(const DDSketch& udpQuantiles, const DDSketch& tcpQuantiles, std::ostream& output) {
+    output << fmt::format((fileFormat == "csv" ? "{}\n{},{},{}\n" : "|{:=^48}|\n|{:^16}{:^16}{:^16}|\n"),
+                          fmt::format("Payload length quantiles (error {:.2}%)", udpQuantiles.accuracy() * 100.0),
+                          "quantile", "UDP", "TCP");
+    const std::pair<const char*, double> levels[] = {{"p50", 0.5}, {"p90", 0.9}, {"p99", 0.99}, {"p99.9", 0.999}};
+    for (auto& level : levels) {
+        std::string udp = udpQuantiles.count() > 0 ? fmt::format("{:.0f}", udpQuantiles.quantile(level.second)) : "-";
+        std::string tcp = tcpQuantiles.count() > 0 ? fmt::format("{:.0f}", tcpQuantiles.quantile(level.second)) : "-";
+        output << fmt::format((fileFormat == "csv" ? "{},{},{}\n" : "|{:<16}{:<16}{:<16}|\n"), level.first, udp, tcp);
+    }
+}
+
+/**
+ * \brief Метод для записи статистики high-load портов
+ * \author Jodode
+ * \version 0.1
+ * @param dstPorts Счетчики {port : countOfAddress}
+ * @param output Поток для записи результатов
+ *
+ * Внутри метода высчитывается распределение портов в процентах, а затем результат записывается в указанный пользователем
+ * поток, существует автоматическое определение формата вывода (csv,txt). Выводимые данные можно фильтровать с помощью
+ * конфиг файла
+ */
+inline void writeDstPorts(const PortCounter& dstPorts, std::ostream& output) {
+
+    output << fmt::format((fileFormat == "csv" ? "{}\n{},{},{}\n" : "|{:=^48}|\n|{:^16}{:^16}{:^16}|\n"),
+                                "Dest port stats", "port", "count", percHeader());
+
+    size_t totalPortRequests = 0;
+    dstPorts.forEach([&totalPortRequests](uint32_t, uint64_t count) { totalPortRequests += count; });
+
+    dstPorts.forEach([&](uint32_t port, uint64_t count) {
+        double perc = getPerc(count, totalPortRequests);
+        if (perc > minimalPercPort)
+            output << fmt::format((fileFormat == "csv" ? "{},{},{}\n" : "|{:<16}{:<16}{:<16}|\n"),
+                                  port, count, percCell(perc, totalPortRequests));
+    });
+}
+
+/**
+ * \brief Метод для записи статистики high-load IP адресов
+ * \author Jodode
+ * \version 0.1
+ * @param dstIPv4 Счетчики {IP : countOfAddress}
+ * @param output Поток для записи результатов
+ *
+ * Внутри метода высчитывается распределение IP в процентах, а затем результат записывается в указанный пользователем
+ * поток, существует автоматическое определение формата вывода (csv,txt). Выводимые данные можно фильтровать с помощью
+ * конфиг файла. Адреса сортируются только здесь, при записи отчета
+ */
+inline void writeDstIPv4(const IPv4Counter& dstIPv4, std::ostream& output) {
+    output << fmt::format((fileFormat == "csv" ? "{}\n{},{},{}\n" : "|{:=^48}|\n|{:^16}{:^16}{:^16}|\n"),
+                          "Dest IPv4 stats", "IPv4", "count", percHeader());
+    auto dstMap = dstIPv4.sorted();
+    size_t totalIPv4 = 0;
+    for (auto& pair : dstMap)
+        totalIPv4 += pair.second;
+
+    for (auto& pair : dstMap) {
+        double perc = getPerc(pair.second, totalIPv4);
+        if (perc > minimalPercIP)
+            output << fmt::format((fileFormat == "csv" ? "{},{},{}\n" : "|{:<16}{:<16}{:<16}|\n"),
+                                  pcpp::IPv4Address(pair.first).toString(), pair.second, percCell(perc, totalIPv4));
+    }
+}
+
+/**
+ * \brief Метод для записи статистики по именованным подсетям
+ * \author Jodode
+ * \version 0.1
+ * @param dstSubnets Число пакетов по номерам подсетей (0 - вне подсетей)
+ * @param subnets Таблица подсетей
+ * @param output Поток для записи результатов
+ *
+ * Подсети выводятся по убыванию числа пакетов, адреса вне подсетей - отдельной строкой "(other)". Проценты
+ * считаются от всех пакетов с IPv4 заголовком, фильтр MINIMAL_IP_PERC применяется к подсетям
+ */
+inline void writeDstSubnets(const std::vector<uint64_t>& dstSubnets, const SubnetTable& subnets,
+                            std::ostream& output) {
+    output << fmt::format((fileFormat == "csv" ? "{}\n{},{},{}\n" : "|{:=^48}|\n|{:^16}{:^16}{:^16}|\n"),
+                          "Dest subnet stats", "subnet", "count", percHeader());
+    size_t totalIPv4 = 0;
+    std::vector<std::pair<uint32_t, uint64_t>> counts;
+    for (size_t id = 0; id < dstSubnets.size(); ++id) {
+        totalIPv4 += dstSubnets[id];
+        if (id != 0 && dstSubnets[id] != 0)
+            counts.emplace_back(static_cast<uint32_t>(id), dstSubnets[id]);
+    }
+    std::stable_sort(counts.begin(), counts.end(), [](const std::pair<uint32_t, uint64_t>& a,
+                                                      const std::pair<uint32_t, uint64_t>& b) {
+        return a.second > b.second;
+    });
+    for (auto& pair : counts) {
+        double perc = getPerc(pair.second, totalIPv4);
+        if (perc > minimalPercIP)
+            output << fmt::format((fileFormat == "csv" ? "{},{},{}\n" : "|{:<16}{:<16}{:<16}|\n"),
+                                  subnets.name(pair.first), pair.second, percCell(perc, totalIPv4));
+    }
+    if (!dstSubnets.empty() && dstSubnets[0] != 0)
+        output << fmt::format((fileFormat == "csv" ? "{},{},{}\n" : "|{:<16}{:<16}{:<16}|\n"), "(other)",
+                              dstSubnets[0], percCell(getPerc(dstSubnets[0], totalIPv4), totalIPv4));
+}
+
+/**
+ * \brief Метод для записи статистики адресов, укрупненных до префикса
+ * \author Jodode
+ * \version 0.1
+ * @param dstIPv4 Счетчики {IP : countOfAddress}
+ * @param prefixLength Длина префикса (например, 24 или 16)
+ * @param output Поток для записи результатов
+ *
+ * Адреса складываются по префиксам при записи отчета, поэтому укрупнение не стоит ничего при сборе. Префиксы
+ * выводятся по убыванию числа пакетов с фильтром MINIMAL_IP_PERC
+ */
+inline void writeDstIPv4Rollup(const IPv4Counter& dstIPv4, unsigned prefixLength, std::ostream& output) {
+    output << fmt::format((fileFormat == "csv" ? "{}\n{},{},{}\n" : "|{:=^48}|\n|{:^16}{:^16}{:^16}|\n"),
+                          fmt::format("Dest IPv4 /{} stats", prefixLength), "prefix", "count", percHeader());
+    uint32_t mask = prefixLength == 0 ? 0 : ~0u << (32 - prefixLength);
+    IPv4Counter prefixes;
+    size_t totalIPv4 = 0;
+    dstIPv4.forEach([&prefixes, &totalIPv4, mask](uint32_t address, uint64_t count) {
+        prefixes[ipv4FromHost(ipv4ToHost(address) & mask)] += count;
+        totalIPv4 += count;
+    });
+    auto counts = prefixes.sorted();
+    std::stable_sort(counts.begin(), counts.end(), [](const std::pair<uint32_t, uint64_t>& a,
+                                                      const std::pair<uint32_t, uint64_t>& b) {
+        return a.second > b.second;
+    });
+    for (auto& pair : counts) {
+        double perc = getPerc(pair.second, totalIPv4);
+        if (perc > minimalPercIP)
+            output << fmt::format((fileFormat == "csv" ? "{},{},{}\n" : "|{:<16}{:<16}{:<16}|\n"),
+                                  fmt::format("{}/{}", pcpp::IPv4Address(pair.first).toString(), prefixLength),
+                                  pair.second, percCell(perc, totalIPv4));
+    }
+}
+
+/**
+ * \brief Метод для записи наиболее частых IP адресов
+ * \author Jodode
+ * \version 0.1
+ * @param topDstIPv4 Сводка наиболее частых IP адресов
+ * @param output Поток для записи результатов
+ *
+ * Адреса выводятся по убыванию оценки числа обращений. Для каждого адреса указан диапазон, в котором гарантированно
+ * лежит истинное число обращений, а в заголовке - наибольшая возможная переоценка (не больше N / K). Фильтр
+ * MINIMAL_IP_PERC применяется к оценке
+ */
+inline void writeTopDstIPv4(const SpaceSaving<uint32_t>& topDstIPv4, std::ostream& output) {
+    output << fmt::format((fileFormat == "csv" ? "{}\n{},{},{},{},{}\n" : "|{:=^64}|\n|{:^16}{:^16}{:^16}{:^16}|\n"),
+                          fmt::format("Dest IPv4 top {} (max error {})", topDstIPv4.capacity(), topDstIPv4.maxError()),
+                          "IPv4", "count", "perc", (fileFormat == "csv" ? "lower" : "range"), "upper");
+    size_t totalIPv4 = topDstIPv4.total();
+    for (auto& counter : topDstIPv4.top()) {
+        double perc = getPerc(counter.count, totalIPv4);
+        if (perc <= minimalPercIP)
+            continue;
+        std::string address = pcpp::IPv4Address(counter.key).toString();
+        if (fileFormat == "csv")
+            output << fmt::format("{},{},{:.3},{},{}\n", address, counter.count, perc,
+                                  counter.count - counter.error, counter.count);
+        else
+            output << fmt::format("|{:<16}{:<16}{:<16.3}{:<16}|\n", address, counter.count, perc,
+                                  fmt::format("{}-{}", counter.count - counter.error, counter.count));
+    }
+}
+
+/**
+ * \brief Метод для записи распределения протоколов прикладного уровня
+ * \author Jodode
+ * \version 0.1
+ * @param apps Статистика протоколов прикладного уровня
+ * @param output Поток для записи результатов
+ *
+ * Проценты считаются от всех пакетов UDP и TCP, строка "other" - пакеты невключенных и неопределенных протоколов
+ */
+inline void writeAppProtocols(const AppStats& apps, std::ostream& output) {
+    output << fmt::format((fileFormat == "csv" ? "{}\n{},{},{},{}\n" : "|{:=^48}|\n|{:^12}{:^12}{:^12}{:^12}|\n"),
+                          "Application protocols", "protocol", "packets", "bytes", percHeader());
+    size_t transportPackets = 0;
+    for (uint64_t packets : apps.packets)
+        transportPackets += packets;
+    for (int protocol = AppDns; protocol <= numOfAppProtocols; ++protocol) {
+        int index = protocol == numOfAppProtocols ? AppOther : protocol;
+        if (index != AppOther && !(apps.mask & (1u << index)))
+            continue;
+        output << fmt::format((fileFormat == "csv" ? "{},{},{},{}\n" : "|{:<12}{:<12}{:<12}{:<12}|\n"),
+                              appProtocolName(index), apps.packets[index], apps.bytes[index],
+                              percCell(getPerc(apps.packets[index], transportPackets), transportPackets));
+    }
+}
+
+/**
+ * \brief Метод для записи наиболее частых имен
+ * \author Jodode
+ * \version 0.1
+ * @param names Сводка имен
+ * @param title Заголовок раздела
+ * @param output Поток для записи результатов
+ *
+ * Имена выводятся по убыванию оценки с диапазоном, в котором лежит истинное число появлений, как для наиболее частых
+ * IP адресов. Длинные имена в формате txt обрезаются по ширине столбца
+ */
+inline void writeTopNames(const NameTopK& names, const std::string& title, std::ostream& output) {
+    output << fmt::format((fileFormat == "csv" ? "{}\n{},{},{},{}\n" : "|{:=^64}|\n|{:^32}{:^16}{:^16}|\n"),
+                          fmt::format("{} top {} (max error {})", title, names.capacity(), names.maxError()),
+                          "name", "count", (fileFormat == "csv" ? "lower" : "range"), "upper");
+    for (auto& entry : names.top()) {
+        if (fileFormat == "csv")
+            output << fmt::format("{},{},{},{}\n", entry.name, entry.count, entry.count - entry.error, entry.count);
+        else
+            output << fmt::format("|{:<32.31}{:<16}{:<16}|\n", entry.name, entry.count,
+                                  fmt::format("{}-{}", entry.count - entry.error, entry.count));
+    }
+}
+
+/**
+ * \brief Преобразование флагов TCP в строку
+ * @param flags Байт флагов TCP
+ * @return Строка вида "SAF" (флаги в порядке C E U A P R S F)
+ */
+inline std::string tcpFlagsToString(uint8_t flags) {
+    static const char names[] = "FSRPAUEC";
+    std::string result;
+    for (int bit = 7; bit >= 0; --bit)
+        if (flags & (1 << bit))
+            result += names[bit];
+    return result.empty() ? "-" : result;
+}
+
+/**
+ * \brief Метод для записи статистики потоков
+ * \author Jodode
+ * \version 0.1
+ * @param flows Таблица потоков
+ * @param output Поток для записи результатов
+ *
+ * Записывает наибольшие по числу байт потоки и распределение длительностей потоков, существует автоматическое
+ * определение формата вывода (csv,txt)
+ */
+inline void writeFlows(const FlowTable& flows, std::ostream& output) {
+    uint64_t numOfFlows = flows.numOfFlows();
+    output << fmt::format((fileFormat == "csv" ? "{}\n{},{},{},{},{},{},{},{},{}\n"
+                                               : "|{:=^96}|\n|{:^48}{:^12}{:^12}{:^12}{:^12}|\n"),
+                          fmt::format("Top flows by bytes ({} flows)", numOfFlows),
+                          (fileFormat == "csv" ? "src" : "flow"), "packets", "bytes", "duration", "flags",
+                          "sport", "dst", "dport", "proto");
+    for (auto& flow : flows.topFlows()) {
+        std::string src = pcpp::IPv4Address(flow.key.srcIPv4).toString();
+        std::string dst = pcpp::IPv4Address(flow.key.dstIPv4).toString();
+        double duration = static_cast<double>(flow.duration()) / 1e9;
+        if (fileFormat == "csv")
+            output << fmt::format("{},{},{},{:.6f},{},{},{},{},{}\n", src, flow.packets, flow.bytes, duration,
+                                  tcpFlagsToString(flow.tcpFlags), flow.key.srcPort, dst, flow.key.dstPort,
+                                  flow.key.protocol);
+        else
+            output << fmt::format("|{:<48}{:<12}{:<12}{:<12.3f}{:<12}|\n",
+                                  fmt::format("{}:{} > {}:{} {}", src, flow.key.srcPort, dst, flow.key.dstPort,
+                                              flow.key.protocol == ipProtocolTcp ? "TCP" :
+                                              flow.key.protocol == ipProtocolUdp ? "UDP" :
+                                              std::to_string(flow.key.protocol)),
+                                  flow.packets, flow.bytes, duration, tcpFlagsToString(flow.tcpFlags));
+    }
+
+    auto durations = flows.durationHistogram();
+    output << fmt::format((fileFormat == "csv" ? "{}\n{},{},{}\n" : "|{:=^48}|\n|{:^16}{:^16}{:^16}|\n"),
+                          "Flow duration", "interval ms", "count", "perc");
+    size_t last = 0;
+    for (size_t i = 0; i < durations.size(); ++i)
+        if (durations[i] != 0)
+            last = i;
+    for (size_t i = 0; i <= last; ++i) {
+        std::string interval = i == 0 ? "0-1" : fmt::format("{}-{}", 1ULL << (i - 1), 1ULL << i);
+        output << fmt::format((fileFormat == "csv" ? "{},{},{:.3}\n" : "|{:<16}{:<16}{:<16.3}|\n"),
+                              interval, durations[i], getPerc(durations[i], numOfFlows));
+    }
+}
+
+/**
+ * \brief Метод для записи числа уникальных ключей
+ * \author Jodode
+ * \version 0.1
+ * @param stats Модуль числа уникальных ключей
+ * @param output Поток для записи результатов
+ *
+ * Записывает оценки HyperLogLog числа уникальных источников, получателей, пар (адрес, порт) назначения и
+ * 5-кортежей вместе со стандартной относительной ошибкой оценки
+ */
+inline void writeCardinality(const CardinalityModule& stats, std::ostream& output) {
+    output << fmt::format((fileFormat == "csv" ? "{}\n{},{},{}\n" : "|{:=^48}|\n|{:^16}{:^16}{:^16}|\n"),
+                          "Cardinality", "key", "distinct", "error perc");
+    const std::pair<const char*, const HyperLogLog*> sketches[] = {
+            {"src IPv4", &stats.uniqueSrcIPv4},
+            {"dst IPv4", &stats.uniqueDstIPv4},
+            {"dst IPv4:port", &stats.uniqueDstEndpoints},
+            {"5-tuple", &stats.uniqueFlows}};
+    for (auto& sketch : sketches)
+        output << fmt::format((fileFormat == "csv" ? "{},{:.0f},{:.3}\n" : "|{:<16}{:<16.0f}{:<16.3}|\n"),
+                              sketch.first, sketch.second->estimate(), sketch.second->relativeError() * 100.0);
+}
+
+/**
+ * \brief Метод для записи параметров выборки
+ * \author Jodode
+ * \version 0.1
+ * @param stats Хранилище статистики, собранной по выборке (до масштабирования)
+ * @param output Поток для записи результатов
+ *
+ * Записывает режим выборки, число всех пакетов после фильтра и пакетов выборки. Счетчики отчета после этого раздела -
+ * оценки по всему трафику, проценты указаны с 95% доверительным интервалом. Квантили, число уникальных ключей и
+ * потоки описывают только пакеты выборки
+ */
+template <class Collector>
+void writeSampling(const Collector& stats, std::ostream& output) {
+    const PacketSampler& sampler = stats.sampler;
+    std::string mode = sampler.mode() == SampleHash ? fmt::format("hash 1/{}", sampler.rate()) :
+                       sampler.mode() == SampleSystematic ? fmt::format("every {}", sampler.rate()) :
+                       sampler.mode() == SampleBudget ? fmt::format("budget {}", sampler.budget()) : "snapshot";
+    size_t population = stats.totalPackets - stats.filteredPackets;
+    output << fmt::format((fileFormat == "csv" ? "{}\n{},{},{},{}\n" : "|{:=^48}|\n|{:^12}{:^12}{:^12}{:^12}|\n"),
+                          "Sampling (counts are estimates)", "mode", "packets", "sampled", "perc");
+    output << fmt::format((fileFormat == "csv" ? "{},{},{},{:.3}\n" : "|{:^12}{:^12}{:^12}{:^12.3}|\n"), mode,
+                          population, population - stats.skippedPackets, stats.sampleFraction() * 100.0);
+}
+
+/**
+ * \brief Метод для записи разделов модуля UDP и TCP статистики
+ * \author Jodode
+ * \version 0.1
+ * @param module Модуль статистики
+ * @param output Поток для записи результатов
+ */
+inline void writeModule(const TransportModule& module, std::ostream& output) {
+    if (module.udpStats.numOfPackets > 0)
+        writePayloadLen(module.udpStats.payloadLen, "UDP", output);
+    if (module.tcpStats.numOfPackets > 0)
+        writePayloadLen(module.tcpStats.payloadLen, "TCP", output);
+    if (module.udpStats.payloadQuantiles.count() > 0 || module.tcpStats.payloadQuantiles.count() > 0)
+        writePayloadQuantiles(module.udpStats.payloadQuantiles, module.tcpStats.payloadQuantiles, output);
+}
+
+/**
+ * \brief Метод для записи разделов модуля портов назначения
+ * \author Jodode
+ * \version 0.1
+ * @param module Модуль статистики
+ * @param output Поток для записи результатов
+ */
+inline void writeModule(const PortModule& module, std::ostream& output) {
+    if (!module.dstPorts.empty())
+        writeDstPorts(module.dstPorts, output);
+}
+
+/**
+ * \brief Метод для записи разделов модуля IPv4 адресов назначения
+ * \author Jodode
+ * \version 0.1
+ * @param module Модуль статистики
+ * @param output Поток для записи результатов
+ *
+ * Записывает частоты адресов (или наиболее частые адреса), подсети назначения и адреса, укрупненные до
+ * SUBNET_ROLLUP
+ */
+inline void writeModule(const IPv4Module& module, std::ostream& output) {
+    if (module.topDstIPv4.enabled())
+        writeTopDstIPv4(module.topDstIPv4, output);
+    else if (!module.dstIPv4.empty())
+        writeDstIPv4(module.dstIPv4, output);
+    if (module.subnets && !module.dstSubnets.empty())
+        writeDstSubnets(module.dstSubnets, *module.subnets, output);
+    if (subnetRollup > 0 && !module.dstIPv4.empty())
+        writeDstIPv4Rollup(module.dstIPv4, subnetRollup, output);
+}
+
+/**
+ * \brief Метод для записи разделов модуля потоков
+ * \author Jodode
+ * \version 0.1
+ * @param module Модуль статистики
+ * @param output Поток для записи результатов
+ */
+inline void writeModule(const FlowModule& module, std::ostream& output) {
+    if (module.trackFlows && !module.flows.empty())
+        writeFlows(module.flows, output);
+}
+
+/**
+ * \brief Метод для записи разделов модуля протоколов прикладного уровня
+ * \author Jodode
+ * \version 0.1
+ * @param module Модуль статистики
+ * @param output Поток для записи результатов
+ */
+inline void writeModule(const AppModule& module, std::ostream& output) {
+    const AppStats& apps = module.apps;
+    if (!apps.enabled())
+        return;
+    writeAppProtocols(apps, output);
+    if (apps.dnsNames.enabled() && apps.dnsNames.total() > 0)
+        writeTopNames(apps.dnsNames, "DNS query names", output);
+    if (apps.hostNames.enabled() && apps.hostNames.total() > 0)
+        writeTopNames(apps.hostNames, "HTTP Host / TLS SNI", output);
+}
+
+/**
+ * \brief Метод для записи разделов модуля числа уникальных ключей
+ * \author Jodode
+ * \version 0.1
+ * @param module Модуль статистики
+ * @param output Поток для записи результатов
+ */
+inline void writeModule(const CardinalityModule& module, std::ostream& output) {
+    if (module.trackCardinality)
+        writeCardinality(module, output);
+}
+
+/**
+ * \brief Метод для записи распределения запросов между протоколами UDP и TCP
+ * \author Jodode
+ * \version 0.1
+ * @param module Модуль UDP и TCP статистики
+ * @param output Поток для записи результатов
+ */
+inline void writeProtocolsDistribution(const TransportModule& module, std::ostream& output) {
+    output << fmt::format((fileFormat == "csv" ? "{}\n{},{},{}\n" : "|{:=^48}|\n|{:^16}{:^16}{:^16}|\n"),
+                          "Protocols distribution", "protocol", "count", percHeader());
+    size_t transportPackets = module.udpStats.numOfPackets + module.tcpStats.numOfPackets;
+    output << fmt::format((fileFormat == "csv" ? "{},{},{}\n" : "|{:^16}{:<16}{:<16}|\n"), "UDP",
+                          module.udpStats.numOfPackets,
+                          percCell(getPerc(module.udpStats.numOfPackets, transportPackets), transportPackets));
+    output << fmt::format((fileFormat == "csv" ? "{},{},{}\n" : "|{:^16}{:<16}{:<16}|\n"), "TCP",
+                          module.tcpStats.numOfPackets,
+                          percCell(getPerc(module.tcpStats.numOfPackets, transportPackets), transportPackets));
+}
+
+/**
+ * \brief Метод для записи статистики
+ * \author Jodode
+ * \version 0.1
+ * @param stats Хранилище статистики
+ * @param output Поток для записи результатов
+ *
+ * Внутри метода записывается общая информация о пакетах, затем разделы каждого модуля хранилища в порядке набора
+ * модулей, а также дополнительно распределение запросов между протоколами UDP и TCP.
+ */
+template <class... Modules>
+void writeStats(BasicStatsCollector<Modules...>& stats, std::ostream& output) {
+    if (stats.filter || stats.filteredPackets > 0) {
+        output << fmt::format((fileFormat == "csv" ? "{}\n{},{},{},{}\n" : "|{:=^48}|\n|{:^12}{:^12}{:^12}{:^12}|\n"),
+                              "General packets info", "total", "collected", "dropped", "filtered");
+        output << fmt::format((fileFormat == "csv" ? "{},{},{},{}\n" : "|{:^12}{:^12}{:^12}{:^12}|\n"),
+                              stats.totalPackets, stats.totalPackets - stats.droppedPackets - stats.filteredPackets,
+                              stats.droppedPackets, stats.filteredPackets);
+    } else {
+        output << fmt::format((fileFormat == "csv" ? "{}\n{},{},{}\n" : "|{:=^48}|\n|{:^16}{:^16}{:^16}|\n"),
+                              "General packets info", "total", "collected", "dropped");
+        output << fmt::format((fileFormat == "csv" ? "{},{},{}\n" : "|{:^16}{:^16}{:^16}|\n"),
+                              stats.totalPackets, stats.totalPackets - stats.droppedPackets, stats.droppedPackets);
+    }
+    (writeModule(static_cast<const Modules&>(stats), output), ...);
+    if constexpr (BasicStatsCollector<Modules...>::template hasModule<TransportModule>())
+        writeProtocolsDistribution(stats, output);
+}
+
+/**
+ * \brief Метод для записи отчета
+ * \author Jodode
+ * \version 0.1
+ * @param stats Хранилище статистики
+ * @param output Поток для записи результатов
+ *
+ * Если статистика собрана по выборке, отчет пишется по копии хранилища: выборка фиксированного размера учитывается,
+ * счетчики масштабируются на весь трафик, а к процентам добавляются доверительные интервалы. Само хранилище не
+ * меняется, поэтому промежуточные отчеты не мешают продолжению сбора
+ */
+template <class Collector>
+void writeResults(Collector& stats, std::ostream& output) {
+    if (stats.skippedPackets == 0 && stats.sampler.pending() == 0) {
+        writeStats(stats, output);
+        return;
+    }
+    CollectorOptions estimateOptions = stats.options;
+    estimateOptions.columnarWriter = nullptr;
+    Collector estimate(estimateOptions);
+    estimate.merge(stats);
+    estimate.finishSample();
+    writeSampling(estimate, output);
+    reportSampleFraction() = estimate.sampleFraction();
+    estimate.scaleSample();
+    writeStats(estimate, output);
+    reportSampleFraction() = 1.0;
+}
+
+#endif // REPORT_H
@@ -0,0 +1,697 @@
+/**
+ \file
+ \brief Заголовочный файл со снимками статистики
+
+ Данный файл содержит сохранение хранилища статистики в двоичный файл и загрузку его обратно, чтобы отчет по
+ большому архиву трафика строился из снимков без повторного разбора пакетов
+*/
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include "StatsCollector.h"
+#include "InputFiles.h"
+#include "MappedFile.h"
+
+//! Версия формата снимка
+const uint32_t snapshotVersion = 1;
+
+//! Сигнатура файла снимка
+const char snapshotMagic[8] = {'S', 'F', 'T', 'S', 'N', 'A', 'P', '\0'};
+
+//! Тег раздела снимка из четырех символов
+constexpr uint32_t snapshotTag(char a, char b, char c, char d) {
+    return static_cast<uint32_t>(static_cast<uint8_t>(a)) | (static_cast<uint32_t>(static_cast<uint8_t>(b)) << 8) |
+           (static_cast<uint32_t>(static_cast<uint8_t>(c)) << 16) |
+           (static_cast<uint32_t>(static_cast<uint8_t>(d)) << 24);
+}
+
+//! Проверка, похоже ли имя файла на снимок (.sfts)
+inline bool isSnapshotName(const std::string& name) {
+    return name.size() > 5 && name.compare(name.size() - 5, 5, ".sfts") == 0;
+}
+
+//! Запись снимка
+/**
+ * \brief Буфер, в который значения записываются в порядке байт little-endian
+ * \author Jodode
+ * \version 0.1
+ *
+ * Снимок состоит из заголовка (сигнатура, версия) и разделов: тег, длина содержимого, содержимое. Читатель
+ * пропускает разделы с неизвестными тегами, поэтому новые разделы не ломают чтение старыми версиями программы.
+ * Новые поля существующего раздела дописываются в его конец и читаются, только если раздел их содержит
+ */
+class SnapshotWriter {
+public:
+    SnapshotWriter() {
+        buffer.append(snapshotMagic, sizeof(snapshotMagic));
+        u32(snapshotVersion);
+        u32(0);
+    }
+
+    void u8(uint8_t value) { buffer.push_back(static_cast<char>(value)); }
+    void u16(uint16_t value) { put(value, 2); }
+    void u32(uint32_t value) { put(value, 4); }
+    void u64(uint64_t value) { put(value, 8); }
+    void i64(int64_t value) { put(static_cast<uint64_t>(value), 8); }
+    void f64(double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        put(bits, 8);
+    }
+    void bytes(const uint8_t* data, size_t size) { buffer.append(reinterpret_cast<const char*>(data), size); }
+    void str(const std::string& value) {
+        u32(static_cast<uint32_t>(value.size()));
+        buffer.append(value);
+    }
+
+    //! Начало раздела, возвращает смещение поля длины
+    size_t beginSection(uint32_t tag) {
+        u32(tag);
+        size_t lengthOffset = buffer.size();
+        u64(0);
+        return lengthOffset;
+    }
+
+    //! Конец раздела: запись длины содержимого
+    void endSection(size_t lengthOffset) {
+        uint64_t length = buffer.size() - lengthOffset - 8;
+        for (size_t i = 0; i < 8; ++i)
+            buffer[lengthOffset + i] = static_cast<char>((length >> (8 * i)) & 0xFF);
+    }
+
+    //! Содержимое снимка
+    const std::string& data() const { return buffer; }
+
+private:
+    void put(uint64_t value, size_t size) {
+        for (size_t i = 0; i < size; ++i)
+            buffer.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+
+    std::string buffer;
+};
+
+//! Чтение снимка
+/**
+ * \brief Последовательное чтение значений little-endian из массива байт с проверкой границ
+ * \author Jodode
+ * \version 0.1
+ *
+ * Выход за границу не бросает исключение: чтение возвращает нули, а признак ok() сбрасывается
+ */
+class SnapshotReader {
+public:
+    SnapshotReader(const uint8_t* data, size_t size) : cur(data), end(data + size) {}
+
+    uint8_t u8() { return static_cast<uint8_t>(get(1)); }
+    uint16_t u16() { return static_cast<uint16_t>(get(2)); }
+    uint32_t u32() { return static_cast<uint32_t>(get(4)); }
+    uint64_t u64() { return get(8); }
+    int64_t i64() { return static_cast<int64_t>(get(8)); }
+    double f64() {
+        uint64_t bits = get(8);
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    std::string str() {
+        uint32_t size = u32();
+        const uint8_t* data = bytes(size);
+        return data != nullptr ? std::string(reinterpret_cast<const char*>(data), size) : std::string();
+    }
+
+    //! Указатель на size байт без копирования (nullptr, если их нет)
+    const uint8_t* bytes(size_t size) {
+        if (!good || static_cast<size_t>(end - cur) < size) {
+            good = false;
+            return nullptr;
+        }
+        const uint8_t* data = cur;
+        cur += size;
+        return data;
+    }
+
+    //! Число элементов по size байт, которое может поместиться в оставшихся данных
+    bool fits(uint64_t count, size_t size) {
+        if (good && count <= static_cast<uint64_t>(end - cur) / size)
+            return true;
+        good = false;
+        return false;
+    }
+
+    //! Отметка поврежденных данных
+    void fail() { good = false; }
+    //! Признак отсутствия ошибок чтения
+    bool ok() const { return good; }
+    //! Признак конца данных
+    bool atEnd() const { return cur == end; }
+
+private:
+    uint64_t get(size_t size) {
+        const uint8_t* data = bytes(size);
+        uint64_t value = 0;
+        if (data != nullptr)
+            for (size_t i = 0; i < size; ++i)
+                value |= static_cast<uint64_t>(data[i]) << (8 * i);
+        return value;
+    }
+
+    const uint8_t* cur;
+    const uint8_t* end;
+    bool good = true;
+};
+
+namespace snapshot {
+
+const uint32_t tagOptions = snapshotTag('O', 'P', 'T', 'S');
+const uint32_t tagGeneral = snapshotTag('G', 'E', 'N', 'R');
+const uint32_t tagUdp = snapshotTag('U', 'D', 'P', ' ');
+const uint32_t tagTcp = snapshotTag('T', 'C', 'P', ' ');
+const uint32_t tagPorts = snapshotTag('P', 'O', 'R', 'T');
+const uint32_t tagIPv4 = snapshotTag('I', 'P', 'V', '4');
+const uint32_t tagTopK = snapshotTag('T', 'O', 'P', 'K');
+const uint32_t tagCardinality = snapshotTag('H', 'L', 'L', ' ');
+const uint32_t tagFlows = snapshotTag('F', 'L', 'O', 'W');
+const uint32_t tagFiles = snapshotTag('F', 'I', 'L', 'E');
+const uint32_t tagSubnets = snapshotTag('S', 'U', 'B', 'N');
+const uint32_t tagApps = snapshotTag('A', 'P', 'P', 'S');
+
+inline void writeNames(SnapshotWriter& out, const NameTopK& names) {
+    out.u64(names.capacity());
+    out.u64(names.total());
+    auto entries = names.top();
+    out.u64(entries.size());
+    for (auto& entry : entries) {
+        out.str(entry.name);
+        out.u64(entry.count);
+        out.u64(entry.error);
+    }
+}
+
+inline void readNames(SnapshotReader& in, NameTopK& names) {
+    in.u64();
+    uint64_t total = in.u64();
+    uint64_t count = in.u64();
+    std::vector<NameTopK::Entry> entries;
+    for (uint64_t i = 0; i < count && in.ok(); ++i) {
+        NameTopK::Entry entry;
+        entry.name = in.str();
+        entry.count = in.u64();
+        entry.error = in.u64();
+        entries.push_back(entry);
+    }
+    if (!names.enabled() || !in.ok())
+        return;
+    NameTopK summary(names.capacity());
+    summary.assign(total, entries);
+    names.merge(summary);
+}
+
+inline void writeProtocol(SnapshotWriter& out, const GeneralStats& stats, size_t maxPayload) {
+    out.u64(stats.numOfPackets);
+    out.u64(stats.amountOfPackets);
+    out.u64(maxPayload);
+    out.u64(stats.payloadLen.max);
+    out.u64(stats.payloadLen.countOfMax);
+    for (size_t count : stats.payloadLen.buckets)
+        out.u64(count);
+    const DDSketch& quantiles = stats.payloadQuantiles;
+    out.f64(quantiles.accuracy());
+    out.i64(quantiles.firstIndex());
+    out.u64(quantiles.zeros());
+    out.u64(quantiles.min());
+    out.u64(quantiles.max());
+    out.u64(quantiles.data().size());
+    for (uint64_t count : quantiles.data())
+        out.u64(count);
+}
+
+inline void readProtocol(SnapshotReader& in, GeneralStats& stats, size_t& maxPayload) {
+    stats.numOfPackets = static_cast<size_t>(in.u64());
+    stats.amountOfPackets = in.u64();
+    maxPayload = static_cast<size_t>(in.u64());
+    stats.payloadLen.max = static_cast<size_t>(in.u64());
+    stats.payloadLen.countOfMax = static_cast<size_t>(in.u64());
+    for (size_t& count : stats.payloadLen.buckets)
+        count = static_cast<size_t>(in.u64());
+    if (in.atEnd())
+        return;
+    DDSketch quantiles(in.f64());
+    int64_t firstIndex = in.i64();
+    uint64_t zeros = in.u64();
+    uint64_t min = in.u64();
+    uint64_t max = in.u64();
+    uint64_t count = in.u64();
+    if (!in.fits(count, 8) || count > DDSketch::maxNumOfBins) {
+        in.fail();
+        return;
+    }
+    std::vector<uint64_t> bins(static_cast<size_t>(count));
+    for (uint64_t& bin : bins)
+        bin = in.u64();
+    if (firstIndex < 0 || firstIndex > DDSketch::maxIndex ||
+        !quantiles.restore(static_cast<int>(firstIndex), bins, zeros, min, max))
+        in.fail();
+    else
+        stats.payloadQuantiles = quantiles;
+}
+
+inline void writeFlow(SnapshotWriter& out, const FlowEntry& flow) {
+    out.u32(flow.key.srcIPv4);
+    out.u32(flow.key.dstIPv4);
+    out.u16(flow.key.srcPort);
+    out.u16(flow.key.dstPort);
+    out.u8(flow.key.protocol);
+    out.u8(flow.tcpFlags);
+    out.u64(flow.packets);
+    out.u64(flow.bytes);
+    out.i64(flow.firstNs);
+    out.i64(flow.lastNs);
+}
+
+//! Размер записи потока в снимке
+const size_t flowRecordSize = 4 + 4 + 2 + 2 + 1 + 1 + 8 * 4;
+
+inline std::vector<FlowEntry> readFlows(SnapshotReader& in) {
+    std::vector<FlowEntry> flows;
+    uint64_t count = in.u64();
+    if (!in.fits(count, flowRecordSize))
+        return flows;
+    flows.resize(static_cast<size_t>(count));
+    for (auto& flow : flows) {
+        flow.key.srcIPv4 = in.u32();
+        flow.key.dstIPv4 = in.u32();
+        flow.key.srcPort = in.u16();
+        flow.key.dstPort = in.u16();
+        flow.key.protocol = in.u8();
+        flow.tcpFlags = in.u8();
+        flow.packets = in.u64();
+        flow.bytes = in.u64();
+        flow.firstNs = in.i64();
+        flow.lastNs = in.i64();
+    }
+    return flows;
+}
+
+} // namespace snapshot
+
+/**
+ * \brief Сохранение снимка статистики
+ * \author Jodode
+ * \version 0.1
+ * @param path Путь до файла снимка
+ * @param stats Хранилище статистики
+ * @param files Обработанные файлы трафика (путь, размер, время изменения)
+ * @param error Описание ошибки
+ * @return false, если снимок не удалось записать
+ *
+ * Снимок пишется во временный файл рядом с целевым и переименовывается, поэтому прерванная запись не оставляет
+ * поврежденного снимка
+ */
+inline bool saveSnapshot(const std::string& path, const StatsCollector& stats, const std::vector<InputFile>& files,
+                         std::string& error) {
+    using namespace snapshot;
+    SnapshotWriter out;
+
+    size_t section = out.beginSection(tagOptions);
+    out.u64(stats.options.topK);
+    out.u8(stats.options.trackFlows ? 1 : 0);
+    out.i64(stats.options.flowTimeoutNs);
+    out.u64(stats.options.topFlows);
+    out.u32(stats.options.hllPrecision);
+    out.str(stats.options.filter);
+    out.u8(static_cast<uint8_t>(stats.options.sampleMode));
+    out.u64(stats.options.sampleRate);
+    out.u64(stats.options.sampleBudget);
+    out.i64(stats.options.timeRange.fromNs);
+    out.i64(stats.options.timeRange.toNs);
+    out.endSection(section);
+
+    section = out.beginSection(tagGeneral);
+    out.u64(stats.totalPackets);
+    out.u64(stats.droppedPackets);
+    out.u64(stats.filteredPackets);
+    out.u64(stats.skippedPackets);
+    out.endSection(section);
+
+    section = out.beginSection(tagUdp);
+    writeProtocol(out, stats.udpStats, stats.udpStats.maxPayload);
+    out.endSection(section);
+
+    section = out.beginSection(tagTcp);
+    writeProtocol(out, stats.tcpStats, stats.tcpStats.maxPayload);
+    out.endSection(section);
+
+    section = out.beginSection(tagPorts);
+    out.u64(stats.dstPorts.size());
+    stats.dstPorts.forEach([&out](uint16_t port, uint64_t count) {
+        out.u16(port);
+        out.u64(count);
+    });
+    out.endSection(section);
+
+    if (stats.topDstIPv4.enabled()) {
+        section = out.beginSection(tagTopK);
+        out.u64(stats.topDstIPv4.capacity());
+        out.u64(stats.topDstIPv4.total());
+        auto counters = stats.topDstIPv4.top();
+        out.u64(counters.size());
+        for (auto& counter : counters) {
+            out.u32(counter.key);
+            out.u64(counter.count);
+            out.u64(counter.error);
+        }
+        out.endSection(section);
+    } else {
+        section = out.beginSection(tagIPv4);
+        out.u64(stats.dstIPv4.size());
+        stats.dstIPv4.forEach([&out](uint32_t address, uint64_t count) {
+            out.u32(address);
+            out.u64(count);
+        });
+        out.endSection(section);
+    }
+
+    if (stats.options.trackCardinality) {
+        section = out.beginSection(tagCardinality);
+        for (const HyperLogLog* sketch : {&stats.uniqueSrcIPv4, &stats.uniqueDstIPv4, &stats.uniqueDstEndpoints,
+                                          &stats.uniqueFlows}) {
+            out.u32(sketch->precision());
+            out.bytes(sketch->data().data(), sketch->data().size());
+        }
+        out.endSection(section);
+    }
+
+    if (stats.options.trackFlows) {
+        section = out.beginSection(tagFlows);
+        out.u64(stats.flows.finishedCount());
+        for (uint64_t count : stats.flows.finishedDurations())
+            out.u64(count);
+        out.u64(stats.flows.finishedTop().size());
+        for (auto& flow : stats.flows.finishedTop())
+            writeFlow(out, flow);
+        out.u64(stats.flows.activeFlows() + stats.flows.boundaryFlows().size());
+        stats.flows.forEachActive([&out](const FlowEntry& flow) { writeFlow(out, flow); });
+        for (auto& flow : stats.flows.boundaryFlows())
+            writeFlow(out, flow);
+        std::vector<FlowTable::Span> coverage = stats.flows.coverage();
+        out.u64(coverage.size());
+        for (auto& span : coverage) {
+            out.i64(span.firstNs);
+            out.i64(span.lastNs);
+        }
+        out.endSection(section);
+    }
+
+    if (stats.options.subnets && !stats.dstSubnets.empty()) {
+        section = out.beginSection(tagSubnets);
+        out.u64(static_cast<uint64_t>(std::count_if(stats.dstSubnets.begin(), stats.dstSubnets.end(),
+                                                    [](uint64_t count) { return count != 0; })));
+        for (size_t id = 0; id < stats.dstSubnets.size(); ++id)
+            if (stats.dstSubnets[id] != 0) {
+                out.str(id == 0 ? std::string() : stats.options.subnets->name(static_cast<uint32_t>(id)));
+                out.u64(stats.dstSubnets[id]);
+            }
+        out.endSection(section);
+    }
+
+    if (stats.apps.enabled()) {
+        section = out.beginSection(tagApps);
+        out.u32(stats.apps.mask);
+        for (size_t i = 0; i < numOfAppProtocols; ++i) {
+            out.u64(stats.apps.packets[i]);
+            out.u64(stats.apps.bytes[i]);
+        }
+        writeNames(out, stats.apps.dnsNames);
+        writeNames(out, stats.apps.hostNames);
+        out.endSection(section);
+    }
+
+    section = out.beginSection(tagFiles);
+    out.u64(files.size());
+    for (auto& file : files) {
+        out.str(file.path);
+        out.u64(file.size);
+        out.i64(file.mtime);
+    }
+    out.endSection(section);
+
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        file.write(out.data().data(), static_cast<std::streamsize>(out.data().size()));
+        file.close();
+        if (!file.good()) {
+            std::remove(tempPath.c_str());
+            error = "Cannot write snapshot " + path;
+            return false;
+        }
+    }
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        std::remove(tempPath.c_str());
+        error = "Cannot rename snapshot to " + path;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * \brief Загрузка снимка статистики с объединением в хранилище
+ * \author Jodode
+ * \version 0.1
+ * @param path Путь до файла снимка
+ * @param stats Хранилище, в которое добавляется статистика снимка
+ * @param files Список обработанных файлов, дополняется файлами снимка
+ * @param warnings Расхождения параметров сбора снимка и хранилища
+ * @param error Описание ошибки
+ * @return false, если файл не является снимком или поврежден (хранилище при этом может быть изменено частично)
+ *
+ * Файл отображается в память, разделы разбираются на месте и сразу добавляются в хранилище, поэтому загрузка
+ * тысяч снимков ограничена скоростью чтения диска. Разделы с неизвестными тегами пропускаются
+ */
+inline bool loadSnapshot(const std::string& path, StatsCollector& stats, std::vector<InputFile>& files,
+                         std::vector<std::string>& warnings, std::string& error) {
+    using namespace snapshot;
+    MappedFile file;
+    if (!file.open(path)) {
+        error = "Cannot open snapshot " + path;
+        return false;
+    }
+    SnapshotReader header(file.data(), file.size());
+    const uint8_t* magic = header.bytes(sizeof(snapshotMagic));
+    if (magic == nullptr || std::memcmp(magic, snapshotMagic, sizeof(snapshotMagic)) != 0) {
+        error = path + " is not a snapshot";
+        return false;
+    }
+    uint32_t version = header.u32();
+    header.u32();
+    if (version == 0 || version > snapshotVersion) {
+        error = "Unsupported snapshot version " + std::to_string(version) + " in " + path;
+        return false;
+    }
+
+    CollectorOptions saved;
+    while (header.ok() && !header.atEnd()) {
+        uint32_t tag = header.u32();
+        uint64_t length = header.u64();
+        const uint8_t* body = header.fits(length, 1) ? header.bytes(static_cast<size_t>(length)) : nullptr;
+        if (body == nullptr)
+            break;
+        SnapshotReader in(body, static_cast<size_t>(length));
+
+        if (tag == tagOptions) {
+            saved.topK = static_cast<size_t>(in.u64());
+            saved.trackFlows = in.u8() != 0;
+            saved.flowTimeoutNs = in.i64();
+            saved.topFlows = static_cast<size_t>(in.u64());
+            saved.hllPrecision = in.u32();
+            if (!in.atEnd())
+                saved.filter = in.str();
+            if (!in.atEnd()) {
+                uint8_t mode = in.u8();
+                saved.sampleMode = mode <= SampleBudget ? static_cast<SampleMode>(mode) : SampleNone;
+                saved.sampleRate = in.u64();
+                saved.sampleBudget = static_cast<size_t>(in.u64());
+            }
+            if (!in.atEnd()) {
+                saved.timeRange.fromNs = in.i64();
+                saved.timeRange.toNs = in.i64();
+            }
+        } else if (tag == tagGeneral) {
+            stats.totalPackets += static_cast<size_t>(in.u64());
+            stats.droppedPackets += static_cast<size_t>(in.u64());
+            if (!in.atEnd())
+                stats.filteredPackets += static_cast<size_t>(in.u64());
+            if (!in.atEnd())
+                stats.skippedPackets += static_cast<size_t>(in.u64());
+        } else if (tag == tagUdp) {
+            UDPStats udp;
+            readProtocol(in, udp, udp.maxPayload);
+            if (udp.payloadQuantiles.count() != udp.numOfPackets ||
+                udp.payloadQuantiles.accuracy() != stats.udpStats.payloadQuantiles.accuracy())
+                warnings.push_back("UDP payload quantiles are missing or use another accuracy, skipped");
+            stats.udpStats.merge(udp);
+        } else if (tag == tagTcp) {
+            TCPStats tcp;
+            readProtocol(in, tcp, tcp.maxPayload);
+            if (tcp.payloadQuantiles.count() != tcp.numOfPackets ||
+                tcp.payloadQuantiles.accuracy() != stats.tcpStats.payloadQuantiles.accuracy())
+                warnings.push_back("TCP payload quantiles are missing or use another accuracy, skipped");
+            stats.tcpStats.merge(tcp);
+        } else if (tag == tagPorts) {
+            uint64_t count = in.u64();
+            if (in.fits(count, 2 + 8))
+                for (uint64_t i = 0; i < count; ++i) {
+                    uint16_t port = in.u16();
+                    stats.dstPorts.add(port, in.u64());
+                }
+        } else if (tag == tagIPv4) {
+            uint64_t count = in.u64();
+            if (in.fits(count, 4 + 8))
+                for (uint64_t i = 0; i < count; ++i) {
+                    uint32_t address = in.u32();
+                    uint64_t packets = in.u64();
+                    if (stats.topDstIPv4.enabled())
+                        stats.topDstIPv4.add(address, packets);
+                    else
+                        stats.dstIPv4[address] += packets;
+                }
+        } else if (tag == tagTopK) {
+            uint64_t capacity = in.u64();
+            uint64_t total = in.u64();
+            uint64_t count = in.u64();
+            std::vector<SpaceSaving<uint32_t>::Counter> counters;
+            if (in.fits(count, 4 + 8 + 8)) {
+                counters.resize(static_cast<size_t>(count));
+                for (auto& counter : counters) {
+                    counter.key = in.u32();
+                    counter.count = in.u64();
+                    counter.error = in.u64();
+                }
+            }
+            if (stats.topDstIPv4.enabled()) {
+                if (capacity != stats.topDstIPv4.capacity())
+                    warnings.push_back("top-k size " + std::to_string(capacity) + " differs from " +
+                                       std::to_string(stats.topDstIPv4.capacity()));
+                SpaceSaving<uint32_t> summary(stats.topDstIPv4.capacity());
+                summary.assign(total, counters);
+                stats.topDstIPv4.merge(summary);
+            } else {
+                warnings.push_back("snapshot holds only top-" + std::to_string(capacity) +
+                                   " IP addresses, their counts are upper bounds");
+                for (auto& counter : counters)
+                    stats.dstIPv4[counter.key] += counter.count;
+            }
+        } else if (tag == tagCardinality && !stats.options.trackCardinality) {
+            warnings.push_back("unique counts skipped, they are not estimated (--cardinality)");
+        } else if (tag == tagCardinality) {
+            for (HyperLogLog* sketch : {&stats.uniqueSrcIPv4, &stats.uniqueDstIPv4, &stats.uniqueDstEndpoints,
+                                        &stats.uniqueFlows}) {
+                unsigned precision = in.u32();
+                if (precision < HyperLogLog::minPrecision || precision > HyperLogLog::maxPrecision)
+                    break;
+                const uint8_t* registers = in.bytes(size_t(1) << precision);
+                if (registers == nullptr)
+                    break;
+                if (!sketch->mergeRegisters(precision, registers)) {
+                    warnings.push_back("HLL precision " + std::to_string(precision) + " differs from " +
+                                       std::to_string(sketch->precision()) + ", unique counts skipped");
+                    break;
+                }
+            }
+        } else if (tag == tagFlows) {
+            uint64_t finished = in.u64();
+            std::array<uint64_t, FlowTable::numOfDurationBuckets> durations{};
+            for (uint64_t& count : durations)
+                count = in.u64();
+            std::vector<FlowEntry> top = readFlows(in);
+            std::vector<FlowEntry> pending = readFlows(in);
+            std::vector<FlowTable::Span> coverage;
+            if (!in.atEnd()) {
+                uint64_t count = in.u64();
+                if (in.fits(count, 8 + 8)) {
+                    coverage.resize(static_cast<size_t>(count));
+                    for (auto& span : coverage) {
+                        span.firstNs = in.i64();
+                        span.lastNs = in.i64();
+                    }
+                }
+            }
+            if (!stats.options.trackFlows)
+                warnings.push_back("flow table skipped, flows are not tracked (--flows)");
+            else if (in.ok())
+                stats.flows.restore(finished, durations, top, pending, coverage);
+        } else if (tag == tagSubnets) {
+            uint64_t count = in.u64();
+            size_t missing = 0;
+            for (uint64_t i = 0; i < count && in.ok(); ++i) {
+                std::string name = in.str();
+                uint64_t packets = in.u64();
+                if (stats.dstSubnets.empty())
+                    continue;
+                uint32_t id = name.empty() ? 0 : stats.options.subnets->find(name);
+                missing += !name.empty() && id == 0 ? 1 : 0;
+                stats.dstSubnets[id] += packets;
+            }
+            if (stats.dstSubnets.empty())
+                warnings.push_back("subnet counters skipped, no subnets are configured");
+            else if (missing > 0)
+                warnings.push_back(std::to_string(missing) + " subnets are not configured, counted as (other)");
+        } else if (tag == tagApps) {
+            unsigned mask = in.u32();
+            for (size_t i = 0; i < numOfAppProtocols; ++i) {
+                uint64_t packets = in.u64();
+                uint64_t bytes = in.u64();
+                if (stats.apps.enabled()) {
+                    stats.apps.packets[i] += packets;
+                    stats.apps.bytes[i] += bytes;
+                }
+            }
+            readNames(in, stats.apps.dnsNames);
+            readNames(in, stats.apps.hostNames);
+            if (!stats.apps.enabled())
+                warnings.push_back("application protocol counters skipped, protocols are not classified (--apps)");
+            else if (mask != stats.apps.mask)
+                warnings.push_back("snapshot classified other application protocols, their counters are merged");
+        } else if (tag == tagFiles) {
+            uint64_t count = in.u64();
+            for (uint64_t i = 0; i < count && in.ok(); ++i) {
+                InputFile input;
+                input.path = in.str();
+                input.size = in.u64();
+                input.mtime = in.i64();
+                if (in.ok())
+                    files.push_back(input);
+            }
+        }
+        if (!in.ok()) {
+            error = "Corrupted section in snapshot " + path;
+            return false;
+        }
+    }
+    if (!header.ok()) {
+        error = "Truncated snapshot " + path;
+        return false;
+    }
+    if (saved.filter != stats.options.filter)
+        warnings.push_back("collected with filter \"" + saved.filter + "\", current filter is \"" +
+                           stats.options.filter + "\"");
+    if (saved.sampleMode != stats.options.sampleMode || saved.sampleRate != stats.options.sampleRate ||
+        saved.sampleBudget != stats.options.sampleBudget)
+        warnings.push_back("sampling differs from the current one, estimates mix different sampling rates");
+    if (saved.timeRange.fromNs != stats.options.timeRange.fromNs ||
+        saved.timeRange.toNs != stats.options.timeRange.toNs)
+        warnings.push_back("collected with a different --from/--to time range");
+    if (saved.trackFlows && stats.options.trackFlows && saved.flowTimeoutNs != stats.options.flowTimeoutNs)
+        warnings.push_back("flow timeout differs from the current one");
+    return true;
+}
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,213 @@
+/**
+ \file
+ \brief Заголовочный файл с поиском наиболее частых ключей
+
+ Данный файл содержит алгоритм Space-Saving, который находит наиболее частые ключи потока в фиксированном объеме
+ памяти с гарантированной оценкой ошибки
+*/
+
+#ifndef SPACE_SAVING_H
+#define SPACE_SAVING_H
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include "FlatCounters.h"
+
+//! Сводка наиболее частых ключей
+/**
+ * \brief Алгоритм Space-Saving (Metwally, Agrawal, El Abbadi) в фиксированном объеме памяти
+ * \author Jodode
+ * \version 0.1
+ *
+ * Хранит не более capacity счетчиков в минимальной куче. Новый ключ при заполненной сводке вытесняет ключ с
+ * наименьшим счетчиком и наследует его значение как ошибку. Гарантии для потока из N элементов и k счетчиков:
+ *  - для каждого ключа сводки истинное число лежит в [count - error, count];
+ *  - error <= N / k, то есть переоценка не больше N / k;
+ *  - любой ключ с истинной частотой больше N / k обязательно присутствует в сводке.
+ * Объединение сводок выполняется по схеме Agarwal et al. и сохраняет эти гарантии для суммарного потока
+ */
+template <typename Key>
+class SpaceSaving {
+public:
+    //! Счетчик ключа
+    struct Counter {
+        //! Ключ
+        Key key;
+        //! Оценка сверху числа появлений
+        uint64_t count;
+        //! Максимальная переоценка
+        uint64_t error;
+    };
+
+    //! Конструктор
+    /**
+     * @param capacity Число счетчиков (0 - сводка отключена)
+     */
+    explicit SpaceSaving(size_t capacity = 0) : maxCounters(capacity), positions(capacity * 2 + 16) {
+        heap.reserve(capacity);
+    }
+
+    //! Признак включенной сводки
+    bool enabled() const { return maxCounters > 0; }
+
+    //! Число счетчиков
+    size_t capacity() const { return maxCounters; }
+
+    //! Число учтенных элементов потока
+    uint64_t total() const { return numOfItems; }
+
+    //! Число ключей в сводке
+    size_t size() const { return heap.size(); }
+
+    //! Максимальная переоценка любого ключа (наименьший счетчик заполненной сводки)
+    uint64_t maxError() const { return heap.size() < maxCounters || heap.empty() ? 0 : heap[0].count; }
+
+    /**
+     * \brief Учет ключа
+     * @param key Ключ
+     * @param weight Число появлений
+     */
+    void add(Key key, uint64_t weight = 1) {
+        numOfItems += weight;
+        uint32_t* position = positions.find(key);
+        if (position != nullptr) {
+            heap[*position].count += weight;
+            siftDown(*position);
+            return;
+        }
+        if (heap.size() < maxCounters) {
+            heap.push_back(Counter{key, weight, 0});
+            positions[key] = static_cast<uint32_t>(heap.size() - 1);
+            siftUp(heap.size() - 1);
+            return;
+        }
+        Counter& minimal = heap[0];
+        positions.erase(minimal.key);
+        minimal.key = key;
+        minimal.error = minimal.count;
+        minimal.count += weight;
+        positions[key] = 0;
+        siftDown(0);
+    }
+
+    /**
+     * \brief Объединение с другой сводкой того же размера
+     * @param other Сводка, собранная по другой части трафика
+     */
+    void merge(const SpaceSaving& other) {
+        if (other.numOfItems == 0)
+            return;
+        uint64_t ownMin = maxError();
+        uint64_t otherMin = other.maxError();
+
+        std::vector<Counter> combined;
+        combined.reserve(heap.size() + other.heap.size());
+        for (auto& counter : heap) {
+            const uint32_t* position = other.positions.find(counter.key);
+            if (position != nullptr) {
+                const Counter& match = other.heap[*position];
+                combined.push_back(Counter{counter.key, counter.count + match.count, counter.error + match.error});
+            } else {
+                combined.push_back(Counter{counter.key, counter.count + otherMin, counter.error + otherMin});
+            }
+        }
+        for (auto& counter : other.heap)
+            if (positions.find(counter.key) == nullptr)
+                combined.push_back(Counter{counter.key, counter.count + ownMin, counter.error + ownMin});
+
+        if (combined.size() > maxCounters) {
+            std::nth_element(combined.begin(), combined.begin() + maxCounters, combined.end(),
+                             [](const Counter& a, const Counter& b) { return a.count > b.count; });
+            combined.resize(maxCounters);
+        }
+        numOfItems += other.numOfItems;
+        rebuild(combined);
+    }
+
+    /**
+     * \brief Ключи сводки по убыванию счетчика
+     * @return Вектор счетчиков
+     */
+    std::vector<Counter> top() const {
+        std::vector<Counter> result(heap);
+        std::sort(result.begin(), result.end(), [](const Counter& a, const Counter& b) {
+            return a.count != b.count ? a.count > b.count : a.key < b.key;
+        });
+        return result;
+    }
+
+    /**
+     * \brief Замена содержимого сохраненными счетчиками
+     * @param itemsTotal Число учтенных элементов потока
+     * @param counters Счетчики (лишние сверх capacity отбрасываются как наименьшие)
+     */
+    void assign(uint64_t itemsTotal, std::vector<Counter> counters) {
+        if (counters.size() > maxCounters) {
+            std::nth_element(counters.begin(), counters.begin() + maxCounters, counters.end(),
+                             [](const Counter& a, const Counter& b) { return a.count > b.count; });
+            counters.resize(maxCounters);
+        }
+        numOfItems = itemsTotal;
+        rebuild(counters);
+    }
+
+    //! Функция очищения
+    void clear() {
+        heap.clear();
+        positions.clear();
+        numOfItems = 0;
+    }
+
+private:
+    void rebuild(std::vector<Counter>& counters) {
+        heap.swap(counters);
+        std::make_heap(heap.begin(), heap.end(), [](const Counter& a, const Counter& b) { return a.count > b.count; });
+        positions.clear();
+        for (size_t i = 0; i < heap.size(); ++i)
+            positions[heap[i].key] = static_cast<uint32_t>(i);
+    }
+
+    void swapNodes(size_t a, size_t b) {
+        std::swap(heap[a], heap[b]);
+        positions[heap[a].key] = static_cast<uint32_t>(a);
+        positions[heap[b].key] = static_cast<uint32_t>(b);
+    }
+
+    void siftUp(size_t i) {
+        while (i > 0) {
+            size_t parent = (i - 1) / 2;
+            if (heap[parent].count <= heap[i].count)
+                break;
+            swapNodes(parent, i);
+            i = parent;
+        }
+    }
+
+    void siftDown(size_t i) {
+        for (;;) {
+            size_t smallest = i;
+            size_t left = 2 * i + 1;
+            size_t right = left + 1;
+            if (left < heap.size() && heap[left].count < heap[smallest].count)
+                smallest = left;
+            if (right < heap.size() && heap[right].count < heap[smallest].count)
+                smallest = right;
+            if (smallest == i)
+                return;
+            swapNodes(i, smallest);
+            i = smallest;
+        }
+    }
+
+    //! Максимальное число счетчиков
+    size_t maxCounters;
+    //! Минимальная куча счетчиков
+    std::vector<Counter> heap;
+    //! Позиции ключей в куче
+    FlatHashMap<Key, uint32_t> positions;
+    //! Число учтенных элементов потока
+    uint64_t numOfItems = 0;
+};
+
+#endif // SPACE_SAVING_H
@@ -10,7 +10,12 @@
 #define STATS_H
 
 #include <map>
+#include <memory>
+#include <array>
 #include <sstream>
+#include <cmath>
+#include <type_traits>
+#include <utility>
 #include "TcpLayer.h"
 #include "UdpLayer.h"
 #include "IPv4Layer.h"
@@ -18,21 +23,114 @@
 #include "PayloadLayer.h"
 #include "PacketUtils.h"
 #include "SystemUtils.h"
+#include "Packet.h"
+#include "PacketDecoder.h"
+#include "FlatCounters.h"
+#include "SpaceSaving.h"
+#include "FlowTable.h"
+#include "HyperLogLog.h"
+#include "DDSketch.h"
+#include "TimeSeries.h"
+#include "PacketFilter.h"
+#include "PacketSampler.h"
+#include "PcapFormat.h"
+#include "ColumnarExport.h"
+#include "SubnetTable.h"
+#include "AppClassifier.h"
+#include "BatchKernels.h"
+#include "Profiler.h"
 
+//! Гистограмма размеров "полезной нагрузки"
 /**
- * \brief Функция для вставки/изменения в словаре
+ * \brief Потоковая гистограмма размеров "полезной нагрузки"
  * \author Jodode
- * @param map Целевой словарь
- * @param val Ключ к словарю
- *
+ * \version 0.1
  *
+ * Хранит число пакетов в интервалах 0, 1-19, 20-39, 40-79, ... (границы удваиваются), а также максимальный размер и
+ * число пакетов с этим размером. Интервал вычисляется за O(1) по старшему биту, память не зависит от размера трафика.
+ * Последний интервал при выводе обрезается по максимуму, поэтому отчет совпадает с подсчетом по всем размерам.
  */
-void upsert(std::map<uint32_t, uint32_t> &map, uint32_t val){
-    if (map.find(val) == map.end())
-        map[val] = 1;
-    else
-        ++map[val];
+struct PayloadHistogram {
+    //! Число интервалов, достаточное для любого size_t
+    static constexpr size_t numOfBuckets = 64;
+
+    /**
+     * \brief Номер интервала для размера
+     * @param length Размер "полезной нагрузки"
+     * @return 0 для пустых пакетов, 1 для 1-19, k для [10 * 2^(k-1), 10 * 2^k)
+     */
+    static size_t bucketOf(size_t length) {
+        if (length == 0)
+            return 0;
+        if (length < 20)
+            return 1;
+        return highestBit(length / 10) + 1;
+    }
+
+    /**
+     * \brief Учет пакета
+     * @param length Размер "полезной нагрузки"
+     */
+    void add(size_t length) {
+        add(length, bucketOf(length));
+    }
+
+    /**
+     * \brief Учет пакета с уже известным интервалом
+     * @param length Размер "полезной нагрузки"
+     * @param bucket Номер интервала (bucketOf(length))
+     */
+    void add(size_t length, size_t bucket) {
+        ++buckets[bucket];
+        if (length > max) {
+            max = length;
+            countOfMax = 1;
+        } else if (length == max) {
+            ++countOfMax;
+        }
+    }
+
+    /**
+     * \brief Объединение с другой гистограммой
+     * @param other Гистограмма, собранная по другой части трафика
+     */
+    void merge(const PayloadHistogram& other) {
+        for (size_t i = 0; i < numOfBuckets; ++i)
+            buckets[i] += other.buckets[i];
+        if (other.max > max) {
+            max = other.max;
+            countOfMax = other.countOfMax;
+        } else if (other.max == max) {
+            countOfMax += other.countOfMax;
+        }
+    }
+
+    //! Функция очищения
+    void clear() {
+        buckets.fill(0);
+        max = 0;
+        countOfMax = 0;
+    }
+
+    //! Количество пакетов в каждом интервале
+    std::array<size_t, numOfBuckets> buckets{};
+    //! Максимальный размер "полезной нагрузки"
+    size_t max = 0;
+    //! Количество пакетов с максимальным размером
+    size_t countOfMax = 0;
+};
+
+//! Масштабирование счетчика выборки
+/**
+ * \brief Масштабирование счетчика, собранного по выборке
+ * @param count Счетчик выборки
+ * @param factor Отношение числа всех пакетов к числу пакетов выборки
+ * @return Оценка счетчика по всему трафику
+ */
+inline uint64_t scaleCount(uint64_t count, double factor) {
+    return static_cast<uint64_t>(std::llround(static_cast<double>(count) * factor));
 }
+
 //! Базовая структура
 /**
  * \brief Структура основной статистики для всех видов протоколов
@@ -49,144 +147,914 @@ struct GeneralStats {
     void clear() {
         numOfPackets = 0;
         amountOfPackets = 0;
-        sizeOfPackets = std::vector<size_t>();
+        payloadLen.clear();
+        payloadQuantiles.clear();
+    }
+
+    /**
+     * \brief Объединение с другой статистикой протокола
+     * @param other Статистика, собранная по другой части трафика
+     */
+    void merge(const GeneralStats& other) {
+        numOfPackets += other.numOfPackets;
+        amountOfPackets += other.amountOfPackets;
+        payloadLen.merge(other.payloadLen);
+        payloadQuantiles.merge(other.payloadQuantiles);
+    }
+
+    /**
+     * \brief Масштабирование счетчиков выборки на весь трафик
+     * @param factor Отношение числа всех пакетов к числу пакетов выборки
+     *
+     * Квантили не зависят от масштаба и не меняются
+     */
+    void scale(double factor) {
+        numOfPackets = scaleCount(numOfPackets, factor);
+        amountOfPackets = scaleCount(amountOfPackets, factor);
+        for (size_t& count : payloadLen.buckets)
+            count = scaleCount(count, factor);
+        payloadLen.countOfMax = scaleCount(payloadLen.countOfMax, factor);
     }
 
     //! Суммарное количество пакетов переданных с помощью протокола
     size_t numOfPackets{};
     //! Суммарный объем пакетов переданных с помощью протокола
     uint64_t amountOfPackets{};
-    //! Вектор, с размерами "полезной нагрузки" каждого пакета
-    std::vector<size_t> sizeOfPackets;
+    //! Распределение размеров "полезной нагрузки" пакетов
+    PayloadHistogram payloadLen;
+    //! Квантили размеров "полезной нагрузки" пакетов
+    DDSketch payloadQuantiles;
 };
-//! UDP структура
+//! Статистика транспортного протокола
 /**
- * \brief Структура статистики для UDP протокола
+ * \brief Структура статистики для UDP и TCP протоколов
  * \author Jodode
  * \version 0.1
  *
- * Данная структура хранит в себе ключевую статистику о UDP пакетах
+ * Данная структура хранит в себе ключевую статистику о пакетах одного транспортного протокола, пакеты UDP и TCP
+ * учитываются одинаково
  */
-struct UDPStats : GeneralStats {
-    //! Максимальный размер "полезной нагрузки" переданной с помощью протокола UDP
-    size_t udpMax = 0;
+struct TransportStats : GeneralStats {
+    //! Максимальный размер "полезной нагрузки" переданной с помощью протокола
+    size_t maxPayload = 0;
 
     /**
      * \brief Обработка слоя
      * \author Jodode
      * \version 0.1
-     * @param udpLayer ссылка на UDP слой
+     * @param layer ссылка на UDP или TCP слой
      *
-     * Функция обрабатывает информацию из UDP слоя и сохраняет её внутри объекта для дальнейшего анализа
+     * Функция обрабатывает информацию из транспортного слоя и сохраняет её внутри объекта для дальнейшего анализа
      */
-    void update(pcpp::UdpLayer* udpLayer) {
-        size_t length = udpLayer->getLayerPayloadSize();
+    void update(const pcpp::Layer* layer) {
+        update(layer->getLayerPayloadSize());
+    }
 
+    /**
+     * \brief Учет пакета
+     * @param length Размер "полезной нагрузки" пакета
+     */
+    void update(size_t length) {
         ++numOfPackets;
-        if (length > udpMax) udpMax = length;
+        addPayload(length, PayloadHistogram::bucketOf(length));
+    }
+
+    /**
+     * \brief Учет размера "полезной нагрузки" без увеличения числа пакетов
+     * @param length Размер "полезной нагрузки" пакета
+     * @param bucket Номер интервала гистограммы (PayloadHistogram::bucketOf)
+     *
+     * Используется пачечным учетом, где число пакетов протокола добавляется сразу за всю пачку
+     */
+    void addPayload(size_t length, size_t bucket) {
+        if (length > maxPayload) maxPayload = length;
         amountOfPackets += length;
-        sizeOfPackets.push_back(length);
+        payloadLen.add(length, bucket);
+        payloadQuantiles.add(length);
+    }
+
+    /**
+     * \brief Объединение с другой статистикой протокола
+     * @param other Статистика, собранная по другой части трафика
+     */
+    void merge(const TransportStats& other) {
+        GeneralStats::merge(other);
+        if (other.maxPayload > maxPayload) maxPayload = other.maxPayload;
+    }
+
+    //! Функция очищения
+    void clear() {
+        GeneralStats::clear();
+        maxPayload = 0;
     }
 };
 
+//! UDP структура
+typedef TransportStats UDPStats;
 //! TCP структура
+typedef TransportStats TCPStats;
+
+//! Параметры сбора
+/**
+ * \brief Параметры, определяющие, какая статистика собирается и сколько памяти она занимает
+ * \author Jodode
+ * \version 0.1
+ */
+struct CollectorOptions {
+    //! Число счетчиков сводки наиболее частых IP адресов (0 - точный подсчет всех адресов)
+    size_t topK = 0;
+    //! Вести таблицу потоков
+    bool trackFlows = false;
+    //! Время бездействия, после которого поток завершается, нс
+    int64_t flowTimeoutNs = 60LL * 1000000000LL;
+    //! Число потоков в отчете
+    size_t topFlows = 10;
+    //! Оценивать число уникальных ключей (скетчи HyperLogLog)
+    bool trackCardinality = false;
+    //! Точность скетчей числа уникальных ключей (4-18, память скетча 2^precision байт)
+    unsigned hllPrecision = 12;
+    //! Относительная ошибка квантилей размеров "полезной нагрузки"
+    double quantileAccuracy = 0.01;
+    //! Выражение BPF, которому должны соответствовать учитываемые пакеты (пустое - без фильтра)
+    std::string filter;
+    //! Режим выборки пакетов
+    SampleMode sampleMode = SampleNone;
+    //! N для выборки 1 из N пакетов
+    uint64_t sampleRate = 1;
+    //! Размер выборки для SampleBudget
+    size_t sampleBudget = 0;
+    //! Интервал времени учитываемых пакетов (применяется читателем, пакеты вне интервала не учитываются)
+    TimeRange timeRange;
+    //! Запись заголовков учтенных пакетов в колоночный файл (nullptr - без записи)
+    ColumnarWriter* columnarWriter = nullptr;
+    //! Именованные подсети для учета адресов назначения (nullptr - без учета, таблица должна быть построена)
+    const SubnetTable* subnets = nullptr;
+    //! Протоколы прикладного уровня, которые определяются (бит 1 << AppProtocol, 0 - без определения)
+    unsigned appProtocols = 0;
+    //! Число счетчиков сводок имен DNS и HTTP/TLS
+    size_t topNames = 20;
+    //! Учитывать пакеты пачками по headerBatchSize (collectRawBatch), иначе по одному
+    bool batchMode = false;
+};
+
+//! Модуль хранилища
 /**
- * \brief Структура статистики для TCP протокола
+ * \brief Обработчики модуля хранилища статистики по умолчанию
  * \author Jodode
  * \version 0.1
  *
- * Данная структура хранит в себе ключевую статистику о TCP пакетах
+ * Модуль - одна статистика, из набора которых собирается хранилище BasicStatsCollector. Модуль конструируется по
+ * параметрам сбора и определяет update (учет заголовков пакета), merge и clear, а при необходимости prepare (разбор
+ * пакета до выборки) и scale (масштабирование счетчиков выборки), иначе используются пустые обработчики отсюда.
+ * Модуль может определить updateBatch (учет пачки заголовков по столбцам HeaderBatch), иначе пачка учитывается
+ * вызовами update. Разделы отчета модуля записывает перегрузка writeModule (Report.h)
  */
-struct TCPStats : GeneralStats {
-    //! Максимальный размер "полезной нагрузки" переданной с помощью протокола TCP
-    size_t tcpMax = 0;
+struct CollectorModule {
+    /**
+     * \brief Разбор пакета до выборки фиксированного размера
+     * @param headers Заголовки пакета
+     * @param counted Пакет учитывается сразу, иначе заголовки откладываются в выборку и данные пакета после вызова
+     *                недоступны
+     */
+    void prepare(PacketHeaders& headers, bool counted) {
+        (void) headers;
+        (void) counted;
+    }
 
     /**
-     * \brief Обработка слоя
-     * \author Jodode
-     * \version 0.1
-     * @param tcpLayer ссылка на TCP слой
+     * \brief Масштабирование счетчиков выборки на весь трафик
+     * @param factor Отношение числа всех пакетов к числу пакетов выборки
+     */
+    void scale(double factor) {
+        (void) factor;
+    }
+};
+
+//! Модуль UDP и TCP статистики
+/**
+ * \brief Число пакетов, объем, распределение и квантили размеров "полезной нагрузки" UDP и TCP
+ * \author Jodode
+ * \version 0.1
+ */
+struct TransportModule : CollectorModule {
+    //! Конструктор
+    /**
+     * @param options Параметры сбора
+     */
+    explicit TransportModule(const CollectorOptions& options) {
+        udpStats.payloadQuantiles = DDSketch(options.quantileAccuracy);
+        tcpStats.payloadQuantiles = DDSketch(options.quantileAccuracy);
+    }
+
+    //! UDP статистика
+    UDPStats udpStats;
+    //! TCP статистика
+    TCPStats tcpStats;
+
+    /**
+     * \brief Учет пакета
+     * @param headers Заголовки пакета
+     */
+    void update(const PacketHeaders& headers) {
+        if (headers.l4Protocol == ipProtocolTcp)
+            tcpStats.update(headers.payloadLen);
+        else if (headers.l4Protocol == ipProtocolUdp)
+            udpStats.update(headers.payloadLen);
+    }
+
+    /**
+     * \brief Учет пачки пакетов
+     * @param batch Пачка заголовков со столбцами
      *
-     * Функция обрабатывает информацию из TCP слоя и сохраняет её внутри объекта для дальнейшего анализа
+     * Число пакетов протоколов и номера интервалов гистограммы посчитаны ядрами пачки
      */
-    void update(pcpp::TcpLayer* tcpLayer) {
-        size_t length = tcpLayer->getLayerPayloadSize();
+    void updateBatch(const HeaderBatch& batch) {
+        udpStats.numOfPackets += batch.numOfUdp;
+        tcpStats.numOfPackets += batch.numOfTcp;
+        for (size_t i = 0; i < batch.count; ++i) {
+            if (batch.protocol[i] == ipProtocolTcp)
+                tcpStats.addPayload(batch.payloadLen[i], batch.payloadBucket[i]);
+            else if (batch.protocol[i] == ipProtocolUdp)
+                udpStats.addPayload(batch.payloadLen[i], batch.payloadBucket[i]);
+        }
+    }
 
-        ++numOfPackets;
-        if (length > tcpMax) tcpMax = length;
-        amountOfPackets += length;
-        sizeOfPackets.push_back(length);
+    /**
+     * \brief Функция объединения
+     * @param other Модуль, заполненный по другой части трафика
+     */
+    void merge(const TransportModule& other) {
+        udpStats.merge(other.udpStats);
+        tcpStats.merge(other.tcpStats);
+    }
+
+    //! Функция очищения
+    void clear() {
+        udpStats.clear();
+        tcpStats.clear();
+    }
+
+    /**
+     * \brief Масштабирование счетчиков выборки на весь трафик
+     * @param factor Отношение числа всех пакетов к числу пакетов выборки
+     */
+    void scale(double factor) {
+        udpStats.scale(factor);
+        tcpStats.scale(factor);
     }
 };
 
-//! Хранилище статистики
+//! Модуль портов назначения
 /**
- * \brief Структура общей статистики
+ * \brief Частота обращений на порты назначения UDP и TCP
+ * \author Jodode
+ * \version 0.1
+ */
+struct PortModule : CollectorModule {
+    //! Конструктор
+    explicit PortModule(const CollectorOptions&) {}
+
+    //! Частота обращений на порты
+    PortCounter dstPorts;
+
+    /**
+     * \brief Учет пакета
+     * @param headers Заголовки пакета
+     */
+    void update(const PacketHeaders& headers) {
+        uint16_t port = transportDstPort(headers);
+        if (port) dstPorts.add(port);
+    }
+
+    /**
+     * \brief Учет пачки пакетов
+     * @param batch Пачка заголовков со столбцами
+     *
+     * Счетчики портов (512 КБ) предвыбираются в кэш за prefetchDistance пакетов до обновления
+     */
+    void updateBatch(const HeaderBatch& batch) {
+        for (size_t i = 0; i < batch.count; ++i) {
+            if (i + prefetchDistance < batch.count)
+                prefetchWrite(dstPorts.slotAddress(batch.dstPort[i + prefetchDistance]));
+            if (batch.dstPort[i]) dstPorts.add(batch.dstPort[i]);
+        }
+    }
+
+    /**
+     * \brief Функция объединения
+     * @param other Модуль, заполненный по другой части трафика
+     */
+    void merge(const PortModule& other) {
+        dstPorts.merge(other.dstPorts);
+    }
+
+    //! Функция очищения
+    void clear() {
+        dstPorts.clear();
+    }
+
+    /**
+     * \brief Масштабирование счетчиков выборки на весь трафик
+     * @param factor Отношение числа всех пакетов к числу пакетов выборки
+     */
+    void scale(double factor) {
+        PortCounter scaledPorts;
+        dstPorts.forEach([&scaledPorts, factor](uint32_t port, uint64_t count) {
+            scaledPorts.add(static_cast<uint16_t>(port), scaleCount(count, factor));
+        });
+        std::swap(dstPorts, scaledPorts);
+    }
+};
+
+//! Модуль IPv4 адресов назначения
+/**
+ * \brief Частота обращений на IPv4 адреса назначения и их подсети
  * \author Jodode
  * \version 0.1
  *
- * Данная структура хранит в себе статистику о различных протоколах (UDP, TCP), а также суммарное число пакетов их трафика,
- * частоту обращений на разные IP адреса и разные порты
+ * Адреса считаются точно или, если задан options.topK, сводкой наиболее частых адресов. Если заданы подсети
+ * (options.subnets), адреса дополнительно относятся к подсетям
+ */
+struct IPv4Module : CollectorModule {
+    //! Конструктор
+    /**
+     * @param options Параметры сбора
+     */
+    explicit IPv4Module(const CollectorOptions& options)
+        : topDstIPv4(options.topK), subnets(options.subnets),
+          dstSubnets(options.subnets ? options.subnets->numOfNames() + 1 : 0) {}
+
+    //! Частота обращений на IP адреса (если сводка наиболее частых адресов отключена)
+    IPv4Counter dstIPv4;
+    //! Наиболее частые IP адреса (если задан options.topK)
+    SpaceSaving<uint32_t> topDstIPv4;
+    //! Именованные подсети (nullptr - без учета подсетей)
+    const SubnetTable* subnets;
+    //! Число пакетов по подсетям назначения, индекс - номер подсети (0 - вне подсетей)
+    std::vector<uint64_t> dstSubnets;
+
+    /**
+     * \brief Учет пакета
+     * @param headers Заголовки пакета, адрес учитывается только для пакетов с IPv4 заголовком
+     */
+    void update(const PacketHeaders& headers) {
+        if (!headers.hasIPv4)
+            return;
+        if (topDstIPv4.enabled())
+            topDstIPv4.add(headers.dstIPv4);
+        else
+            ++dstIPv4[headers.dstIPv4];
+        if (!dstSubnets.empty()) ++dstSubnets[subnets->lookup(headers.dstIPv4)];
+    }
+
+    /**
+     * \brief Учет пачки пакетов
+     * @param batch Пачка заголовков со столбцами
+     *
+     * Ячейки таблицы адресов и записи таблицы подсетей предвыбираются в кэш за prefetchDistance пакетов до
+     * обновления. Сводка наиболее частых адресов обновляется по порядку без предвыборки
+     */
+    void updateBatch(const HeaderBatch& batch) {
+        bool exact = !topDstIPv4.enabled();
+        for (size_t i = 0; i < batch.count; ++i) {
+            size_t ahead = i + prefetchDistance;
+            if (ahead < batch.count && batch.hasIPv4[ahead]) {
+                if (exact) prefetchWrite(dstIPv4.slotAddress(batch.dstIPv4[ahead]));
+                if (!dstSubnets.empty()) prefetchWrite(subnets->slotAddress(batch.dstIPv4[ahead]));
+            }
+            if (!batch.hasIPv4[i])
+                continue;
+            if (exact)
+                ++dstIPv4[batch.dstIPv4[i]];
+            else
+                topDstIPv4.add(batch.dstIPv4[i]);
+            if (!dstSubnets.empty()) ++dstSubnets[subnets->lookup(batch.dstIPv4[i])];
+        }
+    }
+
+    /**
+     * \brief Функция объединения
+     * @param other Модуль, заполненный по другой части трафика
+     */
+    void merge(const IPv4Module& other) {
+        dstIPv4.merge(other.dstIPv4);
+        topDstIPv4.merge(other.topDstIPv4);
+        for (size_t i = 0; i < dstSubnets.size() && i < other.dstSubnets.size(); ++i)
+            dstSubnets[i] += other.dstSubnets[i];
+    }
+
+    //! Функция очищения
+    void clear() {
+        dstIPv4.clear();
+        topDstIPv4.clear();
+        std::fill(dstSubnets.begin(), dstSubnets.end(), 0);
+    }
+
+    /**
+     * \brief Масштабирование счетчиков выборки на весь трафик
+     * @param factor Отношение числа всех пакетов к числу пакетов выборки
+     */
+    void scale(double factor) {
+        IPv4Counter scaledIPv4;
+        dstIPv4.forEach([&scaledIPv4, factor](uint32_t address, uint64_t count) {
+            scaledIPv4[address] = scaleCount(count, factor);
+        });
+        std::swap(dstIPv4, scaledIPv4);
+        for (uint64_t& count : dstSubnets)
+            count = scaleCount(count, factor);
+        if (topDstIPv4.enabled()) {
+            auto counters = topDstIPv4.top();
+            for (auto& counter : counters) {
+                counter.count = scaleCount(counter.count, factor);
+                counter.error = scaleCount(counter.error, factor);
+            }
+            topDstIPv4.assign(scaleCount(topDstIPv4.total(), factor), counters);
+        }
+    }
+};
+
+//! Модуль потоков
+/**
+ * \brief Таблица 5-кортежей (если задан options.trackFlows)
+ * \author Jodode
+ * \version 0.1
  *
+ * При выборке таблица описывает только пакеты выборки и не масштабируется
  */
-struct StatsCollector {
+struct FlowModule : CollectorModule {
     //! Конструктор
-    StatsCollector() { this->clear();}
+    /**
+     * @param options Параметры сбора
+     */
+    explicit FlowModule(const CollectorOptions& options)
+        : flows(options.flowTimeoutNs, options.topFlows), trackFlows(options.trackFlows) {}
+
+    //! Таблица потоков
+    FlowTable flows;
+    //! Вести таблицу потоков
+    bool trackFlows;
+
+    /**
+     * \brief Учет пакета
+     * @param headers Заголовки пакета
+     */
+    void update(const PacketHeaders& headers) {
+        if (trackFlows) flows.update(headers);
+    }
+
+    /**
+     * \brief Функция объединения
+     * @param other Модуль, заполненный по другой части трафика
+     */
+    void merge(const FlowModule& other) {
+        flows.merge(other.flows);
+    }
+
+    //! Функция очищения
+    void clear() {
+        flows.clear();
+    }
+};
+
+//! Модуль протоколов прикладного уровня
+/**
+ * \brief Счетчики протоколов прикладного уровня и сводки имен (если задан options.appProtocols)
+ * \author Jodode
+ * \version 0.1
+ *
+ * Протокол определяется в prepare, до выборки фиксированного размера, пока данные пакета доступны
+ */
+struct AppModule : CollectorModule {
+    //! Конструктор
+    /**
+     * @param options Параметры сбора
+     */
+    explicit AppModule(const CollectorOptions& options) : apps(options.appProtocols, options.topNames) {}
+
+    //! Статистика протоколов прикладного уровня
+    AppStats apps;
+
+    /**
+     * \brief Определение протокола пакета
+     * @param headers Заголовки пакета (заполняется headers.appProtocol)
+     * @param counted Пакет учитывается сразу (иначе имена не учитываются)
+     */
+    void prepare(PacketHeaders& headers, bool counted) {
+        if (!apps.enabled())
+            return;
+        ProfileScope scope(ProfileClassify);
+        apps.classify(headers, counted);
+    }
+
+    /**
+     * \brief Учет пакета
+     * @param headers Заголовки пакета после prepare
+     */
+    void update(const PacketHeaders& headers) {
+        if (apps.enabled() && headers.l4Protocol) apps.count(headers);
+    }
+
+    /**
+     * \brief Функция объединения
+     * @param other Модуль, заполненный по другой части трафика
+     */
+    void merge(const AppModule& other) {
+        apps.merge(other.apps);
+    }
+
+    //! Функция очищения
+    void clear() {
+        apps.clear();
+    }
+
+    /**
+     * \brief Масштабирование счетчиков выборки на весь трафик
+     * @param factor Отношение числа всех пакетов к числу пакетов выборки
+     */
+    void scale(double factor) {
+        for (size_t i = 0; i < numOfAppProtocols; ++i) {
+            apps.packets[i] = scaleCount(apps.packets[i], factor);
+            apps.bytes[i] = scaleCount(apps.bytes[i], factor);
+        }
+        for (NameTopK* names : {&apps.dnsNames, &apps.hostNames}) {
+            auto entries = names->top();
+            for (auto& entry : entries) {
+                entry.count = scaleCount(entry.count, factor);
+                entry.error = scaleCount(entry.error, factor);
+            }
+            names->assign(scaleCount(names->total(), factor), entries);
+        }
+    }
+};
+
+//! Модуль числа уникальных ключей
+/**
+ * \brief Скетчи HyperLogLog числа уникальных адресов, пар (адрес, порт) назначения и 5-кортежей (если задан
+ * options.trackCardinality)
+ * \author Jodode
+ * \version 0.1
+ *
+ * При выборке оценки описывают только пакеты выборки и не масштабируются
+ */
+struct CardinalityModule : CollectorModule {
+    //! Конструктор
+    /**
+     * @param options Параметры сбора
+     */
+    explicit CardinalityModule(const CollectorOptions& options)
+        : uniqueSrcIPv4(options.hllPrecision), uniqueDstIPv4(options.hllPrecision),
+          uniqueDstEndpoints(options.hllPrecision), uniqueFlows(options.hllPrecision),
+          trackCardinality(options.trackCardinality) {}
+
+    //! Число уникальных IPv4 адресов источников
+    HyperLogLog uniqueSrcIPv4;
+    //! Число уникальных IPv4 адресов назначения
+    HyperLogLog uniqueDstIPv4;
+    //! Число уникальных пар (IPv4 адрес назначения, порт назначения)
+    HyperLogLog uniqueDstEndpoints;
+    //! Число уникальных 5-кортежей
+    HyperLogLog uniqueFlows;
+    //! Вести скетчи
+    bool trackCardinality;
+
+    /**
+     * \brief Учет пакета
+     * @param headers Заголовки пакета, учитываются только пакеты с IPv4 заголовком
+     */
+    void update(const PacketHeaders& headers) {
+        if (!trackCardinality || !headers.hasIPv4)
+            return;
+        uint16_t port = transportDstPort(headers);
+        uniqueSrcIPv4.add(headers.srcIPv4);
+        uniqueDstIPv4.add(headers.dstIPv4);
+        if (port) uniqueDstEndpoints.add((static_cast<uint64_t>(headers.dstIPv4) << 16) | port);
+        uniqueFlows.addHash(FlowKey{headers.srcIPv4, headers.dstIPv4, headers.srcPort, headers.dstPort,
+                                    headers.l4Protocol}.hash());
+    }
+
+    /**
+     * \brief Функция объединения
+     * @param other Модуль, заполненный по другой части трафика
+     */
+    void merge(const CardinalityModule& other) {
+        uniqueSrcIPv4.merge(other.uniqueSrcIPv4);
+        uniqueDstIPv4.merge(other.uniqueDstIPv4);
+        uniqueDstEndpoints.merge(other.uniqueDstEndpoints);
+        uniqueFlows.merge(other.uniqueFlows);
+    }
+
+    //! Функция очищения
+    void clear() {
+        uniqueSrcIPv4.clear();
+        uniqueDstIPv4.clear();
+        uniqueDstEndpoints.clear();
+        uniqueFlows.clear();
+    }
+};
+
+//! Признак пачечного обработчика модуля
+/**
+ * \brief true, если у модуля есть updateBatch(const HeaderBatch&)
+ */
+template <class Module, class = void>
+struct HasBatchUpdate : std::false_type {};
+
+template <class Module>
+struct HasBatchUpdate<Module, std::void_t<decltype(std::declval<Module&>().updateBatch(
+        std::declval<const HeaderBatch&>()))>> : std::true_type {};
+
+//! Хранилище статистики
+/**
+ * \brief Структура общей статистики из набора модулей
+ * \author Jodode
+ * \version 0.1
+ *
+ * Данная структура хранит в себе суммарное число пакетов трафика, фильтр и выборку пакетов, а статистику собирают
+ * модули (TransportModule, PortModule, ...), от которых хранилище наследуется, поэтому поля модулей доступны как
+ * поля хранилища. Обработчики модулей вызываются свертками по набору Modules, набор известен при компиляции: модули
+ * вне набора не занимают памяти и не стоят времени на горячем пути
+ */
+template <class... Modules>
+struct BasicStatsCollector : Modules... {
+    //! Конструктор
+    /**
+     * @param options Параметры сбора
+     */
+    explicit BasicStatsCollector(const CollectorOptions& options = CollectorOptions())
+        : Modules(options)..., options(options),
+          filter(options.filter.empty() ? nullptr : new PacketFilter(options.filter)),
+          sampler(options.sampleMode, options.sampleRate, options.sampleBudget),
+          columns(options.columnarWriter ? new ColumnarBuffer(options.columnarWriter) : nullptr),
+          batch(options.batchMode ? new HeaderBatch() : nullptr) {
+        this->clear();
+    }
     //! Деструктор
-    ~StatsCollector() = default;
+    ~BasicStatsCollector() = default;
 
-    //! UDP статистика
-    UDPStats udpStats;
-    //! TCP статистика
-    TCPStats tcpStats;
+    //! Признак модуля в наборе хранилища
+    template <class Module>
+    static constexpr bool hasModule() {
+        return (std::is_same<Module, Modules>::value || ...);
+    }
+
+    //! Параметры сбора
+    CollectorOptions options;
     //! Общее число пакетов в траффике
     size_t totalPackets{};
     //! Число пакетов не относящихся к UDP/TCP
     size_t droppedPackets{};
-    //! Частота обращений на порты
-    std::map<uint32_t, uint32_t> dstPorts;
-    //! Частота обращений на IP адреса
-    std::map<uint32_t, uint32_t> dstIPv4;
+    //! Число пакетов, отброшенных фильтром
+    size_t filteredPackets{};
+    //! Число пакетов, не попавших в выборку
+    size_t skippedPackets{};
+    //! Временной ряд по интервалам (если задан, пакеты должны поступать из одного потока в порядке времени)
+    IntervalSeries* series = nullptr;
+    //! Фильтр пакетов (если задан options.filter)
+    std::unique_ptr<PacketFilter> filter;
+    //! Выборка пакетов (если задан options.sampleMode)
+    PacketSampler sampler;
+    //! Записи для колоночного файла (если задан options.columnarWriter)
+    std::unique_ptr<ColumnarBuffer> columns;
+    //! Пачка заголовков (если задан options.batchMode)
+    std::unique_ptr<HeaderBatch> batch;
 
     //! Функция очищения
     /**
      * Очищает значения всех переменных и объектов класса
      */
     void clear() {
-        udpStats.clear();
-        tcpStats.clear();
         totalPackets = 0;
         droppedPackets = 0;
-        dstPorts = std::map<uint32_t, uint32_t>();
+        filteredPackets = 0;
+        skippedPackets = 0;
+        sampler.clear();
+        (Modules::clear(), ...);
+    }
+
+    /**
+     * \brief Функция объединения хранилищ
+     * \author Jodode
+     * \version 0.1
+     * @param other Хранилище, заполненное по другой части трафика (например, другим потоком)
+     *
+     * Складывает счетчики и распределения, после объединения хранилище описывает весь обработанный трафик
+     */
+    void merge(const BasicStatsCollector& other) {
+        totalPackets += other.totalPackets;
+        droppedPackets += other.droppedPackets;
+        filteredPackets += other.filteredPackets;
+        skippedPackets += other.skippedPackets;
+        size_t evicted = sampler.merge(other.sampler);
+        totalPackets += evicted;
+        skippedPackets += evicted;
+        (Modules::merge(static_cast<const Modules&>(other)), ...);
     }
 
     /**
      * \brief Функция "сбора" пакета в хранилище
      * \author Jodode
      * \version 0.1
-     * @param packet пакет прошедший парсинг из "сырых" данных
+     * @param headers Заголовки пакета
      *
-     * Обновляет значение переменных в хранилище, определяет тип пакета и отправляет на обработку, затем записывает
-     * информацию об IP адресе и порте
+     * Обновляет значение переменных в хранилище и передает заголовки всем модулям. Пакеты не UDP и не TCP
+     * учитываются в droppedPackets
      */
-    void collectPacket (pcpp::Packet &packet) {
+    void collectHeaders(const PacketHeaders& headers) {
+        ProfileScope scope(ProfileCollect);
         ++totalPackets;
-        uint32_t port(0);
-        if (packet.isPacketOfType(pcpp::TCP)) {
-            auto* tcp = packet.getLayerOfType<pcpp::TcpLayer>();
-            tcpStats.update(tcp);
-            port = tcp->getDstPort();
-        } else if (packet.isPacketOfType(pcpp::UDP)) {
-            auto* udp = packet.getLayerOfType<pcpp::UdpLayer>();
-            udpStats.update(udp);
-            port = udp->getDstPort();
-        } else {
+        if (columns) columns->add(headers);
+        if (headers.l4Protocol != ipProtocolTcp && headers.l4Protocol != ipProtocolUdp)
             ++droppedPackets;
+        (Modules::update(headers), ...);
+        if (series) series->update(headers);
+    }
+
+    /**
+     * \brief Функция "сбора" пакета в хранилище
+     * \author Jodode
+     * \version 0.1
+     * @param packet пакет прошедший парсинг из "сырых" данных
+     */
+    void collectPacket (pcpp::Packet &packet) {
+        PacketHeaders headers;
+        {
+            ProfileScope scope(ProfileParse);
+            headersFromPacket(packet, headers);
+        }
+        (Modules::prepare(headers, true), ...);
+        collectHeaders(headers);
+    }
+
+    /**
+     * \brief Функция "сбора" "сырого" пакета в хранилище
+     * \author Jodode
+     * \version 0.1
+     * @param rawPacket "сырой" пакет
+     */
+    void collectRawPacket(pcpp::RawPacket& rawPacket) {
+        PacketHeaders headers;
+        uint64_t sampleKey = 0;
+        if (!decodeRawPacket(rawPacket, headers, sampleKey))
+            return;
+        if (sampler.mode() == SampleBudget) {
+            size_t evicted = sampler.offer(sampleKey, headers);
+            totalPackets += evicted;
+            skippedPackets += evicted;
+            return;
+        }
+        collectHeaders(headers);
+    }
+
+    /**
+     * \brief Функция "сбора" пачки "сырых" пакетов в хранилище
+     * \author Jodode
+     * \version 0.1
+     * @param packets "Сырые" пакеты, данные всех пакетов должны быть доступны до конца вызова
+     * @param count Число пакетов
+     * @param owners Номера обработчиков пакетов, nullptr - учитываются все пакеты
+     * @param owner Номер обработчика: учитываются только пакеты с owners[i] == owner
+     *
+     * Пакеты разбираются как в collectRawPacket в заголовки пачки по headerBatchSize, затем каждая пачка учитывается
+     * целиком (collectBatch). Без options.batchMode и при выборке фиксированного размера пакеты учитываются по одному
+     */
+    template <class Packet>
+    void collectRawBatch(Packet* packets, size_t count, const uint16_t* owners = nullptr, uint16_t owner = 0) {
+        if (!batch || sampler.mode() == SampleBudget) {
+            for (size_t i = 0; i < count; ++i)
+                if (!owners || owners[i] == owner)
+                    collectRawPacket(packets[i]);
+            return;
+        }
+        uint64_t sampleKey = 0;
+        for (size_t first = 0; first < count; first += headerBatchSize) {
+            size_t last = std::min(count, first + headerBatchSize);
+            batch->count = 0;
+            for (size_t i = first; i < last; ++i)
+                if ((!owners || owners[i] == owner) &&
+                    decodeRawPacket(packets[i], batch->headers[batch->count], sampleKey))
+                    ++batch->count;
+            collectBatch(*batch);
+        }
+    }
+
+    /**
+     * \brief Функция "сбора" пачки заголовков в хранилище
+     * \author Jodode
+     * \version 0.1
+     * @param headerBatch Пачка с заполненными заголовками headers[0..count)
+     *
+     * Заполняет столбцы пачки и считает по ним ядра, затем передает пачку модулям: модули с updateBatch учитывают
+     * столбцы, остальные - заголовки по одному. Результат совпадает с учетом тех же заголовков через collectHeaders
+     */
+    void collectBatch(HeaderBatch& headerBatch) {
+        ProfileScope scope(ProfileCollect);
+        headerBatch.finish();
+        totalPackets += headerBatch.count;
+        droppedPackets += headerBatch.count - headerBatch.numOfUdp - headerBatch.numOfTcp;
+        if (columns || series)
+            for (size_t i = 0; i < headerBatch.count; ++i) {
+                if (columns) columns->add(headerBatch.headers[i]);
+                if (series) series->update(headerBatch.headers[i]);
+            }
+        (updateModuleBatch<Modules>(headerBatch), ...);
+    }
+
+    /**
+     * \brief Учет выборки фиксированного размера
+     *
+     * Заголовки пакетов выборки SampleBudget учитываются в хранилище в порядке времени. Вызывается после окончания
+     * сбора и перед сохранением снимка или записью отчета
+     */
+    void finishSample() {
+        sampler.drain([this](const PacketHeaders& headers) { collectHeaders(headers); });
+    }
+
+    //! Отношение числа учтенных пакетов ко всем пакетам после фильтра (1, если выборки не было)
+    double sampleFraction() const {
+        size_t population = totalPackets - filteredPackets;
+        return population > 0 && skippedPackets > 0
+               ? static_cast<double>(population - skippedPackets) / static_cast<double>(population) : 1.0;
+    }
+
+    /**
+     * \brief Масштабирование счетчиков выборки на весь трафик
+     *
+     * Счетчики пакетов, байт, портов и адресов умножаются на отношение числа всех пакетов к числу пакетов выборки,
+     * skippedPackets обнуляется. Квантили, число уникальных ключей и таблица потоков остаются значениями выборки
+     */
+    void scaleSample() {
+        double fraction = sampleFraction();
+        if (fraction >= 1.0 || fraction <= 0.0)
+            return;
+        double factor = 1.0 / fraction;
+        droppedPackets = scaleCount(droppedPackets, factor);
+        skippedPackets = 0;
+        (Modules::scale(factor), ...);
+    }
+
+private:
+    /**
+     * \brief Фильтр, выборка и разбор "сырого" пакета
+     * @param rawPacket "Сырой" пакет
+     * @param headers Заголовки пакета (заполняются заново)
+     * @param sampleKey Ключ пакета для выборки фиксированного размера
+     * @return false, если пакет отброшен фильтром или не попал в выборку (учтен в filteredPackets или skippedPackets)
+     *
+     * Если задан фильтр, пакет сначала проверяется им. Затем решается, попадает ли пакет в выборку (если она задана).
+     * Заголовки разбираются напрямую по байтам пакета, а если это невозможно (IPv6, туннели, поврежденные заголовки),
+     * пакет разбирается PcapPlusPlus до транспортного уровня. После разбора вызываются обработчики prepare модулей
+     */
+    bool decodeRawPacket(pcpp::RawPacket& rawPacket, PacketHeaders& headers, uint64_t& sampleKey) {
+        if (filter) {
+            ProfileScope scope(ProfileFilter);
+            if (!filter->matches(rawPacket.getRawData(), static_cast<uint32_t>(rawPacket.getRawDataLen()),
+                                 static_cast<uint32_t>(rawPacket.getFrameLength()), rawPacket.getLinkLayerType())) {
+                ++totalPackets;
+                ++filteredPackets;
+                return false;
+            }
+        }
+        if (sampler.enabled() && !sampler.select(rawPacket.getRawData(),
+                                                 static_cast<size_t>(rawPacket.getRawDataLen()),
+                                                 toNanoseconds(rawPacket.getPacketTimeStamp()), sampleKey)) {
+            ++totalPackets;
+            ++skippedPackets;
+            return false;
+        }
+        bool decoded;
+        {
+            ProfileScope scope(ProfileDecode);
+            decoded = decodeHeaders(rawPacket.getRawData(), static_cast<size_t>(rawPacket.getRawDataLen()),
+                                    rawPacket.getLinkLayerType(), headers) == DecodeOk;
+            headers.frameLen = static_cast<size_t>(rawPacket.getFrameLength());
+            headers.timestampNs = toNanoseconds(rawPacket.getPacketTimeStamp());
         }
-        if (port) upsert(dstPorts, port);
-        upsert(dstIPv4, packet.getLayerOfType<pcpp::IPv4Layer>()->getDstIPv4Address().toInt());
+        if (!decoded) {
+            ProfileScope scope(ProfileParse);
+            pcpp::Packet parsedPacket(&rawPacket, false, pcpp::UnknownProtocol, pcpp::OsiModelTransportLayer);
+            headersFromPacket(parsedPacket, headers);
+        }
+        (Modules::prepare(headers, sampler.mode() != SampleBudget), ...);
+        return true;
+    }
 
+    //! Учет пачки модулем: по столбцам, если у модуля есть updateBatch, иначе по заголовкам
+    template <class Module>
+    void updateModuleBatch(const HeaderBatch& headerBatch) {
+        if constexpr (HasBatchUpdate<Module>::value) {
+            Module::updateBatch(headerBatch);
+        } else {
+            for (size_t i = 0; i < headerBatch.count; ++i)
+                Module::update(headerBatch.headers[i]);
+        }
     }
 };
 
-#endif // STATS_H
\ No newline at end of file
+//! Хранилище статистики программы
+/**
+ * Набор модулей по умолчанию, порядок модулей - порядок разделов отчета
+ */
+typedef BasicStatsCollector<TransportModule, PortModule, IPv4Module, FlowModule, AppModule, CardinalityModule>
+        StatsCollector;
+
+#endif // STATS_H
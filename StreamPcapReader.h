@@ -0,0 +1,362 @@
+/**
+ \file
+ \brief Заголовочный файл с читателем pcap/pcapng из потока (stdin, канал)
+
+ Данный файл содержит читателя, который принимает файл трафика из дескриптора без возможности перемотки,
+ например из вывода tcpdump -w -, или сжатый файл трафика. Чтение и распаковка идут крупными блоками в отдельном
+ потоке
+*/
+
+#ifndef STREAM_PCAP_READER_H
+#define STREAM_PCAP_READER_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "PcapFormat.h"
+#include "PacketDecoder.h"
+#include "BatchQueue.h"
+#include "Decompressor.h"
+
+#include <fcntl.h>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+//! Читатель потока
+/**
+ * \brief Читатель pcap/pcapng из дескриптора без перемотки
+ * \author Jodode
+ * \version 0.1
+ *
+ * Поток чтения заполняет блоки по chunkSize байт и передает их через очередь, поэтому разбор пакетов и запись
+ * отчетов не останавливают прием данных, пока в очереди есть свободные блоки. Перед данными блока оставлен запас
+ * headroom байт: запись, разорванная границей блоков, переносится в запас следующего блока, и разбор всегда идет по
+ * непрерывной памяти. Пакеты выдаются как BorrowedRawPacket и действительны до следующего вызова getNextPacket.
+ *
+ * Сжатие (gzip, zstd) определяется по первым байтам данных, тогда поток чтения распаковывает данные прямо в блоки,
+ * и распаковка идет одновременно с разбором пакетов.
+ *
+ * Поток чтения ждет данных через poll вместе с каналом пробуждения: close() пишет в канал, и чтение заканчивается,
+ * даже если в простаивающий канал или терминал больше ничего не приходит (Windows: чтение не прерывается)
+ */
+class StreamPcapReader {
+public:
+    //! Тип пакета, который заполняет читатель
+    typedef BorrowedRawPacket PacketType;
+
+    //! Размер блока чтения
+    static constexpr size_t chunkSize = 1024 * 1024;
+    //! Запас перед данными блока для переноса разорванной записи
+    static constexpr size_t headroom = 256 * 1024;
+    //! Число блоков (заполняемые, ожидающие разбора и разбираемый)
+    static constexpr size_t numOfChunks = 8;
+    //! Размер буфера сжатых данных
+    static constexpr size_t inputSize = 256 * 1024;
+
+    //! Конструктор
+    /**
+     * @param fd Дескриптор для чтения (0 - stdin)
+     */
+    explicit StreamPcapReader(int fd) : fd(fd), filledChunks(numOfChunks), freeChunks(numOfChunks) {}
+
+    //! Конструктор
+    /**
+     * @param path Путь до файла, дескриптор открывается в open() и закрывается в close()
+     */
+    explicit StreamPcapReader(const std::string& path)
+        : fd(-1), path(path), filledChunks(numOfChunks), freeChunks(numOfChunks) {}
+
+    //! Деструктор
+    ~StreamPcapReader() { close(); }
+
+    StreamPcapReader(const StreamPcapReader&) = delete;
+    StreamPcapReader& operator=(const StreamPcapReader&) = delete;
+
+    /**
+     * \brief Запуск чтения и разбор заголовка файла
+     * @return false, если поток пуст или не является pcap/pcapng
+     */
+    bool open() {
+        if (!path.empty()) {
+#if defined(_WIN32)
+            fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+            fd = ::open(path.c_str(), O_RDONLY);
+#endif
+            if (fd < 0)
+                return false;
+        }
+#if defined(_WIN32)
+        _setmode(fd, _O_BINARY);
+#else
+        if (::pipe(wakeFds) != 0)
+            wakeFds[0] = wakeFds[1] = -1;
+#endif
+        for (size_t i = 0; i < numOfChunks; ++i)
+            freeChunks.push(ChunkPtr(new Chunk()));
+        producer = std::thread(&StreamPcapReader::produce, this);
+        PcapRecord record;
+        return nextRecord(record) == PcapRecordParser::Skip && parser.headerParsed();
+    }
+
+    //! Остановка чтения
+    void close() {
+        freeChunks.close();
+        filledChunks.close();
+#if !defined(_WIN32)
+        if (wakeFds[1] >= 0) {
+            char wake = 0;
+            ssize_t written = ::write(wakeFds[1], &wake, 1);
+            (void) written;
+        }
+#endif
+        if (producer.joinable())
+            producer.join();
+#if !defined(_WIN32)
+        for (int& wakeFd : wakeFds) {
+            if (wakeFd >= 0)
+                ::close(wakeFd);
+            wakeFd = -1;
+        }
+#endif
+        current.reset();
+        if (!path.empty() && fd >= 0) {
+#if defined(_WIN32)
+            _close(fd);
+#else
+            ::close(fd);
+#endif
+            fd = -1;
+        }
+    }
+
+    /**
+     * \brief Ограничение чтения интервалом времени, пакеты вне интервала пропускаются без учета
+     * @param range Интервал времени захвата
+     */
+    void setTimeRange(const TimeRange& range) { timeRange = range; }
+
+    /**
+     * \brief Получение следующего пакета
+     * @param rawPacket Пакет, который будет указывать в блок чтения
+     * @return false, если поток закончился или поврежден
+     */
+    bool getNextPacket(BorrowedRawPacket& rawPacket) {
+        PcapRecord record;
+        for (;;) {
+            PcapRecordParser::Status status = nextRecord(record);
+            if (status == PcapRecordParser::Packet &&
+                (!timeRange.bounded() || timeRange.contains(toNanoseconds(record.timestamp)))) {
+                rawPacket.setRawData(record.data, static_cast<int>(record.capLen), record.timestamp,
+                                     record.linkType, static_cast<int>(record.frameLen));
+                return true;
+            }
+            if (status != PcapRecordParser::Skip && status != PcapRecordParser::Packet)
+                return false;
+        }
+    }
+
+    //! Признак поврежденного потока (разбор или распаковка остановлены на ошибке, а не на конце данных)
+    bool corrupted() const { return error || decompressError; }
+
+    //! Сжатие данных (известно после open())
+    Compression compression() const { return inputCompression; }
+
+    //! Признак сжатия, которое не поддерживается сборкой
+    bool unsupported() const { return unsupportedCompression; }
+
+private:
+    //! Блок чтения
+    struct Chunk {
+        Chunk() : storage(headroom + chunkSize) {}
+        //! Память блока: запас и данные
+        std::vector<uint8_t> storage;
+        //! Начало неразобранных данных
+        size_t begin = headroom;
+        //! Конец данных
+        size_t end = headroom;
+    };
+    typedef std::unique_ptr<Chunk> ChunkPtr;
+
+    //! Поток чтения: заполнение свободных блоков
+    void produce() {
+        ChunkPtr chunk;
+        if (!freeChunks.pop(chunk)) {
+            filledChunks.close();
+            return;
+        }
+        // Сжатие определяется по первым байтам, чтение из канала может вернуть их по частям
+        chunk->begin = chunk->end = headroom;
+        long size = 1;
+        while (chunk->end - headroom < compressionMagicLen && size > 0) {
+            size = readSome(chunk->storage.data() + chunk->end, chunkSize - (chunk->end - headroom));
+            if (size > 0)
+                chunk->end += static_cast<size_t>(size);
+        }
+        inputCompression = detectCompression(chunk->storage.data() + headroom, chunk->end - headroom);
+        if (inputCompression != CompressionNone) {
+            std::vector<uint8_t> input(chunk->storage.begin() + static_cast<std::ptrdiff_t>(headroom),
+                                       chunk->storage.begin() + static_cast<std::ptrdiff_t>(chunk->end));
+            freeChunks.push(std::move(chunk));
+            produceDecompressed(input);
+            filledChunks.close();
+            return;
+        }
+
+        while (chunk->end > chunk->begin && filledChunks.push(std::move(chunk)) && freeChunks.pop(chunk)) {
+            chunk->begin = chunk->end = headroom;
+            size = readSome(chunk->storage.data() + headroom, chunkSize);
+            if (size > 0)
+                chunk->end += static_cast<size_t>(size);
+        }
+        filledChunks.close();
+    }
+
+    /**
+     * \brief Распаковка данных в свободные блоки
+     * @param input Уже прочитанные сжатые данные
+     */
+    void produceDecompressed(std::vector<uint8_t>& input) {
+        Decompressor decompressor(inputCompression);
+        if (!decompressor.supported()) {
+            unsupportedCompression = true;
+            return;
+        }
+        size_t inputBegin = 0;
+        size_t inputFilled = input.size();
+        bool inputEnd = false;
+        if (input.size() < inputSize)
+            input.resize(inputSize);
+
+        ChunkPtr chunk;
+        while (freeChunks.pop(chunk)) {
+            chunk->begin = chunk->end = headroom;
+            while (chunk->end < headroom + chunkSize) {
+                if (inputBegin == inputFilled && !inputEnd) {
+                    long size = readSome(input.data(), input.size());
+                    inputBegin = 0;
+                    inputFilled = size > 0 ? static_cast<size_t>(size) : 0;
+                    inputEnd = size <= 0;
+                }
+                size_t consumed = 0;
+                size_t produced = 0;
+                Decompressor::Status status = decompressor.run(input.data() + inputBegin, inputFilled - inputBegin,
+                                                               consumed, chunk->storage.data() + chunk->end,
+                                                               headroom + chunkSize - chunk->end, produced);
+                inputBegin += consumed;
+                chunk->end += produced;
+                if (status == Decompressor::Error || (consumed == 0 && produced == 0 && inputBegin < inputFilled)) {
+                    decompressError = true;
+                    break;
+                }
+                if (inputEnd && produced == 0) {
+                    decompressError = decompressor.unfinished();
+                    break;
+                }
+            }
+            bool last = chunk->end < headroom + chunkSize;
+            if (chunk->end > chunk->begin && !filledChunks.push(std::move(chunk)))
+                return;
+            if (last)
+                return;
+        }
+    }
+
+    //! Чтение из дескриптора, 0 - конец данных или пробуждение из close()
+    long readSome(uint8_t* buffer, size_t size) {
+        for (;;) {
+#if defined(_WIN32)
+            long result = _read(fd, buffer, static_cast<unsigned>(size));
+#else
+            if (wakeFds[0] >= 0) {
+                pollfd fds[2] = {{fd, POLLIN, 0}, {wakeFds[0], POLLIN, 0}};
+                if (::poll(fds, 2, -1) < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    return -1;
+                }
+                if (fds[1].revents != 0)
+                    return 0;
+            }
+            long result = static_cast<long>(::read(fd, buffer, size));
+#endif
+            if (result >= 0 || errno != EINTR)
+                return result;
+        }
+    }
+
+    //! Разбор следующей записи с переходом между блоками
+    PcapRecordParser::Status nextRecord(PcapRecord& record) {
+        for (;;) {
+            if (current) {
+                size_t consumed = 0;
+                PcapRecordParser::Status status = parser.next(current->storage.data() + current->begin,
+                                                              current->end - current->begin, consumed, record);
+                if (status == PcapRecordParser::Packet || status == PcapRecordParser::Skip) {
+                    current->begin += consumed;
+                    return status;
+                }
+                if (status == PcapRecordParser::Error) {
+                    error = true;
+                    return status;
+                }
+            }
+
+            ChunkPtr next;
+            if (!filledChunks.pop(next))
+                return PcapRecordParser::NeedMore;
+            size_t tail = current ? current->end - current->begin : 0;
+            if (tail > next->begin) {
+                std::vector<uint8_t> storage(tail + chunkSize);
+                std::memcpy(storage.data() + tail, next->storage.data() + next->begin, next->end - next->begin);
+                next->end = tail + next->end - next->begin;
+                next->begin = tail;
+                next->storage.swap(storage);
+            }
+            if (tail > 0) {
+                next->begin -= tail;
+                std::memcpy(next->storage.data() + next->begin, current->storage.data() + current->begin, tail);
+            }
+            if (current)
+                freeChunks.push(std::move(current));
+            current = std::move(next);
+        }
+    }
+
+    //! Дескриптор для чтения
+    int fd;
+    //! Путь до файла (пустой, если дескриптор передан в конструкторе)
+    std::string path;
+    //! Заполненные блоки, ожидающие разбора
+    BatchQueue<ChunkPtr> filledChunks;
+    //! Свободные блоки
+    BatchQueue<ChunkPtr> freeChunks;
+    //! Разбираемый блок
+    ChunkPtr current;
+    //! Поток чтения
+    std::thread producer;
+    //! Канал пробуждения потока чтения: чтение и запись (-1, если канал не создан)
+    int wakeFds[2] = {-1, -1};
+    //! Разбор записей
+    PcapRecordParser parser;
+    //! Признак поврежденного потока
+    bool error = false;
+    //! Признак поврежденных сжатых данных (записывается потоком чтения)
+    std::atomic<bool> decompressError{false};
+    //! Сжатие данных (записывается потоком чтения до первого блока)
+    Compression inputCompression = CompressionNone;
+    //! Признак сжатия, которое не поддерживается сборкой
+    bool unsupportedCompression = false;
+    //! Интервал времени читаемых пакетов
+    TimeRange timeRange;
+};
+
+#endif // STREAM_PCAP_READER_H
@@ -0,0 +1,236 @@
+/**
+ \file
+ \brief Заголовочный файл с таблицей подсетей
+
+ Данный файл содержит таблицу именованных IPv4 подсетей (CIDR) с поиском наиболее длинного совпадающего префикса
+ (DIR-24-8): адрес назначения каждого пакета относится к своей подсети за одно-два обращения к памяти
+*/
+
+#ifndef SUBNET_TABLE_H
+#define SUBNET_TABLE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <unordered_map>
+
+/**
+ * \brief Перевод IPv4 адреса из порядка байт пакета в число
+ * @param address Адрес в порядке байт пакета (как в PacketHeaders)
+ * @return Адрес, у которого первый октет - старший байт
+ */
+inline uint32_t ipv4ToHost(uint32_t address) {
+    uint8_t bytes[4];
+    std::memcpy(bytes, &address, sizeof(bytes));
+    return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) |
+           (static_cast<uint32_t>(bytes[2]) << 8) | bytes[3];
+}
+
+/**
+ * \brief Перевод IPv4 адреса из числа в порядок байт пакета
+ * @param address Адрес, у которого первый октет - старший байт
+ */
+inline uint32_t ipv4FromHost(uint32_t address) {
+    uint8_t bytes[4] = {static_cast<uint8_t>(address >> 24), static_cast<uint8_t>(address >> 16),
+                        static_cast<uint8_t>(address >> 8), static_cast<uint8_t>(address)};
+    uint32_t result;
+    std::memcpy(&result, bytes, sizeof(result));
+    return result;
+}
+
+/**
+ * \brief Разбор префикса IPv4
+ * @param text Префикс "a.b.c.d/len" (без длины - /32)
+ * @param address Адрес сети (биты узла обнуляются)
+ * @param length Длина префикса
+ * @return false, если префикс не разобран
+ */
+inline bool parseIPv4Prefix(const std::string& text, uint32_t& address, unsigned& length) {
+    unsigned octets[4] = {};
+    int consumed = 0;
+    length = 32;
+    if (std::sscanf(text.c_str(), "%3u.%3u.%3u.%3u%n", &octets[0], &octets[1], &octets[2], &octets[3],
+                    &consumed) != 4)
+        return false;
+    const char* rest = text.c_str() + consumed;
+    if (*rest == '/') {
+        int lengthConsumed = 0;
+        if (std::sscanf(rest + 1, "%2u%n", &length, &lengthConsumed) != 1)
+            return false;
+        rest += 1 + lengthConsumed;
+    }
+    if (*rest != '\0' || length > 32 || octets[0] > 255 || octets[1] > 255 || octets[2] > 255 || octets[3] > 255)
+        return false;
+    address = (octets[0] << 24) | (octets[1] << 16) | (octets[2] << 8) | octets[3];
+    address &= length == 0 ? 0 : ~0u << (32 - length);
+    return true;
+}
+
+//! Таблица подсетей
+/**
+ * \brief Поиск наиболее длинного префикса по таблицам DIR-24-8
+ * \author Jodode
+ * \version 0.1
+ *
+ * Первая таблица содержит 2^24 записей (64 МБ) по старшим 24 битам адреса: номер подсети или, если в этом /24 есть
+ * префиксы длиннее /24, номер группы из 256 записей второй таблицы по младшему байту. Поиск - одно обращение к
+ * памяти, для адресов внутри длинных префиксов - два, независимо от числа префиксов. Таблицы строятся один раз
+ * после загрузки всех префиксов: префиксы заполняются от коротких к длинным, поэтому более длинный префикс
+ * перекрывает короткий. Несколько префиксов с одним именем учитываются как одна подсеть, номер 0 - адрес вне подсетей.
+ * Таблица только читается при сборе и общая для всех потоков
+ */
+class SubnetTable {
+public:
+    //! Признак записи первой таблицы, указывающей на группу второй таблицы
+    static constexpr uint32_t groupFlag = 0x80000000u;
+
+    /**
+     * \brief Добавление префикса
+     * @param prefix Префикс "a.b.c.d/len"
+     * @param name Имя подсети (пустое - сам префикс)
+     * @param error Описание ошибки
+     * @return false, если префикс не разобран
+     */
+    bool add(const std::string& prefix, const std::string& name, std::string& error) {
+        Prefix entry{};
+        if (!parseIPv4Prefix(prefix, entry.address, entry.length)) {
+            error = "Wrong subnet \"" + prefix + "\", expected e.g. 10.1.0.0/16";
+            return false;
+        }
+        std::string key = name.empty() ? prefix : name;
+        auto found = nameIds.find(key);
+        if (found == nameIds.end()) {
+            names.push_back(key);
+            found = nameIds.emplace(key, static_cast<uint32_t>(names.size())).first;
+        }
+        entry.id = found->second;
+        prefixes.push_back(entry);
+        built = false;
+        return true;
+    }
+
+    /**
+     * \brief Загрузка префиксов из файла
+     * @param path Путь до файла: строки "префикс [имя]", строки с # и пустые пропускаются
+     * @param error Описание ошибки
+     * @return false, если файл не открылся или строка не разобрана
+     */
+    bool load(const std::string& path, std::string& error) {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            error = "Cannot open subnets file " + path;
+            return false;
+        }
+        size_t lineNumber = 0;
+        for (std::string line; std::getline(file, line);) {
+            ++lineNumber;
+            std::istringstream fields(line);
+            std::string prefix, name;
+            if (!(fields >> prefix) || prefix[0] == '#')
+                continue;
+            std::getline(fields >> std::ws, name);
+            name.erase(name.find_last_not_of(" \t\r") + 1);
+            if (!add(prefix, name, error)) {
+                error = path + ":" + std::to_string(lineNumber) + ": " + error;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //! Построение таблиц поиска (после добавления всех префиксов)
+    void build() {
+        std::stable_sort(prefixes.begin(), prefixes.end(),
+                         [](const Prefix& a, const Prefix& b) { return a.length < b.length; });
+        tbl24.assign(prefixes.empty() ? 0 : size_t(1) << 24, 0);
+        tblLong.clear();
+        for (auto& prefix : prefixes) {
+            if (prefix.length <= 24) {
+                size_t first = prefix.address >> 8;
+                std::fill(tbl24.begin() + static_cast<std::ptrdiff_t>(first),
+                          tbl24.begin() + static_cast<std::ptrdiff_t>(first + (size_t(1) << (24 - prefix.length))),
+                          prefix.id);
+                continue;
+            }
+            uint32_t& entry = tbl24[prefix.address >> 8];
+            if (!(entry & groupFlag)) {
+                uint32_t group = static_cast<uint32_t>(tblLong.size() / 256);
+                tblLong.resize(tblLong.size() + 256, entry);
+                entry = groupFlag | group;
+            }
+            size_t first = (entry & ~groupFlag) * size_t(256) + (prefix.address & 0xFF);
+            std::fill(tblLong.begin() + static_cast<std::ptrdiff_t>(first),
+                      tblLong.begin() + static_cast<std::ptrdiff_t>(first + (size_t(1) << (32 - prefix.length))),
+                      prefix.id);
+        }
+        built = true;
+    }
+
+    /**
+     * \brief Поиск подсети адреса
+     * @param address Адрес в порядке байт пакета (как в PacketHeaders)
+     * @return Номер подсети (1..numOfNames()), 0 - адрес вне подсетей
+     */
+    uint32_t lookup(uint32_t address) const {
+        uint32_t host = ipv4ToHost(address);
+        uint32_t entry = tbl24[host >> 8];
+        if (entry & groupFlag)
+            entry = tblLong[(entry & ~groupFlag) * size_t(256) + (host & 0xFF)];
+        return entry;
+    }
+
+    //! Адрес записи первой таблицы для адреса (в порядке байт пакета), для предвыборки в кэш до поиска
+    const void* slotAddress(uint32_t address) const { return &tbl24[ipv4ToHost(address) >> 8]; }
+
+    //! Признак пустой таблицы
+    bool empty() const { return prefixes.empty(); }
+    //! Признак построенных таблиц поиска
+    bool ready() const { return built && !prefixes.empty(); }
+    //! Число префиксов
+    size_t numOfPrefixes() const { return prefixes.size(); }
+    //! Число подсетей (различных имен)
+    size_t numOfNames() const { return names.size(); }
+    //! Имя подсети по номеру (1..numOfNames())
+    const std::string& name(uint32_t id) const { return names[id - 1]; }
+
+    /**
+     * \brief Номер подсети по имени
+     * @param name Имя подсети
+     * @return 0, если подсети с таким именем нет
+     */
+    uint32_t find(const std::string& name) const {
+        auto found = nameIds.find(name);
+        return found == nameIds.end() ? 0 : found->second;
+    }
+
+private:
+    //! Префикс
+    struct Prefix {
+        //! Адрес сети, первый октет - старший байт
+        uint32_t address;
+        //! Длина префикса
+        unsigned length;
+        //! Номер подсети
+        uint32_t id;
+    };
+
+    //! Префиксы в порядке добавления (после build - по возрастанию длины)
+    std::vector<Prefix> prefixes;
+    //! Имена подсетей, номер подсети - индекс + 1
+    std::vector<std::string> names;
+    //! Номера подсетей по имени
+    std::unordered_map<std::string, uint32_t> nameIds;
+    //! Записи по старшим 24 битам адреса
+    std::vector<uint32_t> tbl24;
+    //! Группы по 256 записей для префиксов длиннее /24
+    std::vector<uint32_t> tblLong;
+    //! Признак построенных таблиц
+    bool built = false;
+};
+
+#endif // SUBNET_TABLE_H
@@ -0,0 +1,158 @@
+/**
+ \file
+ \brief Заголовочный файл с временным рядом статистики
+
+ Данный файл содержит разбиение трафика на интервалы по меткам времени пакетов. Закрытые интервалы сразу
+ записываются строками CSV, в памяти хранится только текущий интервал
+*/
+
+#ifndef TIME_SERIES_H
+#define TIME_SERIES_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fmt/format.h>
+#include "FlatCounters.h"
+#include "PacketDecoder.h"
+
+//! Временной ряд
+/**
+ * \brief Счетчики трафика по интервалам фиксированной длины
+ * \author Jodode
+ * \version 0.1
+ *
+ * Интервал определяется меткой времени пакета: [start, start + interval), где start кратно interval. Когда приходит
+ * пакет из более позднего интервала, текущий интервал записывается в поток и очищается. Интервалы без пакетов
+ * между ними тоже записываются (нулями), поэтому ряд непрерывен, если разрыв не больше maxEmptyWindows. Пакеты
+ * с меткой раньше текущего интервала (небольшое переупорядочивание в дампе) учитываются в текущем интервале.
+ * Память не зависит от длины дампа
+ */
+class IntervalSeries {
+public:
+    //! Наибольший разрыв в интервалах, заполняемый пустыми строками (больший разрыв пропускается)
+    static constexpr int64_t maxEmptyWindows = 1000000;
+
+    //! Конструктор
+    /**
+     * @param output Поток для строк CSV
+     * @param intervalNs Длина интервала, нс
+     * @param topPorts Число наиболее частых портов назначения в строке интервала
+     */
+    IntervalSeries(std::ostream& output, int64_t intervalNs, size_t topPorts = 3)
+        : output(output), intervalNs(intervalNs), topPorts(topPorts) {}
+
+    //! Запись заголовка CSV
+    void writeHeader() {
+        output << "start,end,packets,bytes,tcp_packets,tcp_bytes,udp_packets,udp_bytes,other_packets,top_ports\n";
+    }
+
+    /**
+     * \brief Учет пакета
+     * @param headers Заголовки пакета с меткой времени и длиной пакета в сети
+     */
+    void update(const PacketHeaders& headers) {
+        if (!opened) {
+            windowStart = floorToInterval(headers.timestampNs);
+            opened = true;
+        } else if (headers.timestampNs >= windowStart + intervalNs) {
+            int64_t next = floorToInterval(headers.timestampNs);
+            writeWindow();
+            resetWindow();
+            windowStart += intervalNs;
+            if ((next - windowStart) / intervalNs > maxEmptyWindows)
+                windowStart = next;
+            for (; windowStart < next; windowStart += intervalNs)
+                writeWindow();
+            output.flush();
+        }
+
+        ++packets;
+        bytes += headers.frameLen;
+        if (headers.l4Protocol == ipProtocolTcp) {
+            ++tcpPackets;
+            tcpBytes += headers.frameLen;
+        } else if (headers.l4Protocol == ipProtocolUdp) {
+            ++udpPackets;
+            udpBytes += headers.frameLen;
+        } else {
+            ++otherPackets;
+        }
+        if ((headers.l4Protocol == ipProtocolTcp || headers.l4Protocol == ipProtocolUdp) && headers.dstPort != 0)
+            ++ports[headers.dstPort];
+    }
+
+    //! Запись текущего интервала после конца трафика
+    void finish() {
+        if (opened) {
+            writeWindow();
+            resetWindow();
+            opened = false;
+        }
+        output.flush();
+    }
+
+    //! Длина интервала, нс
+    int64_t interval() const { return intervalNs; }
+
+private:
+    int64_t floorToInterval(int64_t timestampNs) const {
+        int64_t start = timestampNs - timestampNs % intervalNs;
+        return timestampNs < 0 && start != timestampNs ? start - intervalNs : start;
+    }
+
+    void writeWindow() {
+        std::string top;
+        if (!ports.empty()) {
+            std::vector<std::pair<uint32_t, uint64_t>> counts;
+            counts.reserve(ports.size());
+            ports.forEach([&counts](uint32_t port, uint64_t count) { counts.emplace_back(port, count); });
+            size_t shown = std::min(topPorts, counts.size());
+            std::partial_sort(counts.begin(), counts.begin() + shown, counts.end(),
+                              [](const std::pair<uint32_t, uint64_t>& a, const std::pair<uint32_t, uint64_t>& b) {
+                                  return a.second != b.second ? a.second > b.second : a.first < b.first;
+                              });
+            for (size_t i = 0; i < shown; ++i)
+                top += fmt::format("{}{}:{}", i == 0 ? "" : ";", counts[i].first, counts[i].second);
+        }
+        output << fmt::format("{:.9f},{:.9f},{},{},{},{},{},{},{},{}\n", windowStart / 1e9,
+                              (windowStart + intervalNs) / 1e9, packets, bytes, tcpPackets, tcpBytes, udpPackets,
+                              udpBytes, otherPackets, top);
+    }
+
+    void resetWindow() {
+        packets = bytes = tcpPackets = tcpBytes = udpPackets = udpBytes = otherPackets = 0;
+        if (!ports.empty())
+            ports.clear();
+    }
+
+    //! Поток для строк CSV
+    std::ostream& output;
+    //! Длина интервала, нс
+    int64_t intervalNs;
+    //! Число портов в строке интервала
+    size_t topPorts;
+    //! Признак открытого интервала
+    bool opened = false;
+    //! Начало текущего интервала, нс
+    int64_t windowStart = 0;
+    //! Число пакетов в интервале
+    uint64_t packets = 0;
+    //! Объем пакетов в интервале (длина в сети)
+    uint64_t bytes = 0;
+    //! Число TCP пакетов в интервале
+    uint64_t tcpPackets = 0;
+    //! Объем TCP пакетов в интервале
+    uint64_t tcpBytes = 0;
+    //! Число UDP пакетов в интервале
+    uint64_t udpPackets = 0;
+    //! Объем UDP пакетов в интервале
+    uint64_t udpBytes = 0;
+    //! Число пакетов остальных протоколов в интервале
+    uint64_t otherPackets = 0;
+    //! Частота портов назначения в текущем интервале
+    FlatHashMap<uint32_t, uint64_t> ports;
+};
+
+#endif // TIME_SERIES_H
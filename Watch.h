@@ -0,0 +1,255 @@
+/**
+ \file
+ \brief Заголовочный файл с режимом наблюдения за каталогом
+
+ Данный файл содержит долгоживущий режим --watch DIR: новые закрытые файлы трафика каталога (например, после ротации
+ tcpdump -G) обрабатываются пулом потоков в одно накапливаемое хранилище, а счетчики отдаются в формате Prometheus.
+ Режим доступен только в Linux (inotify)
+*/
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <chrono>
+#include <csignal>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Collection.h"
+#include "InputFiles.h"
+#include "Metrics.h"
+
+#if defined(__linux__)
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+//! Признак запроса остановки наблюдения (SIGINT, SIGTERM)
+inline volatile std::sig_atomic_t& watchStopRequested() {
+    static volatile std::sig_atomic_t requested = 0;
+    return requested;
+}
+
+//! Обработчик сигналов остановки
+inline void requestWatchStop(int) {
+    watchStopRequested() = 1;
+}
+
+#if defined(__linux__)
+
+//! Наблюдение за каталогом
+/**
+ * \brief Выдача файлов трафика, закрытых после записи или перемещенных в каталог
+ * \author Jodode
+ * \version 0.1
+ *
+ * Файл выдается по событию закрытия после записи (IN_CLOSE_WRITE) или переименования в каталог (IN_MOVED_TO), то
+ * есть только дописанным. Имена отбираются как при раскрытии каталога (isCaptureName), поэтому временные файлы
+ * ротации без расширения файла трафика пропускаются
+ */
+class DirectoryWatcher {
+public:
+    //! Конструктор
+    /**
+     * @param directory Путь до каталога
+     */
+    explicit DirectoryWatcher(const std::string& directory) : directory(directory) {}
+
+    //! Деструктор
+    ~DirectoryWatcher() {
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    DirectoryWatcher(const DirectoryWatcher&) = delete;
+    DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+
+    /**
+     * \brief Начало наблюдения
+     * @param error Описание ошибки
+     * @return false, если каталог недоступен
+     */
+    bool open(std::string& error) {
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0 || inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE_SELF |
+                                                               IN_MOVE_SELF | IN_ONLYDIR) < 0) {
+            error = "Cannot watch " + directory + ": " + std::strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * \brief Ожидание событий
+     * @param timeoutMs Наибольшее время ожидания, мс
+     * @param paths Пути до закрытых файлов трафика (дописываются)
+     * @param error Описание ошибки
+     * @return false, если каталог удален или перемещен
+     */
+    bool wait(int timeoutMs, std::vector<std::string>& paths, std::string& error) {
+        pollfd readable{fd, POLLIN, 0};
+        if (::poll(&readable, 1, timeoutMs) <= 0)
+            return true;
+        alignas(inotify_event) char buffer[64 * 1024];
+        for (;;) {
+            ssize_t length = ::read(fd, buffer, sizeof(buffer));
+            if (length <= 0)
+                return true;
+            for (char* cur = buffer; cur < buffer + length;) {
+                auto* event = reinterpret_cast<inotify_event*>(cur);
+                cur += sizeof(inotify_event) + event->len;
+                if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                    error = directory + " was removed or moved";
+                    return false;
+                }
+                if (event->mask & IN_Q_OVERFLOW) {
+                    logMessage(std::cerr, "[-] WARNING: Too many events in " + directory +
+                                          ", some closed files were not collected");
+                    continue;
+                }
+                if (event->len > 0 && !(event->mask & IN_ISDIR) && isCaptureName(event->name))
+                    paths.push_back(directory + (directory.back() == '/' ? "" : "/") + event->name);
+            }
+        }
+    }
+
+private:
+    //! Путь до каталога
+    std::string directory;
+    //! Дескриптор inotify
+    int fd = -1;
+};
+
+#endif
+
+/**
+ * \brief Метод наблюдения за каталогом
+ * \author Jodode
+ * \version 0.1
+ * @param directory Каталог с файлами трафика
+ * @param stats Накапливаемое хранилище статистики
+ * @param processedFiles Учтенные файлы (дописываются, уже учтенные файлы повторно не обрабатываются)
+ * @param numOfThreads Число файлов, обрабатываемых одновременно
+ * @param useMmap Читать файлы через отображение в память
+ * @param metricsAddress Адрес сервера счетчиков (host:port или unix:PATH)
+ * @return false, если наблюдение или сервер счетчиков не удалось запустить
+ *
+ * Работает до SIGINT или SIGTERM. Каждый файл собирается в отдельное хранилище с параметрами stats и объединяется
+ * с stats под блокировкой, под той же блокировкой формируются счетчики для сервера. Путь, который уже собирается,
+ * повторно не берется (повторное закрытие файла или закрытие и перемещение дают несколько событий). После сигнала
+ * файлы, уже ожидающие обработки, дособираются, и управление возвращается для сохранения снимка и записи отчета
+ */
+inline bool watchDirectory(const std::string& directory, StatsCollector& stats,
+                           std::vector<InputFile>& processedFiles, size_t numOfThreads, bool useMmap,
+                           const std::string& metricsAddress) {
+#if defined(__linux__)
+    typedef std::chrono::steady_clock Clock;
+    struct ClosedFile {
+        std::string path;
+        Clock::time_point closedAt;
+    };
+
+    std::string error;
+    DirectoryWatcher watcher(directory);
+    if (!watcher.open(error)) {
+        std::cerr << "[-] ERROR: " << error << std::endl;
+        return false;
+    }
+
+    std::mutex statsMutex;
+    std::set<std::string> inFlight;
+    WatchMetrics watchMetrics;
+    MetricsServer server([&stats, &watchMetrics, &statsMutex]() {
+        std::ostringstream body;
+        std::lock_guard<std::mutex> lock(statsMutex);
+        writePrometheus(stats, watchMetrics, body);
+        return body.str();
+    });
+    if (!server.start(metricsAddress, error)) {
+        std::cerr << "[-] ERROR: " << error << std::endl;
+        return false;
+    }
+
+    BatchQueue<ClosedFile> closedFiles(4096);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < numOfThreads; ++i) {
+        workers.emplace_back([&]() {
+            ClosedFile file;
+            while (closedFiles.pop(file)) {
+                InputFile input = inputFileOf(file.path);
+                {
+                    std::lock_guard<std::mutex> lock(statsMutex);
+                    if (std::any_of(processedFiles.begin(), processedFiles.end(),
+                                    [&input](const InputFile& other) { return other.sameAs(input); }) ||
+                        !inFlight.insert(file.path).second)
+                        continue;
+                }
+                StatsCollector shard(stats.options);
+                bool collected = collectFile(file.path, shard, 1, useMmap);
+                std::lock_guard<std::mutex> lock(statsMutex);
+                inFlight.erase(file.path);
+                if (!collected) {
+                    ++watchMetrics.filesFailed;
+                    continue;
+                }
+                {
+                    ProfileScope scope(ProfileMerge);
+                    stats.merge(shard);
+                }
+                processedFiles.push_back(input);
+                double latency = std::chrono::duration<double>(Clock::now() - file.closedAt).count();
+                ++watchMetrics.filesCollected;
+                watchMetrics.lastLatency = latency;
+                watchMetrics.latencySum += latency;
+                watchMetrics.lastCollectedAt = std::chrono::duration<double>(
+                        std::chrono::system_clock::now().time_since_epoch()).count();
+            }
+        });
+    }
+
+    watchStopRequested() = 0;
+    std::signal(SIGINT, requestWatchStop);
+    std::signal(SIGTERM, requestWatchStop);
+    logMessage(std::cout, "[+] Watching " + directory + ", metrics on " + metricsAddress);
+
+    bool watching = true;
+    std::vector<std::string> paths;
+    while (watching && !watchStopRequested()) {
+        paths.clear();
+        watching = watcher.wait(500, paths, error);
+        Clock::time_point closedAt = Clock::now();
+        for (auto& path : paths) {
+            if (verboseMode)
+                logMessage(std::cout, "[+] New file " + path);
+            closedFiles.push(ClosedFile{path, closedAt});
+        }
+    }
+    if (!watching)
+        logMessage(std::cerr, "[-] WARNING: " + error + ", stopping");
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+
+    closedFiles.close();
+    for (auto& worker : workers)
+        worker.join();
+    server.stop();
+    logMessage(std::cout, fmt::format("[+] Watch stopped: {} files collected, {} failed", watchMetrics.filesCollected,
+                                      watchMetrics.filesFailed));
+    return true;
+#else
+    (void) directory;
+    (void) stats;
+    (void) processedFiles;
+    (void) numOfThreads;
+    (void) useMmap;
+    (void) metricsAddress;
+    std::cerr << "[-] ERROR: --watch needs Linux (inotify)" << std::endl;
+    return false;
+#endif
+}
+
+#endif // WATCH_H
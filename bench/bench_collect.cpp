@@ -0,0 +1,259 @@
+/**
+ \file
+ \brief Компилируемый файл с замерами производительности сбора статистики
+
+ Замеры горячего пути: учет разобранного пакета, учет "сырого" пакета, сбор файла трафика целиком (через
+ PcapPlusPlus и через отображение в память) и запись разделов отчета. Трафик генерируется детерминированно
+ (tools/SyntheticTraffic.h), поэтому результаты воспроизводимы
+*/
+
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <fstream>
+#include <benchmark/benchmark.h>
+#include "Packet.h"
+#include "StatsCollector.h"
+#include "Collection.h"
+#include "Report.h"
+#include "SyntheticTraffic.h"
+
+bool verboseMode = false;
+double minimalPercPort = 5.0;
+double minimalPercIP = 5.0;
+std::string fileFormat = "txt";
+unsigned subnetRollup = 0;
+std::mutex logMutex;
+bool profileMode = false;
+
+//! Число пакетов, по которым идут замеры учета одного пакета
+static const size_t numOfFrames = 64 * 1024;
+//! Число пакетов в файле для замеров сбора файла целиком
+static const size_t numOfFilePackets = 500 * 1000;
+
+/**
+ * \brief Параметры трафика для замера
+ * @param mix 0 - веб (TCP, IMIX, широкий набор адресов), 1 - DNS (UDP, короткие пакеты, мало портов)
+ */
+static SyntheticProfile profileOf(int64_t mix) {
+    SyntheticProfile profile;
+    if (mix == 1) {
+        profile.udpShare = 0.9;
+        profile.numOfPorts = 20;
+        profile.numOfIPs = 500;
+        profile.payloadMode = SyntheticProfile::Uniform;
+        profile.minPayload = 30;
+        profile.maxPayload = 300;
+    } else {
+        profile.udpShare = 0.1;
+        profile.numOfIPs = 100000;
+    }
+    return profile;
+}
+
+//! Сгенерированные кадры
+struct Frames {
+    explicit Frames(const SyntheticProfile& profile) {
+        SyntheticTraffic traffic(profile);
+        std::vector<uint8_t> frame(traffic.maxFrameLen());
+        for (size_t i = 0; i < numOfFrames; ++i) {
+            int64_t timestampNs = 0;
+            size_t frameLen = traffic.next(frame.data(), timestampNs);
+            offsets.push_back(data.size());
+            lengths.push_back(frameLen);
+            timestamps.push_back(timestampNs);
+            data.insert(data.end(), frame.begin(), frame.begin() + static_cast<std::ptrdiff_t>(frameLen));
+            bytes += frameLen;
+        }
+    }
+
+    timespec timestamp(size_t i) const {
+        timespec ts{};
+        ts.tv_sec = static_cast<time_t>(timestamps[i] / 1000000000LL);
+        ts.tv_nsec = static_cast<long>(timestamps[i] % 1000000000LL);
+        return ts;
+    }
+
+    std::vector<uint8_t> data;
+    std::vector<size_t> offsets;
+    std::vector<size_t> lengths;
+    std::vector<int64_t> timestamps;
+    uint64_t bytes = 0;
+};
+
+static void setRates(benchmark::State& state, uint64_t packets, uint64_t bytes) {
+    state.SetItemsProcessed(static_cast<int64_t>(packets));
+    state.SetBytesProcessed(static_cast<int64_t>(bytes));
+    state.counters["packets/s"] = benchmark::Counter(static_cast<double>(packets), benchmark::Counter::kIsRate);
+}
+
+//! Учет пакета, уже разобранного PcapPlusPlus (StatsCollector::collectPacket)
+static void BM_CollectPacket(benchmark::State& state) {
+    Frames frames(profileOf(state.range(0)));
+    std::vector<std::unique_ptr<pcpp::RawPacket>> rawPackets;
+    std::vector<std::unique_ptr<pcpp::Packet>> packets;
+    for (size_t i = 0; i < numOfFrames; ++i) {
+        rawPackets.emplace_back(new pcpp::RawPacket(frames.data.data() + frames.offsets[i],
+                                                    static_cast<int>(frames.lengths[i]), frames.timestamp(i), false));
+        packets.emplace_back(new pcpp::Packet(rawPackets.back().get(), false, pcpp::UnknownProtocol,
+                                              pcpp::OsiModelTransportLayer));
+    }
+    StatsCollector stats;
+    for (auto _ : state)
+        for (auto& packet : packets)
+            stats.collectPacket(*packet);
+    setRates(state, state.iterations() * numOfFrames, state.iterations() * frames.bytes);
+}
+BENCHMARK(BM_CollectPacket)->Arg(0)->Arg(1);
+
+//! Учет "сырого" пакета с разбором заголовков (StatsCollector::collectRawPacket)
+static void BM_CollectRawPacket(benchmark::State& state) {
+    Frames frames(profileOf(state.range(0)));
+    BorrowedRawPacket rawPacket;
+    StatsCollector stats;
+    for (auto _ : state)
+        for (size_t i = 0; i < numOfFrames; ++i) {
+            rawPacket.setRawData(frames.data.data() + frames.offsets[i], static_cast<int>(frames.lengths[i]),
+                                 frames.timestamp(i), pcpp::LINKTYPE_ETHERNET);
+            stats.collectRawPacket(rawPacket);
+        }
+    setRates(state, state.iterations() * numOfFrames, state.iterations() * frames.bytes);
+}
+BENCHMARK(BM_CollectRawPacket)->Arg(0)->Arg(1);
+
+//! Учет "сырого" пакета хранилищем только из UDP/TCP статистики и портов (без модулей адресов и уникальных ключей)
+static void BM_CollectRawPacketPorts(benchmark::State& state) {
+    Frames frames(profileOf(state.range(0)));
+    BorrowedRawPacket rawPacket;
+    BasicStatsCollector<TransportModule, PortModule> stats;
+    for (auto _ : state)
+        for (size_t i = 0; i < numOfFrames; ++i) {
+            rawPacket.setRawData(frames.data.data() + frames.offsets[i], static_cast<int>(frames.lengths[i]),
+                                 frames.timestamp(i), pcpp::LINKTYPE_ETHERNET);
+            stats.collectRawPacket(rawPacket);
+        }
+    setRates(state, state.iterations() * numOfFrames, state.iterations() * frames.bytes);
+}
+BENCHMARK(BM_CollectRawPacketPorts)->Arg(0)->Arg(1);
+
+//! Учет "сырых" пакетов пачками по столбцам (StatsCollector::collectRawBatch с options.batchMode)
+static void BM_CollectRawBatch(benchmark::State& state) {
+    Frames frames(profileOf(state.range(0)));
+    std::vector<BorrowedRawPacket> packets(numOfFrames);
+    for (size_t i = 0; i < numOfFrames; ++i)
+        packets[i].setRawData(frames.data.data() + frames.offsets[i], static_cast<int>(frames.lengths[i]),
+                              frames.timestamp(i), pcpp::LINKTYPE_ETHERNET);
+    CollectorOptions options;
+    options.batchMode = true;
+    StatsCollector stats(options);
+    for (auto _ : state)
+        stats.collectRawBatch(packets.data(), packets.size());
+    state.SetLabel(kernelLevelName(kernelLevel()));
+    setRates(state, state.iterations() * numOfFrames, state.iterations() * frames.bytes);
+}
+BENCHMARK(BM_CollectRawBatch)->Arg(0)->Arg(1);
+
+//! Файл трафика для замеров сбора целиком, создается один раз на набор параметров
+static std::string captureFile(int64_t mix, uint64_t& fileSize) {
+    std::string path = "sft_bench_" + std::to_string(mix) + ".pcap";
+    std::ifstream existing(path, std::ios::binary | std::ios::ate);
+    if (!existing.good()) {
+        std::ofstream output(path, std::ios::binary);
+        SyntheticTraffic traffic(profileOf(mix));
+        PcapFileWriter writer(output);
+        std::vector<uint8_t> frame(traffic.maxFrameLen());
+        for (size_t i = 0; i < numOfFilePackets; ++i) {
+            int64_t timestampNs = 0;
+            size_t frameLen = traffic.next(frame.data(), timestampNs);
+            writer.write(frame.data(), frameLen, timestampNs);
+        }
+        output.close();
+        existing.open(path, std::ios::binary | std::ios::ate);
+    }
+    fileSize = static_cast<uint64_t>(existing.tellg());
+    return path;
+}
+
+//! Сбор файла целиком через читателя PcapPlusPlus (collectPcap)
+static void BM_CollectPcapFile(benchmark::State& state) {
+    uint64_t fileSize = 0;
+    std::string path = captureFile(state.range(0), fileSize);
+    for (auto _ : state) {
+        StatsCollector stats;
+        std::unique_ptr<pcpp::IFileReaderDevice> reader(pcpp::IFileReaderDevice::getReader(path));
+        if (!reader->open()) {
+            state.SkipWithError("cannot open capture");
+            return;
+        }
+        collectPcap(reader.get(), stats);
+        reader->close();
+        benchmark::DoNotOptimize(stats.totalPackets);
+    }
+    setRates(state, state.iterations() * numOfFilePackets, state.iterations() * fileSize);
+}
+BENCHMARK(BM_CollectPcapFile)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+//! Сбор файла целиком через отображение в память (collectPcap с MmapPcapReader)
+static void BM_CollectPcapMmap(benchmark::State& state) {
+    uint64_t fileSize = 0;
+    std::string path = captureFile(state.range(0), fileSize);
+    for (auto _ : state) {
+        StatsCollector stats;
+        MmapPcapReader reader(path);
+        if (!reader.open()) {
+            state.SkipWithError("cannot map capture");
+            return;
+        }
+        collectPcap(&reader, stats);
+        benchmark::DoNotOptimize(stats.totalPackets);
+    }
+    setRates(state, state.iterations() * numOfFilePackets, state.iterations() * fileSize);
+}
+BENCHMARK(BM_CollectPcapMmap)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+//! Статистика, собранная по сгенерированным кадрам
+static StatsCollector& collectedStats(int64_t mix) {
+    static std::unique_ptr<StatsCollector> stats[2];
+    if (!stats[mix]) {
+        stats[mix].reset(new StatsCollector());
+        Frames frames(profileOf(mix));
+        BorrowedRawPacket rawPacket;
+        for (size_t i = 0; i < numOfFrames; ++i) {
+            rawPacket.setRawData(frames.data.data() + frames.offsets[i], static_cast<int>(frames.lengths[i]),
+                                 frames.timestamp(i), pcpp::LINKTYPE_ETHERNET);
+            stats[mix]->collectRawPacket(rawPacket);
+        }
+    }
+    return *stats[mix];
+}
+
+//! Запись распределения размеров "полезной нагрузки" (writePayloadLen)
+static void BM_WritePayloadLen(benchmark::State& state) {
+    StatsCollector& stats = collectedStats(state.range(0));
+    std::ostringstream output;
+    for (auto _ : state) {
+        output.str(std::string());
+        writePayloadLen(stats.udpStats.payloadLen, "UDP", output);
+        writePayloadLen(stats.tcpStats.payloadLen, "TCP", output);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * output.str().size()));
+}
+BENCHMARK(BM_WritePayloadLen)->Arg(0)->Arg(1);
+
+//! Запись частот IP адресов (writeDstIPv4), все адреса попадают в отчет
+static void BM_WriteDstIPv4(benchmark::State& state) {
+    StatsCollector& stats = collectedStats(state.range(0));
+    double savedPerc = minimalPercIP;
+    minimalPercIP = -1.0;
+    std::ostringstream output;
+    for (auto _ : state) {
+        output.str(std::string());
+        writeDstIPv4(stats.dstIPv4, output);
+    }
+    minimalPercIP = savedPerc;
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * stats.dstIPv4.size()));
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * output.str().size()));
+}
+BENCHMARK(BM_WriteDstIPv4)->Arg(0)->Arg(1);
+
+BENCHMARK_MAIN();
@@ -8,13 +8,27 @@
 
 #include <iostream>
 #include <fmt/format.h>
+#include <cerrno>
+#include <climits>
 #include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
 #include "docopt.h"
 #include "SystemUtils.h"
 #include "Packet.h"
 #include "HttpLayer.h"
-#include "PcapFileDevice.h"
 #include "StatsCollector.h"
+#include "Collection.h"
+#include "PcapIndex.h"
+#include "Report.h"
+#include "InputFiles.h"
+#include "Snapshot.h"
+#include "TimeSeries.h"
+#include "Profiler.h"
+#include "Watch.h"
 #include "EthLayer.h"
 #include "VlanLayer.h"
 #include "IPv4Layer.h"
@@ -30,21 +44,59 @@ double minimalPercPort = 5.0;
 double minimalPercIP = 5.0;
 //! Формат файла с результатом
 std::string fileFormat = "txt";
+//! Длина префикса, до которой укрупняются адреса назначения в отчете (0 - без укрупнения)
+unsigned subnetRollup = 0;
+//! Параметры сбора статистики
+CollectorOptions collectorOptions;
 
-static const char VERSION[] = "SFT v1.0";
-static const char pathSeparator =
-#if defined _WIN32 || defined __CYGWIN__ || defined WIN32
-        '\\';
-#else
-        '/';
+//! Блокировка вывода сообщений из нескольких потоков
+std::mutex logMutex;
+//! Режим замеров по этапам обработки
+bool profileMode = false;
+
+#if defined(SFT_PROFILING)
+/**
+ * \brief Выделение памяти с учетом в замерах
+ *
+ * Заменяет глобальный operator new (остальные формы new и delete по умолчанию сводятся к этой паре), чтобы замеры
+ * показывали число выделений памяти, включая выделения внутри PcapPlusPlus
+ */
+void* operator new(std::size_t size) {
+    if (profileMode) {
+        allocationCounters().count.fetch_add(1, std::memory_order_relaxed);
+        allocationCounters().bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    std::size_t request = size == 0 ? 1 : size;
+    for (;;) {
+        void* memory = std::malloc(request);
+        if (memory != nullptr)
+            return memory;
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
 #endif
 
+static const char VERSION[] = "SFT v1.0";
+
 static const char USAGE[] =
 R"(Signatures for traffic.
 
     Usage:
-        sft [-v] -f INFILE [--config CONFIG]
-        sft [-v] -f INFILE -o OUTFILE [--config CONFIG]
+        sft [-v] -f INFILE [INFILES...] [--config CONFIG] [options]
+        sft [-v] -f INFILE [INFILES...] -o OUTFILE [--config CONFIG] [options]
+        sft [-v] --load-state STATES [-f INFILE [INFILES...]] [-o OUTFILE] [--config CONFIG] [options]
+        sft [-v] --watch DIR [--load-state STATES] [-o OUTFILE] [--config CONFIG] [options]
         sft (-h | --help)
         sft --version
         sft --test
@@ -52,10 +104,52 @@ R"(Signatures for traffic.
     Options:
         -h --help               Show this screen.
         --version               Show version.
-        -f INFILE               Path to input pcap/pcapng file.
-        -o OUTFILE              Path to output report file.
+        -f INFILE               Path to input pcap/pcapng file, directory or glob ("dumps/*.pcap"),
+                                "-" reads a pcap/pcapng stream from stdin (tcpdump -w - | sft -f -).
+                                Further files may follow as positional arguments.
+        -o OUTFILE              Path to output report file. With the .col extension, one record per counted packet
+                                (time, addresses, ports, protocol, lengths) is written to a columnar file instead
+                                and the report goes to stdout.
         -v                      Verbose mode.
         --config CONFIG         Config file.
+        --threads N             Number of parser threads, or of files processed at once, 1-1024 [default: 1].
+        --watch DIR             Run until SIGINT/SIGTERM, collecting each capture file closed or moved into DIR
+                                into one cumulative state (Linux). The report and --save-state are written on exit.
+        --metrics ADDR          Serve running counters in Prometheus text format over HTTP with --watch:
+                                host:port or unix:PATH [default: 127.0.0.1:9464].
+        --mmap                  Read input through a memory mapping without copying packets.
+        --batch                 Count packets in batches of 256 with vectorized kernels (AVX2 or SSE2, chosen at
+                                startup). Standard input and --sample-budget are counted packet by packet.
+        --build-index           Write a sidecar index (INFILE.sftidx) of each input file before collecting. Later runs
+                                read an indexed file in --threads byte ranges and seek to --from/--to without a scan.
+        --index-every K         Packets between index entries [default: 10000].
+        --from TIME             Count only packets captured at or after TIME: Unix seconds or "YYYY-MM-DD HH:MM:SS" UTC.
+        --to TIME               Count only packets captured at or before TIME.
+        --topk K                Track only the K most frequent destination IPs in fixed memory.
+        --flows                 Track 5-tuple flows and report top flows and flow durations.
+        --flow-timeout SEC      Idle time after which a flow is finished [default: 60].
+        --top-flows N           Number of flows in the report [default: 10].
+        --apps LIST             Classify UDP/TCP packets by application protocol (comma-separated: dns, http, tls
+                                or all) and report DNS query names and HTTP Host / TLS SNI names.
+        --top-names K           Number of names tracked per name table with --apps [default: 20].
+        --cardinality           Estimate the number of distinct source and destination IPs, destination IP:port
+                                pairs and 5-tuples (HyperLogLog).
+        --hll-precision P       Precision of --cardinality sketches, 4-18 [default: 12].
+        --quantile-error E      Relative error of payload length quantiles, 0.0001-0.5 [default: 0.01].
+        --sample RATE           Collect 1 of N packets ("1/N"), counts in the report are scaled estimates.
+        --sample-mode MODE      Sampling of --sample: hash (deterministic by packet) or systematic (every N-th)
+                                [default: hash].
+        --sample-budget K       Collect a uniform sample of at most K packets, counts are scaled estimates.
+        --report-every N        With stdin input, write the report after every N packets.
+        --filter EXPR           Count only packets matching a BPF expression (tcpdump syntax), checked before parsing.
+        --interval DURATION     Write per-interval time series (e.g. 1s, 500ms, 5m) to the --series file, packets are
+                                read in one thread.
+        --series FILE           Output CSV file of the time series, required with --interval.
+        --save-state FILE       Save collected statistics to a binary snapshot (.sfts).
+        --load-state STATES     Comma-separated snapshots, directories or globs merged into the report.
+                                Input files already recorded in them are skipped.
+        --profile               Print time per stage, packets/s, MB/s, peak memory and allocations to stderr.
+        --profile-json FILE     Write the same measurements as JSON, "-" for stdout.
         --test         Testing.
 )";
 
@@ -76,197 +170,83 @@ void require(std::string test_name, bool require_exp){
         std::cout << "[x] -- " << test_name << " -- " << "failed" << std::endl;
     }
 }
-/**
- * \brief Функция для получения процентной статистики
- * @param totalValues количество определенных элементов в выборке
- * @param allValues количество всех элементов в выборке
- * @return Процент от общего количества
- */
-double getPerc(const size_t& totalValues, const size_t& allValues) {
-    return (static_cast<double>(totalValues) / static_cast<double>(allValues)) * 100.0;
-}
-
-double getPerc(const uint32_t & totalValues, const size_t& allValues) {
-    return getPerc(static_cast<size_t>(totalValues), allValues);
-}
-
 
 /**
- * \brief Метод для сборки пакетов в хранилище статистики
- * \author Jodode
- * \version 0.1
- * @param readerDevice читающий агрегат
- * @param stats Хранилище статистики
- *
- * Метод итерируется по всем пакетам трафика и отправляет их на дальнейшую обработку в хранилище
+ * \brief Разбор целого числа в диапазоне
+ * @param text Десятичное число без других символов
+ * @param min Наименьшее допустимое значение
+ * @param max Наибольшее допустимое значение
+ * @param value Число
+ * @return false, если текст не число или число вне [min, max]
  */
-void collectPcap(pcpp::IFileReaderDevice* readerDevice, StatsCollector& stats) {
-    pcpp::RawPacket rawPacket;
-    while(readerDevice->getNextPacket(rawPacket)) {
-        pcpp::Packet parsedPacket(&rawPacket);
-        stats.collectPacket(parsedPacket);
-    }
-    if (verboseMode)
-        std::cout << "[+] All packets collected" << std::endl ;
-
+bool parseInteger(const std::string& text, long min, long max, long& value) {
+    char* end = nullptr;
+    errno = 0;
+    value = std::strtol(text.c_str(), &end, 10);
+    return end != text.c_str() && *end == '\0' && errno == 0 && value >= min && value <= max;
 }
 
-
 /**
- * \brief Метод для записи статистики "полезной нагрузки"
- * \author Jodode
- * \version 0.1
- * @param max Максимальный размер "полезной нагрузки" в пакетах протокола X (UDP/TCP)
- * @param packets Вектор с размерами "полезной нагрузки" пакетов протокола X (UDP/TCP)
- * @param protocol Протокол X (UDP/TCP)
- * @param output Поток для записи результатов
- *
- * Внутри метода высчитывается распределение пакетов по байт-интервалам, а затем результат записывается в указанный пользователем
- * поток, существует автоматическое определение формата вывода (csv,txt)
+ * \brief Разбор длительности с единицей измерения
+ * @param text Число с единицей ns, us, ms, s, m, h (по умолчанию s)
+ * @param durationNs Длительность, нс
+ * @return false, если длительность не положительна или единица неизвестна
  */
-void writePayloadLen(size_t& max, std::vector<size_t>& packets, const std::string& protocol, std::ostream& output) {
-    auto depth = static_cast<size_t>(std::log2(static_cast<double>(max)));
-    std::vector<size_t> intervals(depth, 0);
-
-    size_t countOfMaxes = 0;
-    for (auto& len : packets) {
-        if (len == 0)
-            ++intervals[0];
-        else {
-            size_t upperBound = 20;
-            for (size_t layer = 1; layer < depth + 2; ++layer) {
-
-                if (len < upperBound) {
-                    if (len == max) {
-                        ++countOfMaxes;
-                    }
-                    ++intervals[layer];
-                    break;
-                }
-                if (upperBound * 2 > max) {
-                    upperBound = max + 1;
-                } else { upperBound *= 2; }
-            }
-        }
-    }
-
-    size_t totalPackets = packets.size();
-
-    output << fmt::format((fileFormat == "csv" ? "{}\n{},{},{}\n" : "|{:=^48}|\n|{:^16}{:^16}{:^16}|\n"),
-                          protocol + " payload length", "interval", "count", "perc");
-    output << fmt::format((fileFormat == "csv" ? "{},{},{:.3}\n" : "|{:<16}{:<16}{:<16.3}|\n"), 0, intervals[0],
-                          getPerc(intervals[0], totalPackets));
-    for (size_t lower_bound = 1, upper_bound = 20, i = 1; i < depth; lower_bound = upper_bound, upper_bound *= 2, ++i) {
-
-        double perc = getPerc(intervals[i], totalPackets);
-        double percMax = getPerc(countOfMaxes, totalPackets);
-        if (upper_bound > max) {
-            upper_bound = max + 1;
-
-            output << fmt::format((fileFormat == "csv" ? "{},{},{:.3}\n" : "|{:<16}{:<16}{:<16.3}|\n"),
-                                  fmt::format("{}-{}", lower_bound, upper_bound-1), intervals[i], perc);
-            output << fmt::format((fileFormat == "csv" ? "{},{},{:.3}\n" : "|{:<16}{:<16}{:<16.3}|\n"),
-                                  fmt::format("{}-max", max), countOfMaxes, percMax);
-            break;
-        } else {
-            output << fmt::format((fileFormat == "csv" ? "{},{},{:.3}\n" : "|{:<16}{:<16}{:<16.3}|\n"),
-                                  fmt::format("{}-{}", lower_bound, upper_bound-1), intervals[i], perc);
-        }
-    }
+bool parseDuration(const std::string& text, int64_t& durationNs) {
+    char* end = nullptr;
+    double value = std::strtod(text.c_str(), &end);
+    std::string unit(end);
+    double scale = unit.empty() || unit == "s" ? 1e9 : unit == "ms" ? 1e6 : unit == "us" ? 1e3 :
+                   unit == "ns" ? 1.0 : unit == "m" ? 60e9 : unit == "h" ? 3600e9 : 0.0;
+    durationNs = static_cast<int64_t>(value * scale);
+    return end != text.c_str() && durationNs > 0;
 }
 
 /**
- * \brief Метод для записи статистики high-load портов
- * \author Jodode
- * \version 0.1
- * @param dstMap Словарь {port : countOfAddress}
- * @param output Поток для записи результатов
- *
- * Внутри метода высчитывается распределение портов в процентах, а затем результат записывается в указанный пользователем
- * поток, существует автоматическое определение формата вывода (csv,txt). Выводимые данные можно фильтровать с помощью
- * конфиг файла
+ * \brief Разбор момента времени
+ * @param text Секунды от начала эпохи с дробной частью или "YYYY-MM-DD HH:MM:SS[.fff]" в UTC (вместо пробела
+ * допускается T, в конце - Z)
+ * @param timestampNs Время, нс от начала эпохи
+ * @return false, если время не разобрано
  */
-void writeDstPorts(std::map<uint32_t, uint32_t>& dstMap, std::ostream& output) {
-
-    output << fmt::format((fileFormat == "csv" ? "{}\n{},{},{}\n" : "|{:=^48}|\n|{:^16}{:^16}{:^16}|\n"),
-                                "Dest port stats", "port", "count", "perc");
-
-    size_t totalPortRequests = 0;
-    for (auto& pair : dstMap)
-        totalPortRequests += pair.second;
-
-
-    for (auto& pair : dstMap) {
-        double perc = getPerc(pair.second, totalPortRequests);
-        if (perc > minimalPercPort)
-            output << fmt::format((fileFormat == "csv" ? "{},{},{:.3}\n" : "|{:<16}{:<16}{:<16.3}|\n"),
-                                  pair.first, pair.second, perc);
+bool parseTimestamp(const std::string& text, int64_t& timestampNs) {
+    int year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0, consumed = 0;
+    char separator = 0;
+    int64_t seconds = 0;
+    const char* rest = nullptr;
+    if (std::sscanf(text.c_str(), "%4d-%2d-%2d%c%2d:%2d:%2d%n", &year, &month, &day, &separator, &hour, &minute,
+                    &second, &consumed) == 7) {
+        if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60 ||
+            (separator != ' ' && separator != 'T'))
+            return false;
+        // Число дней от 1970-01-01 по григорианскому календарю (days_from_civil)
+        int y = year - (month <= 2 ? 1 : 0);
+        int era = (y >= 0 ? y : y - 399) / 400;
+        int yearOfEra = y - era * 400;
+        int dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+        int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+        int64_t days = static_cast<int64_t>(era) * 146097 + dayOfEra - 719468;
+        seconds = ((days * 24 + hour) * 60 + minute) * 60 + second;
+        rest = text.c_str() + consumed;
+    } else {
+        char* end = nullptr;
+        seconds = std::strtoll(text.c_str(), &end, 10);
+        if (end == text.c_str())
+            return false;
+        rest = end;
     }
-}
-
-/**
- * \brief Метод для записи статистики high-load IP адресов
- * \author Jodode
- * \version 0.1
- * @param dstMap Словарь {IP : countOfAddress}
- * @param output Поток для записи результатов
- *
- * Внутри метода высчитывается распределение IP в процентах, а затем результат записывается в указанный пользователем
- * поток, существует автоматическое определение формата вывода (csv,txt). Выводимые данные можно фильтровать с помощью
- * конфиг файла
- */
-void writeDstIPv4(std::map<uint32_t, uint32_t>& dstMap, std::ostream& output) {
-    output << fmt::format((fileFormat == "csv" ? "{}\n{},{},{}\n" : "|{:=^48}|\n|{:^16}{:^16}{:^16}|\n"),
-                          "Dest IPv4 stats", "IPv4", "count", "perc");
-    size_t totalIPv4 = 0;
-    for (auto& pair : dstMap)
-        totalIPv4 += pair.second;
-
-    for (auto& pair : dstMap) {
-        double perc = getPerc(pair.second, totalIPv4);
-        if (perc > minimalPercIP)
-            output << fmt::format((fileFormat == "csv" ? "{},{},{:.3}\n" : "|{:<16}{:<16}{:<16.3}|\n"),
-                                  pcpp::IPv4Address(pair.first).toString(), pair.second, perc);
+    int64_t fraction = 0;
+    if (*rest == '.') {
+        int64_t scale = 100000000;
+        for (++rest; *rest >= '0' && *rest <= '9'; ++rest, scale /= 10)
+            fraction += (*rest - '0') * scale;
     }
+    if (*rest == 'Z')
+        ++rest;
+    timestampNs = seconds * 1000000000LL + fraction;
+    return *rest == '\0';
 }
 
-/**
- * \brief Метод для записи статистики
- * \author Jodode
- * \version 0.1
- * @param stats Хранилище статистики
- * @param output Поток для записи результатов
- *
- * Внутри метода вызывается вызов других метод для записи всей доступной статистики, а также дополнительно распределение
- * запросов между протоколами UDP и TCP.
- */
-void writeResults(StatsCollector& stats, std::ostream& output) {
-    output << fmt::format((fileFormat == "csv" ? "{}\n{},{},{}\n" : "|{:=^48}|\n|{:^16}{:^16}{:^16}|\n"),
-                          "General packets info", "total", "collected", "dropped");
-    output << fmt::format((fileFormat == "csv" ? "{},{},{}\n" : "|{:^16}{:^16}{:^16}|\n"),
-                          stats.totalPackets, stats.totalPackets - stats.droppedPackets, stats.droppedPackets);
-    if (stats.udpStats.numOfPackets > 0)
-        writePayloadLen(stats.udpStats.udpMax, stats.udpStats.sizeOfPackets,  "UDP", output);
-    if (stats.tcpStats.numOfPackets > 0)
-        writePayloadLen(stats.tcpStats.tcpMax, stats.tcpStats.sizeOfPackets,  "TCP", output);
-    if (!stats.dstPorts.empty())
-        writeDstPorts(stats.dstPorts, output);
-    if (!stats.dstIPv4.empty())
-        writeDstIPv4(stats.dstIPv4, output);
-    output << fmt::format((fileFormat == "csv" ? "{}\n{},{},{}\n" : "|{:=^48}|\n|{:^16}{:^16}{:^16}|\n"),
-                          "Protocols distribution", "protocol", "count", "perc");
-    output << fmt::format((fileFormat == "csv" ? "{},{},{:.3}\n" : "|{:^16}{:<16}{:<16.3}|\n"), "UDP",
-                          stats.udpStats.numOfPackets,
-                          getPerc(stats.udpStats.numOfPackets, stats.udpStats.numOfPackets + stats.tcpStats.numOfPackets));
-    output << fmt::format((fileFormat == "csv" ? "{},{},{:.3}\n" : "|{:^16}{:<16}{:<16.3}|\n"), "TCP",
-                          stats.tcpStats.numOfPackets,
-                          getPerc(stats.tcpStats.numOfPackets, stats.udpStats.numOfPackets + stats.tcpStats.numOfPackets));
-
-}
-
-
-
-
 int main(int argc, char* argv[]) {
     std::map<std::string, docopt::value> args
             = docopt::docopt(USAGE,
@@ -285,9 +265,6 @@ int main(int argc, char* argv[]) {
         size_t totalIP = 1;
 
         StatsCollector stats;
-        size_t length;
-        std::vector<size_t> udpPackets;
-        size_t udpMax = 0;
         uint32_t max_UDP = std::rand() % 1000;
         for (uint32_t i = 0; i < max_UDP; ++i) {
             if (std::rand() % 13 == 0 && i != 0) {
@@ -298,9 +275,6 @@ int main(int argc, char* argv[]) {
                 dstIP = std::rand();
                 ++totalIP;
             }
-            length = std::rand() % 1000;
-            udpPackets.push_back(length);
-            if (length > udpMax) udpMax = length;
             pcpp::EthLayer newEthernetLayer(pcpp::MacAddress("00:50:43:11:22:33"), pcpp::MacAddress("aa:bb:cc:dd:ee"));
             pcpp::IPv4Layer newIPLayer(pcpp::IPv4Address("192.168.1.1"),
                                        pcpp::IPv4Address(pcpp::IPv4Address(dstIP).toString()));
@@ -319,8 +293,6 @@ int main(int argc, char* argv[]) {
 
         }
 
-        std::vector<size_t> tcpPackets;
-        size_t tcpMax = 0;
         uint32_t max_TCP = std::rand() % 1000;
         for (uint32_t i = 0; i < max_TCP; ++i) {
             if (std::rand() % 13 == 0 && i != 0) {
@@ -331,9 +303,6 @@ int main(int argc, char* argv[]) {
                 dstIP = std::rand();
                 ++totalIP;
             }
-            length = std::rand() % 1000;
-            tcpPackets.push_back(length);
-            if (length > tcpMax) tcpMax = length;
             pcpp::EthLayer nEthernetLayer(pcpp::MacAddress("00:50:43:11:22:33"), pcpp::MacAddress("aa:bb:cc:dd:ee"));
             pcpp::IPv4Layer nIPLayer(pcpp::IPv4Address("192.168.1.1"),
                                      pcpp::IPv4Address(pcpp::IPv4Address(dstIP).toString()));
@@ -359,6 +328,36 @@ int main(int argc, char* argv[]) {
         require("Count TCP packets",assertExp(stats.tcpStats.numOfPackets, max_TCP));
         require("Count destination ports",assertExp(stats.dstPorts.size(), totalPorts));
         require("Count destination IP",assertExp(stats.dstIPv4.size(), totalIP));
+        StatsCollector merged;
+        merged.merge(stats);
+        merged.merge(stats);
+        require("Merge collectors",assertExp(merged.totalPackets, 2 * stats.totalPackets) &&
+                                   assertExp(merged.udpStats.payloadLen.countOfMax, 2 * stats.udpStats.payloadLen.countOfMax) &&
+                                   assertExp(merged.dstPorts.size(), totalPorts) &&
+                                   assertExp(merged.dstIPv4.size(), totalIP));
+        SpaceSaving<uint32_t> heavyHitters(4);
+        for (uint32_t i = 0; i < 1000; ++i)
+            heavyHitters.add(i % 10 == 0 ? 42 : i);
+        auto top = heavyHitters.top();
+        require("Heavy hitter found", !top.empty() && top[0].key == 42 &&
+                                      top[0].count - top[0].error <= 100 && top[0].count >= 100);
+        ColumnChunk addresses;
+        for (uint32_t i = 0; i < 1000; ++i) {
+            const uint8_t bytes[4] = {10, 0, static_cast<uint8_t>(i >> 8), static_cast<uint8_t>(i)};
+            PacketHeaders headers;
+            headers.hasIPv4 = true;
+            std::memcpy(&headers.srcIPv4, bytes, sizeof(bytes));
+            headers.dstIPv4 = headers.srcIPv4;
+            addresses.add(headers);
+        }
+        std::string encoded;
+        columnar::encodeColumn(addresses.srcIPv4, encoded);
+        std::vector<uint32_t> decoded;
+        bool roundTrip = columnar::decodeColumn(reinterpret_cast<const uint8_t*>(encoded.data()) + 4,
+                                                encoded.size() - 4, addresses.size(), decoded);
+        require("Columnar sequential IPs", roundTrip && decoded == addresses.srcIPv4 &&
+                                           decoded.front() == 0x0A000000u && decoded.back() == 0x0A0003E7u &&
+                                           encoded.size() <= 4 + 5 + addresses.size() - 1);
         require("Percent calculating", getPerc(size_t(1), size_t(3)) - 33.333333333 > 0.0000000000001);
 
         std::cout << fmt::format((fileFormat == "csv" ? "{}\n{},{},{}\n" : "|{:=^48}|\n|{:^16}{:^16}{:^16}|\n"),
@@ -366,9 +365,9 @@ int main(int argc, char* argv[]) {
         std::cout << fmt::format((fileFormat == "csv" ? "{},{},{}\n" : "|{:^16}{:^16}{:^16}|\n"),
                               stats.totalPackets, stats.totalPackets - stats.droppedPackets, stats.droppedPackets);
         if (stats.udpStats.numOfPackets > 0)
-            writePayloadLen(udpMax, udpPackets,  "UDP", std::cout);
+            writePayloadLen(stats.udpStats.payloadLen, "UDP", std::cout);
         if (stats.tcpStats.numOfPackets > 0)
-            writePayloadLen(tcpMax, tcpPackets,  "TCP", std::cout);
+            writePayloadLen(stats.tcpStats.payloadLen, "TCP", std::cout);
         if (!stats.dstPorts.empty())
             writeDstPorts(stats.dstPorts, std::cout);
         if (!stats.dstIPv4.empty())
@@ -384,11 +383,146 @@ int main(int argc, char* argv[]) {
 
     }
 
-    StatsCollector statsCollector;
-
     verboseMode = args.find("-v")->second.asBool();
 
+    bool profileText = args.find("--profile")->second.asBool();
+    std::string profileJson;
+    if (args.find("--profile-json")->second)
+        profileJson = args.find("--profile-json")->second.asString();
+    if (profileText || !profileJson.empty()) {
+#if defined(SFT_PROFILING)
+        profileMode = true;
+        Profiler::instance().start();
+#else
+        std::cerr << "[-] WARNING: Built without SFT_PROFILING (cmake -DSFT_PROFILING=ON), --profile is ignored"
+                  << std::endl;
+#endif
+    }
+
+    size_t numOfThreads = 1;
+    if (args.find("--threads")->second) {
+        long threads = 0;
+        if (!parseInteger(args.find("--threads")->second.asString(), 1, static_cast<long>(maxNumOfThreads),
+                          threads)) {
+            std::cerr << "[-] ERROR: Number of threads must be in range 1-" << maxNumOfThreads << std::endl;
+            return 1;
+        }
+        numOfThreads = static_cast<size_t>(threads);
+    }
+
+    if (args.find("--topk")->second) {
+        long topK = 0;
+        if (!parseInteger(args.find("--topk")->second.asString(), 1, std::numeric_limits<long>::max(), topK)) {
+            std::cerr << "[-] ERROR: --topk must be a positive number" << std::endl;
+            return 1;
+        }
+        collectorOptions.topK = static_cast<size_t>(topK);
+    }
+    collectorOptions.trackFlows = args.find("--flows")->second.asBool();
+    if (args.find("--flow-timeout")->second) {
+        double timeout = std::strtod(args.find("--flow-timeout")->second.asString().c_str(), nullptr);
+        if (timeout <= 0) {
+            std::cerr << "[-] ERROR: --flow-timeout must be positive" << std::endl;
+            return 1;
+        }
+        collectorOptions.flowTimeoutNs = static_cast<int64_t>(timeout * 1e9);
+    }
+    if (args.find("--top-flows")->second) {
+        long topFlows = 0;
+        if (!parseInteger(args.find("--top-flows")->second.asString(), 1, std::numeric_limits<long>::max(),
+                          topFlows)) {
+            std::cerr << "[-] ERROR: --top-flows must be a positive number" << std::endl;
+            return 1;
+        }
+        collectorOptions.topFlows = static_cast<size_t>(topFlows);
+    }
+    if (args.find("--apps")->second &&
+        !parseAppProtocols(args.find("--apps")->second.asString(), collectorOptions.appProtocols)) {
+        std::cerr << "[-] ERROR: --apps takes a comma-separated list of dns, http, tls or all" << std::endl;
+        return 1;
+    }
+    if (args.find("--top-names")->second) {
+        long topNames = 0;
+        if (!parseInteger(args.find("--top-names")->second.asString(), 1, std::numeric_limits<long>::max(),
+                          topNames)) {
+            std::cerr << "[-] ERROR: --top-names must be a positive number" << std::endl;
+            return 1;
+        }
+        collectorOptions.topNames = static_cast<size_t>(topNames);
+    }
+    collectorOptions.trackCardinality = args.find("--cardinality")->second.asBool();
+    if (args.find("--hll-precision")->second) {
+        long precision = 0;
+        if (!parseInteger(args.find("--hll-precision")->second.asString(), HyperLogLog::minPrecision,
+                          HyperLogLog::maxPrecision, precision)) {
+            std::cerr << "[-] ERROR: --hll-precision must be in range 4-18" << std::endl;
+            return 1;
+        }
+        collectorOptions.hllPrecision = static_cast<unsigned>(precision);
+    }
+    if (args.find("--quantile-error")->second) {
+        double accuracy = std::strtod(args.find("--quantile-error")->second.asString().c_str(), nullptr);
+        if (accuracy < DDSketch::minAccuracy || accuracy > DDSketch::maxAccuracy) {
+            std::cerr << "[-] ERROR: --quantile-error must be in range 0.0001-0.5" << std::endl;
+            return 1;
+        }
+        collectorOptions.quantileAccuracy = accuracy;
+    }
+    if (args.find("--sample")->second && args.find("--sample-budget")->second) {
+        std::cerr << "[-] ERROR: --sample and --sample-budget cannot be combined" << std::endl;
+        return 1;
+    }
+    if (args.find("--sample")->second) {
+        std::string rate = args.find("--sample")->second.asString();
+        if (rate.compare(0, 2, "1/") == 0)
+            rate = rate.substr(2);
+        collectorOptions.sampleRate = std::strtoull(rate.c_str(), nullptr, 10);
+        std::string mode = args.find("--sample-mode")->second.asString();
+        if (collectorOptions.sampleRate < 2 || (mode != "hash" && mode != "systematic")) {
+            std::cerr << "[-] ERROR: Wrong --sample, expected e.g. --sample 1/100 --sample-mode hash" << std::endl;
+            return 1;
+        }
+        collectorOptions.sampleMode = mode == "hash" ? SampleHash : SampleSystematic;
+    }
+    if (args.find("--sample-budget")->second) {
+        collectorOptions.sampleBudget = static_cast<size_t>(
+                std::strtoull(args.find("--sample-budget")->second.asString().c_str(), nullptr, 10));
+        if (collectorOptions.sampleBudget == 0) {
+            std::cerr << "[-] ERROR: --sample-budget must be positive" << std::endl;
+            return 1;
+        }
+        collectorOptions.sampleMode = SampleBudget;
+    }
+    if (collectorOptions.sampleMode == SampleBudget && collectorOptions.appProtocols != 0)
+        std::cerr << "[-] WARNING: Names are not counted with --sample-budget, only application protocols" << std::endl;
+    collectorOptions.batchMode = args.find("--batch")->second.asBool();
+    if (collectorOptions.batchMode && verboseMode)
+        std::cout << "[+] Batch mode, " << kernelLevelName(kernelLevel()) << " kernels" << std::endl;
+    if (args.find("--filter")->second) {
+        std::string error;
+        collectorOptions.filter = args.find("--filter")->second.asString();
+        if (!PacketFilter::validate(collectorOptions.filter, error)) {
+            std::cerr << "[-] ERROR: Wrong --filter: " << error << std::endl;
+            return 1;
+        }
+    }
+    for (const char* bound : {"--from", "--to"}) {
+        if (!args.find(bound)->second)
+            continue;
+        int64_t timestampNs = 0;
+        if (!parseTimestamp(args.find(bound)->second.asString(), timestampNs)) {
+            std::cerr << "[-] ERROR: Wrong " << bound << ", expected e.g. 1700000000.5 or \"2024-03-01 12:00:00\""
+                      << std::endl;
+            return 1;
+        }
+        (bound[2] == 'f' ? collectorOptions.timeRange.fromNs : collectorOptions.timeRange.toNs) = timestampNs;
+    }
+    if (collectorOptions.timeRange.fromNs > collectorOptions.timeRange.toNs) {
+        std::cerr << "[-] ERROR: --from is after --to" << std::endl;
+        return 1;
+    }
 
+    SubnetTable subnetTable;
     if (args.find("--config")->second) {
         std::string pathConfig = args.find("--config")->second.asString();
         std::string config = pathConfig.substr(pathConfig.rfind(pathSeparator) + 1);
@@ -398,14 +532,43 @@ int main(int argc, char* argv[]) {
         }
         std::ifstream configFile (pathConfig);
         std::string line;
+        std::string error;
         if (configFile.is_open()) {
             while (std::getline(configFile, line)) {
                 if (line[0] != '#'){
                     std::istringstream sin(line.substr(line.find('=') + 1));
-                    if (line.find("MINIMAL_PORT_PERC") != -1)
+                    std::string directive = line.substr(0, line.find('='));
+                    directive.erase(directive.find_last_not_of(" \t") + 1);
+                    if (directive == "MINIMAL_PORT_PERC")
                         sin >> minimalPercPort;
-                    else if (line.find("MINIMAL_IP_PERC") != -1)
+                    else if (directive == "MINIMAL_IP_PERC")
                         sin >> minimalPercIP;
+                    else if (directive == "SUBNETS_FILE") {
+                        std::string subnetsPath;
+                        sin >> subnetsPath;
+                        if (!subnetsPath.empty() && subnetsPath[0] != pathSeparator &&
+                            pathConfig.rfind(pathSeparator) != std::string::npos)
+                            subnetsPath = pathConfig.substr(0, pathConfig.rfind(pathSeparator) + 1) + subnetsPath;
+                        if (!subnetTable.load(subnetsPath, error)) {
+                            std::cerr << "[-] ERROR: " << error << std::endl;
+                            return 1;
+                        }
+                    } else if (directive == "SUBNET_ROLLUP") {
+                        sin >> subnetRollup;
+                        if (subnetRollup > 32) {
+                            std::cerr << "[-] ERROR: SUBNET_ROLLUP must be a prefix length 0-32" << std::endl;
+                            return 1;
+                        }
+                    } else if (directive == "SUBNET") {
+                        std::string prefix, name;
+                        sin >> prefix;
+                        std::getline(sin >> std::ws, name);
+                        name.erase(name.find_last_not_of(" \t\r") + 1);
+                        if (!subnetTable.add(prefix, name, error)) {
+                            std::cerr << "[-] ERROR: " << error << std::endl;
+                            return 1;
+                        }
+                    }
                 }
             }
         }
@@ -413,43 +576,258 @@ int main(int argc, char* argv[]) {
         if (verboseMode)
             std::cout << "[+] Config file read";
     }
+    if (!subnetTable.empty()) {
+        subnetTable.build();
+        collectorOptions.subnets = &subnetTable;
+        if (verboseMode)
+            std::cout << "[+] " << subnetTable.numOfPrefixes() << " prefixes of " << subnetTable.numOfNames()
+                      << " subnets loaded" << std::endl;
+    }
+    if (subnetRollup > 0 && collectorOptions.topK > 0)
+        std::cerr << "[-] WARNING: SUBNET_ROLLUP needs exact IP counters, ignored with --topk" << std::endl;
+
+    std::string outFilename;
+    std::unique_ptr<ColumnarWriter> columnarWriter;
+    if (args.find("-o")->second) {
+        outFilename = args.find("-o")->second.asString();
+        if (fileExists(outFilename)) {
+            std::cerr << "[-] ERROR: Output file exists" << std::endl;
+            return 1;
+        }
+        if (outFilename.substr(outFilename.find_last_of('.') + 1) == "csv") fileFormat = "csv";
+        if (isColumnarName(outFilename)) {
+            std::string error;
+            columnarWriter.reset(new ColumnarWriter(outFilename));
+            if (!columnarWriter->open(error)) {
+                std::cerr << "[-] ERROR: " << error << std::endl;
+                return 1;
+            }
+            collectorOptions.columnarWriter = columnarWriter.get();
+            outFilename.clear();
+        }
+    }
+    StatsCollector statsCollector(collectorOptions);
+
+    auto writeReport = [&statsCollector, &outFilename]() {
+        ProfileScope scope(ProfileReport);
+        if (outFilename.empty()) {
+            writeResults(statsCollector, std::cout);
+            return;
+        }
+        std::string tempFilename = outFilename + ".tmp";
+        std::ofstream outputFile;
+        outputFile.open(tempFilename, std::ios::out);
+        writeResults(statsCollector, outputFile);
+        outputFile.close();
+        std::rename(tempFilename.c_str(), outFilename.c_str());
+    };
+
+    std::ofstream seriesFile;
+    std::unique_ptr<IntervalSeries> intervalSeries;
+    if (args.find("--interval")->second) {
+        if (collectorOptions.sampleMode != SampleNone) {
+            std::cerr << "[-] ERROR: --interval cannot be combined with sampling" << std::endl;
+            return 1;
+        }
+        int64_t intervalNs = 0;
+        if (!parseDuration(args.find("--interval")->second.asString(), intervalNs)) {
+            std::cerr << "[-] ERROR: Wrong --interval, expected e.g. 1s, 500ms, 5m" << std::endl;
+            return 1;
+        }
+        if (!args.find("--series")->second || args.find("--series")->second.asString() == "-") {
+            std::cerr << "[-] ERROR: --interval needs a --series file path" << std::endl;
+            return 1;
+        }
+        std::string seriesPath = args.find("--series")->second.asString();
+        if (fileExists(seriesPath)) {
+            std::cerr << "[-] ERROR: Series file exists" << std::endl;
+            return 1;
+        }
+        seriesFile.open(seriesPath, std::ios::out);
+        intervalSeries.reset(new IntervalSeries(seriesFile, intervalNs));
+        intervalSeries->writeHeader();
+        statsCollector.series = intervalSeries.get();
+        if (numOfThreads > 1 && verboseMode)
+            std::cout << "[!] Time series needs packets in time order, reading in one thread" << std::endl;
+        numOfThreads = 1;
+    }
 
 
+    bool haveStats = false;
+    std::vector<InputFile> processedFiles;
+    if (args.find("--load-state")->second) {
+        std::vector<std::string> specs;
+        std::istringstream list(args.find("--load-state")->second.asString());
+        for (std::string spec; std::getline(list, spec, ',');)
+            if (!spec.empty())
+                specs.push_back(spec);
+        std::vector<InputFile> snapshots = expandInputs(specs, isSnapshotName);
+        if (snapshots.empty()) {
+            std::cerr << "[-] ERROR: No snapshots match --load-state" << std::endl;
+            return 1;
+        }
+        for (auto& snapshot : snapshots) {
+            ProfileScope scope(ProfileState);
+            std::vector<std::string> warnings;
+            std::string error;
+            if (!loadSnapshot(snapshot.path, statsCollector, processedFiles, warnings, error)) {
+                std::cerr << "[-] ERROR: " << error << std::endl;
+                return 1;
+            }
+            for (auto& warning : warnings)
+                std::cerr << "[-] WARNING: " << snapshot.path << ": " << warning << std::endl;
+        }
+        if (verboseMode)
+            std::cout << "[+] Loaded " << snapshots.size() << " snapshots" << std::endl;
+        haveStats = true;
+    }
+
     if (args.find("-f")->second) {
-        std::string inPath = args.find("-f")->second.asString();
-        std::string inFilename = inPath.substr(inPath.rfind(pathSeparator) + 1);
-        pcpp::IFileReaderDevice* reader = pcpp::IFileReaderDevice::getReader(inPath);
+        std::vector<std::string> inputs{args.find("-f")->second.asString()};
+        if (args.find("INFILES")->second) {
+            auto& rest = args.find("INFILES")->second.asStringList();
+            inputs.insert(inputs.end(), rest.begin(), rest.end());
+        }
+        if (inputs.size() == 1 && inputs[0] == "-") {
+            if (args.find("--build-index")->second.asBool()) {
+                std::cerr << "[-] ERROR: --build-index needs capture files, not stdin" << std::endl;
+                return 1;
+            }
+            uint64_t reportEvery = 0;
+            if (args.find("--report-every")->second)
+                reportEvery = std::strtoull(args.find("--report-every")->second.asString().c_str(), nullptr, 10);
+            auto incrementalReport = [&writeReport, &statsCollector]() {
+                logMessage(std::cout, "[+] Writing report after " + std::to_string(statsCollector.totalPackets) +
+                                      " packets");
+                writeReport();
+            };
+            if (!collectStream(statsCollector, reportEvery, incrementalReport))
+                return 1;
+        } else {
+            std::vector<InputFile> files = expandInputs(inputs);
+            if (files.empty()) {
+                std::cerr << "[-] ERROR: No capture files match the input" << std::endl;
+                return 1;
+            }
+            files.erase(std::remove_if(files.begin(), files.end(), [&processedFiles](const InputFile& file) {
+                for (auto& processed : processedFiles)
+                    if (processed.sameAs(file)) {
+                        if (verboseMode)
+                            std::cout << "[+] Skipping " << file.path << ", already in snapshot" << std::endl;
+                        return true;
+                    }
+                return false;
+            }), files.end());
+
+            if (args.find("--build-index")->second.asBool()) {
+                long every = 0;
+                if (!parseInteger(args.find("--index-every")->second.asString(), 1,
+                                  static_cast<long>(std::min<unsigned long>(UINT32_MAX, LONG_MAX)), every)) {
+                    std::cerr << "[-] ERROR: --index-every must be positive" << std::endl;
+                    return 1;
+                }
+                for (auto& file : files) {
+                    PcapIndex index;
+                    std::string error;
+                    if (!index.build(file.path, static_cast<uint32_t>(every), error) ||
+                        !index.save(PcapIndex::pathFor(file.path), error)) {
+                        std::cerr << "[-] WARNING: " << error << std::endl;
+                        continue;
+                    }
+                    std::cout << "[+] Index of " << file.path << " written: " << index.numOfPackets() << " packets, "
+                              << index.data().size() << " entries" << std::endl;
+                }
+            }
 
-        if (reader == nullptr)
-        {
-            std::cerr << "[-] ERROR: Cannot determine reader for file type" << std::endl;
+            if (files.size() == 1 || (intervalSeries && !files.empty())) {
+                size_t failed = 0;
+                for (auto& file : files) {
+                    if (collectFile(file.path, statsCollector, numOfThreads, args.find("--mmap")->second.asBool()))
+                        processedFiles.push_back(file);
+                    else
+                        ++failed;
+                }
+                if (failed == files.size())
+                    return 1;
+                if (failed > 0)
+                    std::cerr << "[-] WARNING: " << failed << " of " << files.size() << " files were skipped"
+                              << std::endl;
+            } else if (!files.empty()) {
+                if (verboseMode)
+                    std::cout << "[+] Collecting " << files.size() << " files" << std::endl;
+                std::vector<InputFile> failed = collectFiles(files, statsCollector, numOfThreads,
+                                                             args.find("--mmap")->second.asBool());
+                if (failed.size() == files.size())
+                    return 1;
+                if (!failed.empty())
+                    std::cerr << "[-] WARNING: " << failed.size() << " of " << files.size() << " files were skipped"
+                              << std::endl;
+                for (auto& file : files)
+                    if (std::none_of(failed.begin(), failed.end(),
+                                     [&file](const InputFile& other) { return other.path == file.path; }))
+                        processedFiles.push_back(file);
+            }
+        }
+        haveStats = true;
+    } else if (args.find("--watch")->second) {
+        if (intervalSeries || collectorOptions.sampleMode == SampleBudget) {
+            std::cerr << "[-] ERROR: --watch cannot be combined with --interval or --sample-budget" << std::endl;
             return 1;
         }
-        if (!reader->open())
-        {
-            std::cerr << "[-] ERROR: Cannot open " << inFilename << " for reading" << std::endl;
+        if (!watchDirectory(args.find("--watch")->second.asString(), statsCollector, processedFiles, numOfThreads,
+                            args.find("--mmap")->second.asBool(), args.find("--metrics")->second.asString()))
+            return 1;
+        haveStats = true;
+    }
+    statsCollector.finishSample();
+    if (columnarWriter) {
+        std::string error;
+        statsCollector.columns->flush();
+        if (!columnarWriter->close(error)) {
+            std::cerr << "[-] ERROR: " << error << std::endl;
             return 1;
         }
+        std::cout << "[+] " << columnarWriter->numOfRecords() << " packet records written to "
+                  << args.find("-o")->second.asString() << std::endl;
+    }
+    if (intervalSeries) {
+        intervalSeries->finish();
+        statsCollector.series = nullptr;
+    }
 
-        std::cout << "[+] File successfully opened" << std::endl;
-        if (verboseMode)
-            std::cout << "[+] Starting analyze" << std::endl;
+    if (args.find("--save-state")->second) {
+        std::string statePath = args.find("--save-state")->second.asString();
+        std::string error;
+        bool saved;
+        {
+            ProfileScope scope(ProfileState);
+            saved = saveSnapshot(statePath, statsCollector, processedFiles, error);
+        }
+        if (!saved) {
+            std::cerr << "[-] ERROR: " << error << std::endl;
+            return 1;
+        }
+        std::cout << "[+] State saved to " << statePath << std::endl;
+    }
 
-        collectPcap(reader, statsCollector);
+    if (haveStats) {
         std::cout << "[+] Writing report" << std::endl;
-        if (args.find("-o")->second) {
-            std::string outFilename = args.find("-o")->second.asString();
-            if (fileExists(outFilename)) {
-                std::cerr << "[-] ERROR: Output file exists" << std::endl;
+        writeReport();
+    }
+
+    if (profileMode) {
+        if (profileText)
+            Profiler::instance().writeText(std::cerr);
+        if (profileJson == "-") {
+            Profiler::instance().writeJson(std::cout);
+        } else if (!profileJson.empty()) {
+            std::ofstream jsonFile(profileJson, std::ios::out);
+            Profiler::instance().writeJson(jsonFile);
+            jsonFile.close();
+            if (!jsonFile) {
+                std::cerr << "[-] ERROR: Cannot write profile to " << profileJson << std::endl;
                 return 1;
             }
-            if (outFilename.substr(outFilename.find_last_of('.') + 1) == "csv") fileFormat = "csv";
-            std::ofstream outputFile;
-            outputFile.open(outFilename, std::ios::out);
-            writeResults(statsCollector, outputFile);
-            outputFile.close();
-        } else {
-            writeResults(statsCollector, std::cout);
         }
     }
 
@@ -0,0 +1,306 @@
+/**
+ \file
+ \brief Заголовочный файл с генератором синтетического трафика
+
+ Данный файл содержит детерминированный генератор пакетов Ethernet/IPv4/TCP/UDP/ICMP с управляемым распределением
+ адресов, портов и размеров "полезной нагрузки" и запись их в формате pcap. Одинаковые параметры и seed дают
+ одинаковый файл
+*/
+
+#ifndef SYNTHETIC_TRAFFIC_H
+#define SYNTHETIC_TRAFFIC_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+//! Параметры синтетического трафика
+/**
+ * \brief Распределения, по которым генерируются пакеты
+ * \author Jodode
+ * \version 0.1
+ */
+struct SyntheticProfile {
+    //! Режим размеров "полезной нагрузки"
+    enum PayloadMode {
+        //! Простой IMIX: 7 : 4 : 1 для IP пакетов 40, 576 и 1500 байт
+        Imix,
+        //! Равномерно в [minPayload, maxPayload]
+        Uniform,
+        //! Всегда minPayload
+        Fixed
+    };
+
+    //! Начальное значение генератора случайных чисел
+    uint64_t seed = 1;
+    //! Число различных IP адресов назначения
+    uint32_t numOfIPs = 10000;
+    //! Показатель распределения Ципфа адресов назначения (0 - равномерное)
+    double ipSkew = 1.1;
+    //! Число различных портов назначения
+    uint32_t numOfPorts = 1000;
+    //! Показатель распределения Ципфа портов назначения
+    double portSkew = 1.2;
+    //! Доля UDP пакетов
+    double udpShare = 0.3;
+    //! Доля пакетов остальных протоколов (ICMP)
+    double otherShare = 0.01;
+    //! Режим размеров "полезной нагрузки"
+    PayloadMode payloadMode = Imix;
+    //! Минимальный размер "полезной нагрузки"
+    size_t minPayload = 0;
+    //! Максимальный размер "полезной нагрузки"
+    size_t maxPayload = 1460;
+    //! Средняя скорость, пакетов в секунду
+    double packetsPerSecond = 100000;
+    //! Время первого пакета, нс
+    int64_t startNs = 1700000000LL * 1000000000LL;
+};
+
+//! Генератор синтетического трафика
+/**
+ * \brief Детерминированный источник кадров Ethernet
+ * \author Jodode
+ * \version 0.1
+ *
+ * Случайные числа берутся из splitmix64, а распределения реализованы здесь же, а не через <random>, чтобы
+ * результат не зависел от стандартной библиотеки. Адреса и порты выбираются по рангу из распределения Ципфа,
+ * ранг переводится в адрес перестановкой, поэтому частые адреса не идут подряд. Интервалы между пакетами
+ * экспоненциальные со средним 1 / packetsPerSecond
+ */
+class SyntheticTraffic {
+public:
+    //! Размер заголовков Ethernet + IPv4 + TCP
+    static constexpr size_t headersLen = 14 + 20 + 20;
+
+    //! Конструктор
+    /**
+     * @param profile Параметры трафика
+     */
+    explicit SyntheticTraffic(const SyntheticProfile& profile)
+        : profile(profile), state(profile.seed), timestampNs(profile.startNs),
+          ipRanks(zipfTable(std::max<uint32_t>(profile.numOfIPs, 1), profile.ipSkew)),
+          portRanks(zipfTable(std::max<uint32_t>(profile.numOfPorts, 1), profile.portSkew)) {}
+
+    //! Наибольшая длина кадра при данных параметрах
+    size_t maxFrameLen() const {
+        return headersLen + std::max<size_t>(profile.payloadMode == SyntheticProfile::Imix ? 1460 : profile.maxPayload,
+                                             profile.minPayload);
+    }
+
+    /**
+     * \brief Генерация следующего кадра
+     * @param frame Буфер не меньше maxFrameLen() байт
+     * @param frameTimestampNs Время пакета, нс
+     * @return Длина кадра
+     */
+    size_t next(uint8_t* frame, int64_t& frameTimestampNs) {
+        timestampNs += static_cast<int64_t>(-std::log(1.0 - uniform()) * 1e9 / profile.packetsPerSecond);
+        frameTimestampNs = timestampNs;
+
+        double kind = uniform();
+        uint8_t protocol = kind < profile.otherShare ? 1 : kind < profile.otherShare + profile.udpShare ? 17 : 6;
+        size_t l4HeaderLen = protocol == 6 ? 20 : 8;
+        size_t payload = payloadLen(l4HeaderLen);
+
+        uint32_t srcIPv4 = 0xC0A80000u | static_cast<uint32_t>(nextRandom() & 0xFFFF);
+        uint32_t dstIPv4 = 0x0A000000u | scatter(sample(ipRanks), 0xFFFFFF);
+        uint16_t srcPort = static_cast<uint16_t>(1024 + nextRandom() % (65536 - 1024));
+        uint16_t dstPort = portOfRank(sample(portRanks));
+
+        static const uint8_t ethernet[14] = {0x00, 0x1b, 0x21, 0x3c, 0x4d, 0x5e, 0x00, 0x50,
+                                             0x43, 0x11, 0x22, 0x33, 0x08, 0x00};
+        std::memcpy(frame, ethernet, sizeof(ethernet));
+
+        uint8_t* ip = frame + 14;
+        size_t ipTotal = 20 + l4HeaderLen + payload;
+        ip[0] = 0x45;
+        ip[1] = 0;
+        put16(ip + 2, static_cast<uint16_t>(ipTotal));
+        put16(ip + 4, static_cast<uint16_t>(packetId++));
+        put16(ip + 6, 0x4000);
+        ip[8] = 64;
+        ip[9] = protocol;
+        put16(ip + 10, 0);
+        put32(ip + 12, srcIPv4);
+        put32(ip + 16, dstIPv4);
+        put16(ip + 10, checksum(ip, 20));
+
+        uint8_t* l4 = ip + 20;
+        if (protocol == 6) {
+            put16(l4, srcPort);
+            put16(l4 + 2, dstPort);
+            put32(l4 + 4, static_cast<uint32_t>(nextRandom()));
+            put32(l4 + 8, static_cast<uint32_t>(nextRandom()));
+            l4[12] = 0x50;
+            l4[13] = uniform() < 0.02 ? 0x02 : 0x18;
+            put16(l4 + 14, 65535);
+            put32(l4 + 16, 0);
+        } else if (protocol == 17) {
+            put16(l4, srcPort);
+            put16(l4 + 2, dstPort);
+            put16(l4 + 4, static_cast<uint16_t>(8 + payload));
+            put16(l4 + 6, 0);
+        } else {
+            l4[0] = 8;
+            l4[1] = 0;
+            put16(l4 + 2, 0);
+            put32(l4 + 4, static_cast<uint32_t>(packetId));
+        }
+        std::memset(l4 + l4HeaderLen, static_cast<int>(packetId & 0xFF), payload);
+        return 14 + ipTotal;
+    }
+
+private:
+    uint64_t nextRandom() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    //! Равномерное число в [0, 1)
+    double uniform() { return static_cast<double>(nextRandom() >> 11) * (1.0 / 9007199254740992.0); }
+
+    //! Функция распределения Ципфа по рангам 0..n-1
+    static std::vector<double> zipfTable(uint32_t n, double skew) {
+        std::vector<double> cdf(n);
+        double sum = 0;
+        for (uint32_t i = 0; i < n; ++i) {
+            sum += 1.0 / std::pow(static_cast<double>(i + 1), skew);
+            cdf[i] = sum;
+        }
+        for (auto& value : cdf)
+            value /= sum;
+        return cdf;
+    }
+
+    uint32_t sample(const std::vector<double>& cdf) {
+        auto it = std::upper_bound(cdf.begin(), cdf.end(), uniform());
+        return static_cast<uint32_t>(std::min<size_t>(static_cast<size_t>(it - cdf.begin()), cdf.size() - 1));
+    }
+
+    //! Перестановка ранга в пределах маски (нечетный множитель - биекция по модулю 2^k)
+    static uint32_t scatter(uint32_t rank, uint32_t mask) { return (rank * 2654435761u + 1) & mask; }
+
+    //! Порт по рангу: сначала распространенные службы, затем порты с 1024
+    static uint16_t portOfRank(uint32_t rank) {
+        static const uint16_t common[] = {443, 80, 53, 22, 123, 25, 993, 8080, 3306, 5432};
+        const uint32_t numOfCommon = sizeof(common) / sizeof(common[0]);
+        return rank < numOfCommon ? common[rank] : static_cast<uint16_t>(1024 + (rank - numOfCommon) % 64512);
+    }
+
+    size_t payloadLen(size_t l4HeaderLen) {
+        if (profile.payloadMode == SyntheticProfile::Fixed)
+            return profile.minPayload;
+        if (profile.payloadMode == SyntheticProfile::Uniform) {
+            size_t span = profile.maxPayload >= profile.minPayload ? profile.maxPayload - profile.minPayload : 0;
+            return profile.minPayload + static_cast<size_t>(nextRandom() % (span + 1));
+        }
+        uint64_t pick = nextRandom() % 12;
+        size_t ipLen = pick < 7 ? 40 : pick < 11 ? 576 : 1500;
+        return ipLen > 20 + l4HeaderLen ? ipLen - 20 - l4HeaderLen : 0;
+    }
+
+    static void put16(uint8_t* data, uint16_t value) {
+        data[0] = static_cast<uint8_t>(value >> 8);
+        data[1] = static_cast<uint8_t>(value);
+    }
+
+    static void put32(uint8_t* data, uint32_t value) {
+        put16(data, static_cast<uint16_t>(value >> 16));
+        put16(data + 2, static_cast<uint16_t>(value));
+    }
+
+    static uint16_t checksum(const uint8_t* data, size_t len) {
+        uint32_t sum = 0;
+        for (size_t i = 0; i + 1 < len; i += 2)
+            sum += (static_cast<uint32_t>(data[i]) << 8) | data[i + 1];
+        while (sum >> 16)
+            sum = (sum & 0xFFFF) + (sum >> 16);
+        return static_cast<uint16_t>(~sum);
+    }
+
+    //! Параметры трафика
+    SyntheticProfile profile;
+    //! Состояние splitmix64
+    uint64_t state;
+    //! Время последнего пакета, нс
+    int64_t timestampNs;
+    //! Номер пакета (идентификатор IPv4)
+    uint64_t packetId = 0;
+    //! Функция распределения рангов адресов назначения
+    std::vector<double> ipRanks;
+    //! Функция распределения рангов портов назначения
+    std::vector<double> portRanks;
+};
+
+//! Запись файла pcap
+/**
+ * \brief Запись заголовка и пакетов pcap (микросекунды, little-endian, Ethernet)
+ * \author Jodode
+ * \version 0.1
+ */
+class PcapFileWriter {
+public:
+    //! Конструктор
+    /**
+     * @param output Поток для записи (открытый в двоичном режиме)
+     * @param snapLen Наибольшее число сохраняемых байт пакета
+     */
+    PcapFileWriter(std::ostream& output, uint32_t snapLen = 65535) : output(output), snapLen(snapLen) {
+        uint8_t header[24];
+        put32(header, 0xA1B2C3D4u);
+        put16(header + 4, 2);
+        put16(header + 6, 4);
+        put32(header + 8, 0);
+        put32(header + 12, 0);
+        put32(header + 16, snapLen);
+        put32(header + 20, 1);
+        output.write(reinterpret_cast<const char*>(header), sizeof(header));
+    }
+
+    /**
+     * \brief Запись пакета
+     * @param frame Кадр
+     * @param frameLen Длина кадра
+     * @param timestampNs Время пакета, нс
+     * @return Число записанных байт вместе с заголовком записи
+     */
+    size_t write(const uint8_t* frame, size_t frameLen, int64_t timestampNs) {
+        uint32_t capLen = static_cast<uint32_t>(std::min<size_t>(frameLen, snapLen));
+        uint8_t header[16];
+        put32(header, static_cast<uint32_t>(timestampNs / 1000000000LL));
+        put32(header + 4, static_cast<uint32_t>((timestampNs % 1000000000LL) / 1000));
+        put32(header + 8, capLen);
+        put32(header + 12, static_cast<uint32_t>(frameLen));
+        output.write(reinterpret_cast<const char*>(header), sizeof(header));
+        output.write(reinterpret_cast<const char*>(frame), capLen);
+        return sizeof(header) + capLen;
+    }
+
+    //! Размер заголовка файла
+    static constexpr size_t fileHeaderLen = 24;
+
+private:
+    static void put16(uint8_t* data, uint16_t value) {
+        data[0] = static_cast<uint8_t>(value);
+        data[1] = static_cast<uint8_t>(value >> 8);
+    }
+
+    static void put32(uint8_t* data, uint32_t value) {
+        put16(data, static_cast<uint16_t>(value));
+        put16(data + 2, static_cast<uint16_t>(value >> 16));
+    }
+
+    //! Поток для записи
+    std::ostream& output;
+    //! Наибольшее число сохраняемых байт пакета
+    uint32_t snapLen;
+};
+
+#endif // SYNTHETIC_TRAFFIC_H
@@ -0,0 +1,102 @@
+/**
+ \file
+ \brief Компилируемый файл выгрузки колоночного файла в CSV
+
+ Читает колоночный файл (.col), записанный sft -o out.col, и выводит записи в CSV для инструментов, которые не
+ читают колоночный формат. Блоки вне интервала времени пропускаются по оглавлению без распаковки
+*/
+
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include "docopt.h"
+#include "ColumnarExport.h"
+
+static const char USAGE[] =
+R"(Columnar packet records to CSV.
+
+    Usage:
+        sftcol -f INFILE [-o OUTFILE] [options]
+        sftcol (-h | --help)
+
+    Options:
+        -h --help               Show this screen.
+        -f INFILE               Path to a columnar file written by sft -o out.col.
+        -o OUTFILE              Path to output CSV file, stdout by default.
+        --from NS               Only records captured at or after NS nanoseconds since the epoch.
+        --to NS                 Only records captured at or before NS nanoseconds since the epoch.
+        --summary               Print chunks and record counts instead of records.
+)";
+
+//! Запись IPv4 адреса колонки ((a << 24) | ... | d) точками
+static void writeIPv4(std::ostream& output, uint32_t address) {
+    output << (address >> 24) << '.' << ((address >> 16) & 0xFF) << '.' << ((address >> 8) & 0xFF) << '.'
+           << (address & 0xFF);
+}
+
+int main(int argc, char* argv[]) {
+    std::map<std::string, docopt::value> args = docopt::docopt(USAGE, {argv + 1, argv + argc}, true);
+
+    int64_t fromNs = std::numeric_limits<int64_t>::min();
+    int64_t toNs = std::numeric_limits<int64_t>::max();
+    if (args.find("--from")->second)
+        fromNs = std::strtoll(args.find("--from")->second.asString().c_str(), nullptr, 10);
+    if (args.find("--to")->second)
+        toNs = std::strtoll(args.find("--to")->second.asString().c_str(), nullptr, 10);
+
+    ColumnarReader reader;
+    std::string error;
+    if (!reader.open(args.find("-f")->second.asString(), error)) {
+        std::cerr << "[-] ERROR: " << error << std::endl;
+        return 1;
+    }
+
+    if (args.find("--summary")->second.asBool()) {
+        uint64_t records = 0;
+        for (auto& info : reader.chunks())
+            records += info.numOfRecords;
+        std::cout << "chunks," << reader.chunks().size() << "\nrecords," << records << "\n";
+        if (!reader.chunks().empty())
+            std::cout << "first_ns," << reader.chunks().front().minTimestampNs << "\nlast_ns,"
+                      << reader.chunks().back().maxTimestampNs << "\n";
+        return 0;
+    }
+
+    std::ofstream outputFile;
+    if (args.find("-o")->second) {
+        std::string outFilename = args.find("-o")->second.asString();
+        if (std::ifstream(outFilename).good()) {
+            std::cerr << "[-] ERROR: Output file exists" << std::endl;
+            return 1;
+        }
+        outputFile.open(outFilename, std::ios::out);
+    }
+    std::ostream& output = outputFile.is_open() ? outputFile : std::cout;
+
+    for (size_t i = 0; i < ColumnChunk::numOfColumns; ++i)
+        output << (i == 0 ? "" : ",") << ColumnChunk::columnName(i);
+    output << "\n";
+    ColumnChunk chunk;
+    for (size_t number = 0; number < reader.chunks().size(); ++number) {
+        const ColumnChunkInfo& info = reader.chunks()[number];
+        if (info.maxTimestampNs < fromNs || info.minTimestampNs > toNs)
+            continue;
+        if (!reader.read(number, chunk)) {
+            std::cerr << "[-] ERROR: Chunk " << number << " is corrupted" << std::endl;
+            return 1;
+        }
+        for (size_t i = 0; i < chunk.size(); ++i) {
+            if (chunk.timestampNs[i] < fromNs || chunk.timestampNs[i] > toNs)
+                continue;
+            output << chunk.timestampNs[i] << ',';
+            writeIPv4(output, chunk.srcIPv4[i]);
+            output << ',';
+            writeIPv4(output, chunk.dstIPv4[i]);
+            output << ',' << chunk.srcPort[i] << ',' << chunk.dstPort[i] << ','
+                   << static_cast<unsigned>(chunk.protocol[i]) << ',' << chunk.payloadLen[i] << ','
+                   << chunk.frameLen[i] << '\n';
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,143 @@
+/**
+ \file
+ \brief Компилируемый файл генератора синтетических файлов трафика
+
+ Генератор пишет файл pcap с заданным числом пакетов или заданного размера, распределения адресов, портов и
+ размеров "полезной нагрузки" задаются параметрами. Используется для воспроизводимых замеров производительности
+*/
+
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <vector>
+#include "docopt.h"
+#include "SyntheticTraffic.h"
+
+static const char USAGE[] =
+R"(Synthetic capture generator for SFT benchmarks.
+
+    Usage:
+        sftgen -o OUTFILE [options]
+        sftgen (-h | --help)
+
+    Options:
+        -h --help               Show this screen.
+        -o OUTFILE              Path to output pcap file.
+        --packets N             Number of packets [default: 1000000].
+        --size SIZE             Stop at file size instead of packet count (e.g. 500M, 4G).
+        --seed S                Random seed [default: 1].
+        --ips N                 Number of distinct destination IPs [default: 10000].
+        --ip-skew S             Zipf exponent of destination IPs, 0 for uniform [default: 1.1].
+        --ports N               Number of distinct destination ports [default: 1000].
+        --port-skew S           Zipf exponent of destination ports [default: 1.2].
+        --udp P                 Share of UDP packets [default: 0.3].
+        --other P               Share of ICMP packets [default: 0.01].
+        --payload MODE          imix, uniform:MIN-MAX or fixed:N [default: imix].
+        --pps N                 Mean packet rate for timestamps [default: 100000].
+        --snaplen N             Bytes stored per packet [default: 65535].
+)";
+
+/**
+ * \brief Разбор размера с суффиксом K, M, G
+ * @param text Размер, например "4G"
+ * @return Размер в байтах
+ */
+uint64_t parseSize(const std::string& text) {
+    char* end = nullptr;
+    double value = std::strtod(text.c_str(), &end);
+    switch (*end) {
+        case 'K': case 'k': value *= 1024.0; break;
+        case 'M': case 'm': value *= 1024.0 * 1024.0; break;
+        case 'G': case 'g': value *= 1024.0 * 1024.0 * 1024.0; break;
+        default: break;
+    }
+    return static_cast<uint64_t>(value);
+}
+
+/**
+ * \brief Разбор режима размеров "полезной нагрузки"
+ * @param text imix, uniform:MIN-MAX или fixed:N
+ * @param profile Параметры трафика
+ * @return false, если режим неизвестен
+ */
+bool parsePayload(const std::string& text, SyntheticProfile& profile) {
+    if (text == "imix") {
+        profile.payloadMode = SyntheticProfile::Imix;
+        return true;
+    }
+    if (text.compare(0, 6, "fixed:") == 0) {
+        profile.payloadMode = SyntheticProfile::Fixed;
+        profile.minPayload = std::strtoul(text.c_str() + 6, nullptr, 10);
+        return profile.minPayload <= 65000;
+    }
+    if (text.compare(0, 8, "uniform:") == 0) {
+        char* end = nullptr;
+        profile.payloadMode = SyntheticProfile::Uniform;
+        profile.minPayload = std::strtoul(text.c_str() + 8, &end, 10);
+        if (*end != '-')
+            return false;
+        profile.maxPayload = std::strtoul(end + 1, nullptr, 10);
+        return profile.minPayload <= profile.maxPayload && profile.maxPayload <= 65000;
+    }
+    return false;
+}
+
+int main(int argc, char* argv[]) {
+    std::map<std::string, docopt::value> args = docopt::docopt(USAGE, {argv + 1, argv + argc}, true);
+
+    SyntheticProfile profile;
+    profile.seed = std::strtoull(args.find("--seed")->second.asString().c_str(), nullptr, 10);
+    profile.numOfIPs = static_cast<uint32_t>(std::strtoul(args.find("--ips")->second.asString().c_str(), nullptr, 10));
+    profile.ipSkew = std::strtod(args.find("--ip-skew")->second.asString().c_str(), nullptr);
+    profile.numOfPorts = static_cast<uint32_t>(
+            std::strtoul(args.find("--ports")->second.asString().c_str(), nullptr, 10));
+    profile.portSkew = std::strtod(args.find("--port-skew")->second.asString().c_str(), nullptr);
+    profile.udpShare = std::strtod(args.find("--udp")->second.asString().c_str(), nullptr);
+    profile.otherShare = std::strtod(args.find("--other")->second.asString().c_str(), nullptr);
+    profile.packetsPerSecond = std::strtod(args.find("--pps")->second.asString().c_str(), nullptr);
+    if (!parsePayload(args.find("--payload")->second.asString(), profile)) {
+        std::cerr << "[-] ERROR: Wrong --payload, expected imix, uniform:MIN-MAX or fixed:N" << std::endl;
+        return 1;
+    }
+    if (profile.packetsPerSecond <= 0 || profile.udpShare + profile.otherShare > 1.0) {
+        std::cerr << "[-] ERROR: Wrong --pps or protocol shares" << std::endl;
+        return 1;
+    }
+
+    uint64_t numOfPackets = std::strtoull(args.find("--packets")->second.asString().c_str(), nullptr, 10);
+    uint64_t maxSize = args.find("--size")->second ? parseSize(args.find("--size")->second.asString()) : 0;
+    auto snapLen = static_cast<uint32_t>(std::strtoul(args.find("--snaplen")->second.asString().c_str(), nullptr, 10));
+
+    std::string outFilename = args.find("-o")->second.asString();
+    if (std::ifstream(outFilename).good()) {
+        std::cerr << "[-] ERROR: Output file exists" << std::endl;
+        return 1;
+    }
+    std::vector<char> streamBuffer(4 * 1024 * 1024);
+    std::ofstream outputFile;
+    outputFile.rdbuf()->pubsetbuf(streamBuffer.data(), static_cast<std::streamsize>(streamBuffer.size()));
+    outputFile.open(outFilename, std::ios::out | std::ios::binary);
+    if (!outputFile.good()) {
+        std::cerr << "[-] ERROR: Cannot open " << outFilename << " for writing" << std::endl;
+        return 1;
+    }
+
+    SyntheticTraffic traffic(profile);
+    PcapFileWriter writer(outputFile, snapLen);
+    std::vector<uint8_t> frame(traffic.maxFrameLen());
+    uint64_t written = PcapFileWriter::fileHeaderLen;
+    uint64_t packets = 0;
+    while (maxSize != 0 ? written < maxSize : packets < numOfPackets) {
+        int64_t timestampNs = 0;
+        size_t frameLen = traffic.next(frame.data(), timestampNs);
+        written += writer.write(frame.data(), frameLen, timestampNs);
+        ++packets;
+    }
+    outputFile.close();
+    if (!outputFile.good()) {
+        std::cerr << "[-] ERROR: Cannot write " << outFilename << std::endl;
+        return 1;
+    }
+    std::cout << "[+] Written " << packets << " packets, " << written << " bytes to " << outFilename << std::endl;
+    return 0;
+}